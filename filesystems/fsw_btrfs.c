@@ -40,6 +40,7 @@
 //#define DPRINT(x...)  Print(x)
 
 #include "fsw_core.h"
+#include "fsw_codec.h"
 #define uint8_t fsw_u8
 #define uint16_t fsw_u16
 #define uint32_t fsw_u32
@@ -67,22 +68,19 @@
 #define MINILZO_CFG_SKIP_LZO1X_DECOMPRESS 1
 #define MINILZO_CFG_SKIP_LZO1X_1_COMPRESS 1
 #include "minilzo.c"
+#include "fsw_btrfs_lzo.h"
+#include "fsw_btrfs_zstd.h"
+#ifdef HOST_POSIX
+/* The host tools open a single image, there are no other disks to scan. */
+static struct fsw_volume *clone_dummy_volume(struct fsw_volume *vol) { return NULL; }
+static int scan_disks(int (*hook)(struct fsw_volume *, struct fsw_volume *), struct fsw_volume *master) { return 0; }
+#else
 #include "scandisk.c"
+#endif
 
 #define BTRFS_DEFAULT_BLOCK_SIZE 4096
 #define GRUB_BTRFS_SIGNATURE "_BHRfS_M"
 
-/* from http://www.oberhumer.com/opensource/lzo/lzofaq.php
- * LZO will expand incompressible data by a little amount. I still haven't
- * computed the exact values, but I suggest using these formulas for
- * a worst-case expansion calculation:
- *
- * output_block_size = input_block_size + (input_block_size / 16) + 64 + 3
- *  */
-#define GRUB_BTRFS_LZO_BLOCK_SIZE 4096
-#define GRUB_BTRFS_LZO_BLOCK_MAX_CSIZE (GRUB_BTRFS_LZO_BLOCK_SIZE + \
-        (GRUB_BTRFS_LZO_BLOCK_SIZE / 16) + 64 + 3)
-
 /*
  * on disk struct has prefix 'btrfs_', little endian
  * on memory struct has prefix 'fsw_btrfs_'
@@ -137,13 +135,59 @@ struct fsw_btrfs_device_desc
     uint64_t id;
 };
 
-#define RECOVER_CACHE_SIZE 17
+/*
+ * Sectors rebuilt from the parity of a degraded RAID5/6 chunk, kept in a
+ * small LRU so that nearby reads do not reconstruct the same sector again.
+ * Buffers are allocated on demand, so the cost is at most
+ * RECOVER_CACHE_SIZE sectors per volume.
+ */
+#ifndef RECOVER_CACHE_SIZE
+#define RECOVER_CACHE_SIZE 256
+#endif
 struct fsw_btrfs_recover_cache
 {
     uint64_t device_id;
     uint64_t offset;
     char *buffer;
     BOOLEAN valid;
+    unsigned lastuse;
+};
+
+/*
+ * Tree nodes are read whole and kept in a small LRU keyed by logical
+ * address, so that a tree lookup costs one node read per level and the
+ * upper levels, which every lookup passes through, stay in memory.
+ */
+#ifndef NODE_CACHE_SIZE
+#define NODE_CACHE_SIZE 64
+#endif
+struct fsw_btrfs_node_cache
+{
+    uint64_t laddr;
+    uint8_t *buffer;
+    unsigned lastuse;
+};
+
+/*
+ * Decompressed copies of the most recently used compressed extents, so that
+ * reads which do not start at the beginning of an extent, or come back to it
+ * through another file handle, do not decompress the same data again.
+ * btrfs limits a compressed extent to 128 KiB of uncompressed data.
+ */
+#ifndef DECOMPRESS_CACHE_SIZE
+#define DECOMPRESS_CACHE_SIZE 32
+#endif
+#ifndef DECOMPRESS_CACHE_MAX_EXTENT
+#define DECOMPRESS_CACHE_MAX_EXTENT 0x40000
+#endif
+struct fsw_btrfs_decompress_cache
+{
+    uint64_t laddr;
+    uint64_t compressed_size;
+    uint8_t compression;
+    char *buffer;
+    fsw_size_t size;
+    unsigned lastuse;
 };
 
 struct fsw_btrfs_volume
@@ -161,6 +205,7 @@ struct fsw_btrfs_volume
     unsigned num_devices;
     unsigned sectorshift;
     unsigned sectorsize;
+    unsigned nodesize;
     int is_master;
     int rescan_once;
 
@@ -168,6 +213,9 @@ struct fsw_btrfs_volume
     unsigned n_devices_attached;
     unsigned n_devices_allocated;
 
+    struct fsw_btrfs_chunk_map *chunk_map;
+    unsigned n_chunks;
+
     /* Cached extent data.  */
     uint64_t extstart;
     uint64_t extend;
@@ -175,7 +223,19 @@ struct fsw_btrfs_volume
     uint64_t exttree;
     uint32_t extsize;
     struct btrfs_extent_data *extent;
+    struct fsw_btrfs_node_cache *ncache;
+    unsigned ncache_tick;
+    uint64_t ncache_hits;
+    uint64_t ncache_misses;
     struct fsw_btrfs_recover_cache *rcache;
+    unsigned rcache_tick;
+    uint64_t rcache_hits;
+    uint64_t rcache_misses;
+    struct fsw_btrfs_decompress_cache *zcache;
+    unsigned zcache_tick;
+    uint64_t zcache_hits;
+    uint64_t zcache_misses;
+    uint64_t zcache_bytes;  /* total bytes produced by the decompressors */
 };
 
 enum
@@ -252,6 +312,17 @@ struct btrfs_dir_item
     char name[0];
 } __attribute__ ((__packed__));
 
+/*
+ * All chunks of the volume sorted by logical address, read from the chunk
+ * tree at mount so that mapping a logical address is a binary search
+ * instead of a chunk tree lookup.
+ */
+struct fsw_btrfs_chunk_map
+{
+    struct btrfs_key key;               /* offset is the chunk's logical start */
+    struct btrfs_chunk_item *chunk;     /* followed by its stripes */
+};
+
 struct fsw_btrfs_leaf_descriptor
 {
     unsigned depth;
@@ -392,6 +463,7 @@ static fsw_status_t btrfs_set_superblock_info(struct fsw_btrfs_volume *vol, stru
 
     vol->sectorshift = 0;
     vol->sectorsize = fsw_u32_le_swap(sb->sectorsize);
+    vol->nodesize = fsw_u32_le_swap(sb->nodesize);
     for(i=9; i<20; i++) {
         if((1UL<<i) == vol->sectorsize) {
             vol->sectorshift = i;
@@ -484,6 +556,97 @@ static int key_cmp (const struct btrfs_key *a, const struct btrfs_key *b)
     return 0;
 }
 
+/*
+ * Returns the tree node at logical address addr from the node cache, reading
+ * the whole node on a miss. The pointer stays valid until the next call.
+ */
+static fsw_status_t fsw_btrfs_read_node (struct fsw_btrfs_volume *vol,
+        uint64_t addr, struct btrfs_header **head_out,
+        int rdepth, int cache_level)
+{
+    struct fsw_btrfs_node_cache *nc, *victim = NULL;
+    struct btrfs_header *head;
+    uint8_t *buffer;
+    unsigned i;
+    fsw_size_t itemsize;
+    fsw_status_t err;
+
+    if(vol->ncache == NULL) {
+        err = fsw_alloc_zero(sizeof (struct fsw_btrfs_node_cache) * NODE_CACHE_SIZE, (void **) &vol->ncache);
+        if (err)
+            return err;
+    }
+    for(i = 0; i < NODE_CACHE_SIZE; i++) {
+        nc = &vol->ncache[i];
+        if(nc->buffer && nc->laddr == addr) {
+            vol->ncache_hits++;
+            nc->lastuse = ++vol->ncache_tick;
+            *head_out = (struct btrfs_header *) nc->buffer;
+            return FSW_SUCCESS;
+        }
+    }
+    vol->ncache_misses++;
+
+    /* Mapping addr may look up the chunk tree and come back here, so the
+     * node is read into its own buffer and only then put into the cache. */
+    err = fsw_alloc(vol->nodesize, (void **) &buffer);
+    if (err)
+        return err;
+    err = fsw_btrfs_read_logical (vol, addr, buffer, vol->nodesize, rdepth, cache_level);
+    if (err) {
+        FreePool (buffer);
+        return err;
+    }
+    head = (struct btrfs_header *) buffer;
+    itemsize = head->level ? sizeof (struct btrfs_internal_node) : sizeof (struct btrfs_leaf_node);
+    if (sizeof (*head) + fsw_u32_le_swap (head->nitems) * (uint64_t) itemsize > vol->nodesize) {
+        FreePool (buffer);
+        return FSW_VOLUME_CORRUPTED;
+    }
+
+    for(i = 0; i < NODE_CACHE_SIZE; i++) {
+        nc = &vol->ncache[i];
+        if(victim == NULL || (victim->buffer && (!nc->buffer || nc->lastuse < victim->lastuse)))
+            victim = nc;
+    }
+    if(victim->buffer)
+        FreePool (victim->buffer);
+    victim->laddr = addr;
+    victim->buffer = buffer;
+    victim->lastuse = ++vol->ncache_tick;
+    *head_out = head;
+    return FSW_SUCCESS;
+}
+
+/*
+ * Binary search over the nitems items of a node, which all start with their
+ * key. Returns the index of the last item with a key not above key_in, or
+ * -1 if key_in sorts before all of them.
+ */
+static int node_lower_bound (const struct btrfs_header *head, fsw_size_t itemsize,
+        unsigned nitems, const struct btrfs_key *key_in)
+{
+    const uint8_t *items = (const uint8_t *) (head + 1);
+    int lo = 0, hi = (int) nitems - 1, found = -1;
+
+    while (lo <= hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        int cmp = key_cmp ((const struct btrfs_key *) (items + mid * itemsize), key_in);
+
+        if (cmp == 0)
+            return mid;
+        if (cmp < 0)
+        {
+            found = mid;
+            lo = mid + 1;
+        }
+        else
+            hi = mid - 1;
+    }
+    return found;
+}
+
 static void free_iterator (struct fsw_btrfs_leaf_descriptor *desc)
 {
     fsw_free (desc->data);
@@ -518,7 +681,8 @@ static int next (struct fsw_btrfs_volume *vol,
         struct btrfs_key *key_out)
 {
     fsw_status_t err;
-    struct btrfs_leaf_node leaf;
+    struct btrfs_header *head;
+    struct btrfs_leaf_node *leaf;
 
     for (; desc->depth > 0; desc->depth--)
     {
@@ -531,40 +695,41 @@ static int next (struct fsw_btrfs_volume *vol,
         return 0;
     while (!desc->data[desc->depth - 1].leaf)
     {
-        struct btrfs_internal_node node;
-        struct btrfs_header head;
-        fsw_memzero(&node, sizeof (node));
-
-        err = fsw_btrfs_read_logical (vol, desc->data[desc->depth - 1].iter
-                * sizeof (node)
-                + sizeof (struct btrfs_header)
-                + desc->data[desc->depth - 1].addr,
-                &node, sizeof (node), 0, 1);
+        struct btrfs_internal_node *node;
+        uint64_t child;
+
+        err = fsw_btrfs_read_node (vol, desc->data[desc->depth - 1].addr, &head, 0, 1);
         if (err)
             return -err;
+        if (!head->level || desc->data[desc->depth - 1].iter >= fsw_u32_le_swap (head->nitems))
+            return -FSW_VOLUME_CORRUPTED;
+        node = (struct btrfs_internal_node *) (head + 1);
+        child = fsw_u64_le_swap (node[desc->data[desc->depth - 1].iter].addr);
 
-        err = fsw_btrfs_read_logical (vol, fsw_u64_le_swap (node.addr),
-                &head, sizeof (head), 0, 1);
+        err = fsw_btrfs_read_node (vol, child, &head, 0, 1);
         if (err)
             return -err;
 
-        save_ref (desc, fsw_u64_le_swap (node.addr), 0,
-                fsw_u32_le_swap (head.nitems), !head.level);
+        err = save_ref (desc, child, 0,
+                fsw_u32_le_swap (head->nitems), !head->level);
+        if (err)
+            return -err;
     }
-    err = fsw_btrfs_read_logical (vol, desc->data[desc->depth - 1].iter
-            * sizeof (leaf)
-            + sizeof (struct btrfs_header)
-            + desc->data[desc->depth - 1].addr, &leaf,
-            sizeof (leaf), 0, 1);
+    err = fsw_btrfs_read_node (vol, desc->data[desc->depth - 1].addr, &head, 0, 1);
     if (err)
         return -err;
-    *outsize = fsw_u32_le_swap (leaf.size);
+    if (head->level || desc->data[desc->depth - 1].iter >= fsw_u32_le_swap (head->nitems))
+        return -FSW_VOLUME_CORRUPTED;
+    leaf = (struct btrfs_leaf_node *) (head + 1) + desc->data[desc->depth - 1].iter;
+    *outsize = fsw_u32_le_swap (leaf->size);
     *outaddr = desc->data[desc->depth - 1].addr + sizeof (struct btrfs_header)
-        + fsw_u32_le_swap (leaf.offset);
-    *key_out = leaf.key;
+        + fsw_u32_le_swap (leaf->offset);
+    *key_out = leaf->key;
     return 1;
 }
 
+/* btrfs trees are at most 8 levels deep */
+#define BTRFS_MAX_LEVEL 8
 #define depth2cache(x)  ((x) >= 4 ? 1 : 5-(x))
 static fsw_status_t lower_bound (struct fsw_btrfs_volume *vol,
         const struct btrfs_key *key_in,
@@ -597,119 +762,67 @@ static fsw_status_t lower_bound (struct fsw_btrfs_volume *vol,
     while (1)
     {
         fsw_status_t err;
-        struct btrfs_header head;
-        fsw_memzero(&head, sizeof (head));
+        struct btrfs_header *head;
+        unsigned nitems;
+        int i;
 
-reiter:
-        depth++;
-        /* FIXME: preread few nodes into buffer. */
-        err = fsw_btrfs_read_logical (vol, addr, &head, sizeof (head),
+        if (++depth >= BTRFS_MAX_LEVEL)
+            return FSW_VOLUME_CORRUPTED;
+        err = fsw_btrfs_read_node (vol, addr, &head,
                 rdepth + 1, depth2cache(rdepth));
         if (err)
             return err;
-        addr += sizeof (head);
-        if (head.level)
+        nitems = fsw_u32_le_swap (head->nitems);
+        if (head->level)
         {
-            unsigned i;
-            struct btrfs_internal_node node, node_last;
-            int have_last = 0;
-            fsw_memzero (&node_last, sizeof (node_last));
-            for (i = 0; i < fsw_u32_le_swap (head.nitems); i++)
-            {
-                err = fsw_btrfs_read_logical (vol, addr + i * sizeof (node),
-                        &node, sizeof (node), rdepth + 1, depth2cache(rdepth));
-                if (err)
-                    return err;
+            struct btrfs_internal_node *node = (struct btrfs_internal_node *) (head + 1);
 
-                DPRINT (L"btrfs: internal node (depth %d) %lx %x %lx\n", depth,
-                        node.key.object_id, node.key.type,
-                        node.key.offset);
-
-                if (key_cmp (&node.key, key_in) == 0)
-                {
-                    err = FSW_SUCCESS;
-                    if (desc)
-                        err = save_ref (desc, addr - sizeof (head), i,
-                                fsw_u32_le_swap (head.nitems), 0);
-                    if (err)
-                        return err;
-                    addr = fsw_u64_le_swap (node.addr);
-                    goto reiter;
-                }
-                if (key_cmp (&node.key, key_in) > 0)
-                    break;
-                fsw_memcpy (&node_last, &node, sizeof(node_last));
-                have_last = 1;
-            }
-            if (have_last)
+            i = node_lower_bound (head, sizeof (*node), nitems, key_in);
+            if (i < 0)
             {
-                err = FSW_SUCCESS;
+                *outsize = 0;
+                *outaddr = 0;
+                fsw_memzero (key_out, sizeof (*key_out));
                 if (desc)
-                    err = save_ref (desc, addr - sizeof (head), i - 1,
-                            fsw_u32_le_swap (head.nitems), 0);
-                if (err)
-                    return err;
-                addr = fsw_u64_le_swap (node_last.addr);
-                goto reiter;
+                    return save_ref (desc, addr, -1, nitems, 0);
+                return FSW_SUCCESS;
             }
-            *outsize = 0;
-            *outaddr = 0;
-            fsw_memzero (key_out, sizeof (*key_out));
+
+            DPRINT (L"btrfs: internal node (depth %d) %lx %x %lx\n", depth,
+                    node[i].key.object_id, node[i].key.type,
+                    node[i].key.offset);
+
             if (desc)
-                return save_ref (desc, addr - sizeof (head), -1,
-                        fsw_u32_le_swap (head.nitems), 0);
-            return FSW_SUCCESS;
-        }
-        {
-            unsigned i;
-            struct btrfs_leaf_node leaf, leaf_last;
-            int have_last    = 0;
-            leaf_last.size   = 0;
-            leaf_last.offset = 0;
-            for (i = 0; i < fsw_u32_le_swap (head.nitems); i++)
             {
-                err = fsw_btrfs_read_logical (vol, addr + i * sizeof (leaf),
-                        &leaf, sizeof (leaf), rdepth + 1, depth2cache(rdepth));
+                err = save_ref (desc, addr, i, nitems, 0);
                 if (err)
                     return err;
-
-                DPRINT (L"btrfs: leaf (depth %d) %lx %x %lx\n", depth,
-                        leaf.key.object_id, leaf.key.type, leaf.key.offset);
-
-                if (key_cmp (&leaf.key, key_in) == 0)
-                {
-                    fsw_memcpy (key_out, &leaf.key, sizeof (*key_out));
-                    *outsize = fsw_u32_le_swap (leaf.size);
-                    *outaddr = addr + fsw_u32_le_swap (leaf.offset);
-                    if (desc)
-                        return save_ref (desc, addr - sizeof (head), i,
-                                fsw_u32_le_swap (head.nitems), 1);
-                    return FSW_SUCCESS;
-                }
-
-                if (key_cmp (&leaf.key, key_in) > 0)
-                    break;
-
-                have_last = 1;
-                leaf_last = leaf;
             }
+            addr = fsw_u64_le_swap (node[i].addr);
+        }
+        else
+        {
+            struct btrfs_leaf_node *leaf = (struct btrfs_leaf_node *) (head + 1);
 
-            if (have_last)
+            i = node_lower_bound (head, sizeof (*leaf), nitems, key_in);
+            if (i < 0)
             {
-                fsw_memcpy (key_out, &leaf_last.key, sizeof (*key_out));
-                *outsize = fsw_u32_le_swap (leaf_last.size);
-                *outaddr = addr + fsw_u32_le_swap (leaf_last.offset);
+                *outsize = 0;
+                *outaddr = 0;
+                fsw_memzero (key_out, sizeof (*key_out));
                 if (desc)
-                    return save_ref (desc, addr - sizeof (head), i - 1,
-                            fsw_u32_le_swap (head.nitems), 1);
+                    return save_ref (desc, addr, -1, nitems, 1);
                 return FSW_SUCCESS;
             }
-            *outsize = 0;
-            *outaddr = 0;
-            fsw_memzero (key_out, sizeof (*key_out));
+
+            DPRINT (L"btrfs: leaf (depth %d) %lx %x %lx\n", depth,
+                    leaf[i].key.object_id, leaf[i].key.type, leaf[i].key.offset);
+
+            fsw_memcpy (key_out, &leaf[i].key, sizeof (*key_out));
+            *outsize = fsw_u32_le_swap (leaf[i].size);
+            *outaddr = addr + sizeof (*head) + fsw_u32_le_swap (leaf[i].offset);
             if (desc)
-                return save_ref (desc, addr - sizeof (head), -1,
-                        fsw_u32_le_swap (head.nitems), 1);
+                return save_ref (desc, addr, i, nitems, 1);
             return FSW_SUCCESS;
         }
     }
@@ -783,26 +896,88 @@ struct stripe_table {
     char *ptr;
 };
 
-static void block_xor(char *dst, const char *src, uint32_t blocksize)
+/*
+ * Parity kernels. They process a machine word at a time, or a 16 byte vector
+ * where GCC vector extensions map onto SSE2 or NEON; sector sizes are always
+ * a multiple of 16. In GF(2^8) multiplying by x is a shift plus a conditional
+ * xor of the RAID6 polynomial in every byte lane, so a multiplication by any
+ * constant takes at most eight such steps and no table lookups per byte.
+ */
+#if defined(__GNUC__) && (defined(__SSE2__) || defined(__ARM_NEON)) && !defined(FSW_BTRFS_NO_SIMD)
+typedef uint8_t raid_word __attribute__ ((__vector_size__ (16), __may_alias__, __aligned__ (1)));
+typedef int8_t raid_sword __attribute__ ((__vector_size__ (16)));
+
+static __inline raid_word raid_mulx(raid_word v)
 {
-    UINTN *d = (UINTN *)dst;
-    const UINTN *s = (const UINTN *)src;
-    blocksize /= sizeof (UINTN);
-    uint32_t i;
-    for( i = 0; i < blocksize; i++)
-	d[i] ^= s[i];
+    raid_word carry = (raid_word)((raid_sword)v < 0);
+    return (v + v) ^ (carry & 0x1d);
+}
+#else
+typedef UINTN raid_word;
+#define RAID_BYTES(b) (((UINTN)-1 / 0xff) * (b))
+
+static __inline raid_word raid_mulx(raid_word v)
+{
+    raid_word hi = v & RAID_BYTES(0x80);
+    return ((v << 1) & RAID_BYTES(0xfe)) ^ (((hi << 1) - (hi >> 7)) & RAID_BYTES(0x1d));
+}
+#endif
+
+/* v * c, for c below (top << 1); top is the highest bit set in c */
+static __inline raid_word raid_mulc(raid_word v, uint8_t c, uint8_t top)
+{
+    raid_word r = v;
+
+    for (top >>= 1; top; top >>= 1) {
+	r = raid_mulx(r);
+	if (c & top)
+	    r ^= v;
+    }
+    return r;
+}
+
+static uint8_t raid_topbit(uint8_t c)
+{
+    uint8_t top = 0x80;
+
+    while (top > 1 && !(c & top))
+	top >>= 1;
+    return top;
 }
 
 static void stripe_xor(char *dst, struct stripe_table *stripe, int data_stripes, uint32_t blocksize)
 {
     unsigned i, j;
-    UINTN c;
-    for(j = 0; j < blocksize; j += sizeof (UINTN)) {
+    raid_word c;
+    for(j = 0; j < blocksize; j += sizeof (raid_word)) {
 	/* data + P stripes */
-	for(c=0, i=0; i <= data_stripes; i++)
+	c = *(raid_word *)(stripe[data_stripes].ptr + j);
+	for(i=0; i < data_stripes; i++)
 	    if(stripe[i].ptr)
-		c ^= *(UINTN *)(stripe[i].ptr + j);
-	*(UINTN *)(dst + j) = c;
+		c ^= *(raid_word *)(stripe[i].ptr + j);
+	*(raid_word *)(dst + j) = c;
+    }
+}
+
+/*
+ * dst = Q ^ D0 ^ x*D1 ^ ... ^ x**(n-1)*D(n-1) over the data stripes that
+ * could be read, evaluated with Horner's rule so that every stripe is
+ * touched once per word and the partial syndrome stays in a register.
+ */
+static void stripe_syndrome(char *dst, struct stripe_table *stripe, int data_stripes, const char *q, uint32_t blocksize)
+{
+    uint32_t j;
+    int i;
+    raid_word c;
+    for(j = 0; j < blocksize; j += sizeof (raid_word)) {
+	c = *(const raid_word *)(q + j);
+	c ^= c;  /* zero for either word type */
+	for(i = data_stripes - 1; i >= 0; i--) {
+	    c = raid_mulx(c);
+	    if(stripe[i].ptr)
+		c ^= *(raid_word *)(stripe[i].ptr + j);
+	}
+	*(raid_word *)(dst + j) = c ^ *(const raid_word *)(q + j);
     }
 }
 
@@ -824,19 +999,25 @@ static const uint8_t poly = 0x1d;
 static void block_mulx (unsigned mul, char *buf, uint32_t size)
 {
     uint32_t i;
-    uint8_t *p = (uint8_t *) buf;
-    for (i = 0; i < size; i++, p++)
-	if (*p)
-	    *p = powx[mul + powx_inv[*p]];
+    raid_word *p = (raid_word *) buf;
+    uint8_t c = powx[mul];
+    uint8_t top = raid_topbit(c);
+    if (c == 1)
+	return;
+    size /= sizeof (raid_word);
+    for (i = 0; i < size; i++)
+	p[i] = raid_mulc(p[i], c, top);
 }
 static void block_mulx_xor (char *dst, unsigned mul, const char *buf, uint32_t size)
 {
     uint32_t i;
-    const uint8_t *p = (const uint8_t *) buf;
-    uint8_t *q = (uint8_t *) dst;
-    for (i = 0; i < size; i++, p++, q++)
-	if (*p)
-	    *q ^= powx[mul + powx_inv[*p]];
+    const raid_word *p = (const raid_word *) buf;
+    raid_word *q = (raid_word *) dst;
+    uint8_t c = powx[mul];
+    uint8_t top = raid_topbit(c);
+    size /= sizeof (raid_word);
+    for (i = 0; i < size; i++)
+	q[i] ^= raid_mulc(p[i], c, top);
 }
 
 static void raid6_init_table (void)
@@ -863,29 +1044,206 @@ static void raid6_init_table (void)
 
 static struct fsw_btrfs_recover_cache *get_recover_cache(struct fsw_btrfs_volume *vol, uint64_t device_id, uint64_t offset)
 {
+    struct fsw_btrfs_recover_cache *rc, *victim = NULL;
+    unsigned i;
+
     if(vol->rcache == NULL) {
 	if(fsw_alloc_zero(sizeof (struct fsw_btrfs_recover_cache) * RECOVER_CACHE_SIZE, (void **) &vol->rcache) != FSW_SUCCESS)
 	    return NULL;
     }
-#ifdef __MAKEWITH_TIANO
-    unsigned hash;
-#else
-    UINTN hash;
-#endif
-    DivU64x32Remainder(((device_id >> 32) | device_id | (offset >> 32) | offset), RECOVER_CACHE_SIZE, &hash);
-    struct fsw_btrfs_recover_cache *rc = &vol->rcache[hash];
+    for(i = 0; i < RECOVER_CACHE_SIZE; i++) {
+	rc = &vol->rcache[i];
+	if(rc->valid && rc->device_id == device_id && rc->offset == offset) {
+	    vol->rcache_hits++;
+	    rc->lastuse = ++vol->rcache_tick;
+	    return rc;
+	}
+	if(victim == NULL || (victim->valid && (!rc->valid || rc->lastuse < victim->lastuse)))
+	    victim = rc;
+    }
+
+    vol->rcache_misses++;
+    rc = victim;
     if(rc->buffer == NULL) {
-	if(fsw_alloc_zero(vol->sectorsize, (void **) &rc->buffer) != FSW_SUCCESS)
+	if(fsw_alloc(vol->sectorsize, (void **) &rc->buffer) != FSW_SUCCESS)
 	    return NULL;
     }
-    if(rc->device_id != device_id || rc->offset != offset) {
-	rc->valid = FALSE;
-	rc->device_id = device_id;
-	rc->offset = offset;
-    }
+    rc->valid = FALSE;
+    rc->device_id = device_id;
+    rc->offset = offset;
+    rc->lastuse = ++vol->rcache_tick;
     return rc;
 }
 
+/*
+ * Returns the chunk map entry covering logical address addr, or NULL.
+ */
+static struct fsw_btrfs_chunk_map *find_chunk (struct fsw_btrfs_volume *vol, uint64_t addr)
+{
+    unsigned lo = 0, hi = vol->n_chunks;
+
+    /* find the first chunk starting above addr, the one before may hold it */
+    while (lo < hi)
+    {
+        unsigned mid = lo + (hi - lo) / 2;
+
+        if (fsw_u64_le_swap (vol->chunk_map[mid].key.offset) <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+    if (addr - fsw_u64_le_swap (vol->chunk_map[lo - 1].key.offset)
+            >= fsw_u64_le_swap (vol->chunk_map[lo - 1].chunk->size))
+        return NULL;
+    return &vol->chunk_map[lo - 1];
+}
+
+static void free_chunk_map (struct fsw_btrfs_chunk_map *map, unsigned n)
+{
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        FreePool (map[i].chunk);
+    FreePool (map);
+}
+
+/*
+ * Walks the chunk tree once and keeps all chunk items, with their stripes,
+ * in vol->chunk_map sorted by logical address.
+ */
+static fsw_status_t fsw_btrfs_read_chunk_map (struct fsw_btrfs_volume *vol)
+{
+    struct fsw_btrfs_leaf_descriptor desc;
+    struct fsw_btrfs_chunk_map *map = NULL;
+    unsigned n = 0, allocated = 0;
+    struct btrfs_key key_in, key_out;
+    uint64_t chaddr;
+    fsw_size_t chsize;
+    fsw_status_t err;
+    int r = 1;
+
+    key_in.object_id = fsw_u64_le_swap (GRUB_BTRFS_OBJECT_ID_CHUNK);
+    key_in.type = GRUB_BTRFS_ITEM_TYPE_CHUNK;
+    key_in.offset = 0;
+
+    desc.data = NULL;
+    err = lower_bound (vol, &key_in, &key_out, vol->chunk_tree, &chaddr, &chsize, &desc, 0);
+    if (err)
+        goto out;
+    if (key_out.object_id != key_in.object_id || key_out.type != key_in.type)
+        r = next (vol, &desc, &chaddr, &chsize, &key_out);
+
+    while (r > 0 && key_out.object_id == key_in.object_id && key_out.type == key_in.type)
+    {
+        struct btrfs_chunk_item *chunk;
+
+        if (n == allocated)
+        {
+            struct fsw_btrfs_chunk_map *newmap;
+
+            allocated = allocated ? allocated * 2 : 16;
+            err = fsw_alloc (sizeof (*map) * allocated, (void **) &newmap);
+            if (err)
+                goto out;
+            if (map)
+            {
+                fsw_memcpy (newmap, map, sizeof (*map) * n);
+                FreePool (map);
+            }
+            map = newmap;
+        }
+
+        if (chsize < sizeof (*chunk))
+        {
+            err = FSW_VOLUME_CORRUPTED;
+            goto out;
+        }
+        err = fsw_alloc (chsize, (void **) &chunk);
+        if (err)
+            goto out;
+        err = fsw_btrfs_read_logical (vol, chaddr, chunk, chsize, 0, 1);
+        if (err == FSW_SUCCESS && (fsw_u16_le_swap (chunk->nstripes) == 0
+                    || sizeof (*chunk) + fsw_u16_le_swap (chunk->nstripes)
+                    * sizeof (struct btrfs_chunk_stripe) > chsize
+                    || (n > 0 && fsw_u64_le_swap (map[n - 1].key.offset)
+                        + fsw_u64_le_swap (map[n - 1].chunk->size)
+                        > fsw_u64_le_swap (key_out.offset))))
+            err = FSW_VOLUME_CORRUPTED;
+        if (err)
+        {
+            FreePool (chunk);
+            goto out;
+        }
+        map[n].key = key_out;
+        map[n].chunk = chunk;
+        n++;
+
+        r = next (vol, &desc, &chaddr, &chsize, &key_out);
+    }
+    if (r < 0)
+        err = -r;
+
+out:
+    if (desc.data)
+        free_iterator (&desc);
+    if (err || n == 0)
+    {
+        if (map)
+            free_chunk_map (map, n);
+        return err ? err : FSW_VOLUME_CORRUPTED;
+    }
+    vol->chunk_map = map;
+    vol->n_chunks = n;
+    return FSW_SUCCESS;
+}
+
+#ifdef HOST_POSIX
+/*
+ * Prints the chunk map for the host test tools, with the fields and names
+ * of "btrfs inspect-internal dump-tree -t chunk".
+ */
+void fsw_btrfs_dump_chunk_map (struct fsw_volume *volg)
+{
+    static const struct { uint64_t bit; const char *name; } flags[] = {
+        { 1, "DATA" }, { 2, "SYSTEM" }, { 4, "METADATA" },
+        { GRUB_BTRFS_CHUNK_TYPE_RAID0, "RAID0" }, { GRUB_BTRFS_CHUNK_TYPE_RAID1, "RAID1" },
+        { GRUB_BTRFS_CHUNK_TYPE_DUPLICATED, "DUP" }, { GRUB_BTRFS_CHUNK_TYPE_RAID10, "RAID10" },
+        { GRUB_BTRFS_CHUNK_TYPE_RAID5, "RAID5" }, { GRUB_BTRFS_CHUNK_TYPE_RAID6, "RAID6" },
+        { GRUB_BTRFS_CHUNK_TYPE_RAID1C3, "RAID1C3" }, { GRUB_BTRFS_CHUNK_TYPE_RAID1C4, "RAID1C4" },
+    };
+    struct fsw_btrfs_volume *vol = (struct fsw_btrfs_volume *)volg;
+    unsigned i, j;
+
+    for (i = 0; i < vol->n_chunks; i++)
+    {
+        struct btrfs_chunk_item *chunk = vol->chunk_map[i].chunk;
+        struct btrfs_chunk_stripe *stripe = (struct btrfs_chunk_stripe *) (chunk + 1);
+        uint64_t type = fsw_u64_le_swap (chunk->type);
+        const char *sep = "";
+
+        printf ("chunk %llu\n\tlength %llu owner %llu stripe_len %llu type ",
+                (unsigned long long) fsw_u64_le_swap (vol->chunk_map[i].key.offset),
+                (unsigned long long) fsw_u64_le_swap (chunk->size),
+                (unsigned long long) fsw_u64_le_swap (chunk->dummy),
+                (unsigned long long) fsw_u64_le_swap (chunk->stripe_length));
+        for (j = 0; j < sizeof (flags) / sizeof (flags[0]); j++)
+            if (type & flags[j].bit)
+            {
+                printf ("%s%s", sep, flags[j].name);
+                sep = "|";
+            }
+        printf ("\n\tnum_stripes %u sub_stripes %u\n",
+                fsw_u16_le_swap (chunk->nstripes), fsw_u16_le_swap (chunk->nsubstripes));
+        for (j = 0; j < fsw_u16_le_swap (chunk->nstripes); j++)
+            printf ("\t\tstripe %u devid %llu offset %llu\n", j,
+                    (unsigned long long) fsw_u64_le_swap (stripe[j].device_id),
+                    (unsigned long long) fsw_u64_le_swap (stripe[j].offset));
+    }
+}
+#endif
+
 static fsw_status_t fsw_btrfs_read_logical (struct fsw_btrfs_volume *vol, uint64_t addr,
         void *buf, fsw_size_t size, int rdepth, int cache_level)
 {
@@ -904,6 +1262,17 @@ static fsw_status_t fsw_btrfs_read_logical (struct fsw_btrfs_volume *vol, uint64
         uint64_t chaddr;
 
 	err = 0;
+        if (vol->chunk_map)
+        {
+            struct fsw_btrfs_chunk_map *map = find_chunk (vol, addr);
+
+            if (map)
+            {
+                key = &map->key;
+                chunk = map->chunk;
+                goto chunk_found;
+            }
+        }
         for (ptr = vol->bootstrap_mapping; ptr < vol->bootstrap_mapping + sizeof (vol->bootstrap_mapping) - sizeof (struct btrfs_key);)
         {
             key = (struct btrfs_key *) ptr;
@@ -1264,12 +1633,7 @@ begin_direct_read:
 			    raid6_init_table();
 
 			    // calc Q
-			    fsw_memzero(rcache->buffer, sectorsize);
-			    for( i = 0; i < nstripes - 2; i++) {
-				if(stripe_table[i].ptr)
-				    block_mulx_xor(rcache->buffer, i, stripe_table[i].ptr, sectorsize);
-			    }
-			    block_xor(rcache->buffer, /*Q*/stripe_table[nstripes - 1].ptr, sectorsize);
+			    stripe_syndrome(rcache->buffer, stripe_table, dstripes, /*Q*/stripe_table[nstripes - 1].ptr, sectorsize);
 
 			    if(bad2 == nstripes - 2) {
 				// target & P failed
@@ -1331,7 +1695,9 @@ static fsw_status_t fsw_btrfs_volume_mount(struct fsw_volume *volg) {
     fsw_status_t err;
     int i;
 
-    init_crc32c_table();
+    fsw_codec_register(&fsw_codec_zlib);
+    fsw_codec_register(&fsw_codec_lzo);
+    fsw_codec_register(&fsw_codec_zstd);
 
     err = btrfs_read_superblock (volg, &sblock);
     if (err)
@@ -1342,6 +1708,10 @@ static fsw_status_t fsw_btrfs_volume_mount(struct fsw_volume *volg) {
     if(vol->sectorshift == 0)
         return FSW_UNSUPPORTED;
 
+    if(vol->nodesize < vol->sectorsize || vol->nodesize > 0x10000
+            || (vol->nodesize & (vol->nodesize - 1)))
+        return FSW_UNSUPPORTED;
+
     if(vol->num_devices >= BTRFS_MAX_NUM_DEVICES)
         return FSW_UNSUPPORTED;
 
@@ -1386,6 +1756,10 @@ static fsw_status_t fsw_btrfs_volume_mount(struct fsw_volume *volg) {
         return err;
     }
 
+    err = fsw_btrfs_read_chunk_map(vol);
+    if (err)
+        FSW_MSG_DEBUG((FSW_MSGSTR("fsw_btrfs_volume_mount: no chunk map (%d), using the chunk tree\n"), err));
+
     err = fsw_btrfs_get_default_root(vol, sblock.root_dir_objectid);
     if (err) {
         DPRINT(L"root not found\n");
@@ -1416,14 +1790,34 @@ static void fsw_btrfs_volume_free(struct fsw_volume *volg)
 	}
 	FreePool (vol->devices_attached);
     }
+    if(vol->chunk_map)
+        free_chunk_map (vol->chunk_map, vol->n_chunks);
     if(vol->extent)
         FreePool (vol->extent);
+    if(vol->ncache) {
+	FSW_MSG_DEBUG((FSW_MSGSTR("fsw_btrfs_volume_free: node cache hits %d misses %d\n"),
+		    (int)vol->ncache_hits, (int)vol->ncache_misses));
+	for(i = 0; i < NODE_CACHE_SIZE; i++)
+	    if(vol->ncache[i].buffer)
+		FreePool(vol->ncache[i].buffer);
+        FreePool (vol->ncache);
+    }
     if(vol->rcache) {
+	FSW_MSG_DEBUG((FSW_MSGSTR("fsw_btrfs_volume_free: recover cache hits %d misses %d\n"),
+		    (int)vol->rcache_hits, (int)vol->rcache_misses));
 	for(i = 0; i < RECOVER_CACHE_SIZE; i++)
-	    if(vol->rcache->buffer)
-		FreePool(vol->rcache->buffer);
+	    if(vol->rcache[i].buffer)
+		FreePool(vol->rcache[i].buffer);
         FreePool (vol->rcache);
     }
+    if(vol->zcache) {
+	FSW_MSG_DEBUG((FSW_MSGSTR("fsw_btrfs_volume_free: decompress cache hits %d misses %d, %d KiB decompressed\n"),
+		    (int)vol->zcache_hits, (int)vol->zcache_misses, (int)(vol->zcache_bytes >> 10)));
+	for(i = 0; i < DECOMPRESS_CACHE_SIZE; i++)
+	    if(vol->zcache[i].buffer)
+		FreePool(vol->zcache[i].buffer);
+        FreePool (vol->zcache);
+    }
 }
 
 static fsw_status_t fsw_btrfs_volume_stat(struct fsw_volume *volg, struct fsw_volume_stat *sb)
@@ -1532,103 +1926,121 @@ static fsw_status_t fsw_btrfs_dnode_stat(struct fsw_volume *volg, struct fsw_dno
     return FSW_SUCCESS;
 }
 
-static fsw_ssize_t grub_btrfs_lzo_decompress(char *ibuf, fsw_size_t isize, grub_off_t off,
+/* Registry format of each btrfs compression type */
+static const fsw_u32 btrfs_codec_formats[GRUB_BTRFS_COMPRESSION_MAX] = {
+	FSW_CODEC_ZLIB,
+	FSW_CODEC_LZO,
+	FSW_CODEC_ZSTD,
+};
+
+static fsw_ssize_t btrfs_decompress(struct fsw_btrfs_volume *vol, uint8_t comp,
+	char *ibuf, fsw_size_t isize,
+	grub_off_t off,
         char *obuf, fsw_size_t osize)
 {
-    uint32_t total_size, cblock_size;
-    fsw_size_t ret = 0;
-    unsigned char buf[GRUB_BTRFS_LZO_BLOCK_SIZE];
-    char *ibuf0 = ibuf;
+	fsw_u32 produced;
 
-#define fsw_get_unaligned32(x) (*(uint32_t *)(x))
-    total_size = fsw_u32_le_swap (fsw_get_unaligned32(ibuf));
-    ibuf += sizeof (total_size);
+	if (fsw_codec_decompress(&vol->g, btrfs_codec_formats[comp-1], ibuf, isize, off,
+				 obuf, osize, &produced) != FSW_SUCCESS)
+		return -1;
+	return produced;
+}
 
-    if (isize < total_size)
-        return -1;
+/*
+ * Read the compressed data of the current extent and decompress up to osize
+ * bytes starting at off straight into obuf. The number of bytes produced is
+ * stored in *produced.
+ */
+static fsw_status_t fsw_btrfs_decompress_extent(struct fsw_btrfs_volume *vol,
+	uint64_t off, char *obuf, fsw_size_t osize, fsw_ssize_t *produced)
+{
+    char *tmp;
+    uint64_t zsize;
+    fsw_ssize_t ret;
+    fsw_status_t err;
 
-    /* Jump forward to first block with requested data.  */
-    while (off >= GRUB_BTRFS_LZO_BLOCK_SIZE)
+    zsize = fsw_u64_le_swap (vol->extent->compressed_size);
+    tmp = AllocatePool (zsize);
+    if (!tmp)
+	return FSW_OUT_OF_MEMORY;
+    err = fsw_btrfs_read_logical (vol, fsw_u64_le_swap (vol->extent->laddr), tmp, zsize, 0, 0);
+    if (err)
     {
-        /* Do not let following uint32_t cross the page boundary.  */
-        if (((ibuf - ibuf0) & 0xffc) == 0xffc)
-            ibuf = ((ibuf - ibuf0 + 3) & ~3) + ibuf0;
-
-        cblock_size = fsw_u32_le_swap (fsw_get_unaligned32 (ibuf));
-        ibuf += sizeof (cblock_size);
-
-        if (cblock_size > GRUB_BTRFS_LZO_BLOCK_MAX_CSIZE)
-            return -1;
-
-        off -= GRUB_BTRFS_LZO_BLOCK_SIZE;
-        ibuf += cblock_size;
+	FreePool (tmp);
+	return FSW_VOLUME_CORRUPTED;
     }
 
-    while (osize > 0)
-    {
-        lzo_uint usize = GRUB_BTRFS_LZO_BLOCK_SIZE;
-
-        /* Do not let following uint32_t cross the page boundary.  */
-        if (((ibuf - ibuf0) & 0xffc) == 0xffc)
-            ibuf = ((ibuf - ibuf0 + 3) & ~3) + ibuf0;
-
-        cblock_size = fsw_u32_le_swap (fsw_get_unaligned32 (ibuf));
-        ibuf += sizeof (cblock_size);
-
-        if (cblock_size > GRUB_BTRFS_LZO_BLOCK_MAX_CSIZE)
-            return -1;
-
-        /* Block partially filled with requested data.  */
-        if (off > 0 || osize < GRUB_BTRFS_LZO_BLOCK_SIZE)
-        {
-            fsw_size_t to_copy = GRUB_BTRFS_LZO_BLOCK_SIZE - off;
-
-            if (to_copy > osize)
-                to_copy = osize;
-
-            if (lzo1x_decompress_safe ((lzo_bytep)ibuf, cblock_size, (lzo_bytep)buf, &usize, NULL) != 0)
-                return -1;
-
-            if (to_copy > usize)
-                to_copy = usize;
-            fsw_memcpy(obuf, buf + off, to_copy);
+    ret = btrfs_decompress (vol, vol->extent->compression, tmp, zsize, off, obuf, osize);
+    FreePool (tmp);
+    if (ret <= 0)
+	return FSW_VOLUME_CORRUPTED;
+    vol->zcache_bytes += ret;
+    *produced = ret;
+    return FSW_SUCCESS;
+}
 
-            osize -= to_copy;
-            ret += to_copy;
-            obuf += to_copy;
-            ibuf += cblock_size;
-            off = 0;
-            continue;
-        }
+/*
+ * Copy osize bytes at off of the current compressed extent into obuf, going
+ * through the decompress cache. The whole extent is decompressed on a miss
+ * and kept, so each compressed extent is decompressed once while it stays
+ * in the cache. Returns FSW_UNSUPPORTED if the extent is too large to cache.
+ */
+static fsw_status_t fsw_btrfs_read_compressed_cached(struct fsw_btrfs_volume *vol,
+	uint64_t off, char *obuf, fsw_size_t osize)
+{
+    struct fsw_btrfs_decompress_cache *zc, *victim = NULL;
+    uint64_t laddr = fsw_u64_le_swap (vol->extent->laddr);
+    uint64_t zsize = fsw_u64_le_swap (vol->extent->compressed_size);
+    uint64_t rsize = fsw_u64_le_swap (vol->extent->size);
+    fsw_ssize_t ret;
+    fsw_status_t err;
+    unsigned i;
 
-        /* Decompress whole block directly to output buffer.  */
-        if (lzo1x_decompress_safe ((lzo_bytep)ibuf, cblock_size, (lzo_bytep)obuf, &usize, NULL) != 0)
-            return -1;
+    if (rsize == 0 || rsize > DECOMPRESS_CACHE_MAX_EXTENT)
+	return FSW_UNSUPPORTED;
 
-        osize -= usize;
-        ret += usize;
-        obuf += usize;
-        ibuf += cblock_size;
+    if (vol->zcache == NULL) {
+	if (fsw_alloc_zero(sizeof (struct fsw_btrfs_decompress_cache) * DECOMPRESS_CACHE_SIZE, (void **) &vol->zcache) != FSW_SUCCESS)
+	    return FSW_OUT_OF_MEMORY;
     }
 
-    return ret;
-}
-
-#include "fsw_btrfs_zstd.h"
-
-typedef fsw_ssize_t (*decompressor_t)(char *ibuf, fsw_size_t isize, grub_off_t off, char *obuf, fsw_size_t osize);
-static decompressor_t btrfs_decompressor_table[GRUB_BTRFS_COMPRESSION_MAX] = {
-	grub_zlib_decompress,
-	grub_btrfs_lzo_decompress,
-	zstd_decompress,
-};
+    for (i = 0; i < DECOMPRESS_CACHE_SIZE; i++) {
+	zc = &vol->zcache[i];
+	if (zc->buffer && zc->laddr == laddr && zc->compressed_size == zsize
+		&& zc->compression == vol->extent->compression) {
+	    vol->zcache_hits++;
+	    goto found;
+	}
+	if (victim == NULL || (victim->buffer && (!zc->buffer || zc->lastuse < victim->lastuse)))
+	    victim = zc;
+    }
 
-static fsw_ssize_t btrfs_decompress(uint8_t comp,
-	char *ibuf, fsw_size_t isize,
-	grub_off_t off,
-        char *obuf, fsw_size_t osize)
-{
-	return btrfs_decompressor_table[comp-1](ibuf, isize, off, obuf, osize);
+    vol->zcache_misses++;
+    zc = victim;
+    if (zc->buffer) {
+	FreePool (zc->buffer);
+	zc->buffer = NULL;
+    }
+    zc->buffer = AllocatePool (rsize);
+    if (!zc->buffer)
+	return FSW_OUT_OF_MEMORY;
+    err = fsw_btrfs_decompress_extent (vol, 0, zc->buffer, rsize, &ret);
+    if (err) {
+	FreePool (zc->buffer);
+	zc->buffer = NULL;
+	return err;
+    }
+    zc->laddr = laddr;
+    zc->compressed_size = zsize;
+    zc->compression = vol->extent->compression;
+    zc->size = ret;
+
+found:
+    zc->lastuse = ++vol->zcache_tick;
+    if (off > zc->size || zc->size - off < osize)
+	return FSW_VOLUME_CORRUPTED;
+    fsw_memcpy (obuf, zc->buffer + off, osize);
+    return FSW_SUCCESS;
 }
 
 static fsw_status_t fsw_btrfs_get_extent(struct fsw_volume *volg, struct fsw_dnode *dnog,
@@ -1731,7 +2143,7 @@ static fsw_status_t fsw_btrfs_get_extent(struct fsw_volume *volg, struct fsw_dno
                 return FSW_OUT_OF_MEMORY;
             if (vol->extent->compression == GRUB_BTRFS_COMPRESSION_NONE)
                 fsw_memcpy (buf, vol->extent->inl + extoff, csize);
-            else if (btrfs_decompress (vol->extent->compression,
+            else if (btrfs_decompress (vol, vol->extent->compression,
 				vol->extent->inl, vol->extsize -
                             ((uint8_t *) vol->extent->inl
                              - (uint8_t *) vol->extent),
@@ -1770,41 +2182,22 @@ static fsw_status_t fsw_btrfs_get_extent(struct fsw_volume *volg, struct fsw_dno
             if (vol->extent->compression > GRUB_BTRFS_COMPRESSION_MAX)
                     return -FSW_VOLUME_CORRUPTED;
 
-            {
-                char *tmp;
-                uint64_t zsize;
-                fsw_ssize_t ret;
-
-                zsize = fsw_u64_le_swap (vol->extent->compressed_size);
-                tmp = AllocatePool (zsize);
-                if (!tmp)
-                    return -FSW_OUT_OF_MEMORY;
-                err = fsw_btrfs_read_logical (vol, fsw_u64_le_swap (vol->extent->laddr), tmp, zsize, 0, 0);
-                if (err)
-                {
-                    FreePool (tmp);
-                    return -FSW_VOLUME_CORRUPTED;
-                }
-
-                buf = AllocatePool( count << vol->sectorshift);
-                if(!buf) {
-                    FreePool(tmp);
-                    return FSW_OUT_OF_MEMORY;
-                }
-
-		ret = btrfs_decompress ( vol->extent->compression,
-			tmp, zsize,
-			extoff + fsw_u64_le_swap (vol->extent->offset),
-			buf, csize);
-
-                FreePool (tmp);
+            buf = AllocatePool( count << vol->sectorshift);
+            if(!buf)
+                return FSW_OUT_OF_MEMORY;
 
-                if (ret != (fsw_ssize_t) csize) {
-                    FreePool(tmp);
-                    return -FSW_VOLUME_CORRUPTED;
-                }
+            extoff += fsw_u64_le_swap (vol->extent->offset);
+            err = fsw_btrfs_read_compressed_cached (vol, extoff, buf, csize);
+            if (err == FSW_UNSUPPORTED) {
+                fsw_ssize_t ret;
 
-                break;
+                err = fsw_btrfs_decompress_extent (vol, extoff, buf, csize, &ret);
+                if (err == FSW_SUCCESS && ret != (fsw_ssize_t) csize)
+                    err = FSW_VOLUME_CORRUPTED;
+            }
+            if (err) {
+                FreePool(buf);
+                return err;
             }
             break;
         default:
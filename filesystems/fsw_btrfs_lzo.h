@@ -0,0 +1,131 @@
+/*
+ * fsw_btrfs_lzo.h:
+ * btrfs LZO extents, from the grub 2.0 btrfs implementation.
+ */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2010  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * An LZO extent starts with its total size, followed by one LZO1X segment
+ * per 4 KiB of data, each behind its compressed size. No size field crosses
+ * a 4 KiB boundary of the extent.
+ */
+
+/* from http://www.oberhumer.com/opensource/lzo/lzofaq.php
+ * LZO will expand incompressible data by a little amount. I still haven't
+ * computed the exact values, but I suggest using these formulas for
+ * a worst-case expansion calculation:
+ *
+ * output_block_size = input_block_size + (input_block_size / 16) + 64 + 3
+ *  */
+#define GRUB_BTRFS_LZO_BLOCK_SIZE 4096
+#define GRUB_BTRFS_LZO_BLOCK_MAX_CSIZE (GRUB_BTRFS_LZO_BLOCK_SIZE + \
+        (GRUB_BTRFS_LZO_BLOCK_SIZE / 16) + 64 + 3)
+
+static fsw_ssize_t grub_btrfs_lzo_decompress(char *ibuf, fsw_size_t isize, grub_off_t off,
+        char *obuf, fsw_size_t osize)
+{
+    uint32_t total_size, cblock_size;
+    fsw_size_t ret = 0;
+    unsigned char buf[GRUB_BTRFS_LZO_BLOCK_SIZE];
+    char *ibuf0 = ibuf;
+
+#define fsw_get_unaligned32(x) (*(uint32_t *)(x))
+    total_size = fsw_u32_le_swap (fsw_get_unaligned32(ibuf));
+    ibuf += sizeof (total_size);
+
+    if (isize < total_size)
+        return -1;
+
+    /* Jump forward to first block with requested data.  */
+    while (off >= GRUB_BTRFS_LZO_BLOCK_SIZE)
+    {
+        /* Do not let following uint32_t cross the page boundary.  */
+        if (((ibuf - ibuf0) & 0xffc) == 0xffc)
+            ibuf = ((ibuf - ibuf0 + 3) & ~3) + ibuf0;
+
+        cblock_size = fsw_u32_le_swap (fsw_get_unaligned32 (ibuf));
+        ibuf += sizeof (cblock_size);
+
+        if (cblock_size > GRUB_BTRFS_LZO_BLOCK_MAX_CSIZE)
+            return -1;
+
+        off -= GRUB_BTRFS_LZO_BLOCK_SIZE;
+        ibuf += cblock_size;
+    }
+
+    while (osize > 0)
+    {
+        lzo_uint usize = GRUB_BTRFS_LZO_BLOCK_SIZE;
+
+        /* Do not let following uint32_t cross the page boundary.  */
+        if (((ibuf - ibuf0) & 0xffc) == 0xffc)
+            ibuf = ((ibuf - ibuf0 + 3) & ~3) + ibuf0;
+
+        cblock_size = fsw_u32_le_swap (fsw_get_unaligned32 (ibuf));
+        ibuf += sizeof (cblock_size);
+
+        if (cblock_size > GRUB_BTRFS_LZO_BLOCK_MAX_CSIZE)
+            return -1;
+
+        /* Block partially filled with requested data.  */
+        if (off > 0 || osize < GRUB_BTRFS_LZO_BLOCK_SIZE)
+        {
+            fsw_size_t to_copy = GRUB_BTRFS_LZO_BLOCK_SIZE - off;
+
+            if (to_copy > osize)
+                to_copy = osize;
+
+            if (lzo1x_decompress_safe ((lzo_bytep)ibuf, cblock_size, (lzo_bytep)buf, &usize, NULL) != 0)
+                return -1;
+
+            if (to_copy > usize)
+                to_copy = usize;
+            fsw_memcpy(obuf, buf + off, to_copy);
+
+            osize -= to_copy;
+            ret += to_copy;
+            obuf += to_copy;
+            ibuf += cblock_size;
+            off = 0;
+            continue;
+        }
+
+        /* Decompress whole block directly to output buffer.  */
+        if (lzo1x_decompress_safe ((lzo_bytep)ibuf, cblock_size, (lzo_bytep)obuf, &usize, NULL) != 0)
+            return -1;
+
+        osize -= usize;
+        ret += usize;
+        obuf += usize;
+        ibuf += cblock_size;
+    }
+
+    return ret;
+}
+
+static fsw_s32 lzo_codec_decompress(void *workspace, fsw_u8 *in, fsw_u32 insize,
+        fsw_u32 off, fsw_u8 *out, fsw_u32 outsize)
+{
+    return grub_btrfs_lzo_decompress((char *)in, insize, off, (char *)out, outsize);
+}
+
+static const struct fsw_codec fsw_codec_lzo = {
+    FSW_CODEC_LZO, "lzo", 0, 0,
+    lzo_codec_decompress, NULL, NULL
+};
@@ -50,84 +50,155 @@ static inline void put_unaligned_le16(uint16_t v, void *s)
 #define ZSTD_BTRFS_MAX_WINDOWLOG 17
 #define ZSTD_BTRFS_MAX_INPUT (1 << ZSTD_BTRFS_MAX_WINDOWLOG)
 
+/*
+ * Decoder state kept for the life of a volume as the registry workspace of
+ * fsw_codec_zstd. The DStream workspace is sized for the largest window
+ * btrfs writes (128 KiB), allocated on first use and only reset for each
+ * extent after that.
+ */
+struct zstd_btrfs_ctx {
+	void *workspace;
+	size_t workspace_size;
+	ZSTD_DStream *stream;
+	uint64_t calls;
+	uint64_t allocs;
+	uint64_t frames_skipped;	/* frames passed over without decoding */
+	uint64_t bytes_discarded;	/* bytes decoded only to reach start_byte */
+};
+
+static void zstd_ctx_free(struct zstd_btrfs_ctx *ctx)
+{
+	if (ctx->workspace)
+		FreePool(ctx->workspace);
+	ctx->workspace = NULL;
+	ctx->stream = NULL;
+}
 
-static fsw_ssize_t zstd_decompress(char *data_in, fsw_size_t srclen,
+/*
+ * Decompress destlen bytes starting at start_byte of the uncompressed data
+ * into data_out. The input may hold several frames, which are decoded in
+ * sequence. Whole frames that end before start_byte and record their size
+ * are stepped over without decoding; the rest of the data before start_byte
+ * is decoded into data_out itself and overwritten, so no extra buffer is
+ * needed. Output past the end of the data is zero filled.
+ */
+static fsw_ssize_t zstd_decompress_ctx(struct zstd_btrfs_ctx *ctx,
+		char *data_in, fsw_size_t srclen,
 		grub_off_t start_byte,
 		char *data_out, fsw_size_t destlen)
 {
-	ZSTD_DStream *stream;
 	ZSTD_inBuffer in_buf;
 	ZSTD_outBuffer out_buf;
+	ZSTD_frameParams params;
 	fsw_ssize_t ret = 0;
-	size_t ret2;
-
-	size_t workspace_size = ZSTD_DStreamWorkspaceBound(ZSTD_BTRFS_MAX_INPUT);
-	void * workspace;
+	size_t ret2, csize, in_pos, done = 0;
 
 	in_buf.src = data_in;
 	in_buf.pos = 0;
 	in_buf.size = srclen;
 
-	out_buf.dst = NULL;
+	out_buf.dst = data_out;
 	out_buf.pos = 0;
+	out_buf.size = destlen;
 
-	workspace = AllocatePool(workspace_size);
-
-	if(!workspace) {
-		ret = -FSW_OUT_OF_MEMORY;
-		goto finish;
+	ctx->calls++;
+	if (destlen == 0)
+		return 0;
+	if (ctx->stream == NULL) {
+		ctx->workspace_size = ZSTD_DStreamWorkspaceBound(ZSTD_BTRFS_MAX_INPUT);
+		ctx->workspace = AllocatePool(ctx->workspace_size);
+		if (!ctx->workspace) {
+			ret = -FSW_OUT_OF_MEMORY;
+			goto finish;
+		}
+		ctx->allocs++;
+		ctx->stream = ZSTD_initDStream(ZSTD_BTRFS_MAX_INPUT, ctx->workspace, ctx->workspace_size);
+		if (!ctx->stream) {
+			DPRINT(L"BTRFS: ZSTD_initDStream failed\n");
+			zstd_ctx_free(ctx);
+			ret = -FSW_OUT_OF_MEMORY;
+			goto finish;
+		}
+	} else {
+		ZSTD_resetDStream(ctx->stream);
 	}
 
-	stream = ZSTD_initDStream(ZSTD_BTRFS_MAX_INPUT, workspace, workspace_size);
-	if (!stream) {
-		DPRINT(L"BTRFS: ZSTD_initDStream failed\n");
-		ret = -FSW_OUT_OF_MEMORY;
-		goto finish;
+	while (start_byte > 0 && in_buf.pos < in_buf.size) {
+		if (ZSTD_getFrameParams(&params, data_in + in_buf.pos, in_buf.size - in_buf.pos) != 0)
+			break;
+		/* skippable frames have no window and no content */
+		if (params.windowSize != 0 &&
+		    (params.frameContentSize == 0 || params.frameContentSize > (unsigned long long)start_byte))
+			break;
+		csize = ZSTD_findFrameCompressedSize(data_in + in_buf.pos, in_buf.size - in_buf.pos);
+		if (ZSTD_isError(csize))
+			break;
+		in_buf.pos += csize;
+		if (params.windowSize != 0)
+			start_byte -= (grub_off_t)params.frameContentSize;
+		ctx->frames_skipped++;
 	}
 
-	while(start_byte > 0) {
-	    out_buf.size = start_byte < PAGE_SIZE ? start_byte : PAGE_SIZE;
-	    if(out_buf.dst == NULL)
-		out_buf.dst = AllocatePool(out_buf.size);
+	while (start_byte > 0) {
+	    out_buf.size = (fsw_size_t)start_byte < destlen ? (fsw_size_t)start_byte : destlen;
 	    out_buf.pos = 0;
+	    in_pos = in_buf.pos;
 
-	    ret2 = ZSTD_decompressStream(stream, &out_buf, &in_buf);
+	    ret2 = ZSTD_decompressStream(ctx->stream, &out_buf, &in_buf);
 	    if (ZSTD_isError(ret2)) {
 		DPRINT(L"BTRFS: ZSTD_decompressStream returned %d\n", ZSTD_getErrorCode(ret2));
 		ret = -FSW_VOLUME_CORRUPTED;
 		goto finish;
 	    }
 
-	    if(out_buf.pos == 0 && in_buf.pos == in_buf.size) {
+	    if(out_buf.pos == 0 && in_buf.pos == in_pos) {
 		DPRINT(L"BTRFS: ZSTD_decompressStream ended early\n");
 		ret = -FSW_VOLUME_CORRUPTED;
 		goto finish;
 	    }
 
 	    start_byte -= out_buf.pos;
+	    ctx->bytes_discarded += out_buf.pos;
 	}
 
-	if(out_buf.dst)
-		FreePool(out_buf.dst);
-
-	out_buf.dst = data_out;
 	out_buf.size = destlen;
 	out_buf.pos = 0;
 
-	ret2 = ZSTD_decompressStream(stream, &out_buf, &in_buf);
-	if (ZSTD_isError(ret2)) {
-	    DPRINT(L"BTRFS: ZSTD_decompressStream returned %d\n", ZSTD_getErrorCode(ret2));
-	    ret = -FSW_VOLUME_CORRUPTED;
-	    goto finish;
+	/* a call returns at the end of each frame; carry on with the next one */
+	while (out_buf.pos < destlen) {
+	    size_t out_pos = out_buf.pos;
+
+	    in_pos = in_buf.pos;
+	    ret2 = ZSTD_decompressStream(ctx->stream, &out_buf, &in_buf);
+	    done = out_buf.pos;
+	    if (ZSTD_isError(ret2)) {
+		DPRINT(L"BTRFS: ZSTD_decompressStream returned %d\n", ZSTD_getErrorCode(ret2));
+		ret = -FSW_VOLUME_CORRUPTED;
+		goto finish;
+	    }
+	    if (out_buf.pos == out_pos && in_buf.pos == in_pos)
+		break;
 	}
 
 	ret = destlen;
 finish:
-	if(out_buf.dst && out_buf.dst != data_out)
-		FreePool(out_buf.dst);
-	if(workspace)
-		FreePool(workspace);
-	if (out_buf.pos < destlen)
-		memset(data_out + out_buf.pos, 0, destlen - out_buf.pos);
+	if (done < destlen)
+		memset(data_out + done, 0, destlen - done);
 	return ret;
 }
+
+static fsw_s32 zstd_codec_decompress(void *workspace, fsw_u8 *in, fsw_u32 insize,
+		fsw_u32 off, fsw_u8 *out, fsw_u32 outsize)
+{
+	return zstd_decompress_ctx(workspace, (char *)in, insize, off, (char *)out, outsize);
+}
+
+static void zstd_codec_workspace_free(void *workspace)
+{
+	zstd_ctx_free(workspace);
+}
+
+static const struct fsw_codec fsw_codec_zstd = {
+	FSW_CODEC_ZSTD, "zstd", 0, sizeof(struct zstd_btrfs_ctx),
+	zstd_codec_decompress, NULL, zstd_codec_workspace_free
+};
@@ -0,0 +1,288 @@
+/**
+ * \file fsw_codec.c
+ * Decompressor registry shared by the file system drivers and libeg.
+ */
+
+/*
+ * This file is distributed under the terms of the GNU General Public
+ * License, version 3 or (at your option) any later version.
+ */
+
+#include "fsw_codec.h"
+
+
+/** Implementations used for each format, set by fsw_codec_register. */
+static const struct fsw_codec *fsw_codec_table[FSW_CODEC_MAX];
+
+#ifdef HOST_POSIX
+#define FSW_CODEC_NAMEFMT "%s"
+#else
+#define FSW_CODEC_NAMEFMT "%a"
+#endif
+
+/**
+ * Make a decompressor available to all contexts. Users call this for the
+ * implementations they carry before they decode; registering the same one
+ * again does nothing. An implementation with a higher priority than the one
+ * registered for its format takes its place from the next call on.
+ */
+
+void fsw_codec_register(const struct fsw_codec *codec)
+{
+    const struct fsw_codec *cur;
+
+    if (codec->format >= FSW_CODEC_MAX)
+        return;
+    cur = fsw_codec_table[codec->format];
+    if (cur == NULL || codec->priority > cur->priority)
+        fsw_codec_table[codec->format] = codec;
+}
+
+/**
+ * Set up an empty decompression context. Workspaces are allocated as the
+ * formats are used.
+ */
+
+void fsw_codec_ctx_init(struct fsw_codec_ctx *ctx)
+{
+    fsw_memzero(ctx, sizeof(struct fsw_codec_ctx));
+}
+
+/**
+ * Free the workspace of a decompressor slot.
+ */
+
+static void fsw_codec_slot_release(struct fsw_codec_slot *slot)
+{
+    if (slot->workspace != NULL) {
+        if (slot->codec->workspace_free != NULL)
+            slot->codec->workspace_free(slot->workspace);
+        fsw_free(slot->workspace);
+        slot->workspace = NULL;
+    }
+}
+
+/**
+ * Get the slot of a format with the workspace of the implementation
+ * registered for it. The workspace is allocated on the first use of the
+ * format in the context and reused by all later ones, so its setup cost is
+ * paid once per context.
+ */
+
+static fsw_status_t fsw_codec_slot_get(struct fsw_codec_ctx *ctx, fsw_u32 format,
+                                       struct fsw_codec_slot **slot_out)
+{
+    fsw_status_t status;
+    const struct fsw_codec *codec;
+    struct fsw_codec_slot *slot;
+
+    if (format >= FSW_CODEC_MAX || (codec = fsw_codec_table[format]) == NULL)
+        return FSW_UNSUPPORTED;
+
+    slot = &ctx->slots[format];
+    if (slot->codec != codec) {
+        // first use, or a faster implementation was registered since
+        if (slot->codec != NULL)
+            fsw_codec_slot_release(slot);
+        slot->codec = codec;
+    }
+    if (slot->workspace == NULL && codec->workspace_size > 0) {
+        status = fsw_alloc(codec->workspace_size, &slot->workspace);
+        if (status)
+            return status;
+        fsw_memzero(slot->workspace, codec->workspace_size);
+        slot->workspace_allocs++;
+    }
+    *slot_out = slot;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Decompress data in a given format with the implementation registered for it.
+ * outsize bytes starting at offset off of the uncompressed data are stored in
+ * out, and the number of bytes produced is returned in produced_out.
+ * Returns FSW_UNSUPPORTED if nothing is registered for the format and
+ * FSW_VOLUME_CORRUPTED if the data cannot be decoded.
+ */
+
+fsw_status_t fsw_codec_ctx_decompress(struct fsw_codec_ctx *ctx, fsw_u32 format,
+                                      void *in, fsw_u32 insize, fsw_u32 off,
+                                      void *out, fsw_u32 outsize, fsw_u32 *produced_out)
+{
+    fsw_status_t status;
+    struct fsw_codec_slot *slot;
+    fsw_s32 ret;
+
+    status = fsw_codec_slot_get(ctx, format, &slot);
+    if (status)
+        return status;
+
+    slot->calls++;
+    slot->bytes_in += insize;
+    ret = slot->codec->decompress(slot->workspace, (fsw_u8 *)in, insize, off, (fsw_u8 *)out, outsize);
+    if (ret < 0) {
+        slot->errors++;
+        return FSW_VOLUME_CORRUPTED;
+    }
+    slot->bytes_out += ret;
+    *produced_out = (fsw_u32)ret;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Free the workspaces of a context and print its statistics. The context
+ * can be used again afterwards.
+ */
+
+void fsw_codec_ctx_free(struct fsw_codec_ctx *ctx)
+{
+    fsw_u32 i;
+    struct fsw_codec_slot *slot;
+
+    for (i = 0; i < FSW_CODEC_MAX; i++) {
+        slot = &ctx->slots[i];
+        if (slot->codec == NULL)
+            continue;
+        FSW_MSG_DEBUG((FSW_MSGSTR("fsw_codec_ctx_free: " FSW_CODEC_NAMEFMT " %d calls, %d stream reads, %d errors, %d workspaces, %d KiB in, %d KiB out\n"),
+                       slot->codec->name, (int)slot->calls, (int)slot->stream_reads, (int)slot->errors,
+                       (int)slot->workspace_allocs, (int)(slot->bytes_in >> 10), (int)(slot->bytes_out >> 10)));
+        fsw_codec_slot_release(slot);
+    }
+    fsw_codec_ctx_init(ctx);
+}
+
+/**
+ * Open a stream of data in a given format, decoded through a context. The
+ * stream holds no resources; it can be dropped without closing it.
+ */
+
+void fsw_codec_stream_init(struct fsw_codec_ctx *ctx, struct fsw_codec_stream *stream, fsw_u32 format)
+{
+    fsw_memzero(stream, sizeof(struct fsw_codec_stream));
+    stream->ctx = ctx;
+    stream->format = format;
+    // 0 stands for no stream in the decoder state
+    if (++ctx->last_stream_id == 0)
+        ++ctx->last_stream_id;
+    stream->id = ctx->last_stream_id;
+}
+
+/**
+ * Feed input to a stream. in holds all of the input so far: the insize bytes
+ * start with the ones fed before, but may have been moved. Set complete with
+ * the last of it.
+ */
+
+void fsw_codec_stream_feed(struct fsw_codec_stream *stream, void *in, fsw_u32 insize, int complete)
+{
+    if (stream->format < FSW_CODEC_MAX && insize > stream->insize)
+        stream->ctx->slots[stream->format].bytes_in += insize - stream->insize;
+    stream->in = (fsw_u8 *)in;
+    stream->insize = insize;
+    stream->in_complete = complete;
+}
+
+/**
+ * Read the next outsize bytes of the uncompressed data of a stream into out.
+ * The number of bytes stored is returned in produced_out; it is short at the
+ * end of the data or if more input has to be fed first. Reads that follow
+ * each other pick up the decoder where the last one left it. Implementations
+ * without a stream entry point decode once all of the input has been fed,
+ * as fsw_codec_ctx_decompress does.
+ * Returns FSW_UNSUPPORTED if nothing is registered for the format and
+ * FSW_VOLUME_CORRUPTED if the data cannot be decoded.
+ */
+
+fsw_status_t fsw_codec_stream_read(struct fsw_codec_stream *stream, void *out, fsw_u32 outsize,
+                                   fsw_u32 *produced_out)
+{
+    fsw_status_t status;
+    struct fsw_codec_slot *slot;
+    fsw_s32 ret;
+
+    status = fsw_codec_slot_get(stream->ctx, stream->format, &slot);
+    if (status)
+        return status;
+
+    slot->stream_reads++;
+    if (slot->codec->stream_read != NULL) {
+        ret = slot->codec->stream_read(slot->workspace, stream->id, stream->in, stream->insize,
+                                       stream->in_complete, stream->pos, (fsw_u8 *)out, outsize,
+                                       &stream->in_used);
+    } else if (!stream->in_complete) {
+        ret = 0;
+    } else if (stream->pos > 0xffffffff) {
+        return FSW_UNSUPPORTED;
+    } else {
+        ret = slot->codec->decompress(slot->workspace, stream->in, stream->insize, (fsw_u32)stream->pos,
+                                      (fsw_u8 *)out, outsize);
+        stream->in_used = stream->insize;
+    }
+    if (ret < 0) {
+        slot->errors++;
+        return FSW_VOLUME_CORRUPTED;
+    }
+    slot->bytes_out += ret;
+    stream->pos += ret;
+    *produced_out = (fsw_u32)ret;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Move the offset the next read of a stream starts at. Reads going forward
+ * decode on from where the stream is, reads going back start over.
+ */
+
+void fsw_codec_stream_seek(struct fsw_codec_stream *stream, fsw_u64 pos)
+{
+    stream->pos = pos;
+}
+
+/**
+ * Get the decompression context of a volume, setting it up on first use.
+ */
+
+fsw_status_t fsw_codec_volume_ctx(struct fsw_volume *vol, struct fsw_codec_ctx **ctx_out)
+{
+    fsw_status_t status;
+
+    if (vol->codecs == NULL) {
+        status = fsw_alloc(sizeof(struct fsw_codec_ctx), &vol->codecs);
+        if (status)
+            return status;
+        fsw_codec_ctx_init(vol->codecs);
+    }
+    *ctx_out = vol->codecs;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Decompress data through the context of a volume, see
+ * fsw_codec_ctx_decompress.
+ */
+
+fsw_status_t fsw_codec_decompress(struct fsw_volume *vol, fsw_u32 format,
+                                  void *in, fsw_u32 insize, fsw_u32 off,
+                                  void *out, fsw_u32 outsize, fsw_u32 *produced_out)
+{
+    fsw_status_t status;
+    struct fsw_codec_ctx *ctx;
+
+    status = fsw_codec_volume_ctx(vol, &ctx);
+    if (status)
+        return status;
+    return fsw_codec_ctx_decompress(ctx, format, in, insize, off, out, outsize, produced_out);
+}
+
+/**
+ * Free the decompression context of a volume. Called when unmounting.
+ */
+
+void fsw_codec_volume_free(struct fsw_volume *vol)
+{
+    if (vol->codecs == NULL)
+        return;
+    fsw_codec_ctx_free(vol->codecs);
+    fsw_free(vol->codecs);
+    vol->codecs = NULL;
+}
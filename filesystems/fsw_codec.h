@@ -0,0 +1,138 @@
+/**
+ * \file fsw_codec.h
+ * Decompressor registry shared by the file system drivers and libeg.
+ *
+ * Implementations of the compressed formats are registered once with
+ * fsw_codec_register. Their users decode through a context they own, which
+ * pools the workspace of each implementation and counts what it does: a
+ * mounted volume has one, libeg has one for the images it loads. Data is
+ * decoded with one call, or read through a stream in as many pieces as the
+ * caller likes, with the input handed over in pieces too.
+ */
+
+/*
+ * This file is distributed under the terms of the GNU General Public
+ * License, version 3 or (at your option) any later version.
+ */
+
+#ifndef _FSW_CODEC_H_
+#define _FSW_CODEC_H_
+
+#include "fsw_core.h"
+
+
+/**
+ * Compressed data formats known to the decompressor registry.
+ */
+
+enum {
+    FSW_CODEC_ZLIB,                 //!< zlib stream (btrfs, HFS+ decmpfs, PNG)
+    FSW_CODEC_LZO,                  //!< btrfs LZO: LZO1X segments per 4 KiB of data
+    FSW_CODEC_ZSTD,                 //!< zstd frames (btrfs)
+    FSW_CODEC_LZNT1,                //!< NTFS compression unit of 4 KiB chunks
+    FSW_CODEC_LZVN,                 //!< HFS+ decmpfs LZVN
+    FSW_CODEC_ICNS_RLE,             //!< Apple .icns run-length coded planes
+    FSW_CODEC_MAX
+};
+
+/**
+ * A decompressor. An implementation with a higher priority replaces the one
+ * registered for the same format, so a faster one only has to be registered
+ * to be used everywhere.
+ */
+
+struct fsw_codec
+{
+    fsw_u32     format;             //!< Data format, one of the FSW_CODEC_* values
+    const char  *name;              //!< Name for statistics
+    fsw_u32     priority;           //!< The highest priority registered for a format is used
+    fsw_u32     workspace_size;     //!< Bytes of state kept per context and passed to every call, 0 for none
+
+    /** Decode outsize bytes starting at offset off of the uncompressed data
+        into out. Returns the number of bytes stored, or a negative value if
+        the data is corrupt. The workspace starts out zeroed and keeps whatever
+        the codec leaves in it until the context is freed. */
+    fsw_s32      (*decompress)(void *workspace, fsw_u8 *in, fsw_u32 insize, fsw_u32 off,
+                               fsw_u8 *out, fsw_u32 outsize);
+
+    /** Optional, may be NULL. Decode outsize bytes at offset pos of the data
+        of stream id into out. in holds the insize bytes of input fed so far;
+        it may have moved and grown since the last call, and all of it is
+        there once in_complete is set. A call for the same stream at or past
+        the point the previous one stopped at carries on decoding from there;
+        any other call starts over. Returns the number of bytes stored, fewer
+        than outsize at the end of the data or when more input is needed, or
+        a negative value if the data is corrupt, and sets *in_used to the
+        input used up so far (insize if the codec does not keep track). */
+    fsw_s32      (*stream_read)(void *workspace, fsw_u32 id, fsw_u8 *in, fsw_u32 insize, int in_complete,
+                                fsw_u64 pos, fsw_u8 *out, fsw_u32 outsize, fsw_u32 *in_used);
+
+    void         (*workspace_free)(void *workspace);  //!< Optional, may be NULL; frees what the codec attached
+};
+
+/**
+ * The workspace and statistics of one decompressor in a context.
+ */
+
+struct fsw_codec_slot {
+    const struct fsw_codec *codec;  //!< Implementation the workspace belongs to, NULL if unused
+    void        *workspace;         //!< Pooled state of the implementation
+    fsw_u64     calls;              //!< Statistics: decompress calls
+    fsw_u64     stream_reads;       //!< Statistics: stream reads
+    fsw_u64     errors;             //!< Statistics: calls that found corrupt data
+    fsw_u64     workspace_allocs;   //!< Statistics: workspaces allocated
+    fsw_u64     bytes_in;           //!< Statistics: compressed bytes passed in or fed
+    fsw_u64     bytes_out;          //!< Statistics: bytes produced
+};
+
+/**
+ * A decompression context, owned by its user. It holds one slot per format,
+ * so each implementation's workspace is set up once for all the calls made
+ * through it.
+ */
+
+struct fsw_codec_ctx {
+    struct fsw_codec_slot slots[FSW_CODEC_MAX];
+    fsw_u32     last_stream_id;     //!< Identifier handed to the last stream opened
+};
+
+/**
+ * A stream of compressed data decoded through a context. The input is fed
+ * as it arrives and the output read in pieces; reads that follow each other
+ * carry on where the previous one stopped. A context keeps the decoder
+ * state of one stream per format, so streams read in turn start over.
+ */
+
+struct fsw_codec_stream {
+    struct fsw_codec_ctx *ctx;      //!< Context the stream decodes through
+    fsw_u32     format;             //!< Data format, one of the FSW_CODEC_* values
+    fsw_u32     id;                 //!< Identifies the stream to the decoder state
+    fsw_u8      *in;                //!< Input fed so far
+    fsw_u32     insize;
+    int         in_complete;        //!< Set once all of the input has been fed
+    fsw_u32     in_used;            //!< Input the decoder has used up
+    fsw_u64     pos;                //!< Offset of the next read in the uncompressed data
+};
+
+
+void         fsw_codec_register(const struct fsw_codec *codec);
+
+void         fsw_codec_ctx_init(struct fsw_codec_ctx *ctx);
+fsw_status_t fsw_codec_ctx_decompress(struct fsw_codec_ctx *ctx, fsw_u32 format,
+                                      void *in, fsw_u32 insize, fsw_u32 off,
+                                      void *out, fsw_u32 outsize, fsw_u32 *produced_out);
+void         fsw_codec_ctx_free(struct fsw_codec_ctx *ctx);
+
+void         fsw_codec_stream_init(struct fsw_codec_ctx *ctx, struct fsw_codec_stream *stream, fsw_u32 format);
+void         fsw_codec_stream_feed(struct fsw_codec_stream *stream, void *in, fsw_u32 insize, int complete);
+fsw_status_t fsw_codec_stream_read(struct fsw_codec_stream *stream, void *out, fsw_u32 outsize,
+                                   fsw_u32 *produced_out);
+void         fsw_codec_stream_seek(struct fsw_codec_stream *stream, fsw_u64 pos);
+
+fsw_status_t fsw_codec_volume_ctx(struct fsw_volume *vol, struct fsw_codec_ctx **ctx_out);
+fsw_status_t fsw_codec_decompress(struct fsw_volume *vol, fsw_u32 format,
+                                  void *in, fsw_u32 insize, fsw_u32 off,
+                                  void *out, fsw_u32 outsize, fsw_u32 *produced_out);
+void         fsw_codec_volume_free(struct fsw_volume *vol);
+
+#endif
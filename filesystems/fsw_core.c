@@ -38,14 +38,25 @@
  */
 
 #include "fsw_core.h"
+#include "fsw_codec.h"
+#ifndef HOST_POSIX
 #include "fsw_efi.h"
+#endif
 
 
 // functions
 
 static void fsw_blockcache_free(struct fsw_volume *vol);
+static void fsw_dcache_free(struct fsw_volume *vol);
 
-#define MAX_CACHE_LEVEL (5)
+/** Smallest number of hash buckets / entries used for the block cache. */
+#define MIN_CACHE_ENTRIES (16)
+
+/** Number of hash buckets in the path lookup cache. Must be a power of 2. */
+#define DCACHE_BUCKETS (256)
+
+/** Largest run of blocks passed to the host's read_blocks in one call, in bytes. */
+#define MAX_DIRECT_READ (0x40000000)
 
 /**
  * Mount a volume with a given file system driver. This function is called by the
@@ -82,6 +93,8 @@ fsw_status_t fsw_mount(void *host_data,
     vol->host_table     = host_table;
     vol->fstype_table   = fstype_table;
     vol->host_string_type = host_table->native_string_type;
+    vol->bcache_limit   = FSW_BCACHE_DEFAULT_LIMIT;
+    vol->dcache_limit   = FSW_DCACHE_DEFAULT_LIMIT;
 
     // let the fs driver mount the file system
     status = vol->fstype_table->volume_mount(vol);
@@ -108,12 +121,17 @@ errorexit:
 
 void fsw_unmount(struct fsw_volume *vol)
 {
+    fsw_dcache_free(vol);
     if (vol->root)
         fsw_dnode_release(vol->root);
-    // TODO: check that no other dnodes are still around
 
     vol->fstype_table->volume_free(vol);
 
+    // the last dnode released frees the hash table; anything left is a reference leak
+    if (vol->dnode_count != 0)
+        FSW_MSG_DEBUG((FSW_MSGSTR("fsw_unmount: %d dnodes still referenced\n"), vol->dnode_count));
+
+    fsw_codec_volume_free(vol);
     fsw_blockcache_free(vol);
     fsw_strfree(&vol->label);
     fsw_free(vol);
@@ -161,6 +179,169 @@ void fsw_set_blocksize(struct fsw_volume *vol, fsw_u32 phys_blocksize, fsw_u32 l
     vol->log_blocksize = log_blocksize;
 }
 
+/**
+ * Set the ceiling for the amount of block data the core keeps cached for the volume.
+ * This function can be called by the host driver or the file system driver at any time.
+ * Blocks that are still referenced are never dropped, so the ceiling may temporarily be
+ * exceeded while many blocks are held at once. A size of 0 restores the default.
+ */
+
+void fsw_set_blockcache_limit(struct fsw_volume *vol, fsw_u32 limit)
+{
+    vol->bcache_limit = limit ? limit : FSW_BCACHE_DEFAULT_LIMIT;
+}
+
+/**
+ * Compute the hash bucket of a physical block number. The number of buckets
+ * is always a power of 2.
+ */
+
+static fsw_u32 fsw_blockcache_hash(struct fsw_volume *vol, fsw_u64 phys_bno)
+{
+    fsw_u32 h;
+
+    h = (fsw_u32)phys_bno ^ (fsw_u32)FSW_U64_SHR(phys_bno, 32);
+    h *= 0x9E3779B1;
+    return (h ^ (h >> 16)) & (vol->bcache_size - 1);
+}
+
+/**
+ * Remove an unreferenced block cache entry from the LRU list of its level.
+ */
+
+static void fsw_blockcache_lru_remove(struct fsw_volume *vol, struct fsw_blockcache *bc)
+{
+    if (bc->lru_prev)
+        bc->lru_prev->lru_next = bc->lru_next;
+    else
+        vol->bcache_lru_head[bc->cache_level] = bc->lru_next;
+    if (bc->lru_next)
+        bc->lru_next->lru_prev = bc->lru_prev;
+    else
+        vol->bcache_lru_tail[bc->cache_level] = bc->lru_prev;
+    bc->lru_prev = bc->lru_next = NULL;
+}
+
+/**
+ * Append a block cache entry that just became unreferenced to the LRU list of its level.
+ */
+
+static void fsw_blockcache_lru_append(struct fsw_volume *vol, struct fsw_blockcache *bc)
+{
+    bc->lru_next = NULL;
+    bc->lru_prev = vol->bcache_lru_tail[bc->cache_level];
+    if (bc->lru_prev)
+        bc->lru_prev->lru_next = bc;
+    else
+        vol->bcache_lru_head[bc->cache_level] = bc;
+    vol->bcache_lru_tail[bc->cache_level] = bc;
+}
+
+/**
+ * Find the block cache entry for a physical block number, or NULL if the block
+ * is not cached.
+ */
+
+static struct fsw_blockcache * fsw_blockcache_find(struct fsw_volume *vol, fsw_u64 phys_bno)
+{
+    struct fsw_blockcache *bc;
+
+    if (vol->bcache == NULL)
+        return NULL;
+    for (bc = vol->bcache[fsw_blockcache_hash(vol, phys_bno)]; bc; bc = bc->hash_next) {
+        if (bc->phys_bno == phys_bno)
+            return bc;
+    }
+    return NULL;
+}
+
+/**
+ * Unlink a block cache entry from its hash bucket.
+ */
+
+static void fsw_blockcache_unhash(struct fsw_volume *vol, struct fsw_blockcache *bc)
+{
+    struct fsw_blockcache **link;
+
+    for (link = &vol->bcache[fsw_blockcache_hash(vol, bc->phys_bno)]; *link; link = &(*link)->hash_next) {
+        if (*link == bc) {
+            *link = bc->hash_next;
+            break;
+        }
+    }
+    bc->hash_next = NULL;
+}
+
+/**
+ * Link a block cache entry into the hash bucket of the block it now holds.
+ */
+
+static void fsw_blockcache_insert(struct fsw_volume *vol, struct fsw_blockcache *bc, fsw_u64 phys_bno)
+{
+    fsw_u32 hash;
+
+    bc->phys_bno = phys_bno;
+    hash = fsw_blockcache_hash(vol, phys_bno);
+    bc->hash_next = vol->bcache[hash];
+    vol->bcache[hash] = bc;
+}
+
+/**
+ * Get a block cache entry to hold a new block. Below the memory ceiling a fresh entry
+ * is allocated. Otherwise the least recently released entry of the lowest level is
+ * evicted and reused. If every entry is still referenced, the cache grows beyond the
+ * ceiling rather than failing the request.
+ */
+
+static fsw_status_t fsw_blockcache_get_entry(struct fsw_volume *vol, struct fsw_blockcache **bc_out)
+{
+    fsw_status_t    status;
+    fsw_u32         level, max_entries, buckets;
+    struct fsw_blockcache *bc;
+
+    max_entries = vol->bcache_limit / vol->phys_blocksize;
+
+    // create the hash table, sized for the memory ceiling
+    if (vol->bcache == NULL) {
+        for (buckets = MIN_CACHE_ENTRIES; buckets < max_entries && buckets < 0x80000000; buckets <<= 1)
+            ;
+        status = fsw_alloc_zero(buckets * sizeof(struct fsw_blockcache *), (void **) &vol->bcache);
+        if (status)
+            return status;
+        vol->bcache_size = buckets;
+    }
+
+    if (max_entries < MIN_CACHE_ENTRIES)
+        max_entries = MIN_CACHE_ENTRIES;
+
+    if (vol->bcache_count >= max_entries) {
+        for (level = 0; level <= FSW_BCACHE_MAX_LEVEL; level++) {
+            bc = vol->bcache_lru_head[level];
+            if (bc != NULL) {
+                fsw_blockcache_lru_remove(vol, bc);
+                fsw_blockcache_unhash(vol, bc);
+                bc->phys_bno = (fsw_u64)FSW_INVALID_BNO;
+                vol->bcache_evictions++;
+                *bc_out = bc;
+                return FSW_SUCCESS;
+            }
+        }
+    }
+
+    status = fsw_alloc_zero(sizeof(struct fsw_blockcache), (void **) &bc);
+    if (status)
+        return status;
+    status = fsw_alloc(vol->phys_blocksize, &bc->data);
+    if (status) {
+        fsw_free(bc);
+        return status;
+    }
+    bc->phys_bno = (fsw_u64)FSW_INVALID_BNO;
+    vol->bcache_count++;
+    *bc_out = bc;
+    return FSW_SUCCESS;
+}
+
 /**
  * Get a block of data from the disk. This function is called by the file system driver
  * or by core functions. It calls through to the host driver's device access routine.
@@ -181,84 +362,98 @@ void fsw_set_blocksize(struct fsw_volume *vol, fsw_u32 phys_blocksize, fsw_u32 l
 fsw_status_t fsw_block_get(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, fsw_u32 cache_level, void **buffer_out)
 {
     fsw_status_t    status;
-    fsw_u32         i, discard_level, new_bcache_size;
-    struct fsw_blockcache *new_bcache;
+    struct fsw_blockcache *bc;
 
-    // TODO: allow the host driver to do its own caching; just call through if
-    //  the appropriate function pointers are set
+    // a host that holds the whole device in memory hands out pointers into it;
+    //  those blocks bypass the cache, and releasing them finds no cache entry
+    if (vol->host_table->map_block != NULL &&
+        vol->host_table->map_block(vol, phys_bno, buffer_out) == FSW_SUCCESS)
+        return FSW_SUCCESS;
 
-    if (cache_level > MAX_CACHE_LEVEL)
-        cache_level = MAX_CACHE_LEVEL;
+    if (cache_level > FSW_BCACHE_MAX_LEVEL)
+        cache_level = FSW_BCACHE_MAX_LEVEL;
 
     // check block cache
-    for (i = 0; i < vol->bcache_size; i++) {
-        if (vol->bcache[i].phys_bno == phys_bno) {
-            // cache hit!
-            if (vol->bcache[i].cache_level < cache_level)
-                vol->bcache[i].cache_level = cache_level;  // promote the entry
-            vol->bcache[i].refcount++;
-            *buffer_out = vol->bcache[i].data;
-            return FSW_SUCCESS;
-        }
+    bc = fsw_blockcache_find(vol, phys_bno);
+    if (bc != NULL) {
+        // cache hit!
+        if (bc->refcount == 0)
+            fsw_blockcache_lru_remove(vol, bc);
+        if (bc->cache_level < cache_level)
+            bc->cache_level = cache_level;  // promote the entry
+        bc->refcount++;
+        vol->bcache_hits++;
+        *buffer_out = bc->data;
+        return FSW_SUCCESS;
     }
+    vol->bcache_misses++;
 
-    // find a free entry in the cache table
-    for (i = 0; i < vol->bcache_size; i++) {
-        if (vol->bcache[i].phys_bno == (fsw_u64)FSW_INVALID_BNO)
-            break;
-    }
-    if (i >= vol->bcache_size) {
-        for (discard_level = 0; discard_level <= MAX_CACHE_LEVEL; discard_level++) {
-            for (i = 0; i < vol->bcache_size; i++) {
-                if (vol->bcache[i].refcount == 0 && vol->bcache[i].cache_level <= discard_level)
-                    break;
-            }
-            if (i < vol->bcache_size)
-                break;
-        }
+    // get a free or evicted entry
+    status = fsw_blockcache_get_entry(vol, &bc);
+    if (status)
+        return status;
+
+    // read the data
+    status = vol->host_table->read_block(vol, phys_bno, bc->data);
+    if (status) {
+        fsw_free(bc->data);
+        fsw_free(bc);
+        vol->bcache_count--;
+        return status;
     }
-    if (i >= vol->bcache_size) {
-        // enlarge / create the cache
-        if (vol->bcache_size < 16)
-            new_bcache_size = 16;
-        else
-            new_bcache_size = vol->bcache_size << 1;
-        status = fsw_alloc(new_bcache_size * sizeof (struct fsw_blockcache), &new_bcache);
-        if (status)
-            return status;
-        if (vol->bcache_size > 0)
-            fsw_memcpy(new_bcache, vol->bcache, vol->bcache_size * sizeof (struct fsw_blockcache));
-        for (i = vol->bcache_size; i < new_bcache_size; i++) {
-            new_bcache[i].refcount = 0;
-            new_bcache[i].cache_level = 0;
-            new_bcache[i].phys_bno = (fsw_u64)FSW_INVALID_BNO;
-            new_bcache[i].data = NULL;
-        }
-        i = vol->bcache_size;
 
-        // switch caches
-        if (vol->bcache != NULL)
-            fsw_free(vol->bcache);
-        vol->bcache = new_bcache;
-        vol->bcache_size = new_bcache_size;
+    bc->cache_level = cache_level;
+    bc->refcount = 1;
+    fsw_blockcache_insert(vol, bc, phys_bno);
+    *buffer_out = bc->data;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Read a run of blocks into the block cache ahead of their use. Blocks that are
+ * already cached keep their entry. The blocks are left unreferenced at the given
+ * cache level, so later fsw_block_get calls find them. Failures are not reported;
+ * the blocks are simply read again when they are needed.
+ */
+
+static void fsw_blockcache_prefetch(struct fsw_volume *vol, fsw_u64 phys_bno, fsw_u32 count, fsw_u32 cache_level)
+{
+    fsw_status_t    status;
+    fsw_u32         i;
+    fsw_u8          *buffer;
+    void            *block;
+    struct fsw_blockcache *bc;
+
+    if (cache_level > FSW_BCACHE_MAX_LEVEL)
+        cache_level = FSW_BCACHE_MAX_LEVEL;
+
+    // without a vectored read, go through the cache block by block
+    if (vol->host_table->read_blocks == NULL) {
+        for (i = 0; i < count; i++) {
+            if (fsw_block_get(vol, phys_bno + i, cache_level, &block) == FSW_SUCCESS)
+                fsw_block_release(vol, phys_bno + i, block);
+        }
+        return;
     }
-    vol->bcache[i].phys_bno = (fsw_u64)FSW_INVALID_BNO;
 
-    // read the data
-    if (vol->bcache[i].data == NULL) {
-        status = fsw_alloc(vol->phys_blocksize, &vol->bcache[i].data);
+    status = fsw_alloc(count * vol->phys_blocksize, (void **) &buffer);
+    if (status)
+        return;
+    status = vol->host_table->read_blocks(vol, phys_bno, count, buffer);
+    for (i = 0; status == FSW_SUCCESS && i < count; i++) {
+        if (fsw_blockcache_find(vol, phys_bno + i) != NULL)
+            continue;
+        status = fsw_blockcache_get_entry(vol, &bc);
         if (status)
-            return status;
+            break;
+        fsw_memcpy(bc->data, buffer + i * vol->phys_blocksize, vol->phys_blocksize);
+        bc->cache_level = cache_level;
+        bc->refcount = 0;
+        fsw_blockcache_insert(vol, bc, phys_bno + i);
+        fsw_blockcache_lru_append(vol, bc);
+        vol->bcache_prefetched++;
     }
-    status = vol->host_table->read_block(vol, phys_bno, vol->bcache[i].data);
-    if (status)
-        return status;
-
-    vol->bcache[i].phys_bno = phys_bno;
-    vol->bcache[i].cache_level = cache_level;
-    vol->bcache[i].refcount = 1;
-    *buffer_out = vol->bcache[i].data;
-    return FSW_SUCCESS;
+    fsw_free(buffer);
 }
 
 /**
@@ -268,15 +463,14 @@ fsw_status_t fsw_block_get(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, fsw_u32
 
 void fsw_block_release(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, void *buffer)
 {
-    fsw_u32 i;
-
-    // TODO: allow the host driver to do its own caching; just call through if
-    //  the appropriate function pointers are set
-
-    // update block cache
-    for (i = 0; i < vol->bcache_size; i++) {
-        if (vol->bcache[i].phys_bno == phys_bno && vol->bcache[i].refcount > 0)
-            vol->bcache[i].refcount--;
+    struct fsw_blockcache *bc;
+
+    // update block cache, blocks mapped by the host are not in it
+    bc = fsw_blockcache_find(vol, phys_bno);
+    if (bc != NULL && bc->refcount > 0) {
+        bc->refcount--;
+        if (bc->refcount == 0)
+            fsw_blockcache_lru_append(vol, bc);
     }
 }
 
@@ -288,32 +482,154 @@ void fsw_block_release(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, void *buffer
 static void fsw_blockcache_free(struct fsw_volume *vol)
 {
     fsw_u32 i;
+    struct fsw_blockcache *bc, *next_bc;
 
     for (i = 0; i < vol->bcache_size; i++) {
-        if (vol->bcache[i].data != NULL)
-            fsw_free(vol->bcache[i].data);
+        for (bc = vol->bcache[i]; bc; bc = next_bc) {
+            next_bc = bc->hash_next;
+            fsw_free(bc->data);
+            fsw_free(bc);
+        }
     }
     if (vol->bcache != NULL) {
         fsw_free(vol->bcache);
         vol->bcache = NULL;
     }
     vol->bcache_size = 0;
+    vol->bcache_count = 0;
+    fsw_memzero(vol->bcache_lru_head, sizeof(vol->bcache_lru_head));
+    fsw_memzero(vol->bcache_lru_tail, sizeof(vol->bcache_lru_tail));
+#ifndef HOST_POSIX
     fsw_efi_clear_cache();
+#endif
+}
+
+/**
+ * Compute the home slot of a dnode id in the volume's dnode hash index. The number
+ * of slots is always a power of 2.
+ */
+
+static fsw_u32 fsw_dnode_hash(struct fsw_volume *vol, fsw_u64 tree_id, fsw_u64 dnode_id)
+{
+    fsw_u32 h;
+
+    h = (fsw_u32)dnode_id ^ (fsw_u32)FSW_U64_SHR(dnode_id, 32);
+    h ^= ((fsw_u32)tree_id ^ (fsw_u32)FSW_U64_SHR(tree_id, 32)) * 0x85EBCA6B;
+    h *= 0x9E3779B1;
+    return (h ^ (h >> 16)) & (vol->dnode_hash_size - 1);
+}
+
+/**
+ * Insert a dnode into the hash index, which must have a free slot.
+ */
+
+static void fsw_dnode_hash_insert(struct fsw_volume *vol, struct fsw_dnode *dno)
+{
+    fsw_u32 i;
+
+    i = fsw_dnode_hash(vol, dno->tree_id, dno->dnode_id);
+    while (vol->dnode_hash[i] != NULL)
+        i = (i + 1) & (vol->dnode_hash_size - 1);
+    vol->dnode_hash[i] = dno;
+}
+
+/**
+ * Find a live dnode by id in the hash index, or return NULL.
+ */
+
+static struct fsw_dnode * fsw_dnode_find(struct fsw_volume *vol, fsw_u64 tree_id, fsw_u64 dnode_id)
+{
+    fsw_u32 i;
+    struct fsw_dnode *dno;
+
+    if (vol->dnode_hash == NULL)
+        return NULL;
+    for (i = fsw_dnode_hash(vol, tree_id, dnode_id); (dno = vol->dnode_hash[i]) != NULL;
+         i = (i + 1) & (vol->dnode_hash_size - 1)) {
+        if (dno->dnode_id == dnode_id && dno->tree_id == tree_id)
+            return dno;
+    }
+    return NULL;
 }
 
 /**
  * Add a new dnode to the list of known dnodes. This internal function is used when a
- * dnode is created to add it to the dnode list that is used to search for existing
- * dnodes by id.
+ * dnode is created to add it to the dnode list and to the hash index that is used to
+ * search for existing dnodes by id. The hash index is kept at most half full and is
+ * doubled in size when necessary.
  */
 
-static void fsw_dnode_register(struct fsw_volume *vol, struct fsw_dnode *dno)
+static fsw_status_t fsw_dnode_register(struct fsw_volume *vol, struct fsw_dnode *dno)
 {
+    fsw_status_t    status;
+    fsw_u32         i, old_size, new_size;
+    struct fsw_dnode **old_hash;
+
+    if ((vol->dnode_count + 1) * 2 > vol->dnode_hash_size) {
+        old_hash = vol->dnode_hash;
+        old_size = vol->dnode_hash_size;
+        new_size = old_size ? old_size << 1 : 64;
+        status = fsw_alloc_zero(new_size * sizeof(struct fsw_dnode *), (void **) &vol->dnode_hash);
+        if (status) {
+            vol->dnode_hash = old_hash;
+            return status;
+        }
+        vol->dnode_hash_size = new_size;
+        for (i = 0; i < old_size; i++) {
+            if (old_hash[i] != NULL)
+                fsw_dnode_hash_insert(vol, old_hash[i]);
+        }
+        if (old_hash != NULL)
+            fsw_free(old_hash);
+    }
+    fsw_dnode_hash_insert(vol, dno);
+    vol->dnode_count++;
+
     dno->next = vol->dnode_head;
     if (vol->dnode_head != NULL)
         vol->dnode_head->prev = dno;
     dno->prev = NULL;
     vol->dnode_head = dno;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Remove a dnode from the list of known dnodes and from the hash index. Entries
+ * following it in the same probe sequence are moved back, so no deleted markers
+ * are needed. The index itself is freed with the last dnode.
+ */
+
+static void fsw_dnode_unregister(struct fsw_volume *vol, struct fsw_dnode *dno)
+{
+    fsw_u32 i, j, home, mask;
+
+    if (dno->next)
+        dno->next->prev = dno->prev;
+    if (dno->prev)
+        dno->prev->next = dno->next;
+    if (vol->dnode_head == dno)
+        vol->dnode_head = dno->next;
+
+    mask = vol->dnode_hash_size - 1;
+    for (i = fsw_dnode_hash(vol, dno->tree_id, dno->dnode_id); vol->dnode_hash[i] != dno; i = (i + 1) & mask)
+        ;
+    vol->dnode_hash[i] = NULL;
+    for (j = (i + 1) & mask; vol->dnode_hash[j] != NULL; j = (j + 1) & mask) {
+        home = fsw_dnode_hash(vol, vol->dnode_hash[j]->tree_id, vol->dnode_hash[j]->dnode_id);
+        // move the entry into the hole unless its home slot lies cyclically in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            vol->dnode_hash[i] = vol->dnode_hash[j];
+            vol->dnode_hash[j] = NULL;
+            i = j;
+        }
+    }
+
+    vol->dnode_count--;
+    if (vol->dnode_count == 0) {
+        fsw_free(vol->dnode_hash);
+        vol->dnode_hash = NULL;
+        vol->dnode_hash_size = 0;
+    }
 }
 
 /**
@@ -343,7 +659,11 @@ fsw_status_t fsw_dnode_create_root_with_tree(struct fsw_volume *vol, fsw_u64 tre
     dno->name.type = FSW_STRING_TYPE_EMPTY;
     // TODO: instead, call a function to create an empty string in the native string type
 
-    fsw_dnode_register(vol, dno);
+    status = fsw_dnode_register(vol, dno);
+    if (status) {
+        fsw_free(dno);
+        return status;
+    }
 
     *dno_out = dno;
     return FSW_SUCCESS;
@@ -379,12 +699,11 @@ fsw_status_t fsw_dnode_create_with_tree(struct fsw_dnode *parent_dno, fsw_u64 tr
     struct fsw_dnode *dno;
 
     // check if we already have a dnode with the same id
-    for (dno = vol->dnode_head; dno; dno = dno->next) {
-        if (dno->dnode_id == dnode_id && dno->tree_id == tree_id) {
-            fsw_dnode_retain(dno);
-            *dno_out = dno;
-            return FSW_SUCCESS;
-        }
+    dno = fsw_dnode_find(vol, tree_id, dnode_id);
+    if (dno != NULL) {
+        fsw_dnode_retain(dno);
+        *dno_out = dno;
+        return FSW_SUCCESS;
     }
 
     // allocate memory for the structure
@@ -406,7 +725,13 @@ fsw_status_t fsw_dnode_create_with_tree(struct fsw_dnode *parent_dno, fsw_u64 tr
         return status;
     }
 
-    fsw_dnode_register(vol, dno);
+    status = fsw_dnode_register(vol, dno);
+    if (status) {
+        fsw_dnode_release(dno->parent);
+        fsw_strfree(&dno->name);
+        fsw_free(dno);
+        return status;
+    }
 
     *dno_out = dno;
     return FSW_SUCCESS;
@@ -446,13 +771,8 @@ void fsw_dnode_release(struct fsw_dnode *dno)
     if (dno->refcount == 0) {
         parent_dno = dno->parent;
 
-        // de-register from volume's list
-        if (dno->next)
-            dno->next->prev = dno->prev;
-        if (dno->prev)
-            dno->prev->next = dno->next;
-        if (vol->dnode_head == dno)
-            vol->dnode_head = dno->next;
+        // de-register from volume's list and hash index
+        fsw_dnode_unregister(vol, dno);
 
         // run fstype-specific cleanup
         vol->fstype_table->dnode_free(vol, dno);
@@ -509,6 +829,187 @@ fsw_status_t fsw_dnode_stat(struct fsw_dnode *dno, struct fsw_dnode_stat *sb)
     return status;
 }
 
+/**
+ * Compute the hash of a name in a directory for the path lookup cache.
+ */
+
+static fsw_u32 fsw_dcache_hash(struct fsw_dnode *parent, struct fsw_string *name)
+{
+    fsw_u32 h, i;
+    fsw_u8  *p = (fsw_u8 *)name->data;
+
+    h = (fsw_u32)parent->dnode_id ^ ((fsw_u32)parent->tree_id * 0x85EBCA6B);
+    for (i = 0; i < (fsw_u32)name->size; i++)
+        h = (h ^ p[i]) * 0x01000193;
+    return h;
+}
+
+/**
+ * Remove an entry from the path lookup cache and release the dnodes it holds.
+ */
+
+static void fsw_dcache_remove(struct fsw_volume *vol, struct fsw_dentry *de)
+{
+    struct fsw_dentry **link;
+
+    for (link = &vol->dcache[de->hash & (DCACHE_BUCKETS - 1)]; *link; link = &(*link)->hash_next) {
+        if (*link == de) {
+            *link = de->hash_next;
+            break;
+        }
+    }
+    if (de->lru_prev)
+        de->lru_prev->lru_next = de->lru_next;
+    else
+        vol->dcache_lru_head = de->lru_next;
+    if (de->lru_next)
+        de->lru_next->lru_prev = de->lru_prev;
+    else
+        vol->dcache_lru_tail = de->lru_prev;
+    vol->dcache_mem -= de->mem_size;
+
+    if (de->dno != NULL)
+        fsw_dnode_release(de->dno);
+    fsw_dnode_release(de->parent);
+    fsw_strfree(&de->name);
+    fsw_free(de);
+}
+
+/**
+ * Drop the whole path lookup cache. Called when unmounting the volume, before the
+ * root dnode is released.
+ */
+
+static void fsw_dcache_free(struct fsw_volume *vol)
+{
+    while (vol->dcache_lru_head != NULL)
+        fsw_dcache_remove(vol, vol->dcache_lru_head);
+    if (vol->dcache != NULL) {
+        fsw_free(vol->dcache);
+        vol->dcache = NULL;
+    }
+}
+
+/**
+ * Look up a name in the path lookup cache. Returns the matching entry, moved to the
+ * most recently used end of the LRU list, or NULL.
+ */
+
+static struct fsw_dentry * fsw_dcache_find(struct fsw_volume *vol, struct fsw_dnode *parent,
+                                           struct fsw_string *name, fsw_u32 hash)
+{
+    struct fsw_dentry *de;
+
+    for (de = vol->dcache[hash & (DCACHE_BUCKETS - 1)]; de; de = de->hash_next) {
+        if (de->hash == hash && de->parent == parent && de->name.size == name->size &&
+            fsw_memeq(de->name.data, name->data, name->size))
+            break;
+    }
+    if (de != NULL && de != vol->dcache_lru_tail) {
+        if (de->lru_prev)
+            de->lru_prev->lru_next = de->lru_next;
+        else
+            vol->dcache_lru_head = de->lru_next;
+        de->lru_next->lru_prev = de->lru_prev;
+        de->lru_prev = vol->dcache_lru_tail;
+        de->lru_next = NULL;
+        vol->dcache_lru_tail->lru_next = de;
+        vol->dcache_lru_tail = de;
+    }
+    return de;
+}
+
+/**
+ * Add the result of a directory lookup to the path lookup cache, evicting the least
+ * recently used entries to stay below the volume's ceiling. A NULL child records a
+ * name that does not exist. Failures are ignored, the cache is only an optimization.
+ */
+
+static void fsw_dcache_add(struct fsw_volume *vol, struct fsw_dnode *parent,
+                           struct fsw_string *name, fsw_u32 hash, struct fsw_dnode *child_dno)
+{
+    struct fsw_dentry *de;
+    fsw_u32 mem_size;
+
+    mem_size = sizeof(struct fsw_dentry) + name->size;
+    if (child_dno != NULL)
+        mem_size += vol->fstype_table->dnode_struct_size;
+    if (mem_size > vol->dcache_limit)
+        return;
+
+    if (fsw_alloc_zero(sizeof(struct fsw_dentry), (void **) &de))
+        return;
+    if (fsw_strdup_coerce(&de->name, name->type, name)) {
+        fsw_free(de);
+        return;
+    }
+
+    while (vol->dcache_mem + mem_size > vol->dcache_limit && vol->dcache_lru_head != NULL)
+        fsw_dcache_remove(vol, vol->dcache_lru_head);
+
+    de->parent = parent;
+    fsw_dnode_retain(parent);
+    de->dno = child_dno;
+    if (child_dno != NULL)
+        fsw_dnode_retain(child_dno);
+    de->hash = hash;
+    de->mem_size = mem_size;
+
+    de->hash_next = vol->dcache[hash & (DCACHE_BUCKETS - 1)];
+    vol->dcache[hash & (DCACHE_BUCKETS - 1)] = de;
+    de->lru_prev = vol->dcache_lru_tail;
+    if (vol->dcache_lru_tail)
+        vol->dcache_lru_tail->lru_next = de;
+    else
+        vol->dcache_lru_head = de;
+    vol->dcache_lru_tail = de;
+    vol->dcache_mem += mem_size;
+}
+
+/**
+ * Look up a name in a directory through the path lookup cache. Positive and negative
+ * results of the file system driver's dir_lookup are remembered per (directory, name),
+ * so repeated lookups of the same path do not reach the driver again. The directory
+ * must be a filled directory dnode.
+ */
+
+static fsw_status_t fsw_dnode_lookup_cached(struct fsw_dnode *dno,
+                                            struct fsw_string *lookup_name, struct fsw_dnode **child_dno_out)
+{
+    fsw_status_t    status;
+    struct fsw_volume *vol = dno->vol;
+    struct fsw_dentry *de;
+    fsw_u32         hash;
+
+    // only names in the host's string type are cached; they compare bytewise
+    if (vol->dcache_limit == 0 || lookup_name->type != vol->host_string_type)
+        return vol->fstype_table->dir_lookup(vol, dno, lookup_name, child_dno_out);
+
+    if (vol->dcache == NULL) {
+        if (fsw_alloc_zero(DCACHE_BUCKETS * sizeof(struct fsw_dentry *), (void **) &vol->dcache))
+            return vol->fstype_table->dir_lookup(vol, dno, lookup_name, child_dno_out);
+    }
+
+    hash = fsw_dcache_hash(dno, lookup_name);
+    de = fsw_dcache_find(vol, dno, lookup_name, hash);
+    if (de != NULL) {
+        vol->dcache_hits++;
+        if (de->dno == NULL)
+            return FSW_NOT_FOUND;
+        fsw_dnode_retain(de->dno);
+        *child_dno_out = de->dno;
+        return FSW_SUCCESS;
+    }
+
+    vol->dcache_misses++;
+    status = vol->fstype_table->dir_lookup(vol, dno, lookup_name, child_dno_out);
+    if (status == FSW_SUCCESS)
+        fsw_dcache_add(vol, dno, lookup_name, hash, *child_dno_out);
+    else if (status == FSW_NOT_FOUND)
+        fsw_dcache_add(vol, dno, lookup_name, hash, NULL);
+    return status;
+}
+
 /**
  * Lookup a directory entry by name. This function is called by the host driver.
  * Given a directory dnode and a file name, it looks up the named entry in the
@@ -532,7 +1033,7 @@ fsw_status_t fsw_dnode_lookup(struct fsw_dnode *dno,
     if (dno->type != FSW_DNODE_TYPE_DIR)
         return FSW_UNSUPPORTED;
 
-    return dno->vol->fstype_table->dir_lookup(dno->vol, dno, lookup_name, child_dno_out);
+    return fsw_dnode_lookup_cached(dno, lookup_name, child_dno_out);
 }
 
 /**
@@ -624,7 +1125,7 @@ fsw_status_t fsw_dnode_lookup_path(struct fsw_dnode *dno,
 
             } else {
                 // do an actual lookup
-                status = vol->fstype_table->dir_lookup(vol, dno, &lookup_name, &child_dno);
+                status = fsw_dnode_lookup_cached(dno, &lookup_name, &child_dno);
                 if (status)
                     goto errorexit;
             }
@@ -677,6 +1178,103 @@ fsw_status_t fsw_dnode_dir_read(struct fsw_shandle *shand, struct fsw_dnode **ch
     return status;
 }
 
+/**
+ * Fill a batch of dnodes. The blocks the file system driver will read for them are
+ * collected first, sorted, and read into the block cache in runs, so that entries
+ * whose metadata shares or neighbours a block cost one disk access together instead
+ * of one each in directory order. Errors are left for the host driver's own
+ * fsw_dnode_fill call on the entry to report.
+ */
+
+static void fsw_dnode_fill_batch(struct fsw_volume *vol, struct fsw_dnode **dnodes, fsw_u32 count)
+{
+    fsw_u64         bnos[FSW_DIR_READAHEAD], bno;
+    fsw_u32         bno_count, i, j, run, max_run;
+
+    if (vol->fstype_table->dnode_location != NULL && vol->host_table->map_block == NULL) {
+        bno_count = 0;
+        for (i = 0; i < count; i++) {
+            if (vol->fstype_table->dnode_location(vol, dnodes[i], &bno) != FSW_SUCCESS)
+                continue;
+            // insertion sort, the batch is small
+            for (j = bno_count; j > 0 && bnos[j - 1] > bno; j--)
+                bnos[j] = bnos[j - 1];
+            bnos[j] = bno;
+            bno_count++;
+        }
+
+        max_run = MAX_DIRECT_READ / vol->phys_blocksize;
+        if (max_run > FSW_DIR_READAHEAD)
+            max_run = FSW_DIR_READAHEAD;
+        for (i = 0; i < bno_count; i = j) {
+            // extend the run over consecutive and duplicate block numbers
+            for (j = i + 1; j < bno_count && bnos[j] - bnos[i] < max_run && bnos[j] <= bnos[j - 1] + 1; j++)
+                ;
+            run = (fsw_u32)(bnos[j - 1] - bnos[i]) + 1;
+            // a run that is entirely cached needs no disk access
+            for (bno = bnos[i]; bno <= bnos[j - 1]; bno++) {
+                if (fsw_blockcache_find(vol, bno) == NULL)
+                    break;
+            }
+            if (bno <= bnos[j - 1])
+                fsw_blockcache_prefetch(vol, bnos[i], run, 2);
+        }
+    }
+
+    for (i = 0; i < count; i++)
+        fsw_dnode_fill(dnodes[i]);
+}
+
+/**
+ * Get the next directory item in sequential order, reading ahead. This function works
+ * like fsw_dnode_dir_read, but collects up to FSW_DIR_READAHEAD entries at a time
+ * and fills them in one pass, in the order of their metadata on disk. Host drivers
+ * that fill every entry they hand out should use it when listing a directory.
+ *
+ * The entries read ahead are kept in a caller-provided structure, which must be
+ * zeroed before the first call. When the iteration restarts or the directory is
+ * closed, the caller must release the pending entries with fsw_dir_readahead_reset.
+ * The shandle position is that of the last entry read ahead, not of the last entry
+ * returned.
+ */
+
+fsw_status_t fsw_dnode_dir_read_ahead(struct fsw_shandle *shand, struct fsw_dir_readahead *ra,
+                                      struct fsw_dnode **child_dno_out)
+{
+    fsw_status_t    status = FSW_SUCCESS;
+
+    if (ra->next >= ra->count) {
+        ra->count = ra->next = 0;
+        while (ra->count < FSW_DIR_READAHEAD) {
+            status = fsw_dnode_dir_read(shand, &ra->dnodes[ra->count]);
+            if (status)
+                break;
+            ra->count++;
+        }
+        // an error after the first entry is returned by the next call again
+        if (ra->count == 0)
+            return status;
+        fsw_dnode_fill_batch(shand->dnode->vol, ra->dnodes, ra->count);
+    }
+
+    // hand over the reference
+    *child_dno_out = ra->dnodes[ra->next];
+    ra->dnodes[ra->next++] = NULL;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Release the entries still held by a read-ahead structure. Call this before
+ * restarting the iteration and before closing the directory.
+ */
+
+void fsw_dir_readahead_reset(struct fsw_dir_readahead *ra)
+{
+    while (ra->next < ra->count)
+        fsw_dnode_release(ra->dnodes[ra->next++]);
+    ra->count = ra->next = 0;
+}
+
 /**
  * Read the target path of a symbolic link. This function is called by the host driver
  * to read the "content" of a symbolic link, that is the relative or absolute path
@@ -855,7 +1453,12 @@ void fsw_shandle_close(struct fsw_shandle *shand)
 
 /**
  * Read data from a shandle (storage handle for a dnode). This function is called by the
- * host driver or internally when data is read from a file. TODO: more
+ * host driver or internally when data is read from a file.
+ *
+ * Data in physical block extents normally passes through the block cache. If the host
+ * provides a read_blocks function, runs of whole blocks inside an extent are read
+ * directly into the caller's buffer instead, so only the partial blocks at the head
+ * and tail of a request use the cache.
  */
 
 fsw_status_t fsw_shandle_read(struct fsw_shandle *shand, fsw_u32 *buffer_size_inout, void *buffer_in)
@@ -866,7 +1469,7 @@ fsw_status_t fsw_shandle_read(struct fsw_shandle *shand, fsw_u32 *buffer_size_in
     fsw_u8          *buffer, *block_buffer;
     fsw_u64         buflen, copylen, pos;
     fsw_u64         log_bno, pos_in_extent, phys_bno, pos_in_physblock;
-    fsw_u32         cache_level;
+    fsw_u32         cache_level, block_count;
 
     if (shand->pos >= dno->size) {   // already at EOF
         *buffer_size_inout = 0;
@@ -881,6 +1484,9 @@ fsw_status_t fsw_shandle_read(struct fsw_shandle *shand, fsw_u32 *buffer_size_in
     // restrict read to file size
     if (buflen > dno->size - pos)
         buflen = (fsw_u32)(dno->size - pos);
+    // a cached buffer may be gone once other handles have been read
+    if (shand->extent.type == FSW_EXTENT_TYPE_CACHED)
+        shand->extent.type = FSW_EXTENT_TYPE_INVALID;
 
     while (buflen > 0) {
         // Get extent for the current logical block
@@ -908,20 +1514,42 @@ fsw_status_t fsw_shandle_read(struct fsw_shandle *shand, fsw_u32 *buffer_size_in
             // convert to physical block number and offset
             phys_bno = shand->extent.phys_start + FSW_U64_DIV(pos_in_extent, vol->phys_blocksize);
             pos_in_physblock = pos_in_extent & (vol->phys_blocksize - 1);
-            copylen = vol->phys_blocksize - pos_in_physblock;
-            if (copylen > buflen)
-                copylen = buflen;
 
-            // Get one physical block
-            status = fsw_block_get(vol, phys_bno, cache_level, (void **) &block_buffer);
-            if (status)
-                return status;
+            // Count the whole physical blocks wanted from this extent
+            block_count = 0;
+            if (pos_in_physblock == 0 && vol->host_table->read_blocks != NULL) {
+                copylen = shand->extent.log_count * vol->log_blocksize - pos_in_extent;
+                if (copylen > buflen)
+                    copylen = buflen;
+                if (copylen > MAX_DIRECT_READ)
+                    copylen = MAX_DIRECT_READ;
+                block_count = (fsw_u32)FSW_U64_DIV(copylen, vol->phys_blocksize);
+            }
+
+            if (block_count > 1) {
+                // Read a run of whole blocks straight into the caller's buffer
+                copylen = (fsw_u64)block_count * vol->phys_blocksize;
+                status = vol->host_table->read_blocks(vol, phys_bno, block_count, buffer);
+                if (status)
+                    return status;
+
+            } else {
+                copylen = vol->phys_blocksize - pos_in_physblock;
+                if (copylen > buflen)
+                    copylen = buflen;
+
+                // Get one physical block
+                status = fsw_block_get(vol, phys_bno, cache_level, (void **) &block_buffer);
+                if (status)
+                    return status;
 
-            // Copy data from it
-            fsw_memcpy(buffer, block_buffer + pos_in_physblock, copylen);
-            fsw_block_release(vol, phys_bno, block_buffer);
+                // Copy data from it
+                fsw_memcpy(buffer, block_buffer + pos_in_physblock, copylen);
+                fsw_block_release(vol, phys_bno, block_buffer);
+            }
 
-        } else if (shand->extent.type == FSW_EXTENT_TYPE_BUFFER) {
+        } else if (shand->extent.type == FSW_EXTENT_TYPE_BUFFER ||
+                   shand->extent.type == FSW_EXTENT_TYPE_CACHED) {
             copylen = shand->extent.log_count * vol->log_blocksize - pos_in_extent;
             if (copylen > buflen)
                 copylen = buflen;
@@ -56,6 +56,33 @@
 /** Indicates that the block cache entry is empty. */
 #define FSW_INVALID_BNO 0xFFFFFFFFFFFFFFFF
 
+/** Highest block cache level accepted by fsw_block_get. */
+#define FSW_BCACHE_MAX_LEVEL (5)
+
+/**
+ * Default ceiling for the block data held in a volume's block cache, in bytes.
+ * Can be overridden when building the driver or per volume with fsw_set_blockcache_limit.
+ */
+#ifndef FSW_BCACHE_DEFAULT_LIMIT
+#define FSW_BCACHE_DEFAULT_LIMIT (4 * 1024 * 1024)
+#endif
+
+/**
+ * Default ceiling for the memory held by a volume's path lookup cache, in bytes.
+ * Can be overridden when building the driver. A value of 0 disables the cache.
+ */
+#ifndef FSW_DCACHE_DEFAULT_LIMIT
+#define FSW_DCACHE_DEFAULT_LIMIT (256 * 1024)
+#endif
+
+/**
+ * Number of directory entries fsw_dnode_dir_read_ahead collects before filling them
+ * in one pass. Can be overridden when building the driver. Must be at least 1.
+ */
+#ifndef FSW_DIR_READAHEAD
+#define FSW_DIR_READAHEAD (32)
+#endif
+
 
 //
 // Byte-swapping macros
@@ -207,12 +234,33 @@ enum {
 struct fsw_dnode;
 struct fsw_host_table;
 struct fsw_fstype_table;
+struct fsw_codec_ctx;
 
 struct fsw_blockcache {
     fsw_u32     refcount;           //!< Reference count
     fsw_u32     cache_level;        //!< Level of importance of this block
     fsw_u64     phys_bno;           //!< Physical block number
     void        *data;              //!< Block data buffer
+
+    struct fsw_blockcache *hash_next;   //!< Next entry in the same hash bucket
+    struct fsw_blockcache *lru_prev;    //!< LRU list of unreferenced entries: older entry
+    struct fsw_blockcache *lru_next;    //!< LRU list of unreferenced entries: newer entry
+};
+
+/**
+ * Core: An entry in the path lookup cache. It maps a name in a parent directory
+ * to the child dnode, or records that the name does not exist.
+ */
+
+struct fsw_dentry {
+    struct fsw_dentry *hash_next;   //!< Next entry in the same hash bucket
+    struct fsw_dentry *lru_prev;    //!< LRU list: older entry
+    struct fsw_dentry *lru_next;    //!< LRU list: newer entry
+    struct fsw_dnode *parent;       //!< Directory the name was looked up in (retained)
+    struct fsw_dnode *dno;          //!< Child dnode (retained), NULL for a negative entry
+    fsw_u32     hash;               //!< Hash of parent and name
+    fsw_u32     mem_size;           //!< Memory accounted to this entry
+    struct fsw_string name;         //!< Name that was looked up, in the host string type
 };
 
 /**
@@ -227,9 +275,30 @@ struct fsw_volume {
     struct fsw_string label;        //!< Volume label
 
     struct fsw_dnode *dnode_head;   //!< List of all dnodes allocated for this volume
-
-    struct fsw_blockcache *bcache;  //!< Array of block cache entries
-    fsw_u32     bcache_size;        //!< Number of entries in the block cache array
+    struct fsw_dnode **dnode_hash;  //!< Open-addressed hash index of all dnodes, keyed by (dnode_id, tree_id)
+    fsw_u32     dnode_hash_size;    //!< Number of slots in the dnode hash index
+    fsw_u32     dnode_count;        //!< Number of dnodes in the dnode hash index
+
+    struct fsw_blockcache **bcache; //!< Hash table of block cache entries, keyed by phys_bno
+    fsw_u32     bcache_size;        //!< Number of buckets in the block cache hash table
+    fsw_u32     bcache_count;       //!< Number of entries currently in the block cache
+    fsw_u32     bcache_limit;       //!< Ceiling for cached block data in bytes
+    struct fsw_blockcache *bcache_lru_head[FSW_BCACHE_MAX_LEVEL + 1];  //!< Per level: least recently released entry
+    struct fsw_blockcache *bcache_lru_tail[FSW_BCACHE_MAX_LEVEL + 1];  //!< Per level: most recently released entry
+    fsw_u64     bcache_hits;        //!< Statistics: block requests served from the cache
+    fsw_u64     bcache_misses;      //!< Statistics: block requests passed to the host
+    fsw_u64     bcache_evictions;   //!< Statistics: cached blocks dropped to make room
+    fsw_u64     bcache_prefetched;  //!< Statistics: blocks read ahead into the cache
+
+    struct fsw_dentry **dcache;     //!< Hash table of path lookup cache entries
+    struct fsw_dentry *dcache_lru_head;     //!< Least recently used path lookup cache entry
+    struct fsw_dentry *dcache_lru_tail;     //!< Most recently used path lookup cache entry
+    fsw_u32     dcache_mem;         //!< Memory held by the path lookup cache in bytes
+    fsw_u32     dcache_limit;       //!< Ceiling for dcache_mem in bytes
+    fsw_u64     dcache_hits;        //!< Statistics: lookups answered from the path lookup cache
+    fsw_u64     dcache_misses;      //!< Statistics: lookups passed to the file system driver
+
+    struct fsw_codec_ctx *codecs;   //!< Decompressor context of the volume, allocated on first use
 
     void        *host_data;         //!< Hook for a host-specific data structure
     struct fsw_host_table *host_table;      //!< Dispatch table for host-specific functions
@@ -278,18 +347,23 @@ struct fsw_extent {
     fsw_u64     log_start;          //!< Starting logical block number
     fsw_u32     log_count;          //!< Logical block count
     fsw_u64     phys_start;         //!< Starting physical block number (for FSW_EXTENT_TYPE_PHYSBLOCK only)
-    void        *buffer;            //!< Allocated buffer pointer (for FSW_EXTENT_TYPE_BUFFER only)
+    void        *buffer;            //!< Allocated buffer pointer (for FSW_EXTENT_TYPE_BUFFER and _CACHED only)
 };
 
 /**
  * Possible extent representation types. FSW_EXTENT_TYPE_INVALID is for shandle's
  * internal use only, it must not be returned from a get_extent function.
+ * The core frees the buffer of an FSW_EXTENT_TYPE_BUFFER extent. The buffer of an
+ * FSW_EXTENT_TYPE_CACHED extent stays with the file system and only has to remain
+ * valid until its next get_extent call; the core does not keep it across
+ * fsw_shandle_read calls.
  */
 enum {
     FSW_EXTENT_TYPE_INVALID,
     FSW_EXTENT_TYPE_SPARSE,
     FSW_EXTENT_TYPE_PHYSBLOCK,
-    FSW_EXTENT_TYPE_BUFFER
+    FSW_EXTENT_TYPE_BUFFER,
+    FSW_EXTENT_TYPE_CACHED
 };
 
 /**
@@ -304,6 +378,17 @@ struct fsw_shandle {
     struct fsw_extent extent;       //!< Current extent
 };
 
+/**
+ * Core: Directory entries read ahead of the host driver by fsw_dnode_dir_read_ahead.
+ * Zero it before the first use and release it with fsw_dir_readahead_reset.
+ */
+
+struct fsw_dir_readahead {
+    struct DNODESTRUCTNAME *dnodes[FSW_DIR_READAHEAD];  //!< Entries read from the directory (retained)
+    fsw_u32     count;              //!< Number of entries in dnodes
+    fsw_u32     next;               //!< Index of the next entry to hand out
+};
+
 /**
  * Core: Used in gathering detailed information on a volume.
  */
@@ -343,6 +428,8 @@ struct fsw_host_table
                                      fsw_u32 old_phys_blocksize, fsw_u32 old_log_blocksize,
                                      fsw_u32 new_phys_blocksize, fsw_u32 new_log_blocksize);
     fsw_status_t EFIAPI (*read_block)(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer);
+    fsw_status_t EFIAPI (*read_blocks)(struct fsw_volume *vol, fsw_u64 phys_bno, fsw_u32 count, void *buffer);  //!< Optional, may be NULL
+    fsw_status_t EFIAPI (*map_block)(struct fsw_volume *vol, fsw_u64 phys_bno, void **buffer_out);  //!< Optional, may be NULL; points at the block in host memory
 };
 
 /**
@@ -372,6 +459,8 @@ struct fsw_fstype_table
                              struct fsw_shandle *shand, struct DNODESTRUCTNAME **child_dno);
     fsw_status_t (*readlink)(struct VOLSTRUCTNAME *vol, struct DNODESTRUCTNAME *dno,
                              struct fsw_string *link_target);
+    fsw_status_t (*dnode_location)(struct VOLSTRUCTNAME *vol, struct DNODESTRUCTNAME *dno,
+                                   fsw_u64 *phys_bno_out);  //!< Optional, may be NULL; block dnode_fill will read
 };
 
 
@@ -388,6 +477,7 @@ void         fsw_unmount(struct fsw_volume *vol);
 fsw_status_t fsw_volume_stat(struct fsw_volume *vol, struct fsw_volume_stat *sb);
 
 void         fsw_set_blocksize(struct VOLSTRUCTNAME *vol, fsw_u32 phys_blocksize, fsw_u32 log_blocksize);
+void         fsw_set_blockcache_limit(struct VOLSTRUCTNAME *vol, fsw_u32 limit);
 fsw_status_t fsw_block_get(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, fsw_u32 cache_level, void **buffer_out);
 void         fsw_block_release(struct VOLSTRUCTNAME *vol, fsw_u64 phys_bno, void *buffer);
 
@@ -417,6 +507,9 @@ fsw_status_t fsw_dnode_lookup_path(struct fsw_dnode *dno,
                                    struct fsw_string *lookup_path, char separator,
                                    struct fsw_dnode **child_dno_out);
 fsw_status_t fsw_dnode_dir_read(struct fsw_shandle *shand, struct fsw_dnode **child_dno_out);
+fsw_status_t fsw_dnode_dir_read_ahead(struct fsw_shandle *shand, struct fsw_dir_readahead *ra,
+                                      struct fsw_dnode **child_dno_out);
+void         fsw_dir_readahead_reset(struct fsw_dir_readahead *ra);
 fsw_status_t fsw_dnode_readlink(struct fsw_dnode *dno, struct fsw_string *link_target);
 fsw_status_t fsw_dnode_readlink_data(struct DNODESTRUCTNAME *dno, struct fsw_string *link_target);
 fsw_status_t fsw_dnode_resolve(struct fsw_dnode *dno, struct fsw_dnode **target_dno_out);
@@ -127,6 +127,12 @@ fsw_status_t EFIAPI fsw_efi_read_block(
     fsw_u64 phys_bno,
     void *buffer
 );
+fsw_status_t EFIAPI fsw_efi_read_blocks(
+    struct fsw_volume *vol,
+    fsw_u64 phys_bno,
+    fsw_u32 count,
+    void *buffer
+);
 EFI_STATUS fsw_efi_map_status(
     fsw_status_t     fsw_status,
     FSW_VOLUME_DATA *Volume
@@ -182,20 +188,33 @@ EFI_STATUS fsw_efi_dnode_fill_FileInfo(
 );
 
 /**
- * Structure for holding disk cache data.
+ * Structure for holding disk cache data. Each window holds a contiguous run of
+ * disk data for one volume. The number of windows and their sizes can be set
+ * when the driver is built.
  */
 
-#define CACHE_SIZE 131072 /* 128KiB */
+#ifndef FSW_EFI_CACHE_WINDOWS
+#define FSW_EFI_CACHE_WINDOWS 8
+#endif
+#ifndef FSW_EFI_CACHE_MIN_SIZE
+#define FSW_EFI_CACHE_MIN_SIZE 131072 /* 128KiB */
+#endif
+#ifndef FSW_EFI_CACHE_MAX_SIZE
+#define FSW_EFI_CACHE_MAX_SIZE 4194304 /* 4MiB */
+#endif
+
 struct cache_data {
    fsw_u8            *Cache;
+   UINTN             CacheAlloc;  // Size of the Cache buffer
+   UINTN             CacheSize;   // Bytes of valid data in the Cache buffer
    fsw_u64           CacheStart;
+   UINT64            LastUsed;
    BOOLEAN           CacheValid;
    FSW_VOLUME_DATA   *Volume; // NOTE: Do not deallocate; copied here to ID volume
 };
 
-#define NUM_CACHES 2 /* Do not increase without modifying fsw_efi_read_block() */
-static struct cache_data    Caches[NUM_CACHES];
-static int LastRead = -1;
+static struct cache_data    Caches[FSW_EFI_CACHE_WINDOWS];
+static UINT64 CacheTick = 0;
 
 /**
  * Interface structure for the UEFI Driver Binding protocol.
@@ -225,7 +244,8 @@ REFINDPLUS_EFI_COMPONENT_NAME_PROTOCOL fsw_efi_ComponentName_table = {
 struct fsw_host_table   fsw_efi_host_table = {
     FSW_STRING_TYPE_UTF16,
     fsw_efi_change_blocksize,
-    fsw_efi_read_block
+    fsw_efi_read_block,
+    fsw_efi_read_blocks
 };
 
 extern struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(FSTYPE);
@@ -235,17 +255,20 @@ VOID EFIAPI fsw_efi_clear_cache(VOID) {
    int i;
 
    // clear the cache
-   for (i = 0; i < NUM_CACHES; i++) {
+   for (i = 0; i < FSW_EFI_CACHE_WINDOWS; i++) {
       if (Caches[i].Cache != NULL) {
          FreePool(Caches[i].Cache);
          Caches[i].Cache = NULL;
       } // if
 
+      Caches[i].CacheAlloc = 0;
+      Caches[i].CacheSize  = 0;
       Caches[i].CacheStart = 0;
+      Caches[i].LastUsed   = 0;
       Caches[i].CacheValid = FALSE;
       Caches[i].Volume     = NULL;
    }
-   LastRead = -1;
+   CacheTick = 0;
 } // VOID EFIAPI fsw_efi_clear_cache();
 
 /**
@@ -552,15 +575,87 @@ void EFIAPI fsw_efi_change_blocksize(
     return;
 }
 
+/**
+ * Load a cache window with ReadSize bytes of disk data starting at StartRead.
+ * The window buffer is enlarged if necessary. If a large read fails (for example,
+ * because it runs past the end of the medium) a single window of the minimum size
+ * is tried instead. Returns TRUE if the window holds valid data afterwards.
+ */
+
+static BOOLEAN fsw_efi_fill_cache(
+    struct cache_data *Window,
+    FSW_VOLUME_DATA   *Volume,
+    UINT64             StartRead,
+    UINTN              ReadSize
+) {
+   EFI_STATUS       Status;
+
+   Window->CacheValid = FALSE;
+   if (Window->Cache != NULL && Window->CacheAlloc < ReadSize) {
+      FreePool(Window->Cache);
+      Window->Cache      = NULL;
+      Window->CacheAlloc = 0;
+   }
+   if (Window->Cache == NULL) {
+      Window->Cache = AllocatePool(ReadSize);
+      if (Window->Cache == NULL && ReadSize > FSW_EFI_CACHE_MIN_SIZE) {
+         ReadSize = FSW_EFI_CACHE_MIN_SIZE;
+         Window->Cache = AllocatePool(ReadSize);
+      }
+      if (Window->Cache == NULL) {
+         return FALSE;
+      }
+      Window->CacheAlloc = ReadSize;
+   }
+
+   // TODO: Below call hangs on my 32-bit Mac Mini when compiled with GNU-EFI.
+   // The same binary is fine under VirtualBox, and the same call is fine when
+   // compiled with Tianocore. Further clue: Omitting "Status =" avoids the
+   // hang but produces a failure to mount the filesystem, even when the same
+   // change is made to later similar call. Calling Volume->DiskIo->ReadDisk()
+   // directly (without REFIT_CALL_5_WRAPPER()) changes nothing. Placing Print()
+   // statements at the start and end of the function, and before and after the
+   // ReadDisk() call, suggests that when it fails, the program is executing
+   // code starting mid-function, so there seems to be something messed up in
+   // the way the function is being called. FIGURE THIS OUT!
+   Status = REFIT_CALL_5_WRAPPER(
+       Volume->DiskIo->ReadDisk, Volume->DiskIo,
+       Volume->MediaId, StartRead,
+       ReadSize, (VOID*) Window->Cache
+   );
+   if (EFI_ERROR(Status) && ReadSize > FSW_EFI_CACHE_MIN_SIZE) {
+      ReadSize = FSW_EFI_CACHE_MIN_SIZE;
+      Status = REFIT_CALL_5_WRAPPER(
+          Volume->DiskIo->ReadDisk, Volume->DiskIo,
+          Volume->MediaId, StartRead,
+          ReadSize, (VOID*) Window->Cache
+      );
+   }
+   if (EFI_ERROR(Status)) {
+      return FALSE;
+   }
+
+   Window->CacheStart = StartRead;
+   Window->CacheSize  = ReadSize;
+   Window->CacheValid = TRUE;
+   Window->Volume     = Volume;
+   Window->LastUsed   = ++CacheTick;
+
+   return TRUE;
+} // static BOOLEAN fsw_efi_fill_cache()
+
 /**
  * FSW interface function to read data blocks. This function is called by the FSW core
  * to read a block of data from the device. The buffer is allocated by the core code.
- * Two caches are maintained, so as to improve performance on some systems. (VirtualBox
- * is particularly susceptible to performance problems with an uncached driver -- the
- * ext2 driver can take 200 seconds to load a Linux kernel under VirtualBox, whereas
- * the time is more like 3 seconds with a cache!) Two independent caches are maintained
- * because the ext2fs driver tends to alternate between accessing two parts of the
- * disk.
+ * A set of read-ahead windows is maintained, so as to improve performance on some
+ * systems. (VirtualBox is particularly susceptible to performance problems with an
+ * uncached driver -- the ext2 driver can take 200 seconds to load a Linux kernel under
+ * VirtualBox, whereas the time is more like 3 seconds with a cache!) Several windows
+ * are kept because drivers alternate between metadata and file data, and because
+ * several volumes may be scanned at once. Each window belongs to one volume; the
+ * least recently used window is replaced on a miss. When a miss falls exactly at
+ * the end of an existing window, the access is treated as a sequential stream: that
+ * window is reused and its read-ahead size doubles, up to FSW_EFI_CACHE_MAX_SIZE.
  */
 
 fsw_status_t EFIAPI fsw_efi_read_block(
@@ -571,74 +666,63 @@ fsw_status_t EFIAPI fsw_efi_read_block(
    int              i, ReadCache = -1;
    FSW_VOLUME_DATA  *Volume = (FSW_VOLUME_DATA *)vol->host_data;
    EFI_STATUS       Status = EFI_SUCCESS;
-   BOOLEAN          ReadOneBlock = FALSE;
+   UINTN            ReadSize;
    UINT64           StartRead = (UINT64) phys_bno * (UINT64) vol->phys_blocksize;
 
    if (buffer == NULL)
       return (fsw_status_t) EFI_BAD_BUFFER_SIZE;
 
-   // Initialize static data structures, if necessary.
-   if (LastRead < 0) {
-      fsw_efi_clear_cache();
-   } // if
-
    // Look for a cache hit on the current query.
-   i = 0;
-   do {
+   for (i = 0; i < FSW_EFI_CACHE_WINDOWS; i++) {
       if ((Caches[i].Volume == Volume) &&
           Caches[i].CacheValid &&
           (StartRead >= Caches[i].CacheStart) &&
-          ((StartRead + vol->phys_blocksize) <= (Caches[i].CacheStart + CACHE_SIZE))) {
+          ((StartRead + vol->phys_blocksize) <= (Caches[i].CacheStart + Caches[i].CacheSize))) {
          ReadCache = i;
+         Caches[i].LastUsed = ++CacheTick;
+         break;
       }
-      i++;
-   } while ((i < NUM_CACHES) && (ReadCache < 0));
+   }
 
    // No cache hit found; load new cache and pass it on.
    if (ReadCache < 0) {
-      if (LastRead == -1)
-         LastRead = 1;
-      ReadCache = 1 - LastRead; // NOTE: If NUM_CACHES > 2, this must become more complex
-      Caches[ReadCache].CacheValid = FALSE;
-      if (Caches[ReadCache].Cache == NULL) {
-          Caches[ReadCache].Cache = AllocatePool(CACHE_SIZE);
+      ReadSize = FSW_EFI_CACHE_MIN_SIZE;
+
+      // Continue a sequential stream in the window it has just run off, with a larger read-ahead.
+      for (i = 0; i < FSW_EFI_CACHE_WINDOWS; i++) {
+         if ((Caches[i].Volume == Volume) &&
+             Caches[i].CacheValid &&
+             (StartRead == Caches[i].CacheStart + Caches[i].CacheSize)) {
+            ReadCache = i;
+            ReadSize  = Caches[i].CacheSize * 2;
+            if (ReadSize > FSW_EFI_CACHE_MAX_SIZE)
+               ReadSize = FSW_EFI_CACHE_MAX_SIZE;
+            break;
+         }
       }
-      if (Caches[ReadCache].Cache == NULL) {
-         ReadOneBlock = TRUE;
-      } else {
-         // TODO: Below call hangs on my 32-bit Mac Mini when compiled with GNU-EFI.
-         // The same binary is fine under VirtualBox, and the same call is fine when
-         // compiled with Tianocore. Further clue: Omitting "Status =" avoids the
-         // hang but produces a failure to mount the filesystem, even when the same
-         // change is made to later similar call. Calling Volume->DiskIo->ReadDisk()
-         // directly (without REFIT_CALL_5_WRAPPER()) changes nothing. Placing Print()
-         // statements at the start and end of the function, and before and after the
-         // ReadDisk() call, suggests that when it fails, the program is executing
-         // code starting mid-function, so there seems to be something messed up in
-         // the way the function is being called. FIGURE THIS OUT!
-         Status = REFIT_CALL_5_WRAPPER(
-             Volume->DiskIo->ReadDisk, Volume->DiskIo,
-             Volume->MediaId, StartRead,
-             (UINTN) CACHE_SIZE, (VOID*) Caches[ReadCache].Cache
-         );
-         if (EFI_ERROR(Status)) {
-            ReadOneBlock = TRUE;
-         } else {
-            Caches[ReadCache].CacheStart = StartRead;
-            Caches[ReadCache].CacheValid = TRUE;
-            Caches[ReadCache].Volume     = Volume;
-            LastRead                     = ReadCache;
+
+      // Otherwise take an unused window, or the least recently used one.
+      if (ReadCache < 0) {
+         ReadCache = 0;
+         for (i = 0; i < FSW_EFI_CACHE_WINDOWS; i++) {
+            if (!Caches[i].CacheValid) {
+               ReadCache = i;
+               break;
+            }
+            if (Caches[i].LastUsed < Caches[ReadCache].LastUsed)
+               ReadCache = i;
          }
-      } // if cache memory allocated
+      }
+
+      if (ReadSize < vol->phys_blocksize ||
+          !fsw_efi_fill_cache(&Caches[ReadCache], Volume, StartRead, ReadSize)) {
+         ReadCache = -1;
+      }
    } // if (ReadCache < 0)
 
-   if (Caches[ReadCache].Cache != NULL && Caches[ReadCache].CacheValid && vol->phys_blocksize > 0) {
+   if (ReadCache >= 0 && vol->phys_blocksize > 0) {
       CopyMem(buffer, &Caches[ReadCache].Cache[StartRead - Caches[ReadCache].CacheStart], vol->phys_blocksize);
-   } else {
-      ReadOneBlock = TRUE;
-   }
-
-   if (ReadOneBlock) { // Something's failed, so try a simple disk read of one block.
+   } else { // Something's failed, so try a simple disk read of one block.
       Status = REFIT_CALL_5_WRAPPER(
           Volume->DiskIo->ReadDisk, Volume->DiskIo,
           Volume->MediaId, phys_bno * vol->phys_blocksize,
@@ -650,6 +734,34 @@ fsw_status_t EFIAPI fsw_efi_read_block(
    return Status;
 } // fsw_status_t *fsw_efi_read_block()
 
+/**
+ * FSW interface function to read a run of contiguous data blocks. This function is
+ * called by the FSW core to read file data directly into the caller's buffer, so the
+ * data is transferred in one Disk I/O request and bypasses the read-ahead windows.
+ */
+
+fsw_status_t EFIAPI fsw_efi_read_blocks(
+    struct fsw_volume *vol,
+    fsw_u64            phys_bno,
+    fsw_u32            count,
+    void              *buffer
+) {
+   FSW_VOLUME_DATA  *Volume = (FSW_VOLUME_DATA *)vol->host_data;
+   EFI_STATUS       Status;
+
+   if (buffer == NULL)
+      return (fsw_status_t) EFI_BAD_BUFFER_SIZE;
+
+   Status = REFIT_CALL_5_WRAPPER(
+       Volume->DiskIo->ReadDisk, Volume->DiskIo,
+       Volume->MediaId, phys_bno * vol->phys_blocksize,
+       (UINTN) count * vol->phys_blocksize, (VOID*) buffer
+   );
+   Volume->LastIOStatus = Status;
+
+   return Status;
+} // fsw_status_t *fsw_efi_read_blocks()
+
 /**
  * Map FSW status codes to EFI status codes. The FSW_IO_ERROR code is only produced
  * by fsw_efi_read_block, so we map it back to the EFI status code remembered from
@@ -734,6 +846,7 @@ EFI_STATUS EFIAPI fsw_efi_FileHandle_Close(
     Print(L"fsw_efi_FileHandle_Close\n");
 #endif
 
+    fsw_dir_readahead_reset(&File->ra);
     fsw_shandle_close(&File->shand);
     FreePool(File);
 
@@ -1048,7 +1161,7 @@ EFI_STATUS fsw_efi_dir_read(
 #endif
 
     // Read the next entry
-    Status = fsw_efi_map_status(fsw_dnode_dir_read(&File->shand, &dno), Volume);
+    Status = fsw_efi_map_status(fsw_dnode_dir_read_ahead(&File->shand, &File->ra, &dno), Volume);
     if (Status == EFI_NOT_FOUND) {
         // End of directory
         *BufferSize = 0;
@@ -1062,6 +1175,11 @@ EFI_STATUS fsw_efi_dir_read(
 
     // Get info into buffer
     Status = fsw_efi_dnode_fill_FileInfo(Volume, dno, BufferSize, Buffer);
+    if (Status == EFI_BUFFER_TOO_SMALL) {
+        // keep the entry for the caller's retry with a larger buffer
+        File->ra.dnodes[--File->ra.next] = dno;
+        return Status;
+    }
     fsw_dnode_release(dno);
     return Status;
 }
@@ -1077,6 +1195,7 @@ EFI_STATUS fsw_efi_dir_setpos(
     IN UINT64         Position
 ) {
     if (Position == 0) {
+        fsw_dir_readahead_reset(&File->ra);
         File->shand.pos = 0;
         return EFI_SUCCESS;
     } else {
@@ -1239,7 +1358,7 @@ EFI_STATUS fsw_efi_dnode_fill_FileInfo(
     // Check buffer size
     RequiredSize = SIZE_OF_EFI_FILE_INFO + fsw_efi_strsize(&dno->name);
     if (*BufferSize < RequiredSize) {
-        // TODO: wind back the directory in this case
+        // fsw_efi_dir_read keeps the entry for the next call in this case
 
 #if DEBUG_LEVEL
         Print(L"... BUFFER TOO SMALL\n");
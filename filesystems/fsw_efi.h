@@ -88,6 +88,7 @@ typedef struct {
 
     UINT64                      Type;           //!< File type used for dispatching
     struct fsw_shandle          shand;          //!< FSW handle for this file
+    struct fsw_dir_readahead    ra;             //!< Directory entries read ahead of Read
 
 } FSW_FILE_DATA;
 
@@ -22,6 +22,7 @@
  */
 
 #include "fsw_ext2.h"
+#include "fsw_htree.c"
 
 
 // functions
@@ -45,6 +46,8 @@ static fsw_status_t fsw_ext2_read_dentry(struct fsw_shandle *shand, struct ext2_
 
 static fsw_status_t fsw_ext2_readlink(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
                                       struct fsw_string *link);
+static fsw_status_t fsw_ext2_dnode_location(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
+                                          fsw_u64 *phys_bno_out);
 
 //
 // Dispatch Table
@@ -65,6 +68,7 @@ struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(ext2) = {
     fsw_ext2_dir_lookup,
     fsw_ext2_dir_read,
     fsw_ext2_readlink,
+    fsw_ext2_dnode_location,
 };
 
 /**
@@ -184,6 +188,22 @@ static fsw_status_t fsw_ext2_volume_stat(struct fsw_ext2_volume *vol, struct fsw
     return FSW_SUCCESS;
 }
 
+/**
+ * Compute the block of the inode table that holds a dnode's inode, and the index
+ * of the inode within that block.
+ */
+
+static fsw_u32 fsw_ext2_inode_bno(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno, fsw_u32 *ino_index_out)
+{
+    fsw_u32         groupno, ino_in_group;
+
+    groupno = (fsw_u32) (dno->g.dnode_id - 1) / vol->sb->s_inodes_per_group;
+    ino_in_group = (fsw_u32) (dno->g.dnode_id - 1) % vol->sb->s_inodes_per_group;
+    *ino_index_out = ino_in_group % (vol->g.phys_blocksize / vol->inode_size);
+    return vol->inotab_bno[groupno] +
+        ino_in_group / (vol->g.phys_blocksize / vol->inode_size);
+}
+
 /**
  * Get full information on a dnode from disk. This function is called by the core
  * whenever it needs to access fields in the dnode structure that may not
@@ -195,7 +215,7 @@ static fsw_status_t fsw_ext2_volume_stat(struct fsw_ext2_volume *vol, struct fsw
 static fsw_status_t fsw_ext2_dnode_fill(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno)
 {
     fsw_status_t    status;
-    fsw_u32         groupno, ino_in_group, ino_bno, ino_index;
+    fsw_u32         ino_bno, ino_index;
     fsw_u8          *buffer;
 
     if (dno->raw)
@@ -204,11 +224,7 @@ static fsw_status_t fsw_ext2_dnode_fill(struct fsw_ext2_volume *vol, struct fsw_
     FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext2_dnode_fill: inode %d\n"), dno->g.dnode_id));
 
     // Read the inode block
-    groupno = (fsw_u32) (dno->g.dnode_id - 1) / vol->sb->s_inodes_per_group;
-    ino_in_group = (fsw_u32) (dno->g.dnode_id - 1) % vol->sb->s_inodes_per_group;
-    ino_bno = vol->inotab_bno[groupno] +
-        ino_in_group / (vol->g.phys_blocksize / vol->inode_size);
-    ino_index = ino_in_group % (vol->g.phys_blocksize / vol->inode_size);
+    ino_bno = fsw_ext2_inode_bno(vol, dno, &ino_index);
     status = fsw_block_get(vol, ino_bno, 2, (void **) &buffer);
     if (status)
         return status;
@@ -234,6 +250,23 @@ static fsw_status_t fsw_ext2_dnode_fill(struct fsw_ext2_volume *vol, struct fsw_
     return FSW_SUCCESS;
 }
 
+/**
+ * Report the block dnode_fill reads for a dnode, so the core can fetch the inode
+ * table blocks of a whole directory listing in one pass. Nothing is reported for
+ * dnodes that are already filled.
+ */
+
+static fsw_status_t fsw_ext2_dnode_location(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
+                                          fsw_u64 *phys_bno_out)
+{
+    fsw_u32         ino_index;
+
+    if (dno->raw)
+        return FSW_NOT_FOUND;
+    *phys_bno_out = fsw_ext2_inode_bno(vol, dno, &ino_index);
+    return FSW_SUCCESS;
+}
+
 /**
  * Free the dnode data structure. Called by the core when deallocating a dnode
  * structure to release the memory used by the file system type specific part
@@ -376,6 +409,9 @@ static fsw_status_t fsw_ext2_get_extent(struct fsw_ext2_volume *vol, struct fsw_
  * to retrieve the directory entry with the given name. A dnode is constructed for
  * this entry and returned. The core makes sure that fsw_ext2_dnode_fill has been called
  * and the dnode is actually a directory.
+ *
+ * Hash-indexed directories are searched through their HTree index. Other directories,
+ * and those whose index cannot be used, are scanned linearly.
  */
 
 static fsw_status_t fsw_ext2_dir_lookup(struct fsw_ext2_volume *vol, struct fsw_ext2_dnode *dno,
@@ -383,7 +419,7 @@ static fsw_status_t fsw_ext2_dir_lookup(struct fsw_ext2_volume *vol, struct fsw_
 {
     fsw_status_t    status;
     struct fsw_shandle shand;
-    fsw_u32         child_ino;
+    fsw_u32         child_ino = 0;
     struct ext2_dir_entry entry;
     struct fsw_string entry_name;
 
@@ -398,6 +434,20 @@ static fsw_status_t fsw_ext2_dir_lookup(struct fsw_ext2_volume *vol, struct fsw_
     if (status)
         return status;
 
+    // use the hash index if the directory has one
+    if ((dno->raw->i_flags & EXT2_INDEX_FL) && dno->g.size > vol->g.log_blocksize) {
+        status = fsw_htree_lookup(&shand, vol->g.log_blocksize, vol->sb->s_hash_seed, vol->sb->s_flags,
+                                  2, lookup_name, &child_ino);
+        if (status == FSW_SUCCESS) {
+            status = fsw_dnode_create(dno, child_ino, FSW_DNODE_TYPE_UNKNOWN, lookup_name, child_dno_out);
+            goto errorexit;
+        }
+        if (status != FSW_UNSUPPORTED)
+            goto errorexit;
+        FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext2_dir_lookup: unusable hash index, scanning directory\n")));
+        shand.pos = 0;
+    }
+
     // scan the directory for the file
     child_ino = 0;
     while (child_ino == 0) {
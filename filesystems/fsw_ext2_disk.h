@@ -270,7 +270,15 @@ struct ext2_super_block {
     __u16   s_reserved_word_pad;
     __le32  s_default_mount_opts;
     __le32  s_first_meta_bg;        /* First metablock block group */
-    __u32   s_reserved[190];        /* Padding to the end of the block */
+    __le32  s_mkfs_time;            /* When the filesystem was created */
+    __le32  s_jnl_blocks[17];       /* Backup of the journal inode */
+    __le32  s_blocks_count_hi;      /* Blocks count */
+    __le32  s_r_blocks_count_hi;    /* Reserved blocks count */
+    __le32  s_free_blocks_hi;       /* Free blocks count */
+    __le16  s_min_extra_isize;      /* All inodes have at least # bytes */
+    __le16  s_want_extra_isize;     /* New inodes should reserve # bytes */
+    __le32  s_flags;                /* Miscellaneous flags */
+    __u32   s_reserved[167];        /* Padding to the end of the block */
 };
 
 /*
@@ -30,6 +30,7 @@
 
 
 #include "fsw_ext4.h"
+#include "fsw_htree.c"
 
 
 // functions
@@ -57,6 +58,8 @@ static fsw_status_t fsw_ext4_read_dentry(struct fsw_shandle *shand, struct ext4_
 
 static fsw_status_t fsw_ext4_readlink(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
                                       struct fsw_string *link);
+static fsw_status_t fsw_ext4_dnode_location(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                          fsw_u64 *phys_bno_out);
 
 //
 // Dispatch Table
@@ -77,6 +80,7 @@ struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(ext4) = {
     fsw_ext4_dir_lookup,
     fsw_ext4_dir_read,
     fsw_ext4_readlink,
+    fsw_ext4_dnode_location,
 };
 
 
@@ -280,6 +284,22 @@ static fsw_status_t fsw_ext4_volume_stat(struct fsw_ext4_volume *vol, struct fsw
     return FSW_SUCCESS;
 }
 
+/**
+ * Compute the block of the inode table that holds a dnode's inode, and the index
+ * of the inode within that block.
+ */
+
+static fsw_u64 fsw_ext4_inode_bno(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno, fsw_u32 *ino_index_out)
+{
+    fsw_u32         groupno, ino_in_group;
+
+    groupno = (fsw_u32) (dno->g.dnode_id - 1) / vol->sb->s_inodes_per_group;
+    ino_in_group = (fsw_u32) (dno->g.dnode_id - 1) % vol->sb->s_inodes_per_group;
+    *ino_index_out = ino_in_group % (vol->g.phys_blocksize / vol->inode_size);
+    return vol->inotab_bno[groupno] +
+        ino_in_group / (vol->g.phys_blocksize / vol->inode_size);
+}
+
 /**
  * Get full information on a dnode from disk. This function is called by the core
  * whenever it needs to access fields in the dnode structure that may not
@@ -291,7 +311,7 @@ static fsw_status_t fsw_ext4_volume_stat(struct fsw_ext4_volume *vol, struct fsw
 static fsw_status_t fsw_ext4_dnode_fill(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno)
 {
     fsw_status_t    status;
-    fsw_u32         groupno, ino_in_group, ino_index;
+    fsw_u32         ino_index;
     fsw_u64         ino_bno;
     fsw_u8          *buffer;
 
@@ -300,11 +320,7 @@ static fsw_status_t fsw_ext4_dnode_fill(struct fsw_ext4_volume *vol, struct fsw_
 
 
     // Read the inode block
-    groupno = (fsw_u32) (dno->g.dnode_id - 1) / vol->sb->s_inodes_per_group;
-    ino_in_group = (fsw_u32) (dno->g.dnode_id - 1) % vol->sb->s_inodes_per_group;
-    ino_bno = vol->inotab_bno[groupno] +
-        ino_in_group / (vol->g.phys_blocksize / vol->inode_size);
-    ino_index = ino_in_group % (vol->g.phys_blocksize / vol->inode_size);
+    ino_bno = fsw_ext4_inode_bno(vol, dno, &ino_index);
     status = fsw_block_get(vol, ino_bno, 2, (void **) &buffer);
 
     if (status)
@@ -333,6 +349,23 @@ static fsw_status_t fsw_ext4_dnode_fill(struct fsw_ext4_volume *vol, struct fsw_
     return FSW_SUCCESS;
 }
 
+/**
+ * Report the block dnode_fill reads for a dnode, so the core can fetch the inode
+ * table blocks of a whole directory listing in one pass. Nothing is reported for
+ * dnodes that are already filled.
+ */
+
+static fsw_status_t fsw_ext4_dnode_location(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                          fsw_u64 *phys_bno_out)
+{
+    fsw_u32         ino_index;
+
+    if (dno->raw)
+        return FSW_NOT_FOUND;
+    *phys_bno_out = fsw_ext4_inode_bno(vol, dno, &ino_index);
+    return FSW_SUCCESS;
+}
+
 /**
  * Free the dnode data structure. Called by the core when deallocating a dnode
  * structure to release the memory used by the file system type specific part
@@ -343,6 +376,8 @@ static void fsw_ext4_dnode_free(struct fsw_ext4_volume *vol, struct fsw_ext4_dno
 {
     if (dno->raw)
         fsw_free(dno->raw);
+    if (dno->emap)
+        fsw_free(dno->emap);
 }
 
 /**
@@ -403,76 +438,280 @@ static fsw_status_t fsw_ext4_get_extent(struct fsw_ext4_volume *vol, struct fsw_
 }
 
 /**
- * New ext4 extents...
+ * Find the run of the dnode's extent map that contains logical block bno.
+ * Returns NULL if that part of the extent tree has not been decoded yet.
  */
-static fsw_status_t fsw_ext4_get_by_extent(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
-                                        struct fsw_extent *extent)
+
+static struct fsw_ext4_extent_run *fsw_ext4_emap_find(struct fsw_ext4_dnode *dno, fsw_u32 bno)
 {
-    fsw_status_t  status;
-    fsw_u32       bno, buf_offset;
-    int           ext_cnt;
-    void          *buffer;
+    fsw_u32 lo = 0, hi = dno->emap_count, mid;
+    struct fsw_ext4_extent_run *run;
+
+    // binary search for the last run starting at or before bno
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (dno->emap[mid].log_start <= bno)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+    run = &dno->emap[lo - 1];
+    if (bno - run->log_start >= run->log_count)
+        return NULL;
+    return run;
+}
+
+/**
+ * Append a run to an array of runs, merging it into the last one if both are
+ * logically and physically contiguous.
+ */
+
+static void fsw_ext4_emap_put(struct fsw_ext4_extent_run *runs, fsw_u32 *count,
+                              fsw_u32 log_start, fsw_u32 log_count, fsw_u64 phys_start)
+{
+    struct fsw_ext4_extent_run *prev;
+
+    if (*count > 0) {
+        prev = &runs[*count - 1];
+        if (prev->log_start + prev->log_count == log_start &&
+            prev->log_count + log_count > prev->log_count &&
+            ((prev->phys_start == 0 && phys_start == 0) ||
+             (prev->phys_start != 0 && prev->phys_start + prev->log_count == phys_start))) {
+            prev->log_count += log_count;
+            return;
+        }
+    }
+    runs[*count].log_start = log_start;
+    runs[*count].log_count = log_count;
+    runs[*count].phys_start = phys_start;
+    (*count)++;
+}
+
+/**
+ * Decode the extents of a leaf node covering the logical blocks from range_start
+ * up to (but not including) range_end into the dnode's extent map. Gaps between
+ * extents are stored as holes, so the whole range is covered afterwards and is
+ * never looked up in the tree again.
+ */
+
+static fsw_status_t fsw_ext4_emap_add_leaf(struct fsw_ext4_dnode *dno, struct ext4_extent_header *header,
+                                           fsw_u32 range_start, fsw_u64 range_end)
+{
+    fsw_status_t    status;
+    struct ext4_extent *ext4_extent;
+    struct fsw_ext4_extent_run *runs, *new_emap;
+    fsw_u32         run_count, pos, hi, mid, i;
+    fsw_u32         ee_len;
+    fsw_u64         next_start, ee_end, phys_start;
+
+    // find the insertion point; the range must not overlap anything decoded before
+    pos = 0;
+    hi = dno->emap_count;
+    while (pos < hi) {
+        mid = pos + (hi - pos) / 2;
+        if (dno->emap[mid].log_start < range_start)
+            pos = mid + 1;
+        else
+            hi = mid;
+    }
+    if (pos > 0 && (fsw_u64)dno->emap[pos - 1].log_start + dno->emap[pos - 1].log_count > range_start)
+        return FSW_VOLUME_CORRUPTED;
+    if (pos < dno->emap_count && dno->emap[pos].log_start < range_end)
+        return FSW_VOLUME_CORRUPTED;
+
+    // each extent may be preceded by a hole, plus two runs for the hole at the end
+    status = fsw_alloc(((fsw_u32)header->eh_entries * 2 + 2) * sizeof(struct fsw_ext4_extent_run), (void **) &runs);
+    if (status)
+        return status;
 
+    run_count = 0;
+    next_start = range_start;
+    ext4_extent = (struct ext4_extent *)(header + 1);
+    for (i = 0; i < header->eh_entries; i++, ext4_extent++) {
+        ee_len = ext4_extent->ee_len;
+        phys_start = ((fsw_u64)ext4_extent->ee_start_hi << 32) | ext4_extent->ee_start_lo;
+        if (ee_len > EXT_INIT_MAX_LEN) {
+            // uninitialized extent, reads as zeroes
+            ee_len -= EXT_INIT_MAX_LEN;
+            phys_start = 0;
+        }
+        ee_end = (fsw_u64)ext4_extent->ee_block + ee_len;
+        if (ee_len == 0 || ext4_extent->ee_block < next_start || ee_end > range_end) {
+            fsw_free(runs);
+            return FSW_VOLUME_CORRUPTED;
+        }
+
+        if (ext4_extent->ee_block > next_start)
+            fsw_ext4_emap_put(runs, &run_count, (fsw_u32)next_start,
+                              (fsw_u32)(ext4_extent->ee_block - next_start), 0);
+        fsw_ext4_emap_put(runs, &run_count, ext4_extent->ee_block, ee_len, phys_start);
+        next_start = ee_end;
+    }
+    while (next_start < range_end) {
+        // hole up to the end of the range, split so the count fits into 32 bits
+        ee_end = range_end - next_start;
+        if (ee_end > 0x80000000)
+            ee_end = 0x80000000;
+        fsw_ext4_emap_put(runs, &run_count, (fsw_u32)next_start, (fsw_u32)ee_end, 0);
+        next_start += ee_end;
+    }
+
+    // splice the new runs into the map
+    status = fsw_alloc((dno->emap_count + run_count) * sizeof(struct fsw_ext4_extent_run), (void **) &new_emap);
+    if (status) {
+        fsw_free(runs);
+        return status;
+    }
+    if (pos > 0)
+        fsw_memcpy(new_emap, dno->emap, pos * sizeof(struct fsw_ext4_extent_run));
+    fsw_memcpy(new_emap + pos, runs, run_count * sizeof(struct fsw_ext4_extent_run));
+    if (pos < dno->emap_count)
+        fsw_memcpy(new_emap + pos + run_count, dno->emap + pos,
+                   (dno->emap_count - pos) * sizeof(struct fsw_ext4_extent_run));
+    fsw_free(runs);
+    if (dno->emap)
+        fsw_free(dno->emap);
+    dno->emap = new_emap;
+    dno->emap_count += run_count;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Check that an extent tree node header is valid and its entries fit into the
+ * space available for the node.
+ */
+
+static int fsw_ext4_extent_header_valid(struct ext4_extent_header *header, fsw_u32 node_size)
+{
+    if (header->eh_magic != EXT4_EXT_MAGIC)
+        return 0;
+    if (header->eh_entries > header->eh_max || header->eh_depth > EXT4_EXT_MAX_DEPTH)
+        return 0;
+    if (sizeof(struct ext4_extent_header) + (fsw_u32)header->eh_max * sizeof(struct ext4_extent) > node_size)
+        return 0;
+    return 1;
+}
+
+/**
+ * Walk the extent tree from the inode down to the leaf that covers logical
+ * block bno and add that leaf to the dnode's extent map. Every index block is
+ * released before descending to the next level.
+ */
+
+static fsw_status_t fsw_ext4_emap_load(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno, fsw_u32 bno)
+{
+    fsw_status_t    status;
+    void            *buffer;
+    fsw_u64         buffer_bno, child_bno;
+    fsw_u32         range_start, lo, hi, mid;
+    fsw_u64         range_end;
+    int             depth;
     struct ext4_extent_header  *ext4_extent_header;
     struct ext4_extent_idx     *ext4_extent_idx;
-    struct ext4_extent         *ext4_extent;
-
-    // Logical block requested by core...
-    bno = extent->log_start;
 
-    // First buffer is the i_block field from inode...
+    // First node is the i_block field from the inode...
     buffer = (void *)dno->raw->i_block;
-    buf_offset = 0;
-    while(1) {
-        ext4_extent_header = (struct ext4_extent_header *)((char *)buffer + buf_offset);
-        buf_offset += sizeof (struct ext4_extent_header);
-        FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_get_by_extent: extent header with %d entries\n"),
-                      ext4_extent_header->eh_entries));
-        if(ext4_extent_header->eh_magic != EXT4_EXT_MAGIC)
-            return FSW_VOLUME_CORRUPTED;
+    buffer_bno = 0;
+    ext4_extent_header = (struct ext4_extent_header *)buffer;
+    if (!fsw_ext4_extent_header_valid(ext4_extent_header, sizeof(dno->raw->i_block)))
+        return FSW_VOLUME_CORRUPTED;
+    depth = ext4_extent_header->eh_depth;
+
+    range_start = 0;
+    range_end = (fsw_u64)1 << 32;
+    while (ext4_extent_header->eh_depth > 0) {
+        FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_emap_load: index node with %d entries, depth %d\n"),
+                      ext4_extent_header->eh_entries, ext4_extent_header->eh_depth));
+        if (ext4_extent_header->eh_entries == 0) {
+            status = FSW_VOLUME_CORRUPTED;
+            goto errorexit;
+        }
 
-        for(ext_cnt = 0;ext_cnt < ext4_extent_header->eh_entries;ext_cnt++)
-        {
-            if(ext4_extent_header->eh_depth == 0)
-            {
-                // Leaf node, the header follows actual extents
-                ext4_extent = (struct ext4_extent *)((char *)buffer + buf_offset);
-                buf_offset += sizeof (struct ext4_extent);
-                FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_get_by_extent: extent node cover %d...\n"), ext4_extent->ee_block));
-
-                // Is the requested block in this extent?
-                if(bno >= ext4_extent->ee_block && bno < ext4_extent->ee_block + ext4_extent->ee_len)
-                {
-                    extent->phys_start = ((fsw_u64)ext4_extent->ee_start_hi << 32) | ext4_extent->ee_start_lo;
-                    extent->phys_start += (bno - ext4_extent->ee_block);
-                    extent->log_count = ext4_extent->ee_len - (bno - ext4_extent->ee_block);
-                    return FSW_SUCCESS;
-                }
-            }
+        // binary search for the last index entry starting at or before bno
+        ext4_extent_idx = (struct ext4_extent_idx *)(ext4_extent_header + 1);
+        lo = 1;
+        hi = ext4_extent_header->eh_entries;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (ext4_extent_idx[mid].ei_block <= bno)
+                lo = mid + 1;
             else
-            {
-                FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_get_by_extent: index extents, depth %d\n"),
-                          ext4_extent_header->eh_depth));
-                ext4_extent_idx = (struct ext4_extent_idx *)((char *)buffer + buf_offset);
-                buf_offset += sizeof (struct ext4_extent_idx);
-
-                FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_get_by_extent: index node covers block %d...\n"),
-                          ext4_extent_idx->ei_block));
-                if(bno >= ext4_extent_idx->ei_block)
-                {
-                    // Follow extent tree...
-                    fsw_u64 phys_bno = ((fsw_u64)ext4_extent_idx->ei_leaf_hi << 32) | ext4_extent_idx->ei_leaf_lo;
-                    status = fsw_block_get(vol, phys_bno, 1, (void **) &buffer);
-                    if (status)
-                        return status;
-                    buf_offset = 0;
-                    break;
-                }
-            }
+                hi = mid;
+        }
+        ext4_extent_idx += lo - 1;
+
+        // narrow the logical range covered by the subtree; a hole in front of
+        // the first entry belongs to the first subtree
+        if (lo > 1 && ext4_extent_idx->ei_block > range_start)
+            range_start = ext4_extent_idx->ei_block;
+        if (lo < ext4_extent_header->eh_entries && ext4_extent_idx[1].ei_block < range_end)
+            range_end = ext4_extent_idx[1].ei_block;
+        child_bno = ((fsw_u64)ext4_extent_idx->ei_leaf_hi << 32) | ext4_extent_idx->ei_leaf_lo;
+
+        // Follow extent tree...
+        if (buffer_bno)
+            fsw_block_release(vol, buffer_bno, buffer);
+        buffer_bno = 0;
+        status = fsw_block_get(vol, child_bno, 1, (void **) &buffer);
+        if (status)
+            return status;
+        buffer_bno = child_bno;
+
+        ext4_extent_header = (struct ext4_extent_header *)buffer;
+        if (!fsw_ext4_extent_header_valid(ext4_extent_header, vol->g.log_blocksize) ||
+            ext4_extent_header->eh_depth != --depth) {
+            status = FSW_VOLUME_CORRUPTED;
+            goto errorexit;
         }
     }
 
-    return FSW_NOT_FOUND;
+    FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_emap_load: leaf with %d extents covers blocks %d...\n"),
+                  ext4_extent_header->eh_entries, range_start));
+    status = fsw_ext4_emap_add_leaf(dno, ext4_extent_header, range_start, range_end);
+
+errorexit:
+    if (buffer_bno)
+        fsw_block_release(vol, buffer_bno, buffer);
+    return status;
+}
+
+/**
+ * New ext4 extents... Extents are served from the dnode's extent map, which is
+ * filled one leaf at a time, so each leaf of the tree is read only once while
+ * the dnode stays alive.
+ */
+
+static fsw_status_t fsw_ext4_get_by_extent(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
+                                        struct fsw_extent *extent)
+{
+    fsw_status_t  status;
+    fsw_u32       bno, offset;
+    struct fsw_ext4_extent_run *run;
+
+    // Logical block requested by core...
+    bno = extent->log_start;
+
+    run = fsw_ext4_emap_find(dno, bno);
+    if (run == NULL) {
+        status = fsw_ext4_emap_load(vol, dno, bno);
+        if (status)
+            return status;
+        run = fsw_ext4_emap_find(dno, bno);
+        if (run == NULL)
+            return FSW_VOLUME_CORRUPTED;
+    }
+
+    offset = bno - run->log_start;
+    extent->log_count = run->log_count - offset;
+    if (run->phys_start == 0) {
+        // hole or uninitialized extent
+        extent->type = FSW_EXTENT_TYPE_SPARSE;
+    } else {
+        extent->phys_start = run->phys_start + offset;
+    }
+    return FSW_SUCCESS;
 }
 
 /**
@@ -569,6 +808,9 @@ static fsw_status_t fsw_ext4_get_by_blkaddr(struct fsw_ext4_volume *vol, struct
  * to retrieve the directory entry with the given name. A dnode is constructed for
  * this entry and returned. The core makes sure that fsw_ext4_dnode_fill has been called
  * and the dnode is actually a directory.
+ *
+ * Hash-indexed directories are searched through their HTree index. Other directories,
+ * and those whose index cannot be used, are scanned linearly.
  */
 
 static fsw_status_t fsw_ext4_dir_lookup(struct fsw_ext4_volume *vol, struct fsw_ext4_dnode *dno,
@@ -576,7 +818,7 @@ static fsw_status_t fsw_ext4_dir_lookup(struct fsw_ext4_volume *vol, struct fsw_
 {
     fsw_status_t    status;
     struct fsw_shandle shand;
-    fsw_u32         child_ino;
+    fsw_u32         child_ino = 0;
     struct ext4_dir_entry entry;
     struct fsw_string entry_name;
 
@@ -589,6 +831,20 @@ static fsw_status_t fsw_ext4_dir_lookup(struct fsw_ext4_volume *vol, struct fsw_
     if (status)
         return status;
 
+    // use the hash index if the directory has one
+    if ((dno->raw->i_flags & EXT4_INDEX_FL) && dno->g.size > vol->g.log_blocksize) {
+        status = fsw_htree_lookup(&shand, vol->g.log_blocksize, vol->sb->s_hash_seed, vol->sb->s_flags,
+                                  (vol->sb->s_feature_incompat & EXT4_FEATURE_INCOMPAT_LARGEDIR) ? 3 : 2, lookup_name, &child_ino);
+        if (status == FSW_SUCCESS) {
+            status = fsw_dnode_create(dno, child_ino, FSW_DNODE_TYPE_UNKNOWN, lookup_name, child_dno_out);
+            goto errorexit;
+        }
+        if (status != FSW_UNSUPPORTED)
+            goto errorexit;
+        FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ext4_dir_lookup: unusable hash index, scanning directory\n")));
+        shand.pos = 0;
+    }
+
     // scan the directory for the file
     child_ino = 0;
     while (child_ino == 0) {
@@ -52,6 +52,18 @@ struct fsw_ext4_volume {
     fsw_u32     inode_size;         //!< Size of inode structure in bytes
 };
 
+/**
+ * ext4: One run of the extent map kept per dnode. Each leaf of the extent tree
+ * is decoded into runs covering its whole logical range, with holes and
+ * uninitialized extents stored as runs with phys_start 0.
+ */
+
+struct fsw_ext4_extent_run {
+    fsw_u32     log_start;          //!< First logical block of the run
+    fsw_u32     log_count;          //!< Number of logical blocks in the run
+    fsw_u64     phys_start;         //!< First physical block, or 0 if the run reads as zeroes
+};
+
 /**
  * ext2: Dnode structure with ext2-specific data.
  */
@@ -60,6 +72,8 @@ struct fsw_ext4_dnode {
     struct fsw_dnode g;             //!< Generic dnode structure
     
     struct ext4_inode *raw;         //!< Full raw inode structure
+    struct fsw_ext4_extent_run *emap; //!< Decoded extent runs sorted by log_start, filled in as leaves are read
+    fsw_u32     emap_count;         //!< Number of valid entries in emap
 };
 
 
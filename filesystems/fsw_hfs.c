@@ -30,6 +30,7 @@
  */
 
 #include "fsw_hfs.h"
+#include "fsw_codec.h"
 
 #ifdef HOST_POSIX
 #define DPRINT(x) printf(x)
@@ -42,6 +43,15 @@
 #define BP(msg) DPRINT(msg)
 #endif
 
+/* Compressed files: zlib streams go through gzio.c, as in the btrfs driver,
+   both it and lzvn.c through the decompressor registry */
+#define uint8_t fsw_u8
+#define grub_off_t fsw_s32
+#define grub_size_t fsw_s32
+#define grub_ssize_t fsw_s32
+#include "gzio.c"
+#include "lzvn.c"
+
 // functions
 #if 0
 void dump_str(fsw_u16* p, fsw_u32 len, int swap)
@@ -64,6 +74,10 @@ static fsw_status_t fsw_hfs_dnode_fill(struct fsw_hfs_volume *vol, struct fsw_hf
 static void         fsw_hfs_dnode_free(struct fsw_hfs_volume *vol, struct fsw_hfs_dnode *dno);
 static fsw_status_t fsw_hfs_dnode_stat(struct fsw_hfs_volume *vol, struct fsw_hfs_dnode *dno,
                                            struct fsw_dnode_stat *sb);
+static fsw_status_t fsw_hfs_fork_block(struct fsw_hfs_volume *vol, struct fsw_hfs_dnode *dno,
+                                       fsw_u8 fork_type, fsw_u32 lbno, fsw_u32 *phys_bno);
+static fsw_status_t fsw_hfs_decmpfs_open(struct fsw_hfs_volume *vol, struct fsw_hfs_dnode *dno);
+static void         fsw_hfs_decmpfs_free(struct fsw_hfs_decmpfs *dc);
 static fsw_status_t fsw_hfs_get_extent(struct fsw_hfs_volume *vol, struct fsw_hfs_dnode *dno,
                                            struct fsw_extent *extent);
 
@@ -130,22 +144,19 @@ static fsw_u16 fsw_to_lower(fsw_u16 ch)
 
 static fsw_s32
 fsw_hfs_read_block (struct fsw_hfs_dnode    * dno,
+                    fsw_u8                    fork_type,
                     fsw_u32                   log_bno,
                     fsw_u32                   off,
                     fsw_s32                   len,
                     fsw_u8                  * buf)
 {
     fsw_status_t          status;
-    struct fsw_extent     extent;
     fsw_u32               phys_bno;
     fsw_u8*                 buffer;
 
-    extent.log_start = log_bno;
-    status = fsw_hfs_get_extent(dno->g.vol, dno, &extent);
+    status = fsw_hfs_fork_block(dno->g.vol, dno, fork_type, log_bno, &phys_bno);
     if (status)
         return status;
-
-    phys_bno = extent.phys_start;
   //Slice - increase cache level from 0 to 3
     status = fsw_block_get(dno->g.vol, phys_bno, 3, (void **) &buffer);
     if (status)
@@ -159,9 +170,10 @@ fsw_hfs_read_block (struct fsw_hfs_dnode    * dno,
 
 }
 
-/* Read data from HFS file. */
+/* Read data from the data fork (fork_type 0) or resource fork (0xFF) of HFS file. */
 static fsw_s32
-fsw_hfs_read_file (struct fsw_hfs_dnode    * dno,
+fsw_hfs_read_fork (struct fsw_hfs_dnode    * dno,
+                   fsw_u8                    fork_type,
                    fsw_u64                   pos,
                    fsw_s32                   len,
                    fsw_u8                  * buf)
@@ -181,11 +193,11 @@ fsw_hfs_read_file (struct fsw_hfs_dnode    * dno,
 
         log_bno = (fsw_u32)RShiftU64(pos, block_size_bits);
 
-        if ((fsw_u32)next_len > block_size) {
-            next_len = block_size;
+        if ((fsw_u32)next_len > block_size - off) {
+            next_len = block_size - off;
         }
 
-        status = fsw_hfs_read_block(dno, log_bno, off, next_len, buf);
+        status = fsw_hfs_read_block(dno, fork_type, log_bno, off, next_len, buf);
         if (status) {
             return -1;
         }
@@ -199,6 +211,16 @@ fsw_hfs_read_file (struct fsw_hfs_dnode    * dno,
     return read;
 }
 
+/* Read data from HFS file. */
+static fsw_s32
+fsw_hfs_read_file (struct fsw_hfs_dnode    * dno,
+                   fsw_u64                   pos,
+                   fsw_s32                   len,
+                   fsw_u8                  * buf)
+{
+    return fsw_hfs_read_fork(dno, 0, pos, len, buf);
+}
+
 
 static fsw_s32
 fsw_hfs_compute_shift(fsw_u32 size)
@@ -254,6 +276,12 @@ HFSGetDescription(CICell ih, char *str, long strMaxLen)
 */
 
 
+/* B-tree node sizes are powers of two from 512 to 32768 bytes */
+static int fsw_hfs_node_size_valid(fsw_u32 node_size)
+{
+    return node_size >= 512 && node_size <= 32768 && (node_size & (node_size - 1)) == 0;
+}
+
 static fsw_status_t fsw_hfs_volume_mount(struct fsw_hfs_volume *vol)
 {
     fsw_status_t              status, rv;
@@ -269,6 +297,8 @@ static fsw_status_t fsw_hfs_volume_mount(struct fsw_hfs_volume *vol)
     rv = FSW_UNSUPPORTED;
 
     vol->primary_voldesc = NULL;
+    fsw_codec_register(&fsw_codec_zlib);
+    fsw_codec_register(&fsw_codec_lzvn);
     fsw_set_blocksize(vol, HFS_BLOCKSIZE, HFS_BLOCKSIZE);
     blockno = HFS_SUPERBLOCK_BLOCKNO;
 
@@ -425,6 +455,40 @@ static fsw_status_t fsw_hfs_volume_mount(struct fsw_hfs_volume *vol)
         vol->extents_tree.root_node = be32_to_cpu (tree_header.rootNode);
         vol->extents_tree.node_size = be16_to_cpu (tree_header.nodeSize);
 
+        if (!fsw_hfs_node_size_valid (vol->catalog_tree.node_size)
+            || !fsw_hfs_node_size_valid (vol->extents_tree.node_size))
+        {
+            rv = FSW_VOLUME_CORRUPTED;
+            break;
+        }
+
+        /* Attributes file, only needed for compressed files */
+        vol->attributes_tree.file = NULL;
+        if (vol->primary_voldesc->attributesFile.logicalSize != 0)
+        {
+            struct fsw_hfs_dnode *attributes;
+
+            status = fsw_dnode_create_root(vol, kHFSAttributesFileID, &attributes);
+            CHECK(status);
+            fsw_memcpy (attributes->extents,
+                        vol->primary_voldesc->attributesFile.extents,
+                        sizeof attributes->extents);
+            attributes->g.size =
+                    be64_to_cpu(vol->primary_voldesc->attributesFile.logicalSize);
+
+            r = fsw_hfs_read_file(attributes,
+                                  sizeof (BTNodeDescriptor),
+                                  sizeof (BTHeaderRec), (fsw_u8 *) &tree_header);
+            if (r > 0 && fsw_hfs_node_size_valid (be16_to_cpu (tree_header.nodeSize)))
+            {
+                vol->attributes_tree.root_node = be32_to_cpu (tree_header.rootNode);
+                vol->attributes_tree.node_size = be16_to_cpu (tree_header.nodeSize);
+                vol->attributes_tree.file = attributes;
+            }
+            else
+                fsw_dnode_release((struct fsw_dnode *) attributes);
+        }
+
         rv = FSW_SUCCESS;
     } while (rv != FSW_SUCCESS);
 
@@ -487,6 +551,43 @@ str[strMaxLen] = '\0';
 
 static void fsw_hfs_volume_free(struct fsw_hfs_volume *vol)
 {
+    fsw_u32 i;
+
+    FSW_MSG_DEBUG((FSW_MSGSTR("fsw_hfs_volume_free: node cache hits %d misses %d\n"),
+                   vol->node_cache_hits, vol->node_cache_misses));
+    if (vol->decmpfs_cache)
+    {
+        FSW_MSG_DEBUG((FSW_MSGSTR("fsw_hfs_volume_free: decmpfs cache hits %d misses %d, %d KiB decoded\n"),
+                       vol->decmpfs_cache_hits, vol->decmpfs_cache_misses, (int)(vol->decmpfs_bytes >> 10)));
+        for (i = 0; i < HFS_DECMPFS_CACHE_SIZE; i++)
+            if (vol->decmpfs_cache[i].buffer)
+                fsw_free(vol->decmpfs_cache[i].buffer);
+        fsw_free(vol->decmpfs_cache);
+        vol->decmpfs_cache = NULL;
+    }
+    if (vol->node_cache)
+    {
+        for (i = 0; i < HFS_NODE_CACHE_SIZE; i++)
+            if (vol->node_cache[i].buffer)
+                fsw_free(vol->node_cache[i].buffer);
+        fsw_free(vol->node_cache);
+        vol->node_cache = NULL;
+    }
+    if (vol->attributes_tree.file)
+    {
+        fsw_dnode_release((struct fsw_dnode *) vol->attributes_tree.file);
+        vol->attributes_tree.file = NULL;
+    }
+    if (vol->extents_tree.file)
+    {
+        fsw_dnode_release((struct fsw_dnode *) vol->extents_tree.file);
+        vol->extents_tree.file = NULL;
+    }
+    if (vol->catalog_tree.file)
+    {
+        fsw_dnode_release((struct fsw_dnode *) vol->catalog_tree.file);
+        vol->catalog_tree.file = NULL;
+    }
     if (vol->primary_voldesc)
     {
         fsw_free(vol->primary_voldesc);
@@ -517,7 +618,22 @@ fsw_status_t fsw_hfs_volume_stat (
 
 static fsw_status_t fsw_hfs_dnode_fill(struct fsw_hfs_volume *vol, struct fsw_hfs_dnode *dno)
 {
-    return FSW_SUCCESS;
+    fsw_status_t status = FSW_SUCCESS;
+
+    /* Compressed files get their real size from the decmpfs attribute. Files
+     * compressed in ways we cannot decode (e.g. LZFSE) can still be listed;
+     * fsw_hfs_get_extent fails for them. The attribute is only looked up once,
+     * whether or not it could be used. */
+    if (dno->compressed && dno->decmpfs == NULL && !dno->decmpfs_failed)
+    {
+        status = fsw_hfs_decmpfs_open(vol, dno);
+        if (status)
+            dno->decmpfs_failed = 1;
+        if (status == FSW_UNSUPPORTED)
+            status = FSW_SUCCESS;
+    }
+
+    return status;
 }
 
 /**
@@ -531,7 +647,11 @@ void fsw_hfs_dnode_free (
     struct fsw_hfs_volume *vol,
     struct fsw_hfs_dnode  *dno
 ) {
-    return;
+    if (dno->decmpfs)
+    {
+        fsw_hfs_decmpfs_free(dno->decmpfs);
+        dno->decmpfs = NULL;
+    }
 }
 
 static fsw_u32 mac_to_posix(fsw_u32 mac_time)
@@ -611,156 +731,261 @@ fsw_hfs_btree_rec (struct fsw_hfs_btree   * btree,
   return (BTreeKey *) (cnode + offset);
 }
 
+/* Child node number stored after the key of an index record */
+static fsw_u32
+fsw_hfs_btree_child (BTreeKey * key)
+{
+  fsw_u32 child;
 
+  /* odd key lengths leave it unaligned */
+  fsw_memcpy (&child, (fsw_u8 *) key + be16_to_cpu (key->length16) + 2, sizeof (child));
+  return be32_to_cpu (child);
+}
+
+/*
+ * Check the record offset table of a node read from disk, so that the
+ * records and the keys of leaf and index nodes can be used without further
+ * bounds checks.
+ */
+static int
+fsw_hfs_btree_node_valid (struct fsw_hfs_btree * btree,
+                          BTNodeDescriptor     * node)
+{
+    fsw_u32 count = be16_to_cpu (node->numRecords);
+    fsw_u32 end, i;
+
+    if (sizeof (BTNodeDescriptor) + 2 * (count + 1) > btree->node_size)
+        return 0;
+    if (node->kind != kBTLeafNode && node->kind != kBTIndexNode)
+        return 1;
+
+    end = btree->node_size - 2 * (count + 1);
+    /* coverity[tainted_data: SUPPRESS] */
+    for (i = 0; i < count; i++)
+    {
+        fsw_u32 offset = fsw_hfs_btree_recoffset (btree, node, i);
+        fsw_u32 next = fsw_hfs_btree_recoffset (btree, node, i + 1);
+        fsw_u32 used;
+
+        if (offset < sizeof (BTNodeDescriptor) || next > end || offset + 2 > next)
+            return 0;
+        used = 2 + be16_to_cpu (fsw_hfs_btree_rec (btree, node, i)->length16);
+        if (node->kind == kBTIndexNode)
+            used += 4;
+        if (offset + used > next)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Get node number nodenum of a B-tree from the volume's node cache, reading
+ * it on a miss. The node stays valid until the next call.
+ */
 static fsw_status_t
-fsw_hfs_btree_search (struct fsw_hfs_btree * btree,
-                      BTreeKey             * key,
-                      int (*compare_keys) (BTreeKey* key1, BTreeKey* key2),
-                      BTNodeDescriptor    ** result,
-                      fsw_u32              * key_offset)
+fsw_hfs_btree_get_node (struct fsw_hfs_btree  * btree,
+                        fsw_u32                 nodenum,
+                        BTNodeDescriptor     ** node_out)
 {
-    BTNodeDescriptor* node;
-    fsw_u32 currnode;
-    fsw_u32 rec;
-    fsw_status_t status;
-    fsw_u8* buffer = NULL;
+    struct fsw_hfs_volume     * vol = (struct fsw_hfs_volume *) btree->file->g.vol;
+    struct fsw_hfs_node_cache * nc;
+    struct fsw_hfs_node_cache * victim = NULL;
+    fsw_status_t                status;
+    fsw_u8                    * buffer;
+    fsw_u32                     i;
+
+    if (vol->node_cache == NULL)
+    {
+        status = fsw_alloc_zero (sizeof (struct fsw_hfs_node_cache) * HFS_NODE_CACHE_SIZE,
+                                 (void **) &vol->node_cache);
+        if (status)
+            return status;
+    }
 
-    currnode = btree->root_node;
-    status = fsw_alloc(btree->node_size, &buffer);
+    for (i = 0; i < HFS_NODE_CACHE_SIZE; i++)
+    {
+        nc = &vol->node_cache[i];
+        if (nc->buffer && nc->btree == btree && nc->node == nodenum)
+        {
+            vol->node_cache_hits++;
+            nc->lastuse = ++vol->node_cache_tick;
+            *node_out = (BTNodeDescriptor *) nc->buffer;
+            return FSW_SUCCESS;
+        }
+    }
+    vol->node_cache_misses++;
+
+    /* Reading a catalog node may search the extents tree, so only pick the
+     * victim once the node is in its own buffer. */
+    status = fsw_alloc (btree->node_size, &buffer);
     if (status)
         return status;
-    node = (BTNodeDescriptor*)buffer;
+    if (fsw_hfs_read_file (btree->file,
+                           (fsw_u64) nodenum * btree->node_size,
+                           btree->node_size, buffer) <= 0
+        || !fsw_hfs_btree_node_valid (btree, (BTNodeDescriptor *) buffer))
+    {
+        fsw_free (buffer);
+        return FSW_VOLUME_CORRUPTED;
+    }
 
-    while (1)
+    for (i = 0; i < HFS_NODE_CACHE_SIZE; i++)
     {
-        int cmp = 0;
-        int match;
-        fsw_u32 count;
+        nc = &vol->node_cache[i];
+        if (victim == NULL || (victim->buffer && (!nc->buffer || nc->lastuse < victim->lastuse)))
+            victim = nc;
+    }
+    if (victim->buffer)
+        fsw_free (victim->buffer);
+    victim->btree = btree;
+    victim->node = nodenum;
+    victim->buffer = buffer;
+    victim->lastuse = ++vol->node_cache_tick;
+
+    *node_out = (BTNodeDescriptor *) buffer;
+    return FSW_SUCCESS;
+}
 
-    readnode:
-        match = 0;
-        /* Read a node.  */
-        if (fsw_hfs_read_file (btree->file,
-                               (fsw_u64)currnode * btree->node_size,
-                               btree->node_size, buffer) <= 0)
-        {
-            status = FSW_VOLUME_CORRUPTED;
+/*
+ * Get the record at a cursor. A cursor past the last record of its node
+ * moves on to the first record of the next leaf; FSW_NOT_FOUND is returned
+ * at the end of the tree. If len is not NULL, it receives the size of the
+ * record including its key.
+ */
+static fsw_status_t
+fsw_hfs_cursor_get (struct fsw_hfs_btree  * btree,
+                    struct fsw_hfs_cursor * cursor,
+                    BTreeKey             ** key,
+                    fsw_u32               * len)
+{
+    BTNodeDescriptor * node;
+    fsw_status_t       status;
+
+    while (1)
+    {
+        status = fsw_hfs_btree_get_node (btree, cursor->node, &node);
+        if (status)
+            return status;
+        if (cursor->rec < be16_to_cpu (node->numRecords))
             break;
-        }
+        if (!node->fLink)
+            return FSW_NOT_FOUND;
+        cursor->node = be32_to_cpu (node->fLink);
+        cursor->rec = 0;
+    }
 
-        if (be16_to_cpu(*(fsw_u16*)(buffer + btree->node_size - 2)) != sizeof (BTNodeDescriptor))
-            BP("corrupted node\n");
+    *key = fsw_hfs_btree_rec (btree, node, cursor->rec);
+    if (len)
+        *len = fsw_hfs_btree_recoffset (btree, node, cursor->rec + 1)
+               - fsw_hfs_btree_recoffset (btree, node, cursor->rec);
+    return FSW_SUCCESS;
+}
 
-        count = be16_to_cpu (node->numRecords);
+/* Move a cursor to the next record, following fLink across leaves */
+static fsw_status_t
+fsw_hfs_cursor_next (struct fsw_hfs_btree  * btree,
+                     struct fsw_hfs_cursor * cursor,
+                     BTreeKey             ** key)
+{
+    cursor->rec++;
+    return fsw_hfs_cursor_get (btree, cursor, key, NULL);
+}
 
-#if 1
-        /* coverity[tainted_data: SUPPRESS] */
-        for (rec = 0; rec < count; rec++)
-        {
-             BTreeKey *currkey;
-
-             currkey = fsw_hfs_btree_rec (btree, node, rec);
-             cmp = compare_keys (currkey, key);
-             //fprintf(stderr, "rec=%d cmp=%d kind=%d \n", rec, cmp, node->kind);
-
-             /* Leaf node. */
-             if (node->kind == kBTLeafNode)
-             {
-               if (cmp == 0)
-               {
-                 /* Found!  */
-                 *result = node;
-                 *key_offset = rec;
-
-                 status = FSW_SUCCESS;
-                 goto done;
-               }
-             }
-             else if (node->kind == kBTIndexNode)
-             {
-                 fsw_u32 *pointer;
-
-                 if (cmp > 0)
-                     break;
-
-                 pointer = (fsw_u32 *) ((char *) currkey
-                                        + be16_to_cpu (currkey->length16)
-                                        + 2);
-                 currnode = be32_to_cpu (*pointer);
-                 match = 1;
-             }
-        }
+/*
+ * Binary search over the records of a node. Returns the index of the last
+ * record with a key not above key, or -1 if all keys are above it; *equal
+ * tells whether that record matches key exactly.
+ */
+static int
+fsw_hfs_btree_node_search (struct fsw_hfs_btree * btree,
+                           BTNodeDescriptor     * node,
+                           BTreeKey             * key,
+                           int (*compare_keys) (BTreeKey* key1, BTreeKey* key2),
+                           int                  * equal)
+{
+    int lower = 0;
+    int upper = (int) be16_to_cpu (node->numRecords) - 1;
+    int found = -1;
+
+    *equal = 0;
+    while (lower <= upper)
+    {
+        int index = lower + (upper - lower) / 2;
+        int cmp = compare_keys (fsw_hfs_btree_rec (btree, node, index), key);
 
-        if (node->kind == kBTLeafNode && cmp < 0 && node->fLink)
+        if (cmp == 0)
         {
-            currnode = be32_to_cpu(node->fLink);
-            goto readnode;
+            *equal = 1;
+            return index;
         }
-        else if (!match)
+        if (cmp < 0)
         {
-            status = FSW_NOT_FOUND;
-            break;
+            found = index;
+            lower = index + 1;
         }
-#else
-         /* Perform binary search */
-         fsw_u32 lower = 0;
-         fsw_u32 upper = count - 1;
-         fsw_s32 cmp = -1;
-         BTreeKey *currkey = NULL;
-
-         if (count == 0)
-         {
-             status = FSW_NOT_FOUND;
-             goto done;
-         }
-
-         while (lower <= upper)
-         {
-             fsw_u32 index = (lower + upper) / 2;
-
-             currkey = fsw_hfs_btree_rec (btree, node, index);
-
-             cmp = compare_keys (currkey, key);
-             if (cmp < 0)  upper = index - 1;
-             if (cmp > 0)  lower = index + 1;
-             if (cmp == 0)
-             {
-                 /* Found!  */
-                 *result = node;
-                 *key_offset = rec;
-
-                 status = FSW_SUCCESS;
-                 goto done;
-             }
-         }
-
-         if (cmp < 0)
-             currkey = fsw_hfs_btree_rec (btree, node, upper);
-
-         if (node->kind == kBTIndexNode && currkey)
-         {
-             fsw_u32 *pointer;
-
-             pointer = (fsw_u32 *) ((char *) currkey
-                                    + be16_to_cpu (currkey->length16)
-                                    + 2);
-             currnode = be32_to_cpu (*pointer);
-         }
-         else
-         {
-             status = FSW_NOT_FOUND;
-             break;
-         }
-#endif
+        else
+            upper = index - 1;
     }
+    return found;
+}
 
+/* Upper bound on the nodes visited by one search, to stop on loops */
+#define HFS_MAX_SEARCH_NODES 64
 
-  done:
-    if (buffer != NULL && status != FSW_SUCCESS)
-        fsw_free(buffer);
+static fsw_status_t
+fsw_hfs_btree_search (struct fsw_hfs_btree  * btree,
+                      BTreeKey              * key,
+                      int (*compare_keys) (BTreeKey* key1, BTreeKey* key2),
+                      struct fsw_hfs_cursor * cursor)
+{
+    BTNodeDescriptor* node;
+    fsw_u32 currnode;
+    fsw_status_t status;
+    int visited;
 
-    return status;
+    currnode = btree->root_node;
+
+    for (visited = 0; visited < HFS_MAX_SEARCH_NODES; visited++)
+    {
+        fsw_u32 count;
+        int rec, equal;
+
+        status = fsw_hfs_btree_get_node (btree, currnode, &node);
+        if (status)
+            return status;
+
+        count = be16_to_cpu (node->numRecords);
+        rec = fsw_hfs_btree_node_search (btree, node, key, compare_keys, &equal);
+
+        if (node->kind == kBTLeafNode)
+        {
+            if (equal)
+            {
+                cursor->node = currnode;
+                cursor->rec = rec;
+                return FSW_SUCCESS;
+            }
+            /* All keys below the wanted one, it may start the next leaf */
+            if (count > 0 && rec == (int) count - 1 && node->fLink)
+            {
+                currnode = be32_to_cpu (node->fLink);
+                continue;
+            }
+            return FSW_NOT_FOUND;
+        }
+        else if (node->kind == kBTIndexNode)
+        {
+            if (rec < 0)
+                return FSW_NOT_FOUND;
+            currnode = fsw_hfs_btree_child (fsw_hfs_btree_rec (btree, node, rec));
+        }
+        else
+            return FSW_VOLUME_CORRUPTED;
+    }
+
+    return FSW_VOLUME_CORRUPTED;
 }
+
 typedef struct
 {
     fsw_u32                 id;
@@ -771,6 +996,10 @@ typedef struct
     fsw_u32                 ctime;
     fsw_u32                 mtime;
     HFSPlusExtentRecord     extents;
+    int                     compressed;
+    fsw_u64                 rsrc_size;
+    fsw_u64                 rsrc_used;
+    HFSPlusExtentRecord     rsrc_extents;
 } file_info_t;
 
 typedef struct
@@ -831,6 +1060,11 @@ int fsw_hfs_btree_visit_node (
             vp->file_info.mtime = be32_to_cpu(file_info->contentModDate);
             fsw_memcpy(&vp->file_info.extents, &file_info->dataFork.extents,
                        sizeof vp->file_info.extents);
+            vp->file_info.compressed = (file_info->bsdInfo.ownerFlags & HFS_UF_COMPRESSED) != 0;
+            vp->file_info.rsrc_size = be64_to_cpu(file_info->resourceFork.logicalSize);
+            vp->file_info.rsrc_used = ((fsw_u64)be32_to_cpu(file_info->resourceFork.totalBlocks)) << vp->vol->block_size_shift;
+            fsw_memcpy(&vp->file_info.rsrc_extents, &file_info->resourceFork.extents,
+                       sizeof vp->file_info.rsrc_extents);
             break;
         }
         case kHFSPlusFolderThreadRecord:
@@ -863,65 +1097,27 @@ int fsw_hfs_btree_visit_node (
 }
 
 static fsw_status_t
-fsw_hfs_btree_iterate_node (struct fsw_hfs_btree * btree,
-                            BTNodeDescriptor     * first_node,
-                            fsw_u32                first_rec,
+fsw_hfs_btree_iterate_node (struct fsw_hfs_btree  * btree,
+                            struct fsw_hfs_cursor * cursor,
                             int                    (*callback) (BTreeKey *record, void* param),
                             void                  * param)
 {
   fsw_status_t status;
-  /* We modify node, so make a copy */
-  BTNodeDescriptor * node   = first_node;
-  fsw_u8           * buffer = NULL;
-
-  status = fsw_alloc(btree->node_size, &buffer);
-  if (status)
-      return status;
+  BTreeKey   * record;
 
-  while (1)
+  status = fsw_hfs_cursor_get (btree, cursor, &record, NULL);
+  while (status == FSW_SUCCESS)
   {
-      fsw_u32 i;
-      fsw_u32 count =  be16_to_cpu(node->numRecords);
-      fsw_u32 next_node;
-
-      /* coverity[tainted_data: SUPPRESS] */
-      for (i = first_rec; i < count; i++) { // Iterate over all records in this node
-          int rv = callback(fsw_hfs_btree_rec (btree, node, i), param);
-
-          switch (rv)
-          {
-              case 1:
-                  status = FSW_SUCCESS;
-                  goto done;
-              case -1:
-                  status = FSW_NOT_FOUND;
-                  goto done;
-          }
-          /* if callback returned 0 - continue */
-      }
-
-      next_node = be32_to_cpu(node->fLink);
-
-      if (!next_node)
+      switch (callback (record, param))
       {
-          status = FSW_NOT_FOUND;
-          break;
+          case 1:
+              return FSW_SUCCESS;
+          case -1:
+              return FSW_NOT_FOUND;
       }
-
-      if (fsw_hfs_read_file (btree->file,
-                             (fsw_u64) (next_node) * btree->node_size,
-                             btree->node_size, buffer) <= 0)
-      {
-          status = FSW_VOLUME_CORRUPTED;
-          goto done;
-      }
-
-      node = (BTNodeDescriptor*)buffer;
-      first_rec = 0;
+      /* if callback returned 0 - continue */
+      status = fsw_hfs_cursor_next (btree, cursor, &record);
   }
- done:
-  if (buffer)
-      fsw_free(buffer);
 
   return status;
 }
@@ -1057,69 +1253,609 @@ fsw_hfs_cmpi_catkey (BTreeKey *key1, BTreeKey *key2)
   }
 }
 
-/**
- * Retrieve file data mapping information. This function is called by the core when
- * fsw_shandle_read needs to know where on the disk the required piece of the file's
- * data can be found. The core makes sure that fsw_hfs_dnode_fill has been called
- * on the dnode before. Our task here is to get the physical disk block number for
- * the requested logical block number.
- */
+/* Attribute keys sort by file ID, then name (binary), then start block */
+static int
+fsw_hfs_cmp_attrkey (BTreeKey *key1, BTreeKey *key2)
+{
+  HFSPlusAttrKey *akey1 = (HFSPlusAttrKey*)key1;
+  HFSPlusAttrKey *akey2 = (HFSPlusAttrKey*)key2;
 
-static fsw_status_t fsw_hfs_get_extent(struct fsw_hfs_volume * vol,
+  fsw_u32  fileId1, start1;
+  fsw_u32  key1Len, keyLength, i;
+  fsw_u16  ac, bc;
+
+  /* First key is read from the FS data, second is in-memory in CPU endianess */
+  fileId1 = be32_to_cpu(akey1->fileID);
+
+  if (fileId1 > akey2->fileID)
+      return 1;
+  if (fileId1 < akey2->fileID)
+      return -1;
+
+  /* The name must lie within the key */
+  keyLength = be16_to_cpu(akey1->keyLength);
+  key1Len = be16_to_cpu(akey1->attrNameLen);
+  if (keyLength < 12)
+      key1Len = 0;
+  else if (key1Len > (keyLength - 12) / 2)
+      key1Len = (keyLength - 12) / 2;
+
+  for (i = 0; i < key1Len && i < akey2->attrNameLen; i++)
+  {
+    ac = be16_to_cpu(akey1->attrName[i]);
+    bc = akey2->attrName[i];
+    if (ac != bc)
+      return ac < bc ? -1 : 1;
+  }
+  if (key1Len != akey2->attrNameLen)
+      return key1Len < akey2->attrNameLen ? -1 : 1;
+
+  start1 = be32_to_cpu(akey1->startBlock);
+  if (start1 != akey2->startBlock)
+      return start1 < akey2->startBlock ? -1 : 1;
+  return 0;
+}
+
+/*
+ * Map logical block lbno of the data fork (fork_type 0) or the resource fork
+ * (0xFF) of a file to a physical block. Blocks past the eight extents in the
+ * catalog record are looked up in the extents overflow tree.
+ */
+static fsw_status_t fsw_hfs_fork_block(struct fsw_hfs_volume * vol,
                                        struct fsw_hfs_dnode  * dno,
-                                       struct fsw_extent     * extent)
+                                       fsw_u8                  fork_type,
+                                       fsw_u32                 lbno,
+                                       fsw_u32               * phys_out)
 {
     fsw_status_t         status = FSW_NOT_FOUND;
-    fsw_u32              lbno;
+    fsw_u32              left = lbno;
     HFSPlusExtentRecord  *exts;
-    BTNodeDescriptor     *node = NULL;
 
-    extent->type = FSW_EXTENT_TYPE_PHYSBLOCK;
-    extent->log_count = 1;
-    lbno = extent->log_start;
-
-    /* we only care about data forks atm, do we? */
-    exts = &dno->extents;
+    exts = fork_type ? &dno->rsrc_extents : &dno->extents;
 
     while (1)
     {
         struct HFSPlusExtentKey* key;
         struct HFSPlusExtentKey  overflowkey;
-        fsw_u32                  ptr;
+        struct fsw_hfs_cursor    cursor;
+        fsw_u32                  len;
         fsw_u32                  phys_bno;
 
-        if (fsw_hfs_find_block(exts, &lbno, &phys_bno))
+        if (fsw_hfs_find_block(exts, &left, &phys_bno))
         {
-            extent->phys_start = phys_bno + vol->emb_block_off;
+            *phys_out = phys_bno + vol->emb_block_off;
             status = FSW_SUCCESS;
             break;
         }
 
 
         /* Find appropriate overflow record */
+        overflowkey.forkType = fork_type;
+        overflowkey.pad = 0;
         overflowkey.fileID = dno->g.dnode_id;
-        overflowkey.startBlock = extent->log_start - lbno;
-
-        if (node != NULL)
-        {
-            fsw_free(node);
-            node = NULL;
-        }
+        overflowkey.startBlock = lbno - left;
 
         status = fsw_hfs_btree_search (&vol->extents_tree,
                                        (BTreeKey*) &overflowkey,
                                        fsw_hfs_cmp_extkey,
-                                       &node, &ptr);
+                                       &cursor);
         if (status)
             break;
 
-        key = (struct HFSPlusExtentKey *)
-                fsw_hfs_btree_rec (&vol->extents_tree, node, ptr);
+        status = fsw_hfs_cursor_get (&vol->extents_tree, &cursor,
+                                     (BTreeKey **) &key, &len);
+        if (status)
+            break;
+        if (len < sizeof (HFSPlusExtentKey) + sizeof (HFSPlusExtentRecord))
+        {
+            status = FSW_VOLUME_CORRUPTED;
+            break;
+        }
         exts = (HFSPlusExtentRecord*) (key + 1);
     }
 
-    if (node != NULL)
-        fsw_free(node);
+    return status;
+}
+
+/* Read len bytes at pos of the resource fork, which must lie inside it */
+static fsw_status_t
+fsw_hfs_read_rsrc (struct fsw_hfs_dnode * dno,
+                   fsw_u64                pos,
+                   fsw_u32                len,
+                   void                 * buf)
+{
+    if (pos > dno->rsrc_size || dno->rsrc_size - pos < len || len > 0x7fffffff)
+        return FSW_VOLUME_CORRUPTED;
+    if (len > 0 && fsw_hfs_read_fork(dno, 0xFF, pos, (fsw_s32) len, buf) != (fsw_s32) len)
+        return FSW_VOLUME_CORRUPTED;
+    return FSW_SUCCESS;
+}
+
+static void
+fsw_hfs_decmpfs_free (struct fsw_hfs_decmpfs * dc)
+{
+    if (dc->chunk_offset)
+        fsw_free(dc->chunk_offset);
+    if (dc->chunk_length)
+        fsw_free(dc->chunk_length);
+    if (dc->inline_data)
+        fsw_free(dc->inline_data);
+    fsw_free(dc);
+}
+
+/*
+ * Chunk table of a zlib compressed resource fork. The fork holds a single
+ * 'cmpf' resource: after the big endian resource fork header, the resource
+ * data starts with its length and a little endian table of (offset, length)
+ * pairs, offsets counting from the table.
+ */
+static fsw_status_t
+fsw_hfs_decmpfs_zlib_table (struct fsw_hfs_dnode   * dno,
+                            struct fsw_hfs_decmpfs * dc)
+{
+    fsw_status_t status;
+    fsw_u32      header[4];
+    fsw_u32      data_length, count, i;
+    fsw_u32    * table;
+    fsw_u64      base;
+
+    status = fsw_hfs_read_rsrc(dno, 0, sizeof header, header);
+    if (status)
+        return status;
+    base = be32_to_cpu(header[0]);
+    status = fsw_hfs_read_rsrc(dno, base, 4, &data_length);
+    if (status)
+        return status;
+    data_length = be32_to_cpu(data_length);
+    base += 4;
+    status = fsw_hfs_read_rsrc(dno, base, 4, &count);
+    if (status)
+        return status;
+    count = fsw_u32_le_swap(count);
+    if (count != dc->chunk_count || data_length < 4 + 8 * (fsw_u64) count)
+        return FSW_VOLUME_CORRUPTED;
+
+    status = fsw_alloc(count * 8, &table);
+    if (status)
+        return status;
+    status = fsw_hfs_read_rsrc(dno, base + 4, count * 8, table);
+    for (i = 0; status == FSW_SUCCESS && i < count; i++)
+    {
+        fsw_u32 offset = fsw_u32_le_swap(table[2 * i]);
+        fsw_u32 length = fsw_u32_le_swap(table[2 * i + 1]);
+
+        if (length == 0 || length > 2 * HFS_DECMPFS_CHUNK_SIZE
+            || offset > data_length || data_length - offset < length)
+            status = FSW_VOLUME_CORRUPTED;
+        dc->chunk_offset[i] = base + offset;
+        dc->chunk_length[i] = length;
+    }
+    fsw_free(table);
+    return status;
+}
+
+/*
+ * Chunk table of an LZVN compressed resource fork: little endian offsets of
+ * the chunks, followed by the end offset of the last one.
+ */
+static fsw_status_t
+fsw_hfs_decmpfs_lzvn_table (struct fsw_hfs_dnode   * dno,
+                            struct fsw_hfs_decmpfs * dc)
+{
+    fsw_status_t status;
+    fsw_u32      count = dc->chunk_count, i;
+    fsw_u32    * table;
+
+    status = fsw_alloc((count + 1) * 4, &table);
+    if (status)
+        return status;
+    status = fsw_hfs_read_rsrc(dno, 0, (count + 1) * 4, table);
+    if (status == FSW_SUCCESS && fsw_u32_le_swap(table[0]) != (count + 1) * 4)
+        status = FSW_VOLUME_CORRUPTED;
+    for (i = 0; status == FSW_SUCCESS && i < count; i++)
+    {
+        fsw_u32 offset = fsw_u32_le_swap(table[i]);
+        fsw_u32 end = fsw_u32_le_swap(table[i + 1]);
+
+        if (end <= offset || end - offset > 2 * HFS_DECMPFS_CHUNK_SIZE || end > dno->rsrc_size)
+            status = FSW_VOLUME_CORRUPTED;
+        dc->chunk_offset[i] = offset;
+        dc->chunk_length[i] = end - offset;
+    }
+    fsw_free(table);
+    return status;
+}
+
+/*
+ * Read the com.apple.decmpfs attribute of a compressed file and set up its
+ * chunk layout. Nothing is decoded here; fsw_hfs_decmpfs_get_extent decodes
+ * the chunks as they are read.
+ */
+static fsw_status_t
+fsw_hfs_decmpfs_open (struct fsw_hfs_volume * vol,
+                      struct fsw_hfs_dnode  * dno)
+{
+    static const char              name[] = "com.apple.decmpfs";
+    fsw_status_t                   status;
+    struct HFSPlusAttrKey          attrkey;
+    struct fsw_hfs_cursor          cursor;
+    struct fsw_hfs_decmpfs_header  header;
+    struct fsw_hfs_decmpfs       * dc;
+    BTreeKey                     * key;
+    HFSPlusAttrData              * attr;
+    fsw_u32                        len, size, i;
+
+    if (vol->attributes_tree.file == NULL)
+        return FSW_VOLUME_CORRUPTED;
+
+    attrkey.fileID = dno->g.dnode_id;
+    attrkey.startBlock = 0;
+    attrkey.attrNameLen = sizeof name - 1;
+    for (i = 0; i < sizeof name - 1; i++)
+        attrkey.attrName[i] = name[i];
+
+    status = fsw_hfs_btree_search (&vol->attributes_tree,
+                                   (BTreeKey*) &attrkey,
+                                   fsw_hfs_cmp_attrkey,
+                                   &cursor);
+    if (status == FSW_NOT_FOUND)
+        status = FSW_VOLUME_CORRUPTED;
+    if (status)
+        return status;
+    status = fsw_hfs_cursor_get (&vol->attributes_tree, &cursor, &key, &len);
+    if (status)
+        return status;
+
+    /* Only inline attributes; macOS moves large data to the resource fork */
+    i = be16_to_cpu(key->length16) + 2;
+    if (len < i + 16)
+        return FSW_VOLUME_CORRUPTED;
+    attr = (HFSPlusAttrData *) ((fsw_u8 *) key + i);
+    if (be32_to_cpu(attr->recordType) != kHFSPlusAttrInlineData)
+        return FSW_UNSUPPORTED;
+    size = be32_to_cpu(attr->attrSize);
+    if (size < sizeof header || size > len - i - 16)
+        return FSW_VOLUME_CORRUPTED;
+    fsw_memcpy(&header, attr->attrData, sizeof header);
+    if (fsw_u32_le_swap(header.magic) != HFS_DECMPFS_MAGIC)
+        return FSW_VOLUME_CORRUPTED;
+
+    status = fsw_alloc_zero(sizeof *dc, (void **) &dc);
+    if (status)
+        return status;
+    dc->type = fsw_u32_le_swap(header.compression_type);
+    dc->size = fsw_u64_le_swap(header.uncompressed_size);
+
+    switch (dc->type)
+    {
+        case HFS_DECMPFS_TYPE_ATTR_RAW:
+        case HFS_DECMPFS_TYPE_ATTR_ZLIB:
+        case HFS_DECMPFS_TYPE_ATTR_LZVN:
+            /* The whole file is one chunk, at least a block long */
+            if (dc->size > HFS_DECMPFS_INLINE_MAX)
+            {
+                status = FSW_UNSUPPORTED;
+                break;
+            }
+            dc->chunk_shift = vol->block_size_shift;
+            while (LShiftU64(1, dc->chunk_shift) < dc->size)
+                dc->chunk_shift++;
+            dc->chunk_count = dc->size ? 1 : 0;
+            dc->inline_size = size - sizeof header;
+            status = fsw_alloc(dc->inline_size + 1, &dc->inline_data);
+            if (status)
+                break;
+            fsw_memcpy(dc->inline_data, attr->attrData + sizeof header, dc->inline_size);
+            break;
+
+        case HFS_DECMPFS_TYPE_RSRC_ZLIB:
+        case HFS_DECMPFS_TYPE_RSRC_LZVN:
+            dc->chunk_shift = HFS_DECMPFS_CHUNK_SHIFT;
+            /* Each chunk takes at least 4 bytes of table */
+            if (RShiftU64(dc->size + HFS_DECMPFS_CHUNK_SIZE - 1, HFS_DECMPFS_CHUNK_SHIFT)
+                > RShiftU64(dno->rsrc_size, 2))
+            {
+                status = FSW_VOLUME_CORRUPTED;
+                break;
+            }
+            dc->chunk_count = (fsw_u32) RShiftU64(dc->size + HFS_DECMPFS_CHUNK_SIZE - 1,
+                                                  HFS_DECMPFS_CHUNK_SHIFT);
+            status = fsw_alloc_zero(dc->chunk_count * sizeof (fsw_u64) + 1, (void **) &dc->chunk_offset);
+            if (status)
+                break;
+            status = fsw_alloc_zero(dc->chunk_count * sizeof (fsw_u32) + 1, (void **) &dc->chunk_length);
+            if (status)
+                break;
+            if (dc->type == HFS_DECMPFS_TYPE_RSRC_ZLIB)
+                status = fsw_hfs_decmpfs_zlib_table(dno, dc);
+            else
+                status = fsw_hfs_decmpfs_lzvn_table(dno, dc);
+            break;
+
+        default:
+            status = FSW_UNSUPPORTED;
+            break;
+    }
+
+    if (status)
+    {
+        /* Report the real size, so that reads fail rather than look empty */
+        if (status == FSW_UNSUPPORTED)
+            dno->g.size = dc->size;
+        fsw_hfs_decmpfs_free(dc);
+        return status;
+    }
+
+    dno->decmpfs = dc;
+    dno->g.size = dc->size;
+    return FSW_SUCCESS;
+}
+
+/*
+ * Decompress a chunk with the registered decompressor for format. Returns the
+ * number of bytes produced, or -1 if the data could not be decoded.
+ */
+static int
+fsw_hfs_decompress (struct fsw_hfs_dnode * dno,
+                    fsw_u32                format,
+                    fsw_u8               * src,
+                    fsw_u32                src_size,
+                    fsw_u8               * out,
+                    fsw_u32                out_size)
+{
+    fsw_u32 produced;
+
+    if (fsw_codec_decompress(&dno->g.vol->g, format, src, src_size, 0, out, out_size, &produced) != FSW_SUCCESS)
+        return -1;
+    return (int) produced;
+}
+
+/*
+ * Decode chunk number chunk of a compressed file into out, which takes the
+ * out_size bytes the chunk expands to. A first byte of 0xFF (zlib; any byte
+ * with the low nibble set is not a valid zlib header) or 0x06 (LZVN) marks
+ * a chunk stored without compression.
+ */
+static fsw_status_t
+fsw_hfs_decmpfs_decode (struct fsw_hfs_dnode * dno,
+                        fsw_u32                chunk,
+                        fsw_u8               * out,
+                        fsw_u32                out_size)
+{
+    struct fsw_hfs_decmpfs * dc = dno->decmpfs;
+    fsw_status_t             status = FSW_SUCCESS;
+    fsw_u8                 * src, * buffer = NULL;
+    fsw_u32                  src_size;
+    int                      raw = 0, ret = -1;
+
+    if (dc->inline_data)
+    {
+        src = dc->inline_data;
+        src_size = dc->inline_size;
+    }
+    else
+    {
+        src_size = dc->chunk_length[chunk];
+        status = fsw_alloc(src_size, &buffer);
+        if (status)
+            return status;
+        status = fsw_hfs_read_rsrc(dno, dc->chunk_offset[chunk], src_size, buffer);
+        if (status)
+        {
+            fsw_free(buffer);
+            return status;
+        }
+        src = buffer;
+    }
+
+    switch (dc->type)
+    {
+        case HFS_DECMPFS_TYPE_ATTR_RAW:
+            raw = 1;
+            break;
+        case HFS_DECMPFS_TYPE_ATTR_ZLIB:
+        case HFS_DECMPFS_TYPE_RSRC_ZLIB:
+            if (src_size > 0 && (src[0] & 0x0f) == 0x0f)
+            {
+                src++;
+                src_size--;
+                raw = 1;
+            }
+            else if (src_size > 0)
+                ret = fsw_hfs_decompress(dno, FSW_CODEC_ZLIB, src, src_size, out, out_size);
+            break;
+        case HFS_DECMPFS_TYPE_ATTR_LZVN:
+        case HFS_DECMPFS_TYPE_RSRC_LZVN:
+            if (src_size > 0 && src[0] == 0x06)
+            {
+                src++;
+                src_size--;
+                raw = 1;
+            }
+            else
+                ret = fsw_hfs_decompress(dno, FSW_CODEC_LZVN, src, src_size, out, out_size);
+            break;
+    }
+
+    if (raw && src_size >= out_size)
+    {
+        fsw_memcpy(out, src, out_size);
+        ret = (int) out_size;
+    }
+    if (ret != (int) out_size)
+        status = FSW_VOLUME_CORRUPTED;
+
+    if (buffer)
+        fsw_free(buffer);
+    return status;
+}
+
+/*
+ * Get a decoded chunk of a compressed file from the volume's chunk cache,
+ * decoding it on a miss. The data stays valid until the next call.
+ */
+static fsw_status_t
+fsw_hfs_decmpfs_chunk (struct fsw_hfs_volume * vol,
+                       struct fsw_hfs_dnode  * dno,
+                       fsw_u32                 chunk,
+                       fsw_u8               ** data_out,
+                       fsw_u32               * size_out)
+{
+    struct fsw_hfs_decmpfs       * dc = dno->decmpfs;
+    struct fsw_hfs_decmpfs_cache * zc, * victim = NULL;
+    fsw_status_t                   status;
+    fsw_u64                        start = LShiftU64(chunk, dc->chunk_shift);
+    fsw_u32                        size, i;
+
+    if (chunk >= dc->chunk_count)
+        return FSW_VOLUME_CORRUPTED;
+    size = (fsw_u32) (dc->size - start < LShiftU64(1, dc->chunk_shift) ?
+                      dc->size - start : LShiftU64(1, dc->chunk_shift));
+
+    if (vol->decmpfs_cache == NULL)
+    {
+        status = fsw_alloc_zero(sizeof (struct fsw_hfs_decmpfs_cache) * HFS_DECMPFS_CACHE_SIZE,
+                                (void **) &vol->decmpfs_cache);
+        if (status)
+            return status;
+    }
+
+    for (i = 0; i < HFS_DECMPFS_CACHE_SIZE; i++)
+    {
+        zc = &vol->decmpfs_cache[i];
+        if (zc->buffer && zc->file_id == dno->g.dnode_id && zc->chunk == chunk)
+        {
+            vol->decmpfs_cache_hits++;
+            goto found;
+        }
+        if (victim == NULL || (victim->buffer && (!zc->buffer || zc->lastuse < victim->lastuse)))
+            victim = zc;
+    }
+
+    vol->decmpfs_cache_misses++;
+    zc = victim;
+    /* Full chunks are all the same size, so their buffers are reused */
+    if (zc->buffer && zc->size != size)
+    {
+        fsw_free(zc->buffer);
+        zc->buffer = NULL;
+    }
+    if (zc->buffer == NULL)
+    {
+        status = fsw_alloc(size, &zc->buffer);
+        if (status)
+            return status;
+    }
+    status = fsw_hfs_decmpfs_decode(dno, chunk, zc->buffer, size);
+    if (status)
+    {
+        fsw_free(zc->buffer);
+        zc->buffer = NULL;
+        return status;
+    }
+    zc->file_id = (fsw_u32) dno->g.dnode_id;
+    zc->chunk = chunk;
+    zc->size = size;
+    vol->decmpfs_bytes += size;
+
+found:
+    zc->lastuse = ++vol->decmpfs_cache_tick;
+    *data_out = zc->buffer;
+    *size_out = zc->size;
+    return FSW_SUCCESS;
+}
+
+/*
+ * Hand out the decoded chunk holding the wanted block as a cached extent,
+ * which the core reads from without a copy of its own. If blocks are larger
+ * than chunks, the chunks of the whole block are copied into a new buffer.
+ */
+static fsw_status_t
+fsw_hfs_decmpfs_get_extent (struct fsw_hfs_volume * vol,
+                            struct fsw_hfs_dnode  * dno,
+                            struct fsw_extent     * extent)
+{
+    struct fsw_hfs_decmpfs * dc = dno->decmpfs;
+    fsw_status_t             status;
+    fsw_u32                  shift = dc->chunk_shift > vol->block_size_shift ?
+                                     dc->chunk_shift : vol->block_size_shift;
+    fsw_u64                  start, pos, end;
+    fsw_u8                 * buffer, * data;
+    fsw_u32                  size;
+
+    start = LShiftU64(RShiftU64(LShiftU64(extent->log_start, vol->block_size_shift), shift), shift);
+    if (start >= dc->size)
+    {
+        extent->type = FSW_EXTENT_TYPE_SPARSE;
+        extent->log_count = 1;
+        return FSW_SUCCESS;
+    }
+
+    if (shift == dc->chunk_shift)
+    {
+        /* Reads never go past the end of the file, so a short last chunk will do */
+        status = fsw_hfs_decmpfs_chunk(vol, dno, (fsw_u32) RShiftU64(start, shift), &data, &size);
+        if (status)
+            return status;
+        extent->type = FSW_EXTENT_TYPE_CACHED;
+        extent->buffer = data;
+    }
+    else
+    {
+        status = fsw_alloc_zero((fsw_u32) LShiftU64(1, shift), (void **) &buffer);
+        if (status)
+            return status;
+
+        end = start + LShiftU64(1, shift);
+        if (end > dc->size)
+            end = dc->size;
+        for (pos = start; pos < end; pos += LShiftU64(1, dc->chunk_shift))
+        {
+            status = fsw_hfs_decmpfs_chunk(vol, dno, (fsw_u32) RShiftU64(pos, dc->chunk_shift),
+                                           &data, &size);
+            if (status)
+            {
+                fsw_free(buffer);
+                return status;
+            }
+            fsw_memcpy(buffer + (fsw_u32) (pos - start), data, size);
+        }
+        extent->type = FSW_EXTENT_TYPE_BUFFER;
+        extent->buffer = buffer;
+    }
+
+    extent->log_start = (fsw_u32) RShiftU64(start, vol->block_size_shift);
+    extent->log_count = 1 << (shift - vol->block_size_shift);
+    return FSW_SUCCESS;
+}
+
+/**
+ * Retrieve file data mapping information. This function is called by the core when
+ * fsw_shandle_read needs to know where on the disk the required piece of the file's
+ * data can be found. The core makes sure that fsw_hfs_dnode_fill has been called
+ * on the dnode before. Our task here is to get the physical disk block number for
+ * the requested logical block number.
+ */
+
+static fsw_status_t fsw_hfs_get_extent(struct fsw_hfs_volume * vol,
+                                       struct fsw_hfs_dnode  * dno,
+                                       struct fsw_extent     * extent)
+{
+    fsw_status_t         status;
+    fsw_u32              phys_bno;
+
+    if (dno->decmpfs)
+        return fsw_hfs_decmpfs_get_extent(vol, dno, extent);
+    if (dno->compressed)
+        return FSW_UNSUPPORTED;
+
+    extent->type = FSW_EXTENT_TYPE_PHYSBLOCK;
+    extent->log_count = 1;
+
+    /* compressed files aside, only data forks are read */
+    status = fsw_hfs_fork_block(vol, dno, 0, extent->log_start, &phys_bno);
+    if (status == FSW_SUCCESS)
+        extent->phys_start = phys_bno;
 
     return status;
 }
@@ -1164,7 +1900,9 @@ create_hfs_dnode(struct fsw_hfs_dnode  * dno,
     if (status)
         return status;
 
-    baby->g.size = file_info->size;
+    /* A compressed file that is already open keeps its decmpfs size */
+    if (baby->decmpfs == NULL && !baby->decmpfs_failed)
+        baby->g.size = file_info->size;
     baby->used_bytes = file_info->used;
     baby->ctime = file_info->ctime;
     baby->mtime = file_info->mtime;
@@ -1174,6 +1912,13 @@ create_hfs_dnode(struct fsw_hfs_dnode  * dno,
     if (file_info->type == FSW_DNODE_TYPE_FILE)
     {
         fsw_memcpy(baby->extents, &file_info->extents, sizeof file_info->extents);
+        baby->compressed = file_info->compressed;
+        if (file_info->compressed)
+        {
+            baby->used_bytes = file_info->rsrc_used;
+            baby->rsrc_size = file_info->rsrc_size;
+            fsw_memcpy(baby->rsrc_extents, &file_info->rsrc_extents, sizeof file_info->rsrc_extents);
+        }
     }
 
     *child_dno_out = baby;
@@ -1196,9 +1941,9 @@ static fsw_status_t fsw_hfs_dir_lookup(struct fsw_hfs_volume * vol,
 {
     fsw_status_t               status;
     struct HFSPlusCatalogKey   catkey;
-    fsw_u32                    ptr = 0;
+    struct fsw_hfs_cursor      cursor;
+    fsw_u32                    len;
     fsw_u16                    rec_type;
-    BTNodeDescriptor *         node = NULL;
     struct fsw_string          rec_name;
     int                        free_data = 0, i;
     HFSPlusCatalogKey*         file_key;
@@ -1256,14 +2001,24 @@ static fsw_status_t fsw_hfs_dir_lookup(struct fsw_hfs_volume * vol,
                                    (BTreeKey*) &catkey,
                                    vol->case_sensitive ?
                                        fsw_hfs_cmp_catkey : fsw_hfs_cmpi_catkey,
-                                   &node, &ptr);
+                                   &cursor);
     if (status)
         goto done;
 
-    file_key = (HFSPlusCatalogKey *)fsw_hfs_btree_rec (&vol->catalog_tree, node, ptr);
+    status = fsw_hfs_cursor_get (&vol->catalog_tree, &cursor,
+                                 (BTreeKey **) &file_key, &len);
+    if (status)
+        goto done;
     /* for plain HFS "-(keySize & 1)" would be needed */
     base = (fsw_u8*)file_key + be16_to_cpu(file_key->keyLength) + 2;
-    rec_type =  be16_to_cpu(*(fsw_u16*)base);
+    len -= (fsw_u32) (base - (fsw_u8*)file_key);
+    rec_type = len < 2 ? 0 : be16_to_cpu(*(fsw_u16*)base);
+    if ((rec_type == kHFSPlusFolderRecord && len < sizeof (HFSPlusCatalogFolder))
+        || (rec_type == kHFSPlusFileRecord && len < sizeof (HFSPlusCatalogFile)))
+    {
+        status = FSW_VOLUME_CORRUPTED;
+        goto done;
+    }
 
     /** @todo: read additional info */
     switch (rec_type)
@@ -1293,6 +2048,11 @@ static fsw_status_t fsw_hfs_dir_lookup(struct fsw_hfs_volume * vol,
             file_info.mtime = be32_to_cpu(info->contentModDate);
             fsw_memcpy(&file_info.extents, &info->dataFork.extents,
                        sizeof file_info.extents);
+            file_info.compressed = (info->bsdInfo.ownerFlags & HFS_UF_COMPRESSED) != 0;
+            file_info.rsrc_size = be64_to_cpu(info->resourceFork.logicalSize);
+            file_info.rsrc_used = ((fsw_u64)be32_to_cpu(info->resourceFork.totalBlocks)) << vol->block_size_shift;
+            fsw_memcpy(&file_info.rsrc_extents, &info->resourceFork.extents,
+                       sizeof file_info.rsrc_extents);
             break;
         }
         default:
@@ -1310,9 +2070,6 @@ create:
 
 done:
 
-    if (node != NULL)
-        fsw_free(node);
-
     if (free_data)
         fsw_strfree(&rec_name);
 
@@ -1334,8 +2091,7 @@ static fsw_status_t fsw_hfs_dir_read(struct fsw_hfs_volume *vol,
 {
     fsw_status_t               status;
     struct HFSPlusCatalogKey   catkey;
-    fsw_u32                    ptr  = 0;
-    BTNodeDescriptor *         node = NULL;
+    struct fsw_hfs_cursor      cursor;
 
     visitor_parameter_t        param;
     struct fsw_string          rec_name;
@@ -1348,27 +2104,41 @@ static fsw_status_t fsw_hfs_dir_read(struct fsw_hfs_volume *vol,
     rec_name.type = FSW_STRING_TYPE_EMPTY;
     param.file_info.name = &rec_name;
 
-    status = fsw_hfs_btree_search (&vol->catalog_tree,
-                                   (BTreeKey*) &catkey,
-                                   vol->case_sensitive ?
-                                       fsw_hfs_cmp_catkey : fsw_hfs_cmpi_catkey,
-                                   &node, &ptr);
-    if (status)
-        goto done;
-
-    /* Iterator updates shand state */
     param.vol = vol;
     param.shandle = shand;
     param.parent = dno->g.dnode_id;
-    param.cur_pos = 0;
+
+    if (shand->pos != 0 && shand->pos == dno->dir_cursor_pos)
+    {
+        /* Sequential read, continue right after the previous entry */
+        cursor = dno->dir_cursor;
+        param.cur_pos = shand->pos;
+    }
+    else
+    {
+        /* Start from the thread record, which sorts first in the directory */
+        status = fsw_hfs_btree_search (&vol->catalog_tree,
+                                       (BTreeKey*) &catkey,
+                                       vol->case_sensitive ?
+                                           fsw_hfs_cmp_catkey : fsw_hfs_cmpi_catkey,
+                                       &cursor);
+        if (status)
+            goto done;
+        param.cur_pos = 0;
+    }
+
+    /* Iterator updates shand state */
     status = fsw_hfs_btree_iterate_node (&vol->catalog_tree,
-                                         node,
-                                         ptr,
+                                         &cursor,
                                          fsw_hfs_btree_visit_node,
                                          &param);
     if (status)
       goto done;
 
+    dno->dir_cursor = cursor;
+    dno->dir_cursor.rec++;
+    dno->dir_cursor_pos = shand->pos;
+
     status = create_hfs_dnode(dno, &param.file_info, child_dno_out);
 
     if (status)
@@ -82,12 +82,38 @@ struct fsw_hfs_key
   {
     struct HFSPlusExtentKey  ext_key;
     struct HFSPlusCatalogKey cat_key;
+    struct HFSPlusAttrKey    attr_key;
     fsw_u16                  key_len; /* Length is at the beginning of all keys */
   } HFS_ALIGNMENT;
 } HFS_ALIGNMENT;
 
+/*
+ * Header of the com.apple.decmpfs attribute of a compressed file. Unlike
+ * the rest of HFS+, it is little endian.
+ */
+struct fsw_hfs_decmpfs_header
+{
+    fsw_u32                  magic;             //!< HFS_DECMPFS_MAGIC
+    fsw_u32                  compression_type;  //!< HFS_DECMPFS_TYPE_*
+    fsw_u64                  uncompressed_size;
+} HFS_ALIGNMENT;
+
 #pragma pack()
 
+#define HFS_DECMPFS_MAGIC           0x636d7066  /* "fpmc" on disk */
+#define HFS_DECMPFS_TYPE_ATTR_RAW   1           /* data follows the header */
+#define HFS_DECMPFS_TYPE_ATTR_ZLIB  3           /* zlib stream follows the header */
+#define HFS_DECMPFS_TYPE_RSRC_ZLIB  4           /* zlib chunks in the resource fork */
+#define HFS_DECMPFS_TYPE_ATTR_LZVN  7           /* LZVN stream follows the header */
+#define HFS_DECMPFS_TYPE_RSRC_LZVN  8           /* LZVN chunks in the resource fork */
+
+/* Chunk size of data in the resource fork */
+#define HFS_DECMPFS_CHUNK_SHIFT     16
+#define HFS_DECMPFS_CHUNK_SIZE      (1 << HFS_DECMPFS_CHUNK_SHIFT)
+
+/* BSD owner flag of compressed files */
+#define HFS_UF_COMPRESSED           0x20
+
 typedef enum {
     /* Regular HFS */
     FSW_HFS_PLAIN = 0,
@@ -97,6 +123,31 @@ typedef enum {
     FSW_HFS_PLUS_EMB
 } fsw_hfs_kind;
 
+/**
+ * HFS: Position of a record in a B-tree.
+ */
+struct fsw_hfs_cursor
+{
+    fsw_u32                  node;      //!< Node number
+    fsw_u32                  rec;       //!< Record index within the node
+};
+
+/**
+ * HFS: Layout of a compressed file, read from its decmpfs attribute when
+ * the dnode is filled. Data is decoded one chunk at a time as it is read.
+ */
+struct fsw_hfs_decmpfs
+{
+    fsw_u32                  type;          //!< HFS_DECMPFS_TYPE_*
+    fsw_u64                  size;          //!< Uncompressed size
+    fsw_u32                  chunk_shift;   //!< log2 of the uncompressed bytes per chunk
+    fsw_u32                  chunk_count;
+    fsw_u64                * chunk_offset;  //!< Resource fork offset of each chunk, chunk_count entries
+    fsw_u32                * chunk_length;  //!< Compressed length of each chunk
+    fsw_u8                 * inline_data;   //!< Data stored in the attribute itself
+    fsw_u32                  inline_size;
+};
+
 /**
  * HFS: Dnode structure with HFS-specific data.
  */
@@ -108,6 +159,13 @@ struct fsw_hfs_dnode
   fsw_u32                   ctime;
   fsw_u32                   mtime;
   fsw_u64                   used_bytes;
+  fsw_u64                   dir_cursor_pos;   //!< Directory position dir_cursor belongs to, 0 if none
+  struct fsw_hfs_cursor     dir_cursor;       //!< Catalog record of the next directory entry
+  int                       compressed;       //!< Has UF_COMPRESSED, data comes from decmpfs
+  HFSPlusExtentRecord       rsrc_extents;     //!< Resource fork extents, for compressed files
+  fsw_u64                   rsrc_size;
+  struct fsw_hfs_decmpfs  * decmpfs;          //!< Set by fsw_hfs_dnode_fill for compressed files
+  int                       decmpfs_failed;   //!< Set when the decmpfs attribute could not be used
 };
 
 /**
@@ -120,6 +178,48 @@ struct fsw_hfs_btree
     struct fsw_hfs_dnode*    file;
 };
 
+/**
+ * HFS: B-tree node kept in the per-volume node cache. Nodes of the catalog
+ * and extents trees share the cache; the upper levels, which every search
+ * passes through, stay in it.
+ */
+#ifndef HFS_NODE_CACHE_SIZE
+#define HFS_NODE_CACHE_SIZE 32
+#endif
+
+struct fsw_hfs_node_cache
+{
+    struct fsw_hfs_btree*    btree;
+    fsw_u32                  node;
+    fsw_u8*                  buffer;
+    fsw_u32                  lastuse;
+};
+
+/**
+ * HFS: Decoded chunk of a compressed file. Reads through several handles,
+ * or ones that do not start on a chunk boundary, decode each chunk once
+ * while it stays in the cache; reads copy straight out of the cached
+ * buffer. Data stored in the decmpfs attribute itself
+ * is one chunk; files larger than HFS_DECMPFS_INLINE_MAX stored that way
+ * are not supported, which bounds the cache at
+ * HFS_DECMPFS_CACHE_SIZE * HFS_DECMPFS_INLINE_MAX bytes.
+ */
+#ifndef HFS_DECMPFS_CACHE_SIZE
+#define HFS_DECMPFS_CACHE_SIZE 8
+#endif
+#ifndef HFS_DECMPFS_INLINE_MAX
+#define HFS_DECMPFS_INLINE_MAX 0x100000
+#endif
+
+struct fsw_hfs_decmpfs_cache
+{
+    fsw_u32                  file_id;
+    fsw_u32                  chunk;
+    fsw_u8*                  buffer;
+    fsw_u32                  size;
+    fsw_u32                  lastuse;
+};
+
 
 /**
  * HFS: In-memory volume structure with HFS-specific data.
@@ -132,11 +232,21 @@ struct fsw_hfs_volume
     struct HFSPlusVolumeHeader   *primary_voldesc;  //!< Volume Descriptor
     struct fsw_hfs_btree          catalog_tree;     // Catalog tree
     struct fsw_hfs_btree          extents_tree;     // Extents overflow tree
+    struct fsw_hfs_btree          attributes_tree;  // Attributes tree, file is NULL if the volume has none
     struct fsw_hfs_dnode          root_file;
     int                           case_sensitive;
     fsw_u32                       block_size_shift;
     fsw_hfs_kind                  hfs_kind;
     fsw_u32                       emb_block_off;
+    struct fsw_hfs_node_cache     *node_cache;      //!< B-tree node LRU, HFS_NODE_CACHE_SIZE entries
+    fsw_u32                       node_cache_tick;
+    fsw_u32                       node_cache_hits;
+    fsw_u32                       node_cache_misses;
+    struct fsw_hfs_decmpfs_cache  *decmpfs_cache;   //!< Decoded chunk LRU, HFS_DECMPFS_CACHE_SIZE entries
+    fsw_u32                       decmpfs_cache_tick;
+    fsw_u32                       decmpfs_cache_hits;
+    fsw_u32                       decmpfs_cache_misses;
+    fsw_u64                       decmpfs_bytes;    //!< Bytes decoded, for the statistics
 };
 
 /* Endianess swappers */
@@ -0,0 +1,472 @@
+/**
+ * \file fsw_htree.c
+ * HTree (dir_index) directory lookup shared by the ext2 and ext4 drivers.
+ *
+ * This file is included by fsw_ext2.c and fsw_ext4.c. All functions are static.
+ * The hash functions follow fs/ext4/hash.c from the Linux kernel.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+
+// hash versions as stored in dx_root_info, plus the unsigned variants
+#define DX_HASH_LEGACY              0
+#define DX_HASH_HALF_MD4            1
+#define DX_HASH_TEA                 2
+#define DX_HASH_LEGACY_UNSIGNED     3
+#define DX_HASH_HALF_MD4_UNSIGNED   4
+#define DX_HASH_TEA_UNSIGNED        5
+
+// superblock s_flags
+#define DX_FLAGS_SIGNED_HASH        0x0001
+#define DX_FLAGS_UNSIGNED_HASH      0x0002
+
+// the index may have up to three levels with the largedir feature
+#define DX_MAX_LEVELS               3
+
+// size of the fake "." and ".." entries in front of dx_root_info
+#define DX_ROOT_INFO_OFFSET         24
+// size of the fake empty entry in front of a dx_node's entries
+#define DX_NODE_ENTRIES_OFFSET      8
+// size of the checksum tail at the end of index blocks with metadata_csum
+#define DX_TAIL_SIZE                8
+
+struct dx_root_info {
+    fsw_u32     reserved_zero;
+    fsw_u8      hash_version;
+    fsw_u8      info_length;        // always 8
+    fsw_u8      indirect_levels;
+    fsw_u8      unused_flags;
+};
+
+struct dx_entry {
+    fsw_u32     hash;               // in the first entry of a block: limit (low 16 bits), count (high 16 bits)
+    fsw_u32     block;
+};
+
+#define DX_LIMIT(entries)   ((fsw_u16)((entries)[0].hash & 0xffff))
+#define DX_COUNT(entries)   ((fsw_u16)((entries)[0].hash >> 16))
+#define DX_BLOCK(entry)     ((entry)->block & 0x0fffffff)
+
+struct dx_frame {
+    fsw_u8          *buffer;        // index block data
+    struct dx_entry *entries;       // entries in this block
+    struct dx_entry *at;            // entry followed to the next level
+};
+
+#define ROL32(x, s) (((x) << (s)) | ((x) >> (32 - (s))))
+
+static void fsw_htree_tea_transform(fsw_u32 buf[4], fsw_u32 const in[])
+{
+    fsw_u32 sum = 0;
+    fsw_u32 b0 = buf[0], b1 = buf[1];
+    fsw_u32 a = in[0], b = in[1], c = in[2], d = in[3];
+    int     n = 16;
+
+    do {
+        sum += 0x9E3779B9;
+        b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+        b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    } while (--n);
+
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+#define ROUND(f, a, b, c, d, x, s) (a += f(b, c, d) + x, a = ROL32(a, s))
+#define K1 0
+#define K2 013240474631UL
+#define K3 015666365641UL
+
+static void fsw_htree_half_md4_transform(fsw_u32 buf[4], fsw_u32 const in[8])
+{
+    fsw_u32 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    // Round 1
+    ROUND(F, a, b, c, d, in[0] + K1,  3);
+    ROUND(F, d, a, b, c, in[1] + K1,  7);
+    ROUND(F, c, d, a, b, in[2] + K1, 11);
+    ROUND(F, b, c, d, a, in[3] + K1, 19);
+    ROUND(F, a, b, c, d, in[4] + K1,  3);
+    ROUND(F, d, a, b, c, in[5] + K1,  7);
+    ROUND(F, c, d, a, b, in[6] + K1, 11);
+    ROUND(F, b, c, d, a, in[7] + K1, 19);
+
+    // Round 2
+    ROUND(G, a, b, c, d, in[1] + K2,  3);
+    ROUND(G, d, a, b, c, in[3] + K2,  5);
+    ROUND(G, c, d, a, b, in[5] + K2,  9);
+    ROUND(G, b, c, d, a, in[7] + K2, 13);
+    ROUND(G, a, b, c, d, in[0] + K2,  3);
+    ROUND(G, d, a, b, c, in[2] + K2,  5);
+    ROUND(G, c, d, a, b, in[4] + K2,  9);
+    ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+    // Round 3
+    ROUND(H, a, b, c, d, in[3] + K3,  3);
+    ROUND(H, d, a, b, c, in[7] + K3,  9);
+    ROUND(H, c, d, a, b, in[2] + K3, 11);
+    ROUND(H, b, c, d, a, in[6] + K3, 15);
+    ROUND(H, a, b, c, d, in[1] + K3,  3);
+    ROUND(H, d, a, b, c, in[5] + K3,  9);
+    ROUND(H, c, d, a, b, in[0] + K3, 11);
+    ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+#undef F
+#undef G
+#undef H
+#undef ROUND
+#undef K1
+#undef K2
+#undef K3
+
+/**
+ * The original "legacy" directory hash.
+ */
+
+static fsw_u32 fsw_htree_legacy_hash(const fsw_u8 *name, int len, int is_unsigned)
+{
+    fsw_u32 hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+    int     c;
+
+    while (len--) {
+        c = is_unsigned ? (int)*name : (int)(fsw_s8)*name;
+        name++;
+        hash = hash1 + (hash0 ^ (fsw_u32)(c * 7152373));
+        if (hash & 0x80000000)
+            hash -= 0x7fffffff;
+        hash1 = hash0;
+        hash0 = hash;
+    }
+    return hash0 << 1;
+}
+
+/**
+ * Pack up to num * 4 bytes of a name into 32-bit words for the MD4 and TEA hashes,
+ * padding with a value derived from the length.
+ */
+
+static void fsw_htree_str2hashbuf(const fsw_u8 *msg, int len, fsw_u32 *buf, int num, int is_unsigned)
+{
+    fsw_u32 pad, val;
+    int     i, c;
+
+    pad = (fsw_u32)len | ((fsw_u32)len << 8);
+    pad |= pad << 16;
+
+    val = pad;
+    if (len > num * 4)
+        len = num * 4;
+    for (i = 0; i < len; i++) {
+        c = is_unsigned ? (int)msg[i] : (int)(fsw_s8)msg[i];
+        val = (fsw_u32)c + (val << 8);
+        if ((i % 4) == 3) {
+            *buf++ = val;
+            val = pad;
+            num--;
+        }
+    }
+    if (--num >= 0)
+        *buf++ = val;
+    while (--num >= 0)
+        *buf++ = pad;
+}
+
+/**
+ * Compute the major directory hash of a name. Returns FSW_UNSUPPORTED for unknown
+ * hash versions.
+ */
+
+static fsw_status_t fsw_htree_hash(const fsw_u8 *name, int len, int hash_version, fsw_u32 *seed,
+                                   fsw_u32 *hash_out)
+{
+    fsw_u32 buf[4], in[8], hash;
+    int     i, is_unsigned;
+
+    buf[0] = 0x67452301;
+    buf[1] = 0xefcdab89;
+    buf[2] = 0x98badcfe;
+    buf[3] = 0x10325476;
+    for (i = 0; i < 4; i++) {
+        if (seed[i]) {
+            fsw_memcpy(buf, seed, sizeof(buf));
+            break;
+        }
+    }
+
+    is_unsigned = (hash_version >= DX_HASH_LEGACY_UNSIGNED);
+    switch (hash_version) {
+        case DX_HASH_LEGACY:
+        case DX_HASH_LEGACY_UNSIGNED:
+            hash = fsw_htree_legacy_hash(name, len, is_unsigned);
+            break;
+        case DX_HASH_HALF_MD4:
+        case DX_HASH_HALF_MD4_UNSIGNED:
+            for (; len > 0; len -= 32, name += 32) {
+                fsw_htree_str2hashbuf(name, len, in, 8, is_unsigned);
+                fsw_htree_half_md4_transform(buf, in);
+            }
+            hash = buf[1];
+            break;
+        case DX_HASH_TEA:
+        case DX_HASH_TEA_UNSIGNED:
+            for (; len > 0; len -= 16, name += 16) {
+                fsw_htree_str2hashbuf(name, len, in, 4, is_unsigned);
+                fsw_htree_tea_transform(buf, in);
+            }
+            hash = buf[0];
+            break;
+        default:
+            return FSW_UNSUPPORTED;
+    }
+
+    hash &= ~1;
+    if (hash == (0x7fffffffU << 1))
+        hash = (0x7fffffffU - 1) << 1;
+    *hash_out = hash;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Read one logical block of the directory through its shandle into a buffer of
+ * blocksize bytes. Short reads mean the index points outside the directory.
+ */
+
+static fsw_status_t fsw_htree_read_block(struct fsw_shandle *shand, fsw_u32 blocksize,
+                                         fsw_u32 block, fsw_u8 *buffer)
+{
+    fsw_status_t    status;
+    fsw_u32         buffer_size;
+
+    if ((fsw_u64)block * blocksize >= shand->dnode->size)
+        return FSW_VOLUME_CORRUPTED;
+    shand->pos = (fsw_u64)block * blocksize;
+    buffer_size = blocksize;
+    status = fsw_shandle_read(shand, &buffer_size, buffer);
+    if (status)
+        return status;
+    if (buffer_size != blocksize)
+        return FSW_VOLUME_CORRUPTED;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Check the count and limit of an index block's entries. The limit depends on whether
+ * the block carries a metadata checksum tail, so both values are accepted.
+ */
+
+static int fsw_htree_entries_valid(struct dx_entry *entries, fsw_u32 space)
+{
+    fsw_u32 limit = DX_LIMIT(entries), count = DX_COUNT(entries);
+
+    if (limit != space / sizeof(struct dx_entry) && limit != (space - DX_TAIL_SIZE) / sizeof(struct dx_entry))
+        return 0;
+    return count > 0 && count <= limit;
+}
+
+/**
+ * Find the entry to follow in an index block: the last one whose hash is not larger
+ * than the hash looked up. The first entry covers all hashes below the second one.
+ */
+
+static struct dx_entry * fsw_htree_search(struct dx_entry *entries, fsw_u32 hash)
+{
+    struct dx_entry *p, *q, *m;
+
+    p = entries + 1;
+    q = entries + DX_COUNT(entries) - 1;
+    while (p <= q) {
+        m = p + (q - p) / 2;
+        if (m->hash > hash)
+            q = m - 1;
+        else
+            p = m + 1;
+    }
+    return p - 1;
+}
+
+/**
+ * Scan one leaf block for a name. Returns FSW_SUCCESS with the inode number,
+ * FSW_NOT_FOUND, or FSW_VOLUME_CORRUPTED if the entries do not fit the block.
+ */
+
+static fsw_status_t fsw_htree_scan_leaf(fsw_u8 *buffer, fsw_u32 blocksize,
+                                        struct fsw_string *lookup_name, fsw_u32 *ino_out)
+{
+    fsw_u32         offset, inode, rec_len, name_len;
+    struct fsw_string entry_name;
+
+    entry_name.type = FSW_STRING_TYPE_ISO88591;
+    for (offset = 0; offset + 8 <= blocksize; offset += rec_len) {
+        inode    = *(fsw_u32 *)(buffer + offset);
+        rec_len  = *(fsw_u16 *)(buffer + offset + 4);
+        name_len = buffer[offset + 6];
+        if (rec_len < 8 || offset + rec_len > blocksize || 8 + name_len > rec_len)
+            return FSW_VOLUME_CORRUPTED;
+        if (inode == 0)
+            continue;
+
+        entry_name.len = entry_name.size = name_len;
+        entry_name.data = buffer + offset + 8;
+        if (fsw_streq(lookup_name, &entry_name)) {
+            *ino_out = inode;
+            return FSW_SUCCESS;
+        }
+    }
+    return FSW_NOT_FOUND;
+}
+
+/**
+ * Look up a name in a hash-indexed directory. The caller passes an open shandle on
+ * the directory, its block size, the superblock's hash seed and flags, and the largest
+ * index depth the file system allows. The index is descended from the dx_root block
+ * using a binary search in each index block, so only one block per level and the
+ * matching leaf are read. Leaves that continue a hash collision are scanned too.
+ *
+ * Returns FSW_SUCCESS with the inode number, or FSW_NOT_FOUND. If the index uses an
+ * unknown hash or does not look sane, FSW_UNSUPPORTED is returned and the caller
+ * should fall back to a linear scan of the directory.
+ */
+
+static fsw_status_t fsw_htree_lookup(struct fsw_shandle *shand, fsw_u32 blocksize,
+                                     fsw_u32 *hash_seed, fsw_u32 sb_flags, int max_levels,
+                                     struct fsw_string *lookup_name, fsw_u32 *ino_out)
+{
+    fsw_status_t    status;
+    struct fsw_string name;
+    struct dx_root_info *info;
+    struct dx_frame frames[DX_MAX_LEVELS], *frame, *p;
+    fsw_u8          *leaf = NULL;
+    fsw_u32         hash, levels, i;
+    int             hash_version;
+
+    fsw_memzero(frames, sizeof(frames));
+    if (max_levels > DX_MAX_LEVELS)
+        max_levels = DX_MAX_LEVELS;
+
+    // names are stored as plain bytes
+    status = fsw_strdup_coerce(&name, FSW_STRING_TYPE_ISO88591, lookup_name);
+    if (status)
+        return FSW_UNSUPPORTED;
+
+    status = fsw_alloc(blocksize, &frames[0].buffer);
+    if (status)
+        goto done;
+    status = fsw_htree_read_block(shand, blocksize, 0, frames[0].buffer);
+    if (status)
+        goto done;
+
+    // check the dx_root header
+    status = FSW_UNSUPPORTED;
+    info = (struct dx_root_info *)(frames[0].buffer + DX_ROOT_INFO_OFFSET);
+    if (info->reserved_zero != 0 || info->info_length != 8 || (info->unused_flags & 1) ||
+        info->indirect_levels >= max_levels)
+        goto done;
+    hash_version = info->hash_version;
+    if (hash_version > DX_HASH_TEA)
+        goto done;
+    if (sb_flags & DX_FLAGS_UNSIGNED_HASH)
+        hash_version += DX_HASH_LEGACY_UNSIGNED;
+    if (fsw_htree_hash((fsw_u8 *)name.data, name.len, hash_version, hash_seed, &hash))
+        goto done;
+    levels = info->indirect_levels + 1;
+
+    frames[0].entries = (struct dx_entry *)(frames[0].buffer + DX_ROOT_INFO_OFFSET + info->info_length);
+    if (!fsw_htree_entries_valid(frames[0].entries, blocksize - DX_ROOT_INFO_OFFSET - info->info_length))
+        goto done;
+
+    // descend through the index
+    for (i = 0; ; i++) {
+        frame = &frames[i];
+        frame->at = fsw_htree_search(frame->entries, hash);
+        if (i + 1 == levels)
+            break;
+
+        status = fsw_alloc(blocksize, &frames[i + 1].buffer);
+        if (status)
+            goto done;
+        status = fsw_htree_read_block(shand, blocksize, DX_BLOCK(frame->at), frames[i + 1].buffer);
+        if (status)
+            goto done;
+        status = FSW_UNSUPPORTED;
+        frames[i + 1].entries = (struct dx_entry *)(frames[i + 1].buffer + DX_NODE_ENTRIES_OFFSET);
+        if (!fsw_htree_entries_valid(frames[i + 1].entries, blocksize - DX_NODE_ENTRIES_OFFSET))
+            goto done;
+    }
+
+    status = fsw_alloc(blocksize, &leaf);
+    if (status)
+        goto done;
+    for (;;) {
+        status = fsw_htree_read_block(shand, blocksize, DX_BLOCK(frame->at), leaf);
+        if (status)
+            goto done;
+        status = fsw_htree_scan_leaf(leaf, blocksize, lookup_name, ino_out);
+        if (status != FSW_NOT_FOUND)
+            goto done;
+
+        // move to the next leaf, stepping up the index as far as necessary
+        for (p = frame; ; p--) {
+            if (++p->at < p->entries + DX_COUNT(p->entries))
+                break;
+            if (p == frames)
+                goto done;  // end of the index, status is FSW_NOT_FOUND
+        }
+
+        // the next leaf only matters if it continues a collision on our hash
+        if ((p->at->hash & ~1) != hash)
+            goto done;
+
+        // reload the index blocks below the one that moved
+        for (; p < frame; p++) {
+            status = fsw_htree_read_block(shand, blocksize, DX_BLOCK(p->at), (p + 1)->buffer);
+            if (status)
+                goto done;
+            status = FSW_UNSUPPORTED;
+            (p + 1)->entries = (struct dx_entry *)((p + 1)->buffer + DX_NODE_ENTRIES_OFFSET);
+            if (!fsw_htree_entries_valid((p + 1)->entries, blocksize - DX_NODE_ENTRIES_OFFSET))
+                goto done;
+            (p + 1)->at = (p + 1)->entries;
+        }
+    }
+
+done:
+    // a damaged index is not fatal, the caller can still scan the directory
+    if (status == FSW_VOLUME_CORRUPTED)
+        status = FSW_UNSUPPORTED;
+    if (leaf != NULL)
+        fsw_free(leaf);
+    for (i = 0; i < DX_MAX_LEVELS; i++) {
+        if (frames[i].buffer != NULL)
+            fsw_free(frames[i].buffer);
+    }
+    fsw_strfree(&name);
+    return status;
+}
+
+#undef ROL32
+
+// EOF
@@ -80,6 +80,12 @@
 #define DBG(x...)
 #endif
 
+//! Memory all directory name indexes of a volume may take together. Directories
+//! whose index does not fit are scanned on every lookup as before.
+#ifndef ISO9660_INDEX_MAX_BYTES
+#define ISO9660_INDEX_MAX_BYTES (4 * 1024 * 1024)
+#endif
+
 //#define MsgLog(x...) if(msgCursor){AsciiSPrint(msgCursor, BOOTER_LOG_SIZE, x); while(*msgCursor){msgCursor++;}}
 
 // extern CHAR8     *msgCursor;
@@ -102,6 +108,13 @@ static fsw_status_t fsw_iso9660_dir_lookup(struct fsw_iso9660_volume *vol, struc
 static fsw_status_t fsw_iso9660_dir_read(struct fsw_iso9660_volume *vol, struct fsw_iso9660_dnode *dno,
                                          struct fsw_shandle *shand, struct fsw_iso9660_dnode **child_dno);
 static fsw_status_t fsw_iso9660_read_dirrec(struct fsw_iso9660_volume *vol, struct fsw_shandle *shand, struct iso9660_dirrec_buffer *dirrec_buffer);
+static void         fsw_iso9660_dirrec_name(struct fsw_iso9660_volume *vol, struct iso9660_dirrec_buffer *dirrec_buffer);
+static fsw_status_t fsw_iso9660_dir_index_get(struct fsw_iso9660_volume *vol, struct fsw_iso9660_dnode *dno,
+                                              struct fsw_iso9660_dir_index **index_out);
+static void         fsw_iso9660_dir_index_free(struct fsw_iso9660_volume *vol, struct fsw_iso9660_dnode *dno);
+static void         fsw_iso9660_free_name(struct iso9660_dirrec_buffer *dirrec_buffer);
+static fsw_u32      fsw_iso9660_name_hash(struct fsw_string *s);
+static int          fsw_iso9660_name_caseeq(struct fsw_string *s1, struct fsw_string *s2);
 
 static fsw_status_t fsw_iso9660_readlink(struct fsw_iso9660_volume *vol, struct fsw_iso9660_dnode *dno,
                                          struct fsw_string *link);
@@ -138,7 +151,7 @@ static fsw_status_t rr_find_sp(struct iso9660_dirrec *dirrec, struct fsw_rock_ri
     struct fsw_rock_ridge_susp_sp *sp;
     r = (fsw_u8 *)((fsw_u8 *)dirrec + sizeof (*dirrec) + dirrec->file_identifier_length);
     off = (int)(r - (fsw_u8 *)dirrec);
-    while(off < dirrec->dirrec_length)
+    while(off + (int)sizeof (*sp) <= dirrec->dirrec_length)
     {
         if (*r == 'S')
         {
@@ -161,8 +174,7 @@ static fsw_status_t rr_find_sp(struct iso9660_dirrec *dirrec, struct fsw_rock_ri
 
 static fsw_status_t rr_find_nm(struct fsw_iso9660_volume *vol, struct iso9660_dirrec *dirrec, int off, struct fsw_string *str)
 {
-    fsw_u8 *r, *begin;
-    int fCe = 0;
+    fsw_u8 *r, *begin, *ce_buffer = NULL;
     struct fsw_rock_ridge_susp_nm *nm;
     int limit = dirrec->dirrec_length;
     begin = (fsw_u8 *)dirrec;
@@ -171,57 +183,61 @@ static fsw_status_t rr_find_nm(struct fsw_iso9660_volume *vol, struct iso9660_di
     str->len = 0;
     str->size = 0;
     str->type = 0;
-    while(off < limit)
+    // every SUSP entry has at least its 4 byte header
+    while(off + 4 <= limit)
     {
-        if (r[0] == 'C' && r[1] == 'E' && r[2] == 28)
+        if (r[0] == 'C' && r[1] == 'E' && r[2] == 28 && off + 28 <= limit)
         {
             int rc;
             int ce_off;
             union fsw_rock_ridge_susp_ce *ce;
-            if (fCe == 0)
-                fsw_alloc_zero(ISO9660_BLOCKSIZE, (void *) &begin);
-            fCe = 1;
+            if (ce_buffer == NULL && fsw_alloc_zero(ISO9660_BLOCKSIZE, (void **) &ce_buffer) != FSW_SUCCESS)
+                break;
         //    DEBUG((DEBUG_WARN, "%a:%d we found CE before NM or its continuation\n", __FILE__, __LINE__));
             ce = (union fsw_rock_ridge_susp_ce *)r;
             limit = ISOINT(ce->X.len);
             ce_off = ISOINT(ce->X.offset);
-            rc = rr_read_ce(vol, ce, begin);
+            if (ce_off < 0 || limit < 0 || ce_off > ISO9660_BLOCKSIZE || limit > ISO9660_BLOCKSIZE - ce_off)
+                break;
+            rc = rr_read_ce(vol, ce, ce_buffer);
             if (rc != FSW_SUCCESS)
             {
-                fsw_free(begin);
+                if (str->data != NULL)
+                    fsw_free(str->data);
+                str->data = NULL;
+                fsw_free(ce_buffer);
                 return rc;
             }
-            begin += ce_off;
+            begin = ce_buffer + ce_off;
             r = begin;
+            off = 0;
+            continue;
         }
         if (r[0] == 'N' && r[1] == 'M')
         {
             nm = (struct fsw_rock_ridge_susp_nm *)r;
             if(    nm->e.sig[0] == 'N'
-                && nm->e.sig[1] == 'M')
+                && nm->e.sig[1] == 'M'
+                && nm->e.len >= sizeof (struct fsw_rock_ridge_susp_nm) - 1
+                && off + nm->e.len <= limit)
             {
                 int len = 0;
                 fsw_u8 *tmp = NULL;
-                if (nm->flags & RR_NM_CURR)
+                if (nm->flags & (RR_NM_CURR | RR_NM_PARE))
                 {
-                     str->len = 1;
-                     if (str->data == NULL) {
-                         fsw_alloc_zero((2 * str->len) + 1, (void **) &str->data);
+                     if (str->data != NULL)
+                         fsw_free(str->data);
+                     str->len = (nm->flags & RR_NM_CURR) ? 1 : 2;
+                     if (fsw_alloc(str->len, (void **) &str->data) != FSW_SUCCESS) {
+                         str->data = NULL;
+                         break;
                      }
-                     fsw_memdup(str->data, ".", str->len);
-                     goto done;
-                }
-                if (nm->flags & RR_NM_PARE)
-                {
-                     str->len = 2;
-                     if (str->data == NULL) {
-                         fsw_alloc_zero((2 * str->len) + 1, (void **) &str->data);
-                     }
-                     fsw_memdup(str->data, "..", str->len);
+                     fsw_memcpy(str->data, "..", str->len);
                      goto done;
                 }
                 len = nm->e.len - sizeof (struct fsw_rock_ridge_susp_nm) + 1;
-                fsw_alloc_zero(str->len + len, (void **) &tmp);
+                if (str->len + len == 0 || fsw_alloc_zero(str->len + len, (void **) &tmp) != FSW_SUCCESS)
+                    goto next;
                 if (str->data != NULL)
                 {
                     fsw_memcpy(tmp, str->data, str->len);
@@ -236,17 +252,22 @@ static fsw_status_t rr_find_nm(struct fsw_iso9660_volume *vol, struct iso9660_di
                     goto done;
             }
         }
+    next:
         r++;
         off = (int)(r - (fsw_u8 *)begin);
     }
-    if(fCe == 1)
-        fsw_free(begin);
+    if (str->data != NULL)
+        fsw_free(str->data);
+    str->data = NULL;
+    str->len = 0;
+    if (ce_buffer != NULL)
+        fsw_free(ce_buffer);
     return FSW_NOT_FOUND;
 done:
     str->type = FSW_STRING_TYPE_ISO88591;
     str->size = str->len;
-    if(fCe == 1)
-        fsw_free(begin);
+    if (ce_buffer != NULL)
+        fsw_free(ce_buffer);
     return FSW_SUCCESS;
 }
 
@@ -412,6 +433,8 @@ static fsw_status_t fsw_iso9660_volume_mount(struct fsw_iso9660_volume *vol)
 
 static void fsw_iso9660_volume_free(struct fsw_iso9660_volume *vol)
 {
+    FSW_MSG_DEBUG((FSW_MSGSTR("fsw_iso9660_volume_free: %d directory indexes built, %d lookups served by them\n"),
+                   vol->index_builds, vol->index_lookups));
     if (vol->primary_voldesc)
         fsw_free(vol->primary_voldesc);
 }
@@ -455,6 +478,7 @@ static fsw_status_t fsw_iso9660_dnode_fill(struct fsw_iso9660_volume *vol, struc
 
 static void fsw_iso9660_dnode_free(struct fsw_iso9660_volume *vol, struct fsw_iso9660_dnode *dno)
 {
+    fsw_iso9660_dir_index_free(vol, dno);
 }
 
 /**
@@ -512,47 +536,127 @@ static fsw_status_t fsw_iso9660_dir_lookup(struct fsw_iso9660_volume *vol, struc
 {
     fsw_status_t    status;
     struct fsw_shandle shand;
-    struct iso9660_dirrec_buffer dirrec_buffer;
+    struct iso9660_dirrec_buffer dirrec_buffer, match_buffer;
     struct iso9660_dirrec *dirrec = &dirrec_buffer.dirrec;
+    struct fsw_iso9660_dir_index *index;
+    struct fsw_iso9660_dirent *entry, *match;
+    struct fsw_string name, utf16_name;
+    fsw_u32         i, hash;
+    int             exact;
 
     // Preconditions: The caller has checked that dno is a directory node.
 
-    // setup handle to read the directory
+    // A directory that is only passed through once is cheaper to scan than to
+    // index, so the index is built on the second lookup in the same dnode.
+    index = NULL;
+    if (dno->index != NULL || dno->scan_lookups++ > 0) {
+        status = fsw_iso9660_dir_index_get(vol, dno, &index);
+        if (status)
+            return status;
+    }
+
+    // names are compared character by character, get UTF-8 names into fixed width first
+    utf16_name.data = NULL;
+    if (lookup_name->type == FSW_STRING_TYPE_UTF8) {
+        status = fsw_strdup_coerce(&utf16_name, FSW_STRING_TYPE_UTF16, lookup_name);
+        if (status)
+            return status;
+        lookup_name = &utf16_name;
+    }
+
+    if (index != NULL) {
+        // an exact match wins over one that differs in case only
+        match = NULL;
+        hash = fsw_iso9660_name_hash(lookup_name);
+        for (i = index->buckets[hash & (index->bucket_count - 1)]; i != ISO9660_INDEX_END; i = entry->hash_next) {
+            entry = &index->entries[i];
+            if (entry->hash != hash || entry->name_len != (fsw_u32)lookup_name->len)
+                continue;
+            name.type = FSW_STRING_TYPE_ISO88591;
+            name.len = name.size = entry->name_len;
+            name.data = index->names + entry->name_offset;
+            if (fsw_streq(lookup_name, &name)) {
+                match = entry;
+                break;
+            }
+            if (match == NULL && fsw_iso9660_name_caseeq(lookup_name, &name))
+                match = entry;
+        }
+        if (match == NULL) {
+            status = FSW_NOT_FOUND;
+            goto done;
+        }
+        vol->index_lookups++;
+
+        // setup a dnode for the child item
+        name.type = FSW_STRING_TYPE_ISO88591;
+        name.len = name.size = match->name_len;
+        name.data = index->names + match->name_offset;
+        status = fsw_dnode_create(dno, match->ino, FSW_DNODE_TYPE_UNKNOWN, &name, child_dno_out);
+        if (status == FSW_SUCCESS)
+            fsw_memcpy(&(*child_dno_out)->dirrec, &match->dirrec, sizeof (struct iso9660_dirrec));
+        goto done;
+    }
+
+    // no index for this directory, scan it
     status = fsw_shandle_open(dno, &shand);
     if (status)
-        return status;
+        goto done;
 
     dirrec_buffer.ino = 0;
+    match_buffer.ino = 0;
+    match_buffer.name.data = NULL;
 
-    // scan the directory for the file
+    // scan the directory for the file, keeping the first entry that differs in
+    // case only until an exact match turns up
     while (1) {
         // read next entry
         status = fsw_iso9660_read_dirrec(vol, &shand, &dirrec_buffer);
         if (status)
             goto errorexit;
-        if (dirrec->dirrec_length == 0) {
-            // end of directory reached
-            status = FSW_NOT_FOUND;
-            goto errorexit;
-        }
+        if (dirrec->dirrec_length == 0)
+            break;      // end of directory reached
 
         // skip . and ..
         if (dirrec->file_identifier_length == 1 &&
-            (dirrec->file_identifier[0] == 0 || dirrec->file_identifier[0] == 1))
+            (dirrec->file_identifier[0] == 0 || dirrec->file_identifier[0] == 1)) {
+            fsw_iso9660_free_name(&dirrec_buffer);
             continue;
+        }
 
         // compare name
-        if (fsw_streq(lookup_name, &dirrec_buffer.name))  // TODO: compare case-insensitively
-            break;
+        if (dirrec_buffer.name.len == lookup_name->len) {
+            exact = fsw_streq(lookup_name, &dirrec_buffer.name);
+            if (exact || (match_buffer.ino == 0 && fsw_iso9660_name_caseeq(lookup_name, &dirrec_buffer.name))) {
+                fsw_iso9660_free_name(&match_buffer);
+                match_buffer = dirrec_buffer;
+                if (dirrec_buffer.name.data == (void *)dirrec->file_identifier)
+                    match_buffer.name.data = match_buffer.dirrec.file_identifier;
+                dirrec_buffer.name.data = NULL;
+                if (exact)
+                    break;
+                continue;
+            }
+        }
+        fsw_iso9660_free_name(&dirrec_buffer);
     }
 
     // setup a dnode for the child item
-    status = fsw_dnode_create(dno, dirrec_buffer.ino, FSW_DNODE_TYPE_UNKNOWN, &dirrec_buffer.name, child_dno_out);
+    if (match_buffer.ino == 0) {
+        status = FSW_NOT_FOUND;
+        goto errorexit;
+    }
+    status = fsw_dnode_create(dno, match_buffer.ino, FSW_DNODE_TYPE_UNKNOWN, &match_buffer.name, child_dno_out);
     if (status == FSW_SUCCESS)
-        fsw_memcpy(&(*child_dno_out)->dirrec, dirrec, sizeof (struct iso9660_dirrec));
+        fsw_memcpy(&(*child_dno_out)->dirrec, &match_buffer.dirrec, sizeof (struct iso9660_dirrec));
 
 errorexit:
+    if (match_buffer.ino != 0)
+        fsw_iso9660_free_name(&match_buffer);
     fsw_shandle_close(&shand);
+done:
+    if (utf16_name.data != NULL)
+        fsw_strfree(&utf16_name);
     return status;
 }
 
@@ -570,6 +674,10 @@ static fsw_status_t fsw_iso9660_dir_read(struct fsw_iso9660_volume *vol, struct
     fsw_status_t    status;
     struct iso9660_dirrec_buffer dirrec_buffer;
     struct iso9660_dirrec *dirrec = &dirrec_buffer.dirrec;
+    struct fsw_iso9660_dir_index *index;
+    struct fsw_iso9660_dirent *entry;
+    struct fsw_string name;
+    fsw_u32         lo, hi, mid;
 
     // Preconditions: The caller has checked that dno is a directory node. The caller
     //  has opened a storage handle to the directory's storage and keeps it around between
@@ -578,6 +686,33 @@ static fsw_status_t fsw_iso9660_dir_read(struct fsw_iso9660_volume *vol, struct
      * should read both blocks.
      */
 
+    status = fsw_iso9660_dir_index_get(vol, dno, &index);
+    if (status)
+        return status;
+    if (index != NULL) {
+        // find the first entry at or after the position
+        for (lo = 0, hi = index->count; lo < hi; ) {
+            mid = (lo + hi) / 2;
+            if (index->entries[mid].pos < shand->pos)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo >= index->count)
+            return FSW_NOT_FOUND; // end of directory
+        entry = &index->entries[lo];
+        shand->pos = entry->next_pos;
+
+        // setup a dnode for the child item
+        name.type = FSW_STRING_TYPE_ISO88591;
+        name.len = name.size = entry->name_len;
+        name.data = index->names + entry->name_offset;
+        status = fsw_dnode_create(dno, entry->ino, FSW_DNODE_TYPE_UNKNOWN, &name, child_dno_out);
+        if (status == FSW_SUCCESS)
+            fsw_memcpy(&(*child_dno_out)->dirrec, &entry->dirrec, sizeof (struct iso9660_dirrec));
+        return status;
+    }
+
     dirrec_buffer.ino = 0;
 
     while (1) {
@@ -596,8 +731,10 @@ static fsw_status_t fsw_iso9660_dir_read(struct fsw_iso9660_volume *vol, struct
 
         // skip . and ..
         if (dirrec->file_identifier_length == 1 &&
-            (dirrec->file_identifier[0] == 0 || dirrec->file_identifier[0] == 1))
+            (dirrec->file_identifier[0] == 0 || dirrec->file_identifier[0] == 1)) {
+            fsw_iso9660_free_name(&dirrec_buffer);
             continue;
+        }
         break;
     }
 
@@ -605,6 +742,7 @@ static fsw_status_t fsw_iso9660_dir_read(struct fsw_iso9660_volume *vol, struct
     status = fsw_dnode_create(dno, dirrec_buffer.ino, FSW_DNODE_TYPE_UNKNOWN, &dirrec_buffer.name, child_dno_out);
     if (status == FSW_SUCCESS)
         fsw_memcpy(&(*child_dno_out)->dirrec, dirrec, sizeof (struct iso9660_dirrec));
+    fsw_iso9660_free_name(&dirrec_buffer);
 
     return status;
 }
@@ -612,34 +750,43 @@ static fsw_status_t fsw_iso9660_dir_read(struct fsw_iso9660_volume *vol, struct
 /**
  * Read a directory entry from the directory's raw data. This internal function is used
  * to read a raw iso9660 directory entry into memory. The shandle's position pointer is adjusted
- * to point to the next entry.
+ * to point to the next entry. Padding at the end of a block is skipped; a record length of
+ * zero is only returned at the end of the directory.
  */
 
 static fsw_status_t fsw_iso9660_read_dirrec(struct fsw_iso9660_volume *vol, struct fsw_shandle *shand, struct iso9660_dirrec_buffer *dirrec_buffer)
 {
     fsw_status_t    status;
-    fsw_u32         i, buffer_size, remaining_size, name_len;
-    struct fsw_rock_ridge_susp_sp *sp = NULL;
+    fsw_u32         buffer_size, remaining_size;
     struct iso9660_dirrec *dirrec = &dirrec_buffer->dirrec;
-    int sp_off;
-    int rc;
+    fsw_u64         start;
 
-    dirrec_buffer->ino = (ISOINT(((struct fsw_iso9660_dnode *)shand->dnode)->dirrec.extent_location)
-                          << ISO9660_BLOCKSIZE_BITS)
-        + (fsw_u32)shand->pos;
+    while (1) {
+        start = shand->pos;
+        dirrec_buffer->ino = (ISOINT(((struct fsw_iso9660_dnode *)shand->dnode)->dirrec.extent_location)
+                              << ISO9660_BLOCKSIZE_BITS)
+            + (fsw_u32)start;
+
+        // read fixed size part of directory record
+        buffer_size = 33;
+        status = fsw_shandle_read(shand, &buffer_size, dirrec);
+        if (status)
+        {
+        //    DEBUG((DEBUG_INFO, "%a:%d \n", __FILE__, __LINE__));
+            return status;
+        }
 
-    // read fixed size part of directory record
-    buffer_size = 33;
-    status = fsw_shandle_read(shand, &buffer_size, dirrec);
-    if (status)
-    {
-    //    DEBUG((DEBUG_INFO, "%a:%d \n", __FILE__, __LINE__));
-        return status;
-    }
+        if (buffer_size < 33) {
+            dirrec->dirrec_length = 0;
+            return FSW_SUCCESS;
+        }
+        if (dirrec->dirrec_length != 0)
+            break;
 
-    if (buffer_size < 33 || dirrec->dirrec_length == 0) {
-        dirrec->dirrec_length = 0;
-        return FSW_SUCCESS;
+        // records do not cross block boundaries, the rest of this block is padding
+        shand->pos = (start & ~(fsw_u64)(vol->g.log_blocksize - 1)) + vol->g.log_blocksize;
+        if (shand->pos >= shand->dnode->size)
+            return FSW_SUCCESS;
     }
     if (dirrec->dirrec_length < 33 ||
         dirrec->dirrec_length < 33 + dirrec->file_identifier_length)
@@ -655,6 +802,24 @@ static fsw_status_t fsw_iso9660_read_dirrec(struct fsw_iso9660_volume *vol, stru
     if (buffer_size < remaining_size)
         return FSW_VOLUME_CORRUPTED;
 
+    fsw_iso9660_dirrec_name(vol, dirrec_buffer);
+    return FSW_SUCCESS;
+}
+
+/**
+ * Set up the name of a directory record that has been read into memory. This is
+ * the Rock Ridge NM name if there is one, otherwise the file identifier without
+ * its version number.
+ */
+
+static void fsw_iso9660_dirrec_name(struct fsw_iso9660_volume *vol, struct iso9660_dirrec_buffer *dirrec_buffer)
+{
+    fsw_u32         i, name_len;
+    struct fsw_rock_ridge_susp_sp *sp = NULL;
+    struct iso9660_dirrec *dirrec = &dirrec_buffer->dirrec;
+    int sp_off;
+    int rc;
+
 //     dump_dirrec(dirrec);
      if (vol->fRockRidge)
      {
@@ -667,12 +832,12 @@ static fsw_status_t fsw_iso9660_read_dirrec(struct fsw_iso9660_volume *vol, stru
          }
          rc = rr_find_nm(vol, dirrec, sp_off,  &dirrec_buffer->name);
          if (rc == FSW_SUCCESS)
-            return FSW_SUCCESS;
+            return;
     }
 
     // setup name
     name_len = dirrec->file_identifier_length;
-    for (i = name_len - 1; i > 0; i--) {
+    for (i = name_len - 1; name_len > 0 && i > 0; i--) {
         if (dirrec->file_identifier[i] == ';') {
             name_len = i;   // cut the ISO9660 version number off
             break;
@@ -684,7 +849,264 @@ static fsw_status_t fsw_iso9660_read_dirrec(struct fsw_iso9660_volume *vol, stru
     dirrec_buffer->name.len = dirrec_buffer->name.size = name_len;
     dirrec_buffer->name.data = dirrec->file_identifier;
 //    DEBUG((DEBUG_INFO, "%a:%d: dirrec_buffer->name.data:%a\n", __FILE__, __LINE__, dirrec_buffer->name.data));
+}
+
+/**
+ * Upper-case a character of a name for case-insensitive comparison. Covers
+ * the Latin-1 range, which is all a name from the volume can hold.
+ */
+
+static fsw_u32 fsw_iso9660_fold(fsw_u32 c)
+{
+    if ((c >= 'a' && c <= 'z') || (c >= 0xE0 && c <= 0xFE && c != 0xF7))
+        return c - 0x20;
+    return c;
+}
+
+/**
+ * Get a character from a fixed width name, i.e. one that is not UTF-8.
+ */
+
+static fsw_u32 fsw_iso9660_name_char(struct fsw_string *s, fsw_u32 i)
+{
+    fsw_u16 c;
+
+    switch (s->type) {
+        case FSW_STRING_TYPE_UTF16:
+            return ((fsw_u16 *)s->data)[i];
+        case FSW_STRING_TYPE_UTF16_SWAPPED:
+            c = ((fsw_u16 *)s->data)[i];
+            return (fsw_u16)((c << 8) | (c >> 8));
+        default:
+            return ((fsw_u8 *)s->data)[i];
+    }
+}
+
+/**
+ * Hash a name for the directory index. Names that differ in case only hash
+ * to the same value.
+ */
+
+static fsw_u32 fsw_iso9660_name_hash(struct fsw_string *s)
+{
+    fsw_u32 h = 0x811C9DC5, i;
+
+    for (i = 0; i < (fsw_u32)s->len; i++)
+        h = (h ^ fsw_iso9660_fold(fsw_iso9660_name_char(s, i))) * 0x01000193;
+    return h;
+}
+
+/**
+ * Compare two fixed width names of the same length ignoring case.
+ */
+
+static int fsw_iso9660_name_caseeq(struct fsw_string *s1, struct fsw_string *s2)
+{
+    fsw_u32 i;
+
+    for (i = 0; i < (fsw_u32)s1->len; i++)
+        if (fsw_iso9660_fold(fsw_iso9660_name_char(s1, i)) != fsw_iso9660_fold(fsw_iso9660_name_char(s2, i)))
+            return 0;
+    return 1;
+}
+
+/**
+ * Release a Rock Ridge name that fsw_iso9660_read_dirrec allocated. Plain
+ * names point into the directory record buffer and are left alone.
+ */
+
+static void fsw_iso9660_free_name(struct iso9660_dirrec_buffer *dirrec_buffer)
+{
+    if (dirrec_buffer->name.data != NULL &&
+        dirrec_buffer->name.data != (void *)dirrec_buffer->dirrec.file_identifier)
+        fsw_free(dirrec_buffer->name.data);
+    dirrec_buffer->name.data = NULL;
+}
+
+/**
+ * Grow an array of the index so that it holds at least need bytes.
+ */
+
+static fsw_status_t fsw_iso9660_index_grow(void **buffer, fsw_u32 used, fsw_u32 *size, fsw_u32 need)
+{
+    fsw_status_t    status;
+    void            *new_buffer;
+    fsw_u32         new_size;
+
+    if (need <= *size)
+        return FSW_SUCCESS;
+    for (new_size = *size ? *size * 2 : 1024; new_size < need; new_size *= 2)
+        ;
+    status = fsw_alloc(new_size, &new_buffer);
+    if (status)
+        return status;
+    if (*buffer != NULL) {
+        fsw_memcpy(new_buffer, *buffer, used);
+        fsw_free(*buffer);
+    }
+    *buffer = new_buffer;
+    *size = new_size;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Free the name index of a directory and give its memory back to the volume.
+ */
+
+static void fsw_iso9660_dir_index_free(struct fsw_iso9660_volume *vol, struct fsw_iso9660_dnode *dno)
+{
+    struct fsw_iso9660_dir_index *index = dno->index;
+
+    if (index == NULL)
+        return;
+    vol->index_bytes -= index->bytes;
+    if (index->buckets)
+        fsw_free(index->buckets);
+    if (index->entries)
+        fsw_free(index->entries);
+    if (index->names)
+        fsw_free(index->names);
+    fsw_free(index);
+    dno->index = NULL;
+}
+
+/**
+ * Get the name index of a directory, building it with one scan over the
+ * directory on first use. Rock Ridge names, including those continued in
+ * CE areas, are resolved once here. If the index would push the volume over
+ * ISO9660_INDEX_MAX_BYTES, no index is built and *index_out is NULL; the
+ * callers then scan the directory themselves. The same goes for every later
+ * call once building the index has failed for any reason.
+ */
+
+static fsw_status_t fsw_iso9660_dir_index_get(struct fsw_iso9660_volume *vol, struct fsw_iso9660_dnode *dno,
+                                              struct fsw_iso9660_dir_index **index_out)
+{
+    fsw_status_t    status;
+    struct fsw_shandle shand;
+    struct iso9660_dirrec_buffer dirrec_buffer;
+    struct iso9660_dirrec *dirrec = &dirrec_buffer.dirrec;
+    struct fsw_iso9660_dir_index *index;
+    struct fsw_iso9660_dirent *entry;
+    struct fsw_string name;
+    fsw_u8          *block;
+    fsw_u32         block_pos, block_size, offset;
+    fsw_u32         entries_size = 0, names_size = 0, names_used = 0, i;
+
+    *index_out = dno->index;
+    if (dno->index != NULL || dno->index_failed)
+        return FSW_SUCCESS;
+    if (vol->index_bytes + sizeof (struct fsw_iso9660_dir_index) > ISO9660_INDEX_MAX_BYTES) {
+        dno->index_failed = 1;
+        return FSW_SUCCESS;
+    }
+
+    // whatever stops the build, later lookups scan instead of trying again
+    dno->index_failed = 1;
+    status = fsw_alloc_zero(sizeof (struct fsw_iso9660_dir_index), (void **) &index);
+    if (status)
+        return status;
+    status = fsw_alloc(ISO9660_BLOCKSIZE, (void **) &block);
+    if (status) {
+        fsw_free(index);
+        return status;
+    }
+    status = fsw_shandle_open(dno, &shand);
+    if (status) {
+        fsw_free(block);
+        fsw_free(index);
+        return status;
+    }
+
+    // go through the directory a block at a time, records do not cross block boundaries
+    for (block_pos = 0; block_pos < dno->g.size; block_pos += ISO9660_BLOCKSIZE) {
+        shand.pos = block_pos;
+        block_size = ISO9660_BLOCKSIZE;
+        status = fsw_shandle_read(&shand, &block_size, block);
+        if (status)
+            goto errorexit;
+
+        for (offset = 0; offset + 33 <= block_size && block[offset] != 0; offset += dirrec->dirrec_length) {
+            fsw_memcpy(dirrec, block + offset, 33);
+            if (dirrec->dirrec_length < 33 + dirrec->file_identifier_length ||
+                offset + dirrec->dirrec_length > block_size) {
+                status = FSW_VOLUME_CORRUPTED;
+                goto errorexit;
+            }
+            fsw_memcpy(dirrec, block + offset, dirrec->dirrec_length);
+
+            // skip . and ..
+            if (dirrec->file_identifier_length == 1 &&
+                (dirrec->file_identifier[0] == 0 || dirrec->file_identifier[0] == 1))
+                continue;
+
+            dirrec_buffer.ino = (ISOINT(dno->dirrec.extent_location) << ISO9660_BLOCKSIZE_BITS) + block_pos + offset;
+            fsw_iso9660_dirrec_name(vol, &dirrec_buffer);
+            name = dirrec_buffer.name;
+
+            // make room for the entry and its name, within the volume's budget
+            status = fsw_iso9660_index_grow((void **) &index->entries, index->count * sizeof (struct fsw_iso9660_dirent),
+                                            &entries_size, (index->count + 1) * sizeof (struct fsw_iso9660_dirent));
+            if (!status)
+                status = fsw_iso9660_index_grow((void **) &index->names, names_used, &names_size, names_used + name.size);
+            if (status || vol->index_bytes + entries_size + names_size > ISO9660_INDEX_MAX_BYTES) {
+                fsw_iso9660_free_name(&dirrec_buffer);
+                goto errorexit;
+            }
+
+            entry = &index->entries[index->count++];
+            entry->pos = block_pos + offset;
+            entry->next_pos = entry->pos + dirrec->dirrec_length;
+            entry->ino = dirrec_buffer.ino;
+            entry->hash = fsw_iso9660_name_hash(&name);
+            entry->name_offset = names_used;
+            entry->name_len = name.size;
+            fsw_memcpy(&entry->dirrec, dirrec, sizeof (struct iso9660_dirrec));
+            if (name.size)
+                fsw_memcpy(index->names + names_used, name.data, name.size);
+            names_used += name.size;
+            fsw_iso9660_free_name(&dirrec_buffer);
+        }
+    }
+
+    // chain the entries into hash buckets, keeping directory order within a bucket
+    for (index->bucket_count = 16; index->bucket_count < index->count; index->bucket_count *= 2)
+        ;
+    index->bytes = sizeof (struct fsw_iso9660_dir_index) + entries_size + names_size +
+                   index->bucket_count * sizeof (fsw_u32);
+    if (vol->index_bytes + index->bytes > ISO9660_INDEX_MAX_BYTES)
+        goto errorexit;
+    status = fsw_alloc(index->bucket_count * sizeof (fsw_u32), (void **) &index->buckets);
+    if (status)
+        goto errorexit;
+    for (i = 0; i < index->bucket_count; i++)
+        index->buckets[i] = ISO9660_INDEX_END;
+    for (i = index->count; i-- > 0; ) {
+        entry = &index->entries[i];
+        entry->hash_next = index->buckets[entry->hash & (index->bucket_count - 1)];
+        index->buckets[entry->hash & (index->bucket_count - 1)] = i;
+    }
+
+    fsw_shandle_close(&shand);
+    fsw_free(block);
+    vol->index_bytes += index->bytes;
+    vol->index_builds++;
+    dno->index = index;
+    dno->index_failed = 0;
+    *index_out = index;
     return FSW_SUCCESS;
+
+errorexit:
+    fsw_shandle_close(&shand);
+    fsw_free(block);
+    if (index->buckets)
+        fsw_free(index->buckets);
+    if (index->entries)
+        fsw_free(index->entries);
+    if (index->names)
+        fsw_free(index->names);
+    fsw_free(index);
+    return status;
 }
 
 /**
@@ -140,6 +140,39 @@ struct iso9660_dirrec_buffer {
 };
 
 
+/**
+ * ISO9660: One directory entry in a directory's name index.
+ */
+
+struct fsw_iso9660_dirent {
+    fsw_u32     pos;                //!< Offset of the directory record in the directory
+    fsw_u32     next_pos;           //!< Offset just past the directory record
+    fsw_u32     ino;                //!< Inode number made up from the record's location
+    fsw_u32     hash;               //!< Hash of the upper-cased name
+    fsw_u32     hash_next;          //!< Next entry in the same bucket, or ISO9660_INDEX_END
+    fsw_u32     name_offset;        //!< Offset of the name in the index's name pool
+    fsw_u32     name_len;           //!< Length of the name in bytes
+    struct iso9660_dirrec dirrec;   //!< Fixed part of the directory record (i.e. w/o name)
+};
+
+#define ISO9660_INDEX_END 0xFFFFFFFF
+
+/**
+ * ISO9660: Name index of a directory. The names are the resolved ones, i.e.
+ * Rock Ridge NM names where present, without version numbers otherwise.
+ * Entries are kept in directory order for dir_read and chained into hash
+ * buckets for dir_lookup.
+ */
+
+struct fsw_iso9660_dir_index {
+    fsw_u32     count;              //!< Number of entries
+    fsw_u32     bucket_count;       //!< Number of hash buckets, a power of two
+    fsw_u32     bytes;              //!< Memory taken by the index, charged to the volume
+    fsw_u32     *buckets;           //!< First entry of each hash bucket
+    struct fsw_iso9660_dirent *entries;
+    fsw_u8      *names;             //!< Name pool
+};
+
 /**
  * ISO9660: Volume structure with ISO9660-specific data.
  */
@@ -154,6 +187,10 @@ struct fsw_iso9660_volume {
     int rr_susp_skip;
 
     struct iso9660_primary_volume_descriptor *primary_voldesc;  //!< Full Primary Volume Descriptor
+
+    fsw_u32     index_bytes;        //!< Memory taken by all directory name indexes
+    fsw_u32     index_builds;       //!< Directory name indexes built
+    fsw_u32     index_lookups;      //!< Lookups served from a name index
 };
 
 /**
@@ -164,6 +201,10 @@ struct fsw_iso9660_dnode {
     struct fsw_dnode g;             //!< Generic dnode structure
 
     struct iso9660_dirrec dirrec;   //!< Fixed part of the directory record (i.e. w/o name)
+
+    struct fsw_iso9660_dir_index *index;    //!< Name index, built on first use for directories
+    int         index_failed;       //!< Set when the index could not be built
+    fsw_u32     scan_lookups;       //!< Lookups done by scanning before the index was built
 };
 
 
@@ -27,8 +27,7 @@
   */
 
 #include "fsw_core.h"
-
-#define Print(x...)	/* */
+#include "fsw_codec.h"
 
 static inline fsw_u8 GETU8(fsw_u8 *buf, int pos)
 {
@@ -50,6 +49,8 @@ static inline fsw_u64 GETU64(fsw_u8 *buf, int pos)
     return fsw_u64_le_swap(*(fsw_u64 *)(buf+pos));
 }
 
+#include "lznt1.c"
+
 #define MFTMASK  ((1ULL<<48) - 1)
 #define BADMFT	(~0ULL)
 #define MFTNO_MFT	0
@@ -102,6 +103,10 @@ struct extent_map
      * read_mft recursive or dead loop.
      * While mft has too many fragments, it need AT_ATTRIBUTE_LIST for extra
      * data, the AT_ATTRIBUTE_LIST parsing code need call read_mft again.
+     *
+     * Non-resident attributes of dnodes get one as well, decoded from all
+     * their run list segments on first access and sorted by vcn. Sparse
+     * runs are not stored, they are the gaps between slots.
      */
     struct extent_slot *extent;
     int total;
@@ -125,6 +130,55 @@ struct ntfs_attr
     int type;			/* current attribute type */
 };
 
+/*
+ * $I30 index node, either the one in AT_INDEX_ROOT or an INDX block, with
+ * the offsets of its entries so that it can be binary searched. The last
+ * offset is that of the end entry.
+ */
+struct ntfs_index_node
+{
+    fsw_u8 *hdr;		/* index header */
+    int len;			/* used bytes from hdr */
+    int count;			/* entries before the end entry */
+    fsw_u16 *entry;		/* entry offsets from hdr, count+1 */
+};
+
+/*
+ * Fixed up INDX blocks are kept in a small per-volume LRU keyed by
+ * directory and block, so that a lookup reads each level of a directory
+ * index once and the upper levels, which every lookup in a large directory
+ * passes through, stay in memory.
+ */
+#ifndef INDEX_CACHE_SIZE
+#define INDEX_CACHE_SIZE 16
+#endif
+struct ntfs_index_cache
+{
+    fsw_u64 mftno;		/* directory */
+    fsw_u64 block;		/* index block: vcn+1 */
+    fsw_u8 *buf;		/* fixed up INDX block */
+    struct ntfs_index_node node;
+    unsigned lastuse;
+};
+
+/*
+ * Fixed up MFT records, keyed by record number. Directory and system
+ * records are the ones read over and over (every lookup and dnode_fill
+ * of a path walks them), so they are kept in preference to file records
+ * and a file read only ever evicts another file record, unless nothing
+ * else is left.
+ */
+#ifndef MFT_CACHE_SIZE
+#define MFT_CACHE_SIZE 64
+#endif
+struct ntfs_mft_cache
+{
+    fsw_u64 mftno;
+    fsw_u8 *buf;		/* fixed up MFT record */
+    int meta;			/* system or directory record */
+    unsigned lastuse;
+};
+
 struct fsw_ntfs_volume
 {
     struct fsw_volume g;
@@ -137,6 +191,16 @@ struct fsw_ntfs_volume
     fsw_u8 clbits;		/* cluster size */
     fsw_u8 mftbits;		/* MFT record size */
     fsw_u8 idxbits;		/* unused index size, use AT_INDEX_ROOT instead */
+
+    struct ntfs_index_cache *icache;	/* INDX block LRU, INDEX_CACHE_SIZE entries */
+    unsigned icache_tick;
+    fsw_u32 icache_hits;
+    fsw_u32 icache_misses;
+
+    struct ntfs_mft_cache *mcache;	/* MFT record LRU, MFT_CACHE_SIZE entries */
+    unsigned mcache_tick;
+    fsw_u32 mcache_hits;
+    fsw_u32 mcache_misses;
 };
 
 struct fsw_ntfs_dnode
@@ -145,6 +209,7 @@ struct fsw_ntfs_dnode
     struct ntfs_mft mft;
     struct ntfs_attr attr;	/* AT_INDEX_ALLOCATION:$I30/AT_DATA */
     fsw_u8 *idxroot;		/* AT_INDEX_ROOT:$I30 */
+    struct ntfs_index_node root;	/* index node in idxroot */
     fsw_u8 *idxbmp;		/* AT_BITMAP:$I30 */
     unsigned int embeded:1;	/* embeded AT_DATA */
     unsigned int has_idxtree:1;	/* valid AT_INDEX_ALLOCATION:$I30 */
@@ -157,12 +222,13 @@ struct fsw_ntfs_dnode
     int idxsz;			/* size of index block */
     int rootsz;			/* size of idxroot: AT_INDEX_ROOT:$I30 */
     int bmpsz;			/* size of idxbmp: AT_BITMAP:$I30 */
-    struct extent_slot cext;	/* cached extent */
+    struct extent_map emap;	/* run list of attr */
+    unsigned int has_emap:1;	/* emap is loaded */
     fsw_u64 fsize;		/* logical file size */
     fsw_u64 finited;		/* initialized file size */
     fsw_u64 cvcn;		/* vcn of compress chunk: cbuf */
     fsw_u64 clcn[16];		/* cluster map of compress chunk */
-    fsw_u8 *cbuf;		/* compress chunk/index block/symlink target */
+    fsw_u8 *cbuf;		/* compress chunk/symlink target */
 };
 
 static fsw_status_t fixup(fsw_u8 *record, char *magic, int sectorsize, int size)
@@ -177,6 +243,9 @@ static fsw_status_t fixup(fsw_u8 *record, char *magic, int sectorsize, int size)
     cnt = GETU16(record, 6);
     if(size && sectorsize*(cnt-1) != size)
 	return FSW_VOLUME_CORRUPTED;
+    /* the update sequence array must lie before the first fixed up word */
+    if(cnt < 1 || off + cnt*2 > sectorsize - 2)
+	return FSW_VOLUME_CORRUPTED;
     val = GETU16(record, off);
     for(i=1; i<cnt; i++) {
 	if(GETU16(record, i*sectorsize-2)!=val)
@@ -460,7 +529,7 @@ static fsw_status_t load_atlist(struct fsw_ntfs_volume *vol, struct ntfs_mft *mf
     return read_attribute_direct(vol, ptr, len, &mft->atlst, &mft->atlen);
 }
 
-static fsw_status_t read_mft(struct fsw_ntfs_volume *vol, fsw_u8 *mft, fsw_u64 mftno)
+static fsw_status_t read_mft_direct(struct fsw_ntfs_volume *vol, fsw_u8 *mft, fsw_u64 mftno)
 {
     int l = 0;
     int r = vol->extmap.used - 1;
@@ -503,6 +572,15 @@ static fsw_status_t read_mft(struct fsw_ntfs_volume *vol, fsw_u8 *mft, fsw_u64 m
                 return FSW_VOLUME_CORRUPTED;
             }
 
+            /* the usual case: the whole record in one run, one host read */
+            if(ecnt >= (fsw_u64)count && vol->g.host_table->read_blocks != NULL) {
+                err = vol->g.host_table->read_blocks(&vol->g, lcn, count, mft);
+                if (err != FSW_SUCCESS) {
+                    return FSW_VOLUME_CORRUPTED;
+                }
+                return fixup(mft, "FILE", 1<<vol->sctbits, 1<<vol->mftbits);
+            }
+
             while(count-- > 0) {
                 fsw_u8 *buffer;
                 err = fsw_block_get(&vol->g, lcn, 0, (void **) &buffer);
@@ -532,6 +610,52 @@ static fsw_status_t read_mft(struct fsw_ntfs_volume *vol, fsw_u8 *mft, fsw_u64 m
     return FSW_NOT_FOUND;
 }
 
+static fsw_status_t read_mft(struct fsw_ntfs_volume *vol, fsw_u8 *mft, fsw_u64 mftno)
+{
+    int i;
+    int size = 1<<vol->mftbits;
+    struct ntfs_mft_cache *mc, *victim = NULL;
+    fsw_status_t err;
+
+    if(vol->mcache == NULL) {
+	if(fsw_alloc_zero(sizeof (struct ntfs_mft_cache) * MFT_CACHE_SIZE, (void **) &vol->mcache) != FSW_SUCCESS)
+	    return read_mft_direct(vol, mft, mftno);
+    }
+    for(i = 0; i < MFT_CACHE_SIZE; i++) {
+	mc = &vol->mcache[i];
+	if(mc->buf && mc->mftno == mftno) {
+	    vol->mcache_hits++;
+	    mc->lastuse = ++vol->mcache_tick;
+	    fsw_memcpy(mft, mc->buf, size);
+	    return FSW_SUCCESS;
+	}
+    }
+    vol->mcache_misses++;
+
+    err = read_mft_direct(vol, mft, mftno);
+    if(err != FSW_SUCCESS)
+	return err;
+
+    /* an empty slot, else the oldest file record, else the oldest one */
+    for(i = 0; i < MFT_CACHE_SIZE; i++) {
+	mc = &vol->mcache[i];
+	if(mc->buf == NULL) {
+	    victim = mc;
+	    break;
+	}
+	if(victim == NULL || mc->meta < victim->meta ||
+		(mc->meta == victim->meta && mc->lastuse < victim->lastuse))
+	    victim = mc;
+    }
+    if(victim->buf == NULL && fsw_alloc(size, (void **) &victim->buf) != FSW_SUCCESS)
+	return FSW_SUCCESS;
+    fsw_memcpy(victim->buf, mft, size);
+    victim->mftno = mftno;
+    victim->meta = mftno < MFTNO_META || (GETU16(mft, 0x16) & 2) != 0;
+    victim->lastuse = ++vol->mcache_tick;
+    return FSW_SUCCESS;
+}
+
 static void init_attr(struct fsw_ntfs_volume *vol, struct ntfs_attr *attr, int type)
 {
     fsw_memzero(attr, sizeof (*attr));
@@ -590,16 +714,15 @@ static fsw_status_t read_small_attribute(struct fsw_ntfs_volume *vol, struct ntf
     return err;
 }
 
-static void add_single_mft_map(struct fsw_ntfs_volume *vol, fsw_u8 *mft)
+/*
+ * Append the runs of one segment of a non-resident attribute to map. A run
+ * continuing the previous one on disk extends it, so the map holds maximal
+ * contiguous extents.
+ */
+static fsw_status_t extent_map_add(struct extent_map *map, fsw_u8 *ptr, int len)
 {
-    fsw_u8 *ptr;
-    int len;
-
-    if(find_attribute_direct(mft, 1<<vol->mftbits, AT_DATA, &ptr, &len)!=FSW_SUCCESS)
-	return;
-
     if(attribute_ondisk(ptr, len) == 0) // RESIDENT_FORM
-	return;
+	return FSW_SUCCESS;
 
     fsw_u64 vcn = GETU64(ptr, 0x10); // ATTRIBUTE_RECORD_HEADER.Form.Nonresident.LowestVcn
     int     off = GETU16(ptr, 0x20); // ATTRIBUTE_RECORD_HEADER.Form.Nonresident.MappingPairsOffset
@@ -611,44 +734,198 @@ static void add_single_mft_map(struct fsw_ntfs_volume *vol, fsw_u8 *mft)
 
     while(len > 0 && get_extent(&ptr, &len, &lcn, &cnt, &pos)==FSW_SUCCESS) {
 	if(lcn) {
-	    int u = vol->extmap.used;
-	    if(u >= vol->extmap.total) {
-		vol->extmap.total = vol->extmap.extent ? u*2 : 16;
-		struct extent_slot *e;
-		if(fsw_alloc(vol->extmap.total * sizeof (struct extent_slot), &e)!=FSW_SUCCESS)
-		    break;
-		if(vol->extmap.extent) {
-		    fsw_memcpy(e, vol->extmap.extent, u*sizeof (struct extent_slot));
-		    fsw_free(vol->extmap.extent);
+	    int u = map->used;
+	    struct extent_slot *e = map->extent;
+	    if(u > 0 && e[u-1].vcn + e[u-1].cnt == vcn && e[u-1].lcn + e[u-1].cnt == lcn) {
+		e[u-1].cnt += cnt;
+		vcn += cnt;
+		continue;
+	    }
+	    if(u >= map->total) {
+		int total = e ? u*2 : 16;
+		if(fsw_alloc(total * sizeof (struct extent_slot), &e)!=FSW_SUCCESS)
+		    return FSW_OUT_OF_MEMORY;
+		if(map->extent) {
+		    fsw_memcpy(e, map->extent, u*sizeof (struct extent_slot));
+		    fsw_free(map->extent);
 		}
-		vol->extmap.extent = e;
+		map->extent = e;
+		map->total = total;
 	    }
-	    vol->extmap.extent[u].vcn = vcn;
-	    vol->extmap.extent[u].lcn = lcn;
-	    vol->extmap.extent[u].cnt = cnt;
-	    vol->extmap.used++;
+	    e[u].vcn = vcn;
+	    e[u].lcn = lcn;
+	    e[u].cnt = cnt;
+	    map->used++;
 	}
 	vcn += cnt;
     }
+    return FSW_SUCCESS;
+}
+
+/* segments are listed in vcn order, so this is one pass normally */
+static void extent_map_sort(struct extent_map *map)
+{
+    int i, j;
+    for(i = 1; i < map->used; i++) {
+	struct extent_slot t = map->extent[i];
+	for(j = i; j > 0 && map->extent[j-1].vcn > t.vcn; j--)
+	    map->extent[j] = map->extent[j-1];
+	map->extent[j] = t;
+    }
+}
+
+/* index of the last slot starting at or before vcn, -1 if none */
+static int extent_map_find(struct extent_map *map, fsw_u64 vcn)
+{
+    int l = 0;
+    int r = map->used - 1;
+    while(l <= r) {
+	int m = (l+r)/2;
+	if(vcn < map->extent[m].vcn)
+	    r = m - 1;
+	else
+	    l = m + 1;
+    }
+    return r;
+}
+
+static void free_extent_map(struct extent_map *map)
+{
+    if(map->extent)
+	fsw_free(map->extent);
+    map->extent = NULL;
+    map->total = map->used = 0;
+}
+
+/*
+ * Decode the run lists of all segments of an attribute into map, reading
+ * each extension record named by the attribute list once.
+ */
+static fsw_status_t load_extent_map(struct fsw_ntfs_volume *vol, struct ntfs_mft *mft, int type, struct extent_map *map)
+{
+    fsw_status_t err = FSW_SUCCESS;
+    fsw_u8 *ptr;
+    int len;
+
+    if(mft->atlst == NULL || mft->atlen == 0) {
+	err = find_attribute_direct(mft->buf, 1<<vol->mftbits, type, &ptr, &len);
+	if(err != FSW_SUCCESS)
+	    return err;
+	return extent_map_add(map, ptr, len);
+    }
+
+    fsw_u8 *atlst = mft->atlst;
+    fsw_u8 *emft = NULL;
+    fsw_u64 last = BADMFT;
+    int namelen = type>>ATTRBITS;
+    int pos = 0;
+
+    while(pos + 0x18 <= mft->atlen) {
+	int off = pos;
+	fsw_u32 t = GETU32(atlst, off);
+	fsw_u32 n = GETU16(atlst, off+4);
+
+	pos = off + n;
+	if(t==0 || (t+1)==0 || t==0xffff || n < 0x18 || pos > mft->atlen)
+	    break;
+
+	fsw_u8 ns = GETU8(atlst, off+6);
+	fsw_u8 *nm = atlst + off + GETU8(atlst, off+7);
+	if(t != (type & ATTRMASK) || namelen != ns || (ns != 0 && !fsw_memeq(NAME_I30, nm, ns*2)))
+	    continue;
+
+	fsw_u64 mftno = GETU64(atlst, off+0x10) & MFTMASK;
+	fsw_u8 *buf = mft->buf;
+	if(mftno == last)
+	    continue;
+	last = mftno;
+	if(mftno != mft->mftno) {
+	    if(emft == NULL && (err = fsw_alloc(1<<vol->mftbits, &emft)) != FSW_SUCCESS)
+		break;
+	    if((err = read_mft(vol, emft, mftno)) != FSW_SUCCESS)
+		break;
+	    buf = emft;
+	}
+	if((err = find_attribute_direct(buf, 1<<vol->mftbits, type, &ptr, &len)) != FSW_SUCCESS)
+	    break;
+	if((err = extent_map_add(map, ptr, len)) != FSW_SUCCESS)
+	    break;
+    }
+    if(emft)
+	fsw_free(emft);
+    extent_map_sort(map);
+    return err;
 }
 
 static void add_mft_map(struct fsw_ntfs_volume *vol, struct ntfs_mft *mft)
 {
     load_atlist(vol, mft);
-    add_single_mft_map(vol, mft->buf);
-    if(mft->atlst == NULL) return;
+    load_extent_map(vol, mft, AT_DATA, &vol->extmap);
+}
 
-    fsw_u64 mftno;
-    int pos = 0;
+static fsw_status_t parse_index_node(fsw_u8 *hdr, int len, struct ntfs_index_node *node)
+{
+    int pass, off, n = 0;
+    fsw_status_t err;
 
-    fsw_u8 *emft;
-    if(fsw_alloc(1<<vol->mftbits, &emft) != FSW_SUCCESS) return;
-    while(find_attrlist_direct(mft->atlst, mft->atlen, AT_DATA, 0, &mftno, &pos) == FSW_SUCCESS) {
-	if(mftno == 0) continue;
-	if(read_mft(vol, emft, mftno)==FSW_SUCCESS)
-	    add_single_mft_map(vol, emft);
+    node->hdr = hdr;
+    node->count = 0;
+    node->entry = NULL;
+    if(len < 0x10)
+	return FSW_VOLUME_CORRUPTED;
+    /* real index size */
+    if(GETU32(hdr, 4) < len)
+	len = GETU32(hdr, 4);
+    node->len = len;
+
+    /* count the entries, then record their offsets */
+    for(pass = 0; pass < 2; pass++) {
+	n = 0;
+	for(off = GETU32(hdr, 0); ; off += GETU16(hdr, off+8)) {
+	    int flag, elen;
+	    if(off < 0x10 || off + 0x10 > len)
+		return FSW_VOLUME_CORRUPTED;
+	    flag = GETU8(hdr, off+12);
+	    elen = GETU16(hdr, off+8);
+	    if(elen < 0x10 || off + elen > len)
+		return FSW_VOLUME_CORRUPTED;
+	    /* the subnode vcn ends the entry, the name must fit before it */
+	    if((flag & 1) && elen < 0x18)
+		return FSW_VOLUME_CORRUPTED;
+	    if(!(flag & 2) && (elen < 0x52 || 0x52 + 2*GETU8(hdr, off+0x50) + (flag & 1 ? 8 : 0) > elen))
+		return FSW_VOLUME_CORRUPTED;
+	    if(pass)
+		node->entry[n] = off;
+	    if(flag & 2)
+		break;
+	    n++;
+	}
+	if(pass == 0) {
+	    err = fsw_alloc((n + 1) * sizeof (fsw_u16), &node->entry);
+	    if(err != FSW_SUCCESS)
+		return err;
+	}
     }
-    fsw_free(emft);
+    node->count = n;
+    return FSW_SUCCESS;
+}
+
+static void free_index_node(struct ntfs_index_node *node)
+{
+    if(node->entry)
+	fsw_free(node->entry);
+    node->entry = NULL;
+}
+
+static inline fsw_u8 *index_entry(struct ntfs_index_node *node, int i)
+{
+    return node->hdr + node->entry[i];
+}
+
+static inline fsw_u64 index_child(struct ntfs_index_node *node, int i)
+{
+    fsw_u8 *e = index_entry(node, i);
+    return GETU64(e, GETU16(e, 8) - 8);
 }
 
 static int tobits(fsw_u32 val)
@@ -667,6 +944,7 @@ static fsw_status_t fsw_ntfs_volume_mount(struct fsw_volume *volg)
     fsw_u64 mft_start[2];
     struct ntfs_mft mft0;
 
+    fsw_codec_register(&fsw_codec_lznt1);
     fsw_set_blocksize(volg, 512, 512);
     if ((err = fsw_block_get(volg, 0, 0, (void **) &buffer)) != FSW_SUCCESS)
 	return FSW_UNSUPPORTED;
@@ -680,7 +958,7 @@ static fsw_status_t fsw_ntfs_volume_mount(struct fsw_volume *volg)
 
     vol->sctbits = tobits(sector_size);
     vol->totalbytes = GETU64(buffer, 0x28) << vol->sctbits;
-    Print(L"NTFS size=%ld M\n", vol->totalbytes>>20);
+    FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ntfs_volume_mount: %d MiB\n"), (int)(vol->totalbytes>>20)));
 
     cluster_size = GETU8(buffer, 0xD) * sector_size;
     if(cluster_size==0 || (cluster_size & (cluster_size-1)) || cluster_size > 0x10000)
@@ -740,11 +1018,11 @@ static fsw_status_t fsw_ntfs_volume_mount(struct fsw_volume *volg)
     {
     int i;
     for(i=0; i<vol->extmap.used; i++)
-	Print(L"extent %d: vcn=%lx lcn=%lx len=%lx\n",
+	FSW_MSG_DEBUGV((FSW_MSGSTR("fsw_ntfs_volume_mount: MFT extent %d: vcn %llx lcn %llx len %llx\n"),
 		i,
-		vol->extmap.extent[i].vcn,
-		vol->extmap.extent[i].lcn,
-		vol->extmap.extent[i].cnt);
+		(unsigned long long)vol->extmap.extent[i].vcn,
+		(unsigned long long)vol->extmap.extent[i].lcn,
+		(unsigned long long)vol->extmap.extent[i].cnt));
     }
 
     free_mft(&mft0);
@@ -762,7 +1040,6 @@ static fsw_status_t fsw_ntfs_volume_mount(struct fsw_volume *volg)
         s.size = GETU16(ptr, 0x10); // ATTRIBUTE_RECORD_HEADER.Form.Resident.ValueLength
         s.len = s.size / 2;
         s.data = ptr + GETU16(ptr, 0x14); // ATTRIBUTE_RECORD_HEADER.Form.Resident.ValueOffset
-        Print(L"Volume name [%.*ls]\n", s.len, s.data);
         fsw_strdup_coerce(&volg->label, volg->host_string_type, &s);
     }
     free_mft(&mft0);
@@ -777,10 +1054,30 @@ static fsw_status_t fsw_ntfs_volume_mount(struct fsw_volume *volg)
 static void fsw_ntfs_volume_free(struct fsw_volume *volg)
 {
     struct fsw_ntfs_volume *vol = (struct fsw_ntfs_volume *)volg;
-    if(vol->extmap.extent)
-	fsw_free(vol->extmap.extent);
+    free_extent_map(&vol->extmap);
     if(vol->upcase && vol->upcase != upcase)
 	fsw_free((void *)vol->upcase);
+    if(vol->icache) {
+	int i;
+	FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ntfs_volume_free: index cache hits %d misses %d\n"),
+		    (int)vol->icache_hits, (int)vol->icache_misses));
+	for(i = 0; i < INDEX_CACHE_SIZE; i++) {
+	    if(vol->icache[i].buf) {
+		free_index_node(&vol->icache[i].node);
+		fsw_free(vol->icache[i].buf);
+	    }
+	}
+	fsw_free(vol->icache);
+    }
+    if(vol->mcache) {
+	int i;
+	FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ntfs_volume_free: MFT cache hits %d misses %d\n"),
+		    (int)vol->mcache_hits, (int)vol->mcache_misses));
+	for(i = 0; i < MFT_CACHE_SIZE; i++)
+	    if(vol->mcache[i].buf)
+		fsw_free(vol->mcache[i].buf);
+	fsw_free(vol->mcache);
+    }
 }
 
 static fsw_status_t fsw_ntfs_volume_stat(struct fsw_volume *volg, struct fsw_volume_stat *sb)
@@ -797,12 +1094,21 @@ static void fsw_ntfs_dnode_free(struct fsw_volume *vol, struct fsw_dnode *dnog)
     struct fsw_ntfs_dnode *dno = (struct fsw_ntfs_dnode *)dnog;
     free_mft(&dno->mft);
     free_attr(&dno->attr);
+    free_index_node(&dno->root);
+    free_extent_map(&dno->emap);
+    dno->has_emap = 0;
     if(dno->idxroot)
 	fsw_free(dno->idxroot);
     if(dno->idxbmp)
 	fsw_free(dno->idxbmp);
     if(dno->cbuf)
 	fsw_free(dno->cbuf);
+    /* dnode_fill frees a half filled dnode on error, which is freed again later */
+    dno->mft.atlst = NULL;
+    dno->attr.emft = NULL;
+    dno->idxroot = NULL;
+    dno->idxbmp = NULL;
+    dno->cbuf = NULL;
 }
 
 static fsw_status_t fsw_ntfs_dnode_fill(struct fsw_volume *volg, struct fsw_dnode *dnog)
@@ -854,7 +1160,14 @@ static fsw_status_t fsw_ntfs_dnode_fill(struct fsw_volume *volg, struct fsw_dnod
 	err = read_small_attribute(vol, &dno->mft, AT_INDEX_ROOT|AT_I30, &dno->idxroot, &dno->rootsz);
 	if(err != FSW_SUCCESS)
 	{
-	    Print(L"dno_fill INDEX_ROOT:$I30 error %d\n", err);
+	    FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ntfs_dnode_fill: INDEX_ROOT:$I30 error %d\n"), err));
+	    goto error_out;
+	}
+
+	err = parse_index_node(dno->idxroot + 16, dno->rootsz - 16, &dno->root);
+	if(err != FSW_SUCCESS)
+	{
+	    FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ntfs_dnode_fill: bad INDEX_ROOT:$I30 of %d\n"), (int)dno->g.dnode_id));
 	    goto error_out;
 	}
 
@@ -866,7 +1179,7 @@ static fsw_status_t fsw_ntfs_dnode_fill(struct fsw_volume *volg, struct fsw_dnod
 	err = read_small_attribute(vol, &dno->mft, AT_BITMAP|AT_I30, &dno->idxbmp, &dno->bmpsz);
 	if(err != FSW_SUCCESS && err != FSW_NOT_FOUND)
 	{
-	    Print(L"dno_fill $Bitmap:$I30 error %d\n", err);
+	    FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ntfs_dnode_fill: $Bitmap:$I30 error %d\n"), err));
 	    goto error_out;
 	}
 
@@ -878,7 +1191,7 @@ static fsw_status_t fsw_ntfs_dnode_fill(struct fsw_volume *volg, struct fsw_dnod
 	    dno->fsize = attribute_size(dno->attr.ptr, dno->attr.len);
 	    dno->finited = dno->fsize;
 	} else if(err != FSW_NOT_FOUND) {
-	    Print(L"dno_fill $INDEX_ALLOCATION:$I30 error %d\n", err);
+	    FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ntfs_dnode_fill: $INDEX_ALLOCATION:$I30 error %d\n"), err));
 	    goto error_out;
 	}
 
@@ -888,7 +1201,7 @@ static fsw_status_t fsw_ntfs_dnode_fill(struct fsw_volume *volg, struct fsw_dnod
 	err = find_attribute(vol, &dno->mft, &dno->attr, 0);
 	if(err != FSW_SUCCESS)
 	{
-	    Print(L"dno_fill AT_DATA error %d\n", err);
+	    FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ntfs_dnode_fill: AT_DATA error %d\n"), err));
 	    goto error_out;
 	}
 	dno->embeded = !attribute_ondisk(dno->attr.ptr, dno->attr.len); // RESIDENT_FORM = embedded, NONRESIDENT_FORM = not embedded
@@ -956,44 +1269,38 @@ static fsw_status_t fsw_ntfs_dnode_stat(struct fsw_volume *volg, struct fsw_dnod
     return FSW_SUCCESS;
 }
 
-static fsw_status_t fsw_ntfs_dnode_get_lcn(struct fsw_ntfs_volume *vol, struct fsw_ntfs_dnode *dno, fsw_u64 vcn, fsw_u64 *lcnp)
+static fsw_status_t fsw_ntfs_load_emap(struct fsw_ntfs_volume *vol, struct fsw_ntfs_dnode *dno)
 {
     fsw_status_t err;
-    if(vcn >= dno->cext.vcn && vcn < dno->cext.vcn+dno->cext.cnt) {
-	*lcnp = dno->cext.lcn + vcn - dno->cext.vcn;
+
+    if(dno->has_emap)
 	return FSW_SUCCESS;
+    err = load_extent_map(vol, &dno->mft, dno->attr.type, &dno->emap);
+    if(err != FSW_SUCCESS) {
+	free_extent_map(&dno->emap);
+	return err;
     }
-    if(!attribute_has_vcn(dno->attr.ptr, dno->attr.len, vcn)) {
-	err = find_attribute(vol, &dno->mft, &dno->attr, vcn);
-	if( err != FSW_SUCCESS )
-	    return err;
-	if(!attribute_has_vcn(dno->attr.ptr, dno->attr.len, vcn))
-	    return FSW_VOLUME_CORRUPTED;
-    }
-    fsw_u8 *ptr = dno->attr.ptr;
-    int len = dno->attr.len;
-    fsw_u64 pos = 0;
-    fsw_u64 lcn, cnt;
-    fsw_u64 svcn = attribute_first_vcn(ptr, len);
-    fsw_u64 evcn = attribute_last_vcn(ptr, len) + 1;
-    int off = GETU16(ptr, 0x20); // ATTRIBUTE_RECORD_HEADER.Form.Nonresident.MappingPairsOffset
-    ptr += off;
-    len -= off;
-    while(len > 0 && get_extent(&ptr, &len, &lcn, &cnt, &pos)==FSW_SUCCESS) {
-	if(vcn >= svcn && vcn < svcn+cnt) {
-	    dno->cext.vcn = svcn;
-	    dno->cext.lcn = lcn;
-	    dno->cext.cnt = cnt;
-	    if(lcn == 0)
-		return FSW_NOT_FOUND;
-	    *lcnp = lcn + vcn - svcn;
-	    return FSW_SUCCESS;
-	}
-	svcn += cnt;
-	if(svcn >= evcn)
-	    break;
-    }
-    return FSW_NOT_FOUND;
+    dno->has_emap = 1;
+    FSW_MSG_DEBUGV((FSW_MSGSTR("fsw_ntfs_load_emap: %d extents in %d\n"), dno->emap.used, (int)dno->g.dnode_id));
+    return FSW_SUCCESS;
+}
+
+static fsw_status_t fsw_ntfs_dnode_get_lcn(struct fsw_ntfs_volume *vol, struct fsw_ntfs_dnode *dno, fsw_u64 vcn, fsw_u64 *lcnp)
+{
+    fsw_status_t err;
+    struct extent_slot *e;
+    int i;
+
+    if((err = fsw_ntfs_load_emap(vol, dno)) != FSW_SUCCESS)
+	return err;
+    i = extent_map_find(&dno->emap, vcn);
+    if(i < 0)
+	return FSW_NOT_FOUND;
+    e = &dno->emap.extent[i];
+    if(vcn >= e->vcn + e->cnt)
+	return FSW_NOT_FOUND;
+    *lcnp = e->lcn + vcn - e->vcn;
+    return FSW_SUCCESS;
 }
 
 static int fsw_ntfs_read_buffer(struct fsw_ntfs_volume *vol, struct fsw_ntfs_dnode *dno, fsw_u8 *buf, fsw_u64 offset, int size)
@@ -1013,7 +1320,7 @@ static int fsw_ntfs_read_buffer(struct fsw_ntfs_volume *vol, struct fsw_ntfs_dno
     }
 
     if(!dno->attr.ptr || !dno->attr.len) {
-	Print(L"BAD--------: attr.ptr %p attr.len %x cleared\n", dno->attr.ptr, dno->attr.len);
+	FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ntfs_read_buffer: attribute of %d lost, searching again\n"), (int)dno->g.dnode_id));
 	if(find_attribute(vol, &dno->mft, &dno->attr, 0) != FSW_SUCCESS)
 	    return 0;
     }
@@ -1093,72 +1400,6 @@ static fsw_status_t fsw_ntfs_get_extent_embeded(struct fsw_ntfs_volume *vol, str
     return FSW_SUCCESS;
 }
 
-static int ntfs_decomp_1page(fsw_u8 *src, int slen, fsw_u8 *dst) {
-    int soff = 0;
-    int doff = 0;
-    while(soff < slen) {
-	int j;
-	int tag = src[soff++];
-	for(j = 0; j < 8 && soff < slen; j++) {
-	    if(tag & (1<<j)){
-		int len;
-		int back;
-		int bits;
-
-		if(!doff || soff + 2 > slen)
-		    return -1;
-		len = GETU16(src, soff); soff += 2;
-		bits = __builtin_clz((doff-1)>>3)-19;
-		back = (len >> bits) + 1;
-		len = (len & ((1<<bits)-1)) + 3;
-		if(doff < back || doff + len > 0x1000)
-		    return -1;
-		while(len-- > 0) {
-		    dst[doff] = dst[doff-back];
-		    doff++;
-		}
-	    } else {
-		if(doff >= 0x1000)
-		    return -1;
-		dst[doff++] = src[soff++];
-	    }
-	}
-    }
-    return doff;
-}
-
-static int ntfs_decomp(fsw_u8 *src, int slen, fsw_u8 *dst, int npage) {
-    fsw_u8 *se = src + slen;
-    fsw_u8 *de = dst + (npage<<12);
-    int i;
-    for(i=0; i<npage; i++) {
-	fsw_u16 slen = GETU16(src, 0);
-	int comp = slen & 0x8000;
-	slen = (slen&0xfff)+1;
-	src += 2;
-
-	if(src + slen > se || dst + 0x1000 > de)
-	    return -1;
-
-	if(!comp) {
-	    fsw_memcpy(dst, src, slen);
-	    if(slen < 0x1000)
-		fsw_memzero(dst+slen, 0x1000-slen);
-	} else if(slen == 1) {
-	    fsw_memzero(dst, 0x1000);
-	} else {
-	    int dlen = ntfs_decomp_1page(src, slen, dst);
-	    if(dlen < 0)
-		return -1;
-	    if(dlen < 0x1000)
-		fsw_memzero(dst+dlen, 0x1000-dlen);
-	}
-	src += slen;
-	dst += 0x1000;
-    }
-    return 0;
-}
-
 static fsw_status_t fsw_ntfs_get_extent_compressed(struct fsw_ntfs_volume *vol, struct fsw_ntfs_dnode *dno, struct fsw_extent *extent)
 {
     if(vol->clbits > 16)
@@ -1183,7 +1424,7 @@ static fsw_status_t fsw_ntfs_get_extent_compressed(struct fsw_ntfs_volume *vol,
 	if(err == FSW_NOT_FOUND) {
 	    break;
 	} else if(err != FSW_SUCCESS) {
-	    Print(L"BAD LCN\n");
+	    FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ntfs_get_extent_compressed: bad lcn at vcn %d\n"), (int)(vcn+i)));
 	    dno->cperror = 1;
 	    return FSW_VOLUME_CORRUPTED;
 	}
@@ -1212,7 +1453,7 @@ static fsw_status_t fsw_ntfs_get_extent_compressed(struct fsw_ntfs_volume *vol,
 	    char *block;
 	    if (fsw_block_get(&vol->g, dno->clcn[b], 0, (void **) &block) != FSW_SUCCESS) {
 		dno->cperror = 1;
-		Print(L"Read ERROR at block %d\n", i);
+		FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ntfs_get_extent_compressed: read error at cluster %d\n"), b));
 		break;
 	    }
 	    fsw_memcpy(src+(b<<vol->clbits), block, 1<<vol->clbits);
@@ -1223,8 +1464,12 @@ static fsw_status_t fsw_ntfs_get_extent_compressed(struct fsw_ntfs_volume *vol,
 	    b = 16<<vol->clbits>>12;
 	else
 	    b = (dno->fsize - (vcn << vol->clbits) + 0xfff)>>12;
-	if(!dno->cperror && ntfs_decomp(src, i<<vol->clbits, dno->cbuf, b) < 0)
-	    dno->cperror = 1;
+	if(!dno->cperror) {
+	    fsw_u32 produced;
+	    if(fsw_codec_decompress(&vol->g, FSW_CODEC_LZNT1, src, i<<vol->clbits, 0,
+				    dno->cbuf, b<<12, &produced) != FSW_SUCCESS)
+		dno->cperror = 1;
+	}
 	fsw_free(src);
     }
 hit:
@@ -1255,31 +1500,41 @@ hit:
 static fsw_status_t fsw_ntfs_get_extent_sparse(struct fsw_ntfs_volume *vol, struct fsw_ntfs_dnode *dno, struct fsw_extent *extent)
 {
     fsw_status_t err;
+    fsw_u64 vcn = extent->log_start;
+    fsw_u64 evcn = (dno->fsize + (1<<vol->clbits) - 1) >> vol->clbits;
+    fsw_u64 ivcn = (dno->finited + (1<<vol->clbits) - 1) >> vol->clbits;
+    fsw_u64 cnt;
+    struct extent_slot *e;
+    int i;
 
-    if((extent->log_start << vol->clbits) > dno->fsize)
+    if((vcn << vol->clbits) > dno->fsize)
 	return FSW_NOT_FOUND;
-    if((extent->log_start << vol->clbits) > dno->finited)
-    {
-	extent->log_count = 1;
-	extent->buffer = NULL;
-	extent->type = FSW_EXTENT_TYPE_SPARSE;
-	return FSW_SUCCESS;
-    }
-    fsw_u64 lcn;
-    err = fsw_ntfs_dnode_get_lcn(vol, dno, extent->log_start, &lcn);
-    if(err == FSW_NOT_FOUND) {
-	extent->log_count = 1;
-	extent->buffer = NULL;
-	extent->type = FSW_EXTENT_TYPE_SPARSE;
+    extent->buffer = NULL;
+    extent->type = FSW_EXTENT_TYPE_SPARSE;
+    extent->log_count = 1;
+    if(vcn >= ivcn) {
+	if(evcn > vcn)
+	    extent->log_count = evcn - vcn > 0xffffffff ? 0xffffffff : evcn - vcn;
 	return FSW_SUCCESS;
     }
-    if(err != FSW_SUCCESS)
+
+    if((err = fsw_ntfs_load_emap(vol, dno)) != FSW_SUCCESS)
 	return err;
-    extent->phys_start = lcn;
-    extent->log_count = 1;
-    if(extent->log_start >= dno->cext.vcn && extent->log_start < dno->cext.vcn+dno->cext.cnt)
-	extent->log_count = dno->cext.cnt + extent->log_start - dno->cext.vcn;
-    extent->type = FSW_EXTENT_TYPE_PHYSBLOCK;
+    i = extent_map_find(&dno->emap, vcn);
+    e = i < 0 ? NULL : &dno->emap.extent[i];
+    if(e == NULL || vcn >= e->vcn + e->cnt) {
+	/* a hole, up to the next run */
+	cnt = (i+1 < dno->emap.used ? dno->emap.extent[i+1].vcn : ivcn) - vcn;
+    } else {
+	extent->phys_start = e->lcn + vcn - e->vcn;
+	extent->type = FSW_EXTENT_TYPE_PHYSBLOCK;
+	cnt = e->cnt - (vcn - e->vcn);
+	/* clusters past the initialized size read as zeros */
+	if(cnt > ivcn - vcn)
+	    cnt = ivcn - vcn;
+    }
+    if(cnt > 0)
+	extent->log_count = cnt > 0xffffffff ? 0xffffffff : cnt;
     return FSW_SUCCESS;
 }
 
@@ -1373,33 +1628,67 @@ static fsw_status_t fsw_ntfs_create_subnode(struct fsw_ntfs_dnode *dno, fsw_u8 *
     return fsw_dnode_create(&dno->g, mftno, type, &s, child_dno);
 }
 
-static fsw_u8 *fsw_ntfs_read_index_block(struct fsw_ntfs_volume *vol, struct fsw_ntfs_dnode *dno, fsw_u64 block)
+/*
+ * Get index block (vcn+1) of a directory from the volume's index cache,
+ * reading it on a miss. The node stays valid until the next call.
+ */
+static struct ntfs_index_node *fsw_ntfs_read_index_block(struct fsw_ntfs_volume *vol, struct fsw_ntfs_dnode *dno, fsw_u64 block)
 {
-    if(dno->cbuf==NULL) {
-	if(fsw_alloc(dno->idxsz, &dno->cbuf) != FSW_SUCCESS)
+    struct ntfs_index_cache *ic, *victim = NULL;
+    struct ntfs_index_node node;
+    fsw_u8 *buf;
+    int i;
+
+    if(vol->icache == NULL) {
+	if(fsw_alloc_zero(sizeof (struct ntfs_index_cache) * INDEX_CACHE_SIZE, (void **) &vol->icache) != FSW_SUCCESS)
 	    return NULL;
-    } else if(block == dno->cvcn)
-	return dno->cbuf;
+    }
+    for(i = 0; i < INDEX_CACHE_SIZE; i++) {
+	ic = &vol->icache[i];
+	if(ic->buf && ic->mftno == dno->g.dnode_id && ic->block == block) {
+	    vol->icache_hits++;
+	    ic->lastuse = ++vol->icache_tick;
+	    return &ic->node;
+	}
+    }
+    vol->icache_misses++;
 
-    dno->cvcn = BADVCN;
-    if(fsw_ntfs_read_buffer(vol, dno, dno->cbuf, (block-1)*dno->idxsz, dno->idxsz) != dno->idxsz)
+    node.entry = NULL;
+    if(fsw_alloc(dno->idxsz, &buf) != FSW_SUCCESS)
 	return NULL;
-    if(fixup(dno->cbuf, "INDX", 1<<vol->sctbits, dno->idxsz) != FSW_SUCCESS)
+    if(fsw_ntfs_read_buffer(vol, dno, buf, (block-1)*dno->idxsz, dno->idxsz) != dno->idxsz ||
+	    fixup(buf, "INDX", 1<<vol->sctbits, dno->idxsz) != FSW_SUCCESS ||
+	    parse_index_node(buf + 24, dno->idxsz - 24, &node) != FSW_SUCCESS) {
+	FSW_MSG_DEBUG((FSW_MSGSTR("fsw_ntfs_read_index_block: bad index block %d of %d\n"), (int)block, (int)dno->g.dnode_id));
+	free_index_node(&node);
+	fsw_free(buf);
 	return NULL;
+    }
 
-    dno->cvcn = block;
-    return dno->cbuf;
+    for(i = 0; i < INDEX_CACHE_SIZE; i++) {
+	ic = &vol->icache[i];
+	if(victim == NULL || (victim->buf && (!ic->buf || ic->lastuse < victim->lastuse)))
+	    victim = ic;
+    }
+    if(victim->buf) {
+	free_index_node(&victim->node);
+	fsw_free(victim->buf);
+    }
+    victim->mftno = dno->g.dnode_id;
+    victim->block = block;
+    victim->buf = buf;
+    victim->node = node;
+    victim->lastuse = ++vol->icache_tick;
+    return &victim->node;
 }
 
 static fsw_status_t fsw_ntfs_dir_lookup(struct fsw_volume *volg, struct fsw_dnode *dnog, struct fsw_string *lookup_name, struct fsw_dnode **child_dno)
 {
     struct fsw_ntfs_volume *vol = (struct fsw_ntfs_volume *)volg;
     struct fsw_ntfs_dnode *dno = (struct fsw_ntfs_dnode *)dnog;
-    int depth = 0;
+    struct ntfs_index_node *node;
+    int depth;
     struct fsw_string s;
-    fsw_u8 *buf;
-    int len;
-    int off;
     fsw_status_t err;
     fsw_u64 block;
     fsw_u8 cpb;
@@ -1409,65 +1698,37 @@ static fsw_status_t fsw_ntfs_dir_lookup(struct fsw_volume *volg, struct fsw_dnod
     if(err)
 	return err;
 
-    /* start from AT_INDEX_ROOT */
-    buf = dno->idxroot + 16;
-    len = dno->rootsz - 16;
-    if(len < 0x18)
-	goto notfound;
-
     cpb = GETU8(dno->idxroot, 12);
     if(cpb == 0) cpb = 1;
 
-    while(depth < 10) {
-	/* real index size */
-	if(GETU32(buf, 4) < len)
-	    len = GETU32(buf, 4);
-
-	/* skip index header */
-	off = GETU32(buf, 0);
-	if(off >= len)
-	    goto notfound;
-
-	block = 0;
-	while(off + 0x18 <= len) {
-	    int flag = GETU8(buf, off+12);
-	    int next = off + GETU16(buf, off+8);
-	    int cmp;
-
-	    if(flag & 2) {
-		/* the end of index entry */
-		cmp = -1;
-		Print(L"depth %d len %x off %x flag %x next %x cmp %d\n", depth, len, off, flag, next, cmp);
-	    } else {
-		int nlen = GETU8(buf, off+0x50);
-		fsw_u8 *name = buf+off+0x52;
-		cmp = ntfs_filename_cmp(vol, s.data, s.len, name, nlen);
-		Print(L"depth %d len %x off %x flag %x next %x cmp %d name %d[%.*ls]\n", depth, len, off, flag, next, cmp, nlen, nlen, name);
-	    }
+    /* start from AT_INDEX_ROOT, entries are sorted by upcased name */
+    node = &dno->root;
+    for(depth = 0; depth < 10; depth++) {
+	int lo = 0;
+	int hi = node->count;
 
+	while(lo < hi) {
+	    int mid = (lo + hi) / 2;
+	    fsw_u8 *e = index_entry(node, mid);
+	    int cmp = ntfs_filename_cmp(vol, s.data, s.len, e+0x52, GETU8(e, 0x50));
 	    if(cmp == 0) {
 		fsw_strfree(&s);
-		return fsw_ntfs_create_subnode(dno, buf+off, child_dno);
-	    } else if(cmp < 0) {
-		if(!(flag & 1) || !dno->has_idxtree)
-		    goto notfound;
-		block = FSW_U64_DIV(GETU64(buf, next-8), cpb) + 1;
-		break;
-	    } else { /* cmp > 0 */
-		off = next;
+		return fsw_ntfs_create_subnode(dno, e, child_dno);
 	    }
+	    if(cmp < 0)
+		hi = mid;
+	    else
+		lo = mid + 1;
 	}
-	if(!block)
-	    break;
 
-	if(!(buf = fsw_ntfs_read_index_block(vol, dno, block)))
+	/* names below entry lo are in its subnode */
+	if(!(GETU8(index_entry(node, lo), 12) & 1) || !dno->has_idxtree)
+	    break;
+	block = FSW_U64_DIV(index_child(node, lo), cpb) + 1;
+	if(!(node = fsw_ntfs_read_index_block(vol, dno, block)))
 	    break;
-	buf += 24;
-	len = dno->idxsz - 24;
-	depth++;
     }
 
-notfound:
     fsw_strfree(&s);
     return FSW_NOT_FOUND;
 }
@@ -1508,43 +1769,31 @@ static fsw_status_t fsw_ntfs_dir_read(struct fsw_volume *volg, struct fsw_dnode
     mblocks = FSW_U64_DIV(dno->fsize, dno->idxsz);
 
     while(block <= mblocks) {
-	fsw_u8 *buf;
-	int len;
+	struct ntfs_index_node *node;
+	int i;
 	if(block == 0) {
 	    /* AT_INDEX_ROOT */
-	    buf = dno->idxroot + 16;
-	    len = dno->rootsz - 16;
-	    if(len < 0x18)
-		goto miss;
-	} else if(!test_idxbmp(dno, block) || !(buf = fsw_ntfs_read_index_block(vol, dno, block)))
+	    node = &dno->root;
+	} else if(!test_idxbmp(dno, block) || !(node = fsw_ntfs_read_index_block(vol, dno, block)))
 	{
 	    /* unused or bad index block */
 	    goto miss;
-	} else {
-	    /* AT_INDEX_ALLOCATION block */
-	    buf += 24;
-	    len = dno->idxsz - 24;
 	}
-	if(GETU32(buf, 4) < len)
-	    len = GETU32(buf, 4);
-	if(off == 0)
-	    off = GETU32(buf, 0);
-	Print(L"block %d len %x off %x\n", block, len, off);
-	while(off + 0x18 <= len) {
-	    int flag = GETU8(buf, off+12);
-	    if(flag & 2) break;
-	    int next = off + GETU16(buf, off+8);
-	    Print(L"flag %x next %x nt %x [%.*ls]\n", flag, next, GETU8(buf, off+0x51), GETU8(buf, off+0x50), buf+off+0x52);
-	    if((GETU8(buf, off+0x51) != 2)) {
+	for(i = 0; i < node->count; i++) {
+	    fsw_u8 *e = index_entry(node, i);
+	    int next;
+	    if(node->entry[i] < off)
+		continue;
+	    next = node->entry[i+1];
+	    if((GETU8(e, 0x51) != 2)) {
 		/* LONG FILE NAME */
-		fsw_status_t err = fsw_ntfs_create_subnode(dno, buf+off, child_dno);
+		fsw_status_t err = fsw_ntfs_create_subnode(dno, e, child_dno);
 		if(err != FSW_NOT_FOUND) {
 		    set_shand_pos(shand, block, next);
 		    return err;
 		}
 		// skip internal MFT record
 	    }
-	    off = next;
 	}
 miss:
 	if(!dno->has_idxtree)
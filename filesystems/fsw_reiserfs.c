@@ -50,6 +50,8 @@ static fsw_status_t fsw_reiserfs_item_search(struct fsw_reiserfs_volume *vol,
                                              struct fsw_reiserfs_item *item);
 static fsw_status_t fsw_reiserfs_item_next(struct fsw_reiserfs_volume *vol,
                                            struct fsw_reiserfs_item *item);
+static fsw_status_t fsw_reiserfs_item_seek(struct fsw_reiserfs_volume *vol, struct fsw_reiserfs_dnode *dno,
+                                           fsw_u64 offset, struct fsw_reiserfs_item *item);
 static void fsw_reiserfs_item_release(struct fsw_reiserfs_volume *vol,
                                       struct fsw_reiserfs_item *item);
 
@@ -131,6 +133,8 @@ static fsw_status_t fsw_reiserfs_volume_mount(struct fsw_reiserfs_volume *vol)
     // check the superblock
     if (vol->sb->s_v1.s_root_block == -1)   // unfinished 'reiserfsck --rebuild-tree'
         return FSW_VOLUME_CORRUPTED;
+    if (vol->sb->s_v1.s_tree_height <= DISK_LEAF_NODE_LEVEL || vol->sb->s_v1.s_tree_height > MAX_HEIGHT)
+        return FSW_VOLUME_CORRUPTED;        // the item path has room for MAX_HEIGHT levels
 
     /*
     if (vol->sb->s_rev_level != EXT2_GOOD_OLD_REV &&
@@ -182,6 +186,8 @@ static fsw_status_t fsw_reiserfs_volume_mount(struct fsw_reiserfs_volume *vol)
 
 static void fsw_reiserfs_volume_free(struct fsw_reiserfs_volume *vol)
 {
+    FSW_MSG_DEBUG((FSW_MSGSTR("fsw_reiserfs_volume_free: %d tree searches, %d served by cursors\n"),
+                   vol->tree_searches, vol->cursor_hits));
     if (vol->sb)
         fsw_free(vol->sb);
 }
@@ -232,6 +238,11 @@ static fsw_status_t fsw_reiserfs_dnode_fill(struct fsw_reiserfs_volume *vol, str
     }
     item_len = item.ih.ih_item_len;
 
+    // The object's first directory or data item follows the stat data
+    dno->cursor = item;
+    dno->cursor.block_bno = 0;
+    dno->cursor.item_data = NULL;
+
     // Get data in appropriate version
     if (item.ih.ih_version == KEY_FORMAT_3_5 && item_len == SD_V1_SIZE) {
         // have stat_data_v1 structure
@@ -337,7 +348,7 @@ static fsw_status_t fsw_reiserfs_get_extent(struct fsw_reiserfs_volume *vol, str
     fsw_status_t    status;
     fsw_u64         search_offset, intra_offset;
     struct fsw_reiserfs_item item;
-    fsw_u32         intra_bno, nr_item;
+    fsw_u32         intra_bno, nr_item, *ptrs;
 
     // Preconditions: The caller has checked that the requested logical block
     //  is within the file's size. The dnode has complete information, i.e.
@@ -351,7 +362,7 @@ static fsw_status_t fsw_reiserfs_get_extent(struct fsw_reiserfs_volume *vol, str
 
     // Get the item for the requested block
     search_offset = (fsw_u64)extent->log_start * vol->g.log_blocksize + 1;
-    status = fsw_reiserfs_item_search(vol, dno->dir_id, dno->g.dnode_id, search_offset, &item);
+    status = fsw_reiserfs_item_seek(vol, dno, search_offset, &item);
     if (status)
         return status;
     if (item.item_offset == 0) {
@@ -374,10 +385,20 @@ static fsw_status_t fsw_reiserfs_get_extent(struct fsw_reiserfs_volume *vol, str
             FSW_MSG_ASSERT((FSW_MSGSTR("fsw_reiserfs_get_extent: indirect block too small\n")));
             goto bail;
         }
-        extent->type = FSW_EXTENT_TYPE_PHYSBLOCK;
-        extent->phys_start = ((fsw_u32 *)item.item_data)[intra_bno];
-
-        // TODO: Check if the following blocks can be aggregated into one extent
+        ptrs = (fsw_u32 *)item.item_data + intra_bno;
+        nr_item -= intra_bno;
+
+        // aggregate the following block pointers of this item into one extent,
+        // a run of zero pointers is a hole
+        if (ptrs[0] == 0) {
+            while (extent->log_count < nr_item && ptrs[extent->log_count] == 0)
+                extent->log_count++;
+        } else {
+            extent->type = FSW_EXTENT_TYPE_PHYSBLOCK;
+            extent->phys_start = ptrs[0];
+            while (extent->log_count < nr_item && ptrs[extent->log_count] == ptrs[0] + extent->log_count)
+                extent->log_count++;
+        }
 
         fsw_reiserfs_item_release(vol, &item);
         return FSW_SUCCESS;
@@ -406,18 +427,6 @@ static fsw_status_t fsw_reiserfs_get_extent(struct fsw_reiserfs_volume *vol, str
 bail:
     fsw_reiserfs_item_release(vol, &item);
     return FSW_VOLUME_CORRUPTED;
-
-    /*
-    // check if the following blocks can be aggregated into one extent
-    file_bcnt = (fsw_u32)((dno->g.size + vol->g.log_blocksize - 1) & (vol->g.log_blocksize - 1));
-    while (path[i]           + extent->log_count < buf_bcnt &&    // indirect block has more block pointers
-           extent->log_start + extent->log_count < file_bcnt) {   // file has more blocks
-        if (buffer[path[i] + extent->log_count] == buffer[path[i] + extent->log_count - 1] + 1)
-            extent->log_count++;
-        else
-            break;
-    }
-    */
 }
 
 /**
@@ -445,7 +454,7 @@ static fsw_status_t fsw_reiserfs_dir_lookup(struct fsw_reiserfs_volume *vol, str
     entry_name.type = FSW_STRING_TYPE_ISO88591;
 
     // Get the item for that position
-    status = fsw_reiserfs_item_search(vol, dno->dir_id, dno->g.dnode_id, FIRST_ITEM_OFFSET, &item);
+    status = fsw_reiserfs_item_seek(vol, dno, FIRST_ITEM_OFFSET, &item);
     if (status)
         return status;
     if (item.item_offset == 0) {
@@ -459,9 +468,17 @@ static fsw_status_t fsw_reiserfs_dir_lookup(struct fsw_reiserfs_volume *vol, str
         dhead = (struct reiserfs_de_head *)item.item_data;
         nr_item = item.ih.u.ih_entry_count;
         next_name_offset = item.ih.ih_item_len;
+        if (nr_item * DEH_SIZE > next_name_offset) {
+            fsw_reiserfs_item_release(vol, &item);
+            return FSW_VOLUME_CORRUPTED;
+        }
         for (i = 0; i < nr_item; i++, dhead++, next_name_offset = name_offset) {
             // Get the name
             name_offset = dhead->deh_location;
+            if (name_offset > next_name_offset) {
+                fsw_reiserfs_item_release(vol, &item);
+                return FSW_VOLUME_CORRUPTED;
+            }
             name_len = next_name_offset - name_offset;
             while (name_len > 0 && item.item_data[name_offset + name_len - 1] == 0)
                 name_len--;
@@ -508,7 +525,7 @@ static fsw_status_t fsw_reiserfs_dir_read(struct fsw_reiserfs_volume *vol, struc
 {
     fsw_status_t    status;
     struct fsw_reiserfs_item item;
-    fsw_u32         nr_item, i, name_offset, next_name_offset, name_len;
+    fsw_u32         nr_item, i, hi, mid, name_offset, next_name_offset, name_len;
     fsw_u32         child_dir_id;
     struct reiserfs_de_head *dhead;
     struct fsw_string entry_name;
@@ -517,14 +534,12 @@ static fsw_status_t fsw_reiserfs_dir_read(struct fsw_reiserfs_volume *vol, struc
     //  has opened a storage handle to the directory's storage and keeps it around between
     //  calls.
 
-    // BIG TODOS: Use binary search within the item.
-
     // Adjust pointer to first entry if necessary
     if (shand->pos == 0)
         shand->pos = FIRST_ITEM_OFFSET;
 
     // Get the item for that position
-    status = fsw_reiserfs_item_search(vol, dno->dir_id, dno->g.dnode_id, shand->pos, &item);
+    status = fsw_reiserfs_item_seek(vol, dno, shand->pos, &item);
     if (status)
         return status;
     if (item.item_offset == 0) {
@@ -534,12 +549,22 @@ static fsw_status_t fsw_reiserfs_dir_read(struct fsw_reiserfs_volume *vol, struc
 
     for(;;) {
 
-        // Search the directory item
+        // Search the directory item for the first entry not yet returned,
+        // the entries are sorted by their hash offsets
         dhead = (struct reiserfs_de_head *)item.item_data;
         nr_item = item.ih.u.ih_entry_count;
-        for (i = 0; i < nr_item; i++, dhead++) {
-            if (dhead->deh_offset < shand->pos)
-                continue;  // not yet past the last entry returned
+        if (nr_item * DEH_SIZE > item.ih.ih_item_len) {
+            fsw_reiserfs_item_release(vol, &item);
+            return FSW_VOLUME_CORRUPTED;
+        }
+        for (i = 0, hi = nr_item; i < hi; ) {
+            mid = (i + hi) / 2;
+            if (dhead[mid].deh_offset < shand->pos)
+                i = mid + 1;
+            else
+                hi = mid;
+        }
+        for (dhead += i; i < nr_item; i++, dhead++) {
             if (dhead->deh_offset == DOT_OFFSET || dhead->deh_offset == DOT_DOT_OFFSET)
                 continue;  // never report . or ..
 
@@ -549,6 +574,10 @@ static fsw_status_t fsw_reiserfs_dir_read(struct fsw_reiserfs_volume *vol, struc
                 next_name_offset = item.ih.ih_item_len;
             else
                 next_name_offset = dhead[-1].deh_location;
+            if (name_offset > next_name_offset || next_name_offset > item.ih.ih_item_len) {
+                fsw_reiserfs_item_release(vol, &item);
+                return FSW_VOLUME_CORRUPTED;
+            }
             name_len = next_name_offset - name_offset;
             while (name_len > 0 && item.item_data[name_offset + name_len - 1] == 0)
                 name_len--;
@@ -633,7 +662,86 @@ static int fsw_reiserfs_compare_key(struct reiserfs_key *key,
 }
 
 /**
- * Find an item by key in the reiserfs tree.
+ * Fill in an item search result from an item head in a leaf block. The block
+ * stays referenced by the result until it is released.
+ */
+
+static fsw_status_t fsw_reiserfs_item_fill(struct fsw_reiserfs_volume *vol, struct fsw_reiserfs_item *item,
+                                           fsw_u32 tree_bno, fsw_u8 *buffer, struct item_head *ihead)
+{
+    if (ihead->ih_item_location < BLKH_SIZE ||
+        (fsw_u32)ihead->ih_item_location + ihead->ih_item_len > vol->g.log_blocksize) {
+        FSW_MSG_ASSERT((FSW_MSGSTR("fsw_reiserfs_item_fill: item outside of block %d\n"), tree_bno));
+        fsw_block_release(vol, tree_bno, buffer);
+        item->valid = 0;
+        item->block_bno = 0;
+        return FSW_VOLUME_CORRUPTED;
+    }
+
+    fsw_memcpy(&item->ih, ihead, sizeof (struct item_head));
+    item->item_type = (fsw_u32)FSW_U64_SHR(ihead->ih_key.u.k_offset_v2.v, 60);
+    if (item->item_type != TYPE_DIRECT &&
+        item->item_type != TYPE_INDIRECT &&
+        item->item_type != TYPE_DIRENTRY) {
+        // 3.5 format (_v1)
+        item->item_type = ihead->ih_key.u.k_offset_v1.k_uniqueness;
+        item->item_offset = ihead->ih_key.u.k_offset_v1.k_offset;
+    } else {
+        // 3.6 format (_v2)
+        item->item_offset = ihead->ih_key.u.k_offset_v2.v & (~0ULL >> 4);
+    }
+    item->item_data = buffer + ihead->ih_item_location;
+    item->valid = 1;
+
+    // add information for block release
+    item->block_bno = tree_bno;
+    item->block_buffer = buffer;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Get a tree block and check that it is a node of the expected level whose
+ * keys and pointers or item heads fit the block.
+ */
+
+static fsw_status_t fsw_reiserfs_node_get(struct fsw_reiserfs_volume *vol, fsw_u32 tree_bno, fsw_u32 tree_level,
+                                          fsw_u8 **buffer_out, fsw_u32 *nr_item_out)
+{
+    fsw_status_t    status;
+    fsw_u8          *buffer;
+    fsw_u32         nr_item, size;
+    struct block_head *bhead;
+
+    status = fsw_block_get(vol, tree_bno, tree_level, (void **) &buffer);
+    if (status)
+        return status;
+    bhead = (struct block_head *)buffer;
+    nr_item = bhead->blk_nr_item;
+    if (tree_level == DISK_LEAF_NODE_LEVEL)
+        size = BLKH_SIZE + nr_item * IH_SIZE;
+    else
+        size = BLKH_SIZE + nr_item * KEY_SIZE + (nr_item + 1) * DC_SIZE;
+    if (bhead->blk_level != tree_level || size > vol->g.log_blocksize) {
+        FSW_MSG_ASSERT((FSW_MSGSTR(
+            "fsw_reiserfs_node_get: tree block %d has not expected level %d\n"),
+            tree_bno, tree_level
+        ));
+        fsw_block_release(vol, tree_bno, buffer);
+        return FSW_VOLUME_CORRUPTED;
+    }
+    FSW_MSG_DEBUGV((FSW_MSGSTR(
+        "fsw_reiserfs_node_get: visiting block %d level %d items %d\n"),
+        tree_bno, tree_level, nr_item
+    ));
+    *buffer_out = buffer;
+    *nr_item_out = nr_item;
+    return FSW_SUCCESS;
+}
+
+/**
+ * Find an item by key in the reiserfs tree. The result is the item with the
+ * largest key not greater than the search key, which must belong to the
+ * object searched for.
  */
 
 static fsw_status_t fsw_reiserfs_item_search(struct fsw_reiserfs_volume *vol,
@@ -641,86 +749,66 @@ static fsw_status_t fsw_reiserfs_item_search(struct fsw_reiserfs_volume *vol,
                                             struct fsw_reiserfs_item *item)
 {
     fsw_status_t    status;
-    int             comp_result;
     fsw_u8          *buffer = 0;
     fsw_u32         nr_item = 0;
-    fsw_u32         tree_bno, next_tree_bno, tree_level, i;
-    struct block_head *bhead;
+    fsw_u32         tree_bno, next_tree_bno, tree_level, lo, hi, mid;
     struct reiserfs_key *key;
     struct item_head *ihead;
 
     FSW_MSG_DEBUG((FSW_MSGSTR("fsw_reiserfs_item_search: searching %d/%d/%lld\n"), dir_id, objectid, offset));
 
-    // BIG TODOS: Use binary search within the item.
-    //  Remember tree path for "get next item" function.
-
     item->valid = 0;
     item->block_bno = 0;
+    vol->tree_searches++;
 
     // walk the tree
     tree_bno = vol->sb->s_v1.s_root_block;
     for (tree_level = vol->sb->s_v1.s_tree_height - 1; ; tree_level--) {
 
         // Get the current tree block into memory
-        status = fsw_block_get(vol, tree_bno, tree_level, (void **) &buffer);
+        status = fsw_reiserfs_node_get(vol, tree_bno, tree_level, &buffer, &nr_item);
         if (status)
             return status;
-        bhead = (struct block_head *)buffer;
-        if (bhead->blk_level != tree_level) {
-            FSW_MSG_ASSERT((FSW_MSGSTR(
-                "fsw_reiserfs_item_search: tree block %d has not expected level %d\n"),
-                tree_bno, tree_level
-            ));
-            fsw_block_release(vol, tree_bno, buffer);
-            return FSW_VOLUME_CORRUPTED;
-        }
-        nr_item = bhead->blk_nr_item;
-        FSW_MSG_DEBUGV((FSW_MSGSTR(
-            "fsw_reiserfs_item_search: visiting block %d level %d items %d\n"),
-            tree_bno, tree_level, nr_item
-        ));
         item->path_bno[tree_level] = tree_bno;
 
         // Check if we have reached a leaf block
         if (tree_level == DISK_LEAF_NODE_LEVEL)
             break;
 
-        // Search internal node block, look for the path to follow
+        // Search internal node block for the first key greater than the search
+        // key, the pointer before it leads to the subtree to follow
         key = (struct reiserfs_key *)(buffer + BLKH_SIZE);
-        for (i = 0; i < nr_item; i++, key++) {
-            if (fsw_reiserfs_compare_key(key, dir_id, objectid, offset) == FIRST_GREATER)
-                break;
+        for (lo = 0, hi = nr_item; lo < hi; ) {
+            mid = (lo + hi) / 2;
+            if (fsw_reiserfs_compare_key(key + mid, dir_id, objectid, offset) == FIRST_GREATER)
+                hi = mid;
+            else
+                lo = mid + 1;
         }
-        item->path_index[tree_level] = i;
-        next_tree_bno = ((struct disk_child *)(buffer + BLKH_SIZE + nr_item * KEY_SIZE))[i].dc_block_number;
+        item->path_index[tree_level] = lo;
+        next_tree_bno = ((struct disk_child *)(buffer + BLKH_SIZE + nr_item * KEY_SIZE))[lo].dc_block_number;
         fsw_block_release(vol, tree_bno, buffer);
         tree_bno = next_tree_bno;
     }
 
-    // Search leaf node block, look for our data
+    // Search leaf node block the same way. The item before the first greater key
+    // is either our key or the last one smaller than it.
+    // NOTE: The first key of the next leaf block is guaranteed to be greater than
+    //  our search key.
     ihead = (struct item_head *)(buffer + BLKH_SIZE);
-    for (i = 0; i < nr_item; i++, ihead++) {
-        comp_result = fsw_reiserfs_compare_key(&ihead->ih_key, dir_id, objectid, offset);
-        if (comp_result == KEYS_IDENTICAL)
-            break;
-        if (comp_result == FIRST_GREATER) {
-            // Current key is greater than the search key. Use the last key before this
-            // one as the preliminary result.
-            if (i == 0) {
-                fsw_block_release(vol, tree_bno, buffer);
-                return FSW_NOT_FOUND;
-            }
-            i--, ihead--;
-            break;
-        }
+    for (lo = 0, hi = nr_item; lo < hi; ) {
+        mid = (lo + hi) / 2;
+        if (fsw_reiserfs_compare_key(&ihead[mid].ih_key, dir_id, objectid, offset) == FIRST_GREATER)
+            hi = mid;
+        else
+            lo = mid + 1;
     }
-    if (i >= nr_item) {
-        // Go back to the last key, it was smaller than the search key.
-        // NOTE: The first key of the next leaf block is guaranteed to be greater than
-        //  our search key.
-        i--, ihead--;
+    if (lo == 0) {
+        fsw_block_release(vol, tree_bno, buffer);
+        return FSW_NOT_FOUND;
     }
-    item->path_index[tree_level] = i;
+    ihead += lo - 1;
+    item->path_index[tree_level] = lo - 1;
     // Since we may have a key that is smaller than the search key, verify that
     // it is for the same object.
     if (ihead->ih_key.k_dir_id != dir_id || ihead->ih_key.k_objectid != objectid) {
@@ -729,24 +817,9 @@ static fsw_status_t fsw_reiserfs_item_search(struct fsw_reiserfs_volume *vol,
     }
 
     // return results
-    fsw_memcpy(&item->ih, ihead, sizeof (struct item_head));
-    item->item_type = (fsw_u32)FSW_U64_SHR(ihead->ih_key.u.k_offset_v2.v, 60);
-    if (item->item_type != TYPE_DIRECT &&
-        item->item_type != TYPE_INDIRECT &&
-        item->item_type != TYPE_DIRENTRY) {
-        // 3.5 format (_v1)
-        item->item_type = ihead->ih_key.u.k_offset_v1.k_uniqueness;
-        item->item_offset = ihead->ih_key.u.k_offset_v1.k_offset;
-    } else {
-        // 3.6 format (_v2)
-        item->item_offset = ihead->ih_key.u.k_offset_v2.v & (~0ULL >> 4);
-    }
-    item->item_data = buffer + ihead->ih_item_location;
-    item->valid = 1;
-
-    // add information for block release
-    item->block_bno = tree_bno;
-    item->block_buffer = buffer;
+    status = fsw_reiserfs_item_fill(vol, item, tree_bno, buffer, ihead);
+    if (status)
+        return status;
 
     FSW_MSG_DEBUG((FSW_MSGSTR("fsw_reiserfs_item_search: found %d/%d/%lld (%d)\n"),
                    ihead->ih_key.k_dir_id, ihead->ih_key.k_objectid, item->item_offset, item->item_type));
@@ -764,35 +837,43 @@ static fsw_status_t fsw_reiserfs_item_next(struct fsw_reiserfs_volume *vol,
     fsw_u32         dir_id, objectid;
     fsw_u32         tree_bno, next_tree_bno, tree_level, nr_item, nr_ptr_item;
     fsw_u8          *buffer;
-    struct block_head *bhead;
     struct item_head *ihead;
 
     if (!item->valid)
         return FSW_NOT_FOUND;
-    fsw_reiserfs_item_release(vol, item);   // TODO: maybe delay this and/or use the cached block!
 
     dir_id = item->ih.ih_key.k_dir_id;
     objectid = item->ih.ih_key.k_objectid;
 
     FSW_MSG_DEBUG((FSW_MSGSTR("fsw_reiserfs_item_next: next for %d/%d/%lld\n"), dir_id, objectid, item->item_offset));
 
+    // the usual case: the next item is in the leaf block we still hold
+    if (item->block_bno > 0) {
+        tree_bno = item->block_bno;
+        buffer = item->block_buffer;
+        nr_item = ((struct block_head *)buffer)->blk_nr_item;
+        if (item->path_index[DISK_LEAF_NODE_LEVEL] + 1 < nr_item) {
+            item->path_index[DISK_LEAF_NODE_LEVEL]++;
+            ihead = ((struct item_head *)(buffer + BLKH_SIZE)) + item->path_index[DISK_LEAF_NODE_LEVEL];
+            if (ihead->ih_key.k_dir_id != dir_id || ihead->ih_key.k_objectid != objectid) {
+                fsw_reiserfs_item_release(vol, item);
+                item->valid = 0;
+                return FSW_NOT_FOUND;   // Found no next key for this object
+            }
+            return fsw_reiserfs_item_fill(vol, item, tree_bno, buffer, ihead);
+        }
+    }
+    fsw_reiserfs_item_release(vol, item);
+
     // find a node that has more items, moving up until we find one
 
     for (tree_level = DISK_LEAF_NODE_LEVEL; tree_level < vol->sb->s_v1.s_tree_height; tree_level++) {
 
         // Get the current tree block into memory
         tree_bno = item->path_bno[tree_level];
-        status = fsw_block_get(vol, tree_bno, tree_level, (void **) &buffer);
+        status = fsw_reiserfs_node_get(vol, tree_bno, tree_level, &buffer, &nr_item);
         if (status)
             return status;
-        bhead = (struct block_head *)buffer;
-        if (bhead->blk_level != tree_level) {
-            FSW_MSG_ASSERT((FSW_MSGSTR("fsw_reiserfs_item_next: tree block %d has not expected level %d\n"), tree_bno, tree_level));
-            fsw_block_release(vol, tree_bno, buffer);
-            return FSW_VOLUME_CORRUPTED;
-        }
-        nr_item = bhead->blk_nr_item;
-        FSW_MSG_DEBUGV((FSW_MSGSTR("fsw_reiserfs_item_next: visiting block %d level %d items %d\n"), tree_bno, tree_level, nr_item));
 
         nr_ptr_item = nr_item + ((tree_level > DISK_LEAF_NODE_LEVEL) ? 1 : 0);  // internal nodes have (nr_item) keys and (nr_item+1) pointers
         item->path_index[tree_level]++;
@@ -811,19 +892,15 @@ static fsw_status_t fsw_reiserfs_item_next(struct fsw_reiserfs_volume *vol,
             tree_level--;
 
             // Get the current tree block into memory
-            status = fsw_block_get(vol, tree_bno, tree_level, (void **) &buffer);
+            status = fsw_reiserfs_node_get(vol, tree_bno, tree_level, &buffer, &nr_item);
             if (status)
                 return status;
-            bhead = (struct block_head *)buffer;
-            if (bhead->blk_level != tree_level) {
-                FSW_MSG_ASSERT((FSW_MSGSTR("fsw_reiserfs_item_next: tree block %d has not expected level %d\n"), tree_bno, tree_level));
-                fsw_block_release(vol, tree_bno, buffer);
-                return FSW_VOLUME_CORRUPTED;
-            }
-            nr_item = bhead->blk_nr_item;
-            FSW_MSG_DEBUGV((FSW_MSGSTR("fsw_reiserfs_item_next: visiting block %d level %d items %d\n"), tree_bno, tree_level, nr_item));
             item->path_bno[tree_level] = tree_bno;
         }
+        if (nr_item == 0) {
+            fsw_block_release(vol, tree_bno, buffer);
+            return FSW_VOLUME_CORRUPTED;
+        }
 
         // Get the item from the leaf node
         ihead = ((struct item_head *)(buffer + BLKH_SIZE)) + item->path_index[tree_level];
@@ -836,24 +913,9 @@ static fsw_status_t fsw_reiserfs_item_next(struct fsw_reiserfs_volume *vol,
         }
 
         // return results
-        fsw_memcpy(&item->ih, ihead, sizeof (struct item_head));
-        item->item_type = (fsw_u32)FSW_U64_SHR(ihead->ih_key.u.k_offset_v2.v, 60);
-        if (item->item_type != TYPE_DIRECT &&
-            item->item_type != TYPE_INDIRECT &&
-            item->item_type != TYPE_DIRENTRY) {
-            // 3.5 format (_v1)
-            item->item_type = ihead->ih_key.u.k_offset_v1.k_uniqueness;
-            item->item_offset = ihead->ih_key.u.k_offset_v1.k_offset;
-        } else {
-            // 3.6 format (_v2)
-            item->item_offset = ihead->ih_key.u.k_offset_v2.v & (~0ULL >> 4);
-        }
-        item->item_data = buffer + ihead->ih_item_location;
-        item->valid = 1;
-
-        // add information for block release
-        item->block_bno = tree_bno;
-        item->block_buffer = buffer;
+        status = fsw_reiserfs_item_fill(vol, item, tree_bno, buffer, ihead);
+        if (status)
+            return status;
 
         FSW_MSG_DEBUG((FSW_MSGSTR("fsw_reiserfs_item_next: found %d/%d/%lld (%d)\n"),
                        ihead->ih_key.k_dir_id, ihead->ih_key.k_objectid, item->item_offset, item->item_type));
@@ -864,6 +926,102 @@ static fsw_status_t fsw_reiserfs_item_next(struct fsw_reiserfs_volume *vol,
     return FSW_NOT_FOUND;
 }
 
+/**
+ * Offset just past the data of an item: the file data of a direct or indirect
+ * item, or the last entry of a directory item.
+ */
+
+static fsw_u64 fsw_reiserfs_item_end(struct fsw_reiserfs_volume *vol, struct fsw_reiserfs_item *item)
+{
+    fsw_u32         nr_item;
+
+    switch (item->item_type) {
+        case TYPE_INDIRECT:
+        case V1_INDIRECT_UNIQUENESS:
+            return item->item_offset + (fsw_u64)(item->ih.ih_item_len / sizeof (fsw_u32)) * vol->g.log_blocksize;
+        case TYPE_DIRECT:
+        case V1_DIRECT_UNIQUENESS:
+            return item->item_offset + item->ih.ih_item_len;
+        case TYPE_DIRENTRY:
+        case V1_DIRENTRY_UNIQUENESS:
+            nr_item = item->ih.u.ih_entry_count;
+            if (nr_item == 0 || nr_item * DEH_SIZE > item->ih.ih_item_len)
+                return item->item_offset;
+            return (fsw_u64)((struct reiserfs_de_head *)item->item_data)[nr_item - 1].deh_offset + 1;
+        default:
+            return item->item_offset + 1;
+    }
+}
+
+/**
+ * Find an item of a dnode by offset, like fsw_reiserfs_item_search, but
+ * starting from the item found last for the dnode. Reading a file or
+ * directory front to back mostly asks for the same item or the one after
+ * it, which costs one block cache lookup instead of a walk from the root.
+ * For directories, an offset between two items may yield the later one,
+ * the directory functions scan forward from whatever item they get.
+ */
+
+static fsw_status_t fsw_reiserfs_item_seek(struct fsw_reiserfs_volume *vol, struct fsw_reiserfs_dnode *dno,
+                                           fsw_u64 offset, struct fsw_reiserfs_item *item)
+{
+    fsw_status_t    status;
+    struct fsw_reiserfs_item *cursor = &dno->cursor;
+    fsw_u32         tree_bno, nr_item, i;
+    fsw_u8          *buffer;
+    struct item_head *ihead;
+
+    if (cursor->valid && cursor->item_offset <= offset) {
+        // get the cursor's item back from its leaf block
+        *item = *cursor;
+        item->valid = 0;
+        item->block_bno = 0;
+        tree_bno = cursor->path_bno[DISK_LEAF_NODE_LEVEL];
+        i = cursor->path_index[DISK_LEAF_NODE_LEVEL];
+        status = fsw_reiserfs_node_get(vol, tree_bno, DISK_LEAF_NODE_LEVEL, &buffer, &nr_item);
+        if (status)
+            return status;
+        ihead = ((struct item_head *)(buffer + BLKH_SIZE)) + i;
+        if (i >= nr_item || !fsw_memeq(&ihead->ih_key, &cursor->ih.ih_key, KEY_SIZE)) {
+            fsw_block_release(vol, tree_bno, buffer);
+            return FSW_VOLUME_CORRUPTED;
+        }
+        status = fsw_reiserfs_item_fill(vol, item, tree_bno, buffer, ihead);
+        if (status)
+            return status;
+
+        if (offset >= fsw_reiserfs_item_end(vol, item)) {
+            status = fsw_reiserfs_item_next(vol, item);
+            if (status == FSW_SUCCESS && item->item_offset > offset &&
+                item->item_type != TYPE_DIRENTRY && item->item_type != V1_DIRENTRY_UNIQUENESS)
+                status = FSW_NOT_FOUND;     // a gap in file data, let the full search sort it out
+            if (status == FSW_SUCCESS && offset >= fsw_reiserfs_item_end(vol, item) &&
+                item->item_offset <= offset)
+                status = FSW_NOT_FOUND;     // more than one item ahead
+            if (status != FSW_SUCCESS) {
+                fsw_reiserfs_item_release(vol, item);
+                item->valid = 0;
+                if (status != FSW_NOT_FOUND)
+                    return status;
+            }
+        }
+        if (item->valid) {
+            vol->cursor_hits++;
+            goto found;
+        }
+    }
+
+    status = fsw_reiserfs_item_search(vol, dno->dir_id, dno->g.dnode_id, offset, item);
+    if (status)
+        return status;
+
+found:
+    *cursor = *item;
+    cursor->block_bno = 0;
+    cursor->item_data = NULL;
+    return FSW_SUCCESS;
+}
+
 /**
  * Release the disk block still referenced by an item search result.
  */
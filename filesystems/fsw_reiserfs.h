@@ -70,6 +70,9 @@ struct fsw_reiserfs_volume {
     
     struct reiserfs_super_block *sb;  //!< Full raw reiserfs superblock structure
     int version;                    //!< Flag for 3.5 or 3.6 format
+
+    fsw_u32 tree_searches;          //!< Searches that walked down from the root
+    fsw_u32 cursor_hits;            //!< Searches served from a dnode's cursor
 };
 
 /**
@@ -82,6 +85,8 @@ struct fsw_reiserfs_dnode {
     fsw_u32 dir_id;                 //!< Locality ID for the reiserfs tree (parent dir id)
     struct stat_data_v1 *sd_v1;     //!< Full stat_data, version 1
     struct stat_data *sd_v2;        //!< Full stat_data, version 2
+
+    struct fsw_reiserfs_item cursor;  //!< Path to the last item found for this object (no block held)
 };
 
 
@@ -68,6 +68,8 @@ GRUB_MOD_LICENSE ("GPLv3+");
 struct grub_gzio
 {
   int err;
+  /* Set when the decoder has read past the end of the input.  */
+  int starved;
   /* If input is in memory following fields are used instead of file.  */
   int mem_input_size, mem_input_off;
   uint8_t *mem_input;
@@ -281,7 +283,12 @@ static ush mask_bits[] =
 
 /* DA-TAG: Modified by Dayo Akanji (sf.net/u/dakanji/profile). 28 Nov 2021 */
 // Make conditional to remove macOS Clang compile warning
-#if !defined(__has_warning) || __has_warning("-Wunsafe-loop-optimizations")
+// GCC does not know __has_warning and cannot parse it in the same #if
+#if defined(__has_warning)
+#if __has_warning("-Wunsafe-loop-optimizations")
+#pragma GCC diagnostic ignored "-Wunsafe-loop-optimizations"
+#endif
+#else
 #pragma GCC diagnostic ignored "-Wunsafe-loop-optimizations"
 #endif
 
@@ -293,6 +300,7 @@ get_byte (grub_gzio_t gzio)
 {
       if (gzio->mem_input_off < gzio->mem_input_size)
         return gzio->mem_input[gzio->mem_input_off++];
+      gzio->starved = 1;
       return 0;
 }
 
@@ -1010,6 +1018,8 @@ initialize_tables (grub_gzio_t gzio)
   /* Reset memory allocation stuff.  */
   huft_free (gzio->tl);
   huft_free (gzio->td);
+  gzio->tl = 0;
+  gzio->td = 0;
 }
 
 
@@ -1044,73 +1054,755 @@ test_zlib_header (grub_gzio_t gzio)
   return 1;
 }
 
-static grub_ssize_t
-grub_gzio_read_real (grub_gzio_t gzio, grub_off_t offset,
-                     char *buf, grub_size_t len)
+/*
+ *  Fast inflate.
+ *
+ *  The decoder above inflates into a 32K sliding window, reads the input
+ *  a byte at a time and walks linked huft tables for every code.  When the
+ *  caller wants the stream from its start, which is how the drivers use
+ *  it, the output buffer itself holds the history the copies refer to, so
+ *  the decoder below writes straight into it.  It keeps up to 64 bits of
+ *  input in the bit buffer, enough for a whole length/distance pair per
+ *  refill, and decodes from flat tables of 32-bit entries.  A first level
+ *  entry of the literal/length table holds two literals when both codes
+ *  fit into its index bits.
+ */
+
+/* Bits resolved by the first level of each table.  */
+#define FAST_LBITS      11
+#define FAST_DBITS      8
+#define FAST_CBITS      7
+#define FAST_MAXBITS    15
+
+/* The first level, plus at most one second level table per symbol, each
+   of at most 2^(FAST_MAXBITS - first level bits) entries.  */
+#define FAST_LTAB_SIZE  ((1 << FAST_LBITS) + 288 * (1 << (FAST_MAXBITS - FAST_LBITS)))
+#define FAST_DTAB_SIZE  ((1 << FAST_DBITS) + 32 * (1 << (FAST_MAXBITS - FAST_DBITS)))
+
+/* Table entries: bits 0..7 hold the number of bits the entry decodes,
+   bits 8..11 the kind of entry, bits 12..15 the number of extra bits
+   (the index bits for FAST_SUB) and bits 16..31 the value: one or two
+   literals, a length or distance base, or the offset of the second
+   level table.  */
+#define FAST_LIT        0x000
+#define FAST_LIT2       0x100
+#define FAST_BASE       0x200
+#define FAST_EOB        0x300
+#define FAST_SUB        0x400
+#define FAST_BAD        0x500
+#define FAST_KIND       0xf00
+
+/* Kinds of code set passed to fast_build.  */
+#define FAST_CODE_LENS  0
+#define FAST_CODE_LITS  1
+#define FAST_CODE_DISTS 2
+
+struct gzio_fast
 {
-  grub_ssize_t ret = 0;
+  fsw_u32 ltab[FAST_LTAB_SIZE];
+  fsw_u32 dtab[FAST_DTAB_SIZE];
+  uch lens[288 + 32];
+};
 
-  /* Do we reset decompression to the beginning of the file?  */
-  if (gzio->saved_offset > offset + WSIZE)
-    initialize_tables (gzio);
+static fsw_u32
+fast_entry (int kind, unsigned sym, unsigned bits)
+{
+  if (kind == FAST_CODE_LENS || (kind == FAST_CODE_LITS && sym < 256))
+    return FAST_LIT | (sym << 16) | bits;
+  if (kind == FAST_CODE_LITS)
+    {
+      if (sym == 256)
+        return FAST_EOB | bits;
+      if (sym - 257 >= 29)
+        return FAST_BAD | bits;
+      return FAST_BASE | ((fsw_u32) cplens[sym - 257] << 16)
+        | (cplext[sym - 257] << 12) | bits;
+    }
+  if (sym >= 30)
+    return FAST_BAD | bits;
+  return FAST_BASE | ((fsw_u32) cpdist[sym] << 16) | (cpdext[sym] << 12) | bits;
+}
 
-  /*
-   *  This loop operates upon uncompressed data only.  The only
-   *  special thing it does is to make sure the decompression
-   *  window is within the range of data it needs.
-   */
+/* Build the decoding table for n code lengths, resolving root bits in the
+   first level.  Incomplete code sets are accepted as long as all codes fit
+   into the first level, where the unused entries decode as FAST_BAD.
+   Return zero on success, nonzero for an invalid set of lengths.  */
 
-  while (len > 0 && !gzio->err)
+static int
+fast_build (const uch *lens, unsigned n, int kind, fsw_u32 *table,
+            unsigned root, unsigned size)
+{
+  unsigned count[FAST_MAXBITS + 1], offs[FAST_MAXBITS + 1];
+  ush work[288];
+  unsigned len, max, sym, huff, incr, fill, curr, drop, low, used, i;
+  int left;
+  fsw_u32 *next;
+
+  for (len = 0; len <= FAST_MAXBITS; len++)
+    count[len] = 0;
+  for (sym = 0; sym < n; sym++)
+    count[lens[sym]]++;
+  for (max = FAST_MAXBITS; max >= 1 && count[max] == 0; max--)
+    ;
+
+  for (i = 0; i < (1U << root); i++)
+    table[i] = FAST_BAD;
+  if (max == 0)                 /* no codes at all, e.g. no distances */
+    return 0;
+
+  left = 1;
+  for (len = 1; len <= FAST_MAXBITS; len++)
     {
-      register grub_size_t size;
-      register char *srcaddr;
+      left <<= 1;
+      left -= count[len];
+      if (left < 0)
+        return 1;               /* over-subscribed */
+    }
+  if (left > 0 && max > root)
+    return 1;                   /* incomplete beyond the first level */
+
+  offs[1] = 0;
+  for (len = 1; len < FAST_MAXBITS; len++)
+    offs[len + 1] = offs[len] + count[len];
+  for (sym = 0; sym < n; sym++)
+    if (lens[sym] != 0)
+      work[offs[lens[sym]]++] = sym;
+
+  /* Fill in the codes in canonical order.  The table is indexed by the
+     code bits as they come from the stream, so huff counts up in bit
+     reversed order.  */
+  for (len = 1; count[len] == 0; len++)
+    ;
+  huff = 0;
+  sym = 0;
+  next = table;
+  curr = root;
+  drop = 0;
+  low = (unsigned) -1;
+  used = 1U << root;
+  for (;;)
+    {
+      incr = 1U << (len - drop);
+      fill = 1U << curr;
+      do
+        {
+          fill -= incr;
+          next[(huff >> drop) + fill] = fast_entry (kind, work[sym], len - drop);
+        }
+      while (fill != 0);
+
+      incr = 1U << (len - 1);
+      while (huff & incr)
+        incr >>= 1;
+      huff = incr != 0 ? (huff & (incr - 1)) + incr : 0;
 
-      while (offset >= gzio->saved_offset)
-        inflate_window (gzio);
+      sym++;
+      if (--count[len] == 0)
+        {
+          if (len == max)
+            break;
+          len = lens[work[sym]];
+        }
 
-      srcaddr = (char *) ((offset & (WSIZE - 1)) + gzio->slide);
-      size = gzio->saved_offset - offset;
-      if (size > len)
-        size = len;
+      /* start a second level table for a new prefix of longer codes */
+      if (len > root && (huff & ((1U << root) - 1)) != low)
+        {
+          if (drop == 0)
+            drop = root;
+          next += 1U << curr;
+          curr = len - drop;
+          left = 1 << curr;
+          while (curr + drop < max)
+            {
+              left -= count[curr + drop];
+              if (left <= 0)
+                break;
+              curr++;
+              left <<= 1;
+            }
+          used += 1U << curr;
+          if (used > size)
+            return 1;
+          for (i = 0; i < (1U << curr); i++)
+            next[i] = FAST_BAD;
+          low = huff & ((1U << root) - 1);
+          table[low] = FAST_SUB | ((fsw_u32) (next - table) << 16)
+            | (curr << 12) | root;
+        }
+    }
 
-      fsw_memcpy (buf, srcaddr, size);
+  /* Pair up literals.  The bits of an index beyond the first code are
+     themselves an index whose entry is valid for the second code if that
+     code is no longer than those bits.  Going down, the entry looked up
+     has not been paired yet.  */
+  if (kind == FAST_CODE_LITS)
+    {
+      fsw_u32 e, e2;
+      unsigned b1;
 
-      buf += size;
-      len -= size;
-      ret += size;
-      offset += size;
+      for (i = 1U << root; i-- > 0; )
+        {
+          e = table[i];
+          if ((e & FAST_KIND) != FAST_LIT)
+            continue;
+          b1 = e & 0xff;
+          e2 = table[i >> b1];
+          if ((e2 & FAST_KIND) != FAST_LIT || (e2 & 0xff) > root - b1)
+            continue;
+          table[i] = FAST_LIT2 | (e & 0xff0000) | ((e2 & 0xff0000) << 8)
+            | (b1 + (e2 & 0xff));
+        }
     }
+  return 0;
+}
 
-  if (gzio->err)
-    ret = -1;
+/* Eight bytes at any alignment.  A fixed-size memcpy compiles to a single
+   load or store where the CPU allows unaligned access and to byte accesses
+   where it does not, such as AArch64 with strict alignment.  */
+#ifdef __GNUC__
+#define FAST_COPY8(dst, src)    __builtin_memcpy ((dst), (src), 8)
+#else
+#define FAST_COPY8(dst, src)    fsw_memcpy ((dst), (src), 8)
+#endif
 
-  return ret;
+static fsw_u64
+fast_load64 (const uch *p)
+{
+  fsw_u64 v;
+
+  FAST_COPY8 (&v, p);
+  return v;
 }
 
-grub_ssize_t
-grub_zlib_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
-                      char *outbuf, grub_size_t outsize)
+static void
+fast_store64 (uch *p, fsw_u64 v)
+{
+  FAST_COPY8 (p, &v);
+}
+
+/* Bit buffer of the fast decoder: up to 64 bits in bb, bk of them valid.
+   Past the end of the input zero bytes are shifted in and counted in over,
+   as get_byte does; consuming any of them means the stream is truncated.  */
+#define FAST_REFILL() \
+  do { \
+    if (iend - ip >= 8) \
+      { \
+        bb |= fsw_u64_le_swap (fast_load64 (ip)) << bk; \
+        ip += (63 - bk) >> 3; \
+        bk |= 56; \
+      } \
+    else \
+      while (bk <= 56) \
+        { \
+          if (ip < iend) \
+            bb |= (fsw_u64) *ip++ << bk; \
+          else \
+            over++; \
+          bk += 8; \
+        } \
+  } while (0)
+#define FAST_NEED(n)    do { if (bk < (n)) FAST_REFILL (); } while (0)
+#define FAST_BITS(n)    ((unsigned) bb & ((1U << (n)) - 1))
+#define FAST_DUMP(n)    do { bb >>= (n); bk -= (n); } while (0)
+
+/* Look up the next code in a table into e and drop its bits.  */
+#define FAST_DECODE(tab, root) \
+  do { \
+    e = (tab)[FAST_BITS (root)]; \
+    if ((e & FAST_KIND) == FAST_SUB) \
+      { \
+        FAST_DUMP (root); \
+        e = (tab)[(e >> 16) + FAST_BITS ((e >> 12) & 0xf)]; \
+      } \
+    FAST_DUMP (e & 0xff); \
+  } while (0)
+
+/* Read the code lengths of a dynamic block and build its tables.  */
+
+static int
+fast_dynamic_tables (struct gzio_fast *f, const uch **ipp, const uch *iend,
+                     fsw_u64 *bbp, unsigned *bkp, unsigned *overp)
 {
-  grub_gzio_t gzio = 0;
+  const uch *ip = *ipp;
+  fsw_u64 bb = *bbp;
+  unsigned bk = *bkp, over = *overp;
+  unsigned nl, nd, nb, i, j, rep, val;
+  fsw_u32 e;
+  int err = 1;
+
+  FAST_NEED (14);
+  nl = 257 + FAST_BITS (5);
+  FAST_DUMP (5);
+  nd = 1 + FAST_BITS (5);
+  FAST_DUMP (5);
+  nb = 4 + FAST_BITS (4);
+  FAST_DUMP (4);
+  if (nl > 286 || nd > 30)
+    goto out;
+
+  for (j = 0; j < 19; j++)
+    f->lens[bitorder[j]] = 0;
+  for (j = 0; j < nb; j++)
+    {
+      FAST_NEED (3);
+      f->lens[bitorder[j]] = FAST_BITS (3);
+      FAST_DUMP (3);
+    }
+  /* the code length code goes into the distance table, built last */
+  if (fast_build (f->lens, 19, FAST_CODE_LENS, f->dtab, FAST_CBITS, 1 << FAST_CBITS))
+    goto out;
+
+  for (i = 0; i < nl + nd; )
+    {
+      FAST_NEED (FAST_CBITS + 7);
+      e = f->dtab[FAST_BITS (FAST_CBITS)];
+      if ((e & FAST_KIND) != FAST_LIT)
+        goto out;
+      FAST_DUMP (e & 0xff);
+      val = e >> 16;
+      if (val < 16)
+        {
+          f->lens[i++] = val;
+          continue;
+        }
+      if (val == 16)
+        {
+          if (i == 0)
+            goto out;
+          rep = 3 + FAST_BITS (2);
+          FAST_DUMP (2);
+          val = f->lens[i - 1];
+        }
+      else if (val == 17)
+        {
+          rep = 3 + FAST_BITS (3);
+          FAST_DUMP (3);
+          val = 0;
+        }
+      else
+        {
+          rep = 11 + FAST_BITS (7);
+          FAST_DUMP (7);
+          val = 0;
+        }
+      if (i + rep > nl + nd)
+        goto out;
+      while (rep--)
+        f->lens[i++] = val;
+    }
+  if (over * 8 > bk || f->lens[256] == 0)
+    goto out;
+
+  if (fast_build (f->lens, nl, FAST_CODE_LITS, f->ltab, FAST_LBITS, FAST_LTAB_SIZE)
+      || fast_build (f->lens + nl, nd, FAST_CODE_DISTS, f->dtab, FAST_DBITS, FAST_DTAB_SIZE))
+    goto out;
+  err = 0;
+
+out:
+  *ipp = ip;
+  *bbp = bb;
+  *bkp = bk;
+  *overp = over;
+  return err;
+}
+
+/* Inflate a raw deflate stream into out, which also serves as the window.
+   Return the number of bytes produced, which is outsize unless the stream
+   ends earlier, or -1 if the stream is corrupt.  */
+
+static grub_ssize_t
+inflate_fast (struct gzio_fast *f, const uch *in, grub_size_t insize,
+              uch *out, grub_size_t outsize)
+{
+  const uch *ip = in, *iend = in + insize;
+  uch *op = out, *oend = out + outsize;
+  fsw_u64 bb = 0;
+  unsigned bk = 0, over = 0;
+  unsigned last, type, len, dist;
+  fsw_u32 e;
+  const uch *from;
+
+  if (outsize <= 0)
+    return 0;
+
+  do
+    {
+      FAST_NEED (3);
+      last = FAST_BITS (1);
+      type = FAST_BITS (3) >> 1;
+      FAST_DUMP (3);
+
+      if (type == INFLATE_STORED)
+        {
+          /* go to the byte boundary and hand back the whole bytes */
+          FAST_DUMP (bk & 7);
+          if (over > bk / 8)
+            return -1;
+          ip -= bk / 8 - over;
+          bb = 0;
+          bk = over = 0;
+          if (iend - ip < 4)
+            return -1;
+          len = ip[0] | (ip[1] << 8);
+          if ((ip[2] | (ip[3] << 8)) != (~len & 0xffff))
+            return -1;
+          ip += 4;
+          if ((unsigned) (iend - ip) < len)
+            return -1;
+          if (len > (unsigned) (oend - op))
+            len = oend - op;
+          fsw_memcpy (op, ip, len);
+          ip += len;
+          op += len;
+          if (op == oend)
+            return outsize;
+          continue;
+        }
+
+      if (type == INFLATE_FIXED)
+        {
+          for (len = 0; len < 144; len++)
+            f->lens[len] = 8;
+          for (; len < 256; len++)
+            f->lens[len] = 9;
+          for (; len < 280; len++)
+            f->lens[len] = 7;
+          for (; len < 288; len++)
+            f->lens[len] = 8;
+          for (len = 0; len < 30; len++)
+            f->lens[288 + len] = 5;
+          fast_build (f->lens, 288, FAST_CODE_LITS, f->ltab, FAST_LBITS, FAST_LTAB_SIZE);
+          fast_build (f->lens + 288, 30, FAST_CODE_DISTS, f->dtab, FAST_DBITS, FAST_DTAB_SIZE);
+        }
+      else if (type != INFLATE_DYNAMIC
+               || fast_dynamic_tables (f, &ip, iend, &bb, &bk, &over))
+        return -1;
+
+      for (;;)
+        {
+          if (over * 8 > bk)
+            return -1;
+          FAST_REFILL ();
+          FAST_DECODE (f->ltab, FAST_LBITS);
+
+          /* literals, as many as the bits in the buffer allow */
+          while ((e & FAST_KIND) <= FAST_LIT2)
+            {
+              if (oend - op < 2)
+                {
+                  *op++ = (uch) (e >> 16);
+                  return outsize;
+                }
+              *op = (uch) (e >> 16);
+              op[1] = (uch) (e >> 24);
+              op += 1 + ((e & FAST_KIND) >> 8);
+              if (op == oend)
+                return outsize;
+              if (bk < FAST_MAXBITS)
+                {
+                  if (over * 8 > bk)
+                    return -1;
+                  FAST_REFILL ();
+                }
+              FAST_DECODE (f->ltab, FAST_LBITS);
+            }
+
+          if ((e & FAST_KIND) == FAST_EOB)
+            break;
+          if ((e & FAST_KIND) != FAST_BASE)
+            return -1;
+
+          /* a length and distance take up to 48 bits */
+          if (bk < 48)
+            {
+              if (over * 8 > bk)
+                return -1;
+              FAST_REFILL ();
+            }
+          len = (e >> 16) + FAST_BITS ((e >> 12) & 0xf);
+          FAST_DUMP ((e >> 12) & 0xf);
+          FAST_DECODE (f->dtab, FAST_DBITS);
+          if ((e & FAST_KIND) != FAST_BASE)
+            return -1;
+          dist = (e >> 16) + FAST_BITS ((e >> 12) & 0xf);
+          FAST_DUMP ((e >> 12) & 0xf);
+          if (dist > (unsigned) (op - out))
+            return -1;
+
+          from = op - dist;
+          if ((unsigned) (oend - op) >= len + 8)
+            {
+              /* whole words, the overshoot lands in the free part of
+                 the output; with dist >= 8 each word is complete before
+                 it is read */
+              uch *end = op + len;
+
+              if (dist >= 8)
+                do
+                  {
+                    fast_store64 (op, fast_load64 (from));
+                    op += 8;
+                    from += 8;
+                  }
+                while (op < end);
+              else if (dist == 1)
+                {
+                  fsw_u64 v = *from * (fsw_u64) 0x0101010101010101ULL;
+
+                  do
+                    {
+                      fast_store64 (op, v);
+                      op += 8;
+                    }
+                  while (op < end);
+                }
+              else
+                while (op < end)
+                  *op++ = *from++;
+              op = end;
+            }
+          else
+            {
+              if (len > (unsigned) (oend - op))
+                len = oend - op;
+              while (len--)
+                *op++ = *from++;
+              if (op == oend)
+                return outsize;
+            }
+        }
+    }
+  while (!last);
+
+  if (over * 8 > bk)
+    return -1;
+  return op - out;
+}
+
+/* Inflate a zlib stream from its start straight into the output buffer.
+   The data past the end of a short stream is zeroed, so the result is the
+   same as the window decoder's.  */
+
+static grub_ssize_t
+grub_zlib_decompress_fast (struct gzio_fast *f, char *inbuf, grub_size_t insize,
+                           char *outbuf, grub_size_t outsize)
+{
+  uch *in = (uch *) inbuf;
   grub_ssize_t ret;
 
-  gzio = AllocatePool (sizeof (*gzio));
-  if (! gzio)
+  if (insize < 2 || (in[0] & 0xf) != DEFLATED
+      || (in[0] * 256 + in[1]) % 31 || (in[1] & 0x20))
     return -1;
-  fsw_memzero(gzio, sizeof (*gzio));
-  gzio->mem_input = (uint8_t *) inbuf;
+
+  ret = inflate_fast (f, in + 2, insize - 2, (uch *) outbuf, outsize);
+
+  if (ret >= 0 && ret < outsize)
+    {
+      fsw_memzero (outbuf + ret, outsize - ret);
+      ret = outsize;
+    }
+  return ret;
+}
+
+/* State of both decoders, kept by the decompressor registry per context
+   so that the tables and the window are not allocated for every call.  */
+
+struct gzio_workspace
+{
+  struct gzio_fast fast;
+  struct grub_gzio window;
+  /* The stream the decoders were last used for, 0 if none.  */
+  fsw_u32 stream_id;
+  /* The window decoder holds the state of that stream.  */
+  int window_valid;
+  /* Where the data of that stream ends, -1 while not known.  */
+  grub_off_t stream_end;
+};
+
+/* Unread input the window decoder wants before it inflates another window
+   of a stream whose input is still coming in: enough for a window of
+   literals with the longest codes.  If a window runs out all the same, the
+   stream starts over once more input has been fed.  */
+#define GZIO_STREAM_MARGIN  (2 * WSIZE + 1024)
+
+/* Read outsize bytes at offset pos of the current stream with the window
+   decoder, which keeps its state from one read to the next: a stream read
+   in pieces, or with gaps, is inflated once.  Return the number of bytes
+   stored, fewer than outsize at the end of the stream or if more input is
+   needed, or -1 if the stream is corrupt.  */
+
+static grub_ssize_t
+gzio_window_read (struct gzio_workspace *ws, uch *in, grub_size_t insize,
+                  int in_complete, grub_off_t pos, uch *out, grub_size_t outsize)
+{
+  grub_gzio_t gzio = &ws->window;
+  grub_ssize_t ret = 0;
+  grub_size_t size;
+
+  if (! ws->window_valid || gzio->saved_offset > pos + WSIZE)
+    {
+      if (insize < 2 && ! in_complete)
+        return 0;
+      /* the tables of a block that was not finished are still allocated */
+      huft_free (gzio->tl);
+      huft_free (gzio->td);
+      fsw_memzero (gzio, sizeof (*gzio));
+      gzio->mem_input = in;
+      gzio->mem_input_size = insize;
+      if (! test_zlib_header (gzio))
+        return -1;
+      ws->window_valid = 1;
+    }
+  gzio->mem_input = in;
   gzio->mem_input_size = insize;
-  gzio->mem_input_off = 0;
+  gzio->starved = 0;
 
-  if (!test_zlib_header (gzio))
+  while (outsize > 0)
     {
-      FreePool (gzio);
-      return -1;
+      if (pos < gzio->saved_offset)
+        {
+          size = gzio->saved_offset - pos;
+          if (ws->stream_end >= 0 && ws->stream_end - pos < size)
+            size = ws->stream_end - pos;
+          if (size > outsize)
+            size = outsize;
+          fsw_memcpy (out, gzio->slide + (pos & (WSIZE - 1)), size);
+          out += size;
+          outsize -= size;
+          pos += size;
+          ret += size;
+          continue;
+        }
+      if (ws->stream_end >= 0)
+        break;
+      if (! in_complete && gzio->mem_input_size - gzio->mem_input_off < GZIO_STREAM_MARGIN)
+        break;
+
+      inflate_window (gzio);
+      if (gzio->err)
+        {
+          ws->window_valid = 0;
+          return -1;
+        }
+      if (gzio->starved && ! in_complete)
+        {
+          /* the window was inflated from missing input */
+          ws->window_valid = 0;
+          break;
+        }
+      if (gzio->last_block && ! gzio->block_len)
+        ws->stream_end = gzio->saved_offset - WSIZE + gzio->wp;
     }
 
-  ret = grub_gzio_read_real (gzio, off, outbuf, outsize);
-  FreePool (gzio);
+  return ret;
+}
 
-  /* FIXME: Check Adler.  */
+/* Read outsize bytes at offset pos of stream id.  A read from the start of
+   a stream whose input is all there goes to the fast decoder, and the
+   window decoder only takes over if the stream carries on past the end of
+   that read.  */
+
+static grub_ssize_t
+gzio_stream_read (struct gzio_workspace *ws, fsw_u32 id, uch *in, grub_size_t insize,
+                  int in_complete, grub_off_t pos, uch *out, grub_size_t outsize)
+{
+  grub_ssize_t ret;
+
+  if (id == 0 || id != ws->stream_id)
+    {
+      ws->stream_id = id;
+      ws->window_valid = 0;
+      ws->stream_end = -1;
+    }
+  if (ws->stream_end >= 0 && pos >= ws->stream_end)
+    return 0;
+
+  if (! ws->window_valid && pos == 0 && in_complete)
+    {
+      if (insize < 2 || (in[0] & 0xf) != DEFLATED
+          || (in[0] * 256 + in[1]) % 31 || (in[1] & 0x20))
+        return -1;
+      ret = inflate_fast (&ws->fast, in + 2, insize - 2, out, outsize);
+      if (ret >= 0 && ret < outsize)
+        ws->stream_end = ret;
+      return ret;
+    }
+
+  return gzio_window_read (ws, in, insize, in_complete, pos, out, outsize);
+}
+
+/* The window decoder, for output starting at an offset into a stream that
+   is read only once.  */
+
+static grub_ssize_t
+grub_zlib_decompress_window (struct gzio_workspace *ws, char *inbuf, grub_size_t insize,
+                             grub_off_t off, char *outbuf, grub_size_t outsize)
+{
+  ws->stream_id = 0;
+  ws->window_valid = 0;
+  ws->stream_end = -1;
+  return gzio_window_read (ws, (uch *) inbuf, insize, 1, off, (uch *) outbuf, outsize);
+}
+
+/* Inflate outsize bytes at offset off of a zlib stream.  The data past the
+   end of a short stream is zeroed.  */
+
+static fsw_s32
+gzio_codec_decompress (void *workspace, fsw_u8 *in, fsw_u32 insize, fsw_u32 off,
+                       fsw_u8 *out, fsw_u32 outsize)
+{
+  struct gzio_workspace *ws = workspace;
+  grub_ssize_t ret;
+
+  if (off == 0)
+    return grub_zlib_decompress_fast (&ws->fast, (char *) in, insize, (char *) out, outsize);
+  ret = grub_zlib_decompress_window (ws, (char *) in, insize, off, (char *) out, outsize);
+  if (ret >= 0 && ret < (grub_ssize_t) outsize)
+    {
+      fsw_memzero (out + ret, outsize - ret);
+      ret = outsize;
+    }
+  return ret;
+}
+
+static fsw_s32
+gzio_codec_stream_read (void *workspace, fsw_u32 id, fsw_u8 *in, fsw_u32 insize, int in_complete,
+                        fsw_u64 pos, fsw_u8 *out, fsw_u32 outsize, fsw_u32 *in_used)
+{
+  /* the decoders do not track where the stream ends in the input */
+  *in_used = insize;
+  if (pos > 0x7fffffff || insize > 0x7fffffff || outsize > 0x7fffffff)
+    return -1;
+  return gzio_stream_read (workspace, id, in, insize, in_complete, pos, out, outsize);
+}
+
+static void
+gzio_codec_workspace_free (void *workspace)
+{
+  struct gzio_workspace *ws = workspace;
+
+  huft_free (ws->window.tl);
+  huft_free (ws->window.td);
+}
+
+static const struct fsw_codec fsw_codec_zlib = {
+  FSW_CODEC_ZLIB, "zlib", 0, sizeof (struct gzio_workspace),
+  gzio_codec_decompress, gzio_codec_stream_read, gzio_codec_workspace_free
+};
+
+grub_ssize_t
+grub_zlib_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+                      char *outbuf, grub_size_t outsize)
+{
+  struct gzio_workspace *ws;
+  grub_ssize_t ret;
+
+  ws = AllocatePool (sizeof (*ws));
+  if (! ws)
+    return -1;
+  fsw_memzero (ws, sizeof (*ws));
+  ret = gzio_codec_decompress (ws, (fsw_u8 *) inbuf, insize, off, (fsw_u8 *) outbuf, outsize);
+  gzio_codec_workspace_free (ws);
+  FreePool (ws);
   return ret;
 }
@@ -0,0 +1,131 @@
+/**
+ * \file lznt1.c
+ * LZNT1 decoder for compressed NTFS files.
+ *
+ * A compression unit is a sequence of chunks that each expand to 4 KiB. A
+ * chunk starts with a 16-bit header: the low 12 bits are its size minus 3
+ * (header included, so the data is that plus 1 bytes), bit 15 is set if the
+ * data is compressed. Compressed data is a series of groups of a flag byte
+ * followed by eight items, literal bytes for clear bits and 16-bit
+ * back-references for set bits. The split of a back-reference between
+ * distance and length depends on how much of the chunk has been written.
+ * Copyright (C) 2015 by Samuel Liao
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+static inline fsw_u16 lznt1_get16(fsw_u8 *buf, int pos)
+{
+    return buf[pos] | (buf[pos+1] << 8);
+}
+
+static int lznt1_decode_chunk(fsw_u8 *src, int slen, fsw_u8 *dst) {
+    int soff = 0;
+    int doff = 0;
+    while(soff < slen) {
+	int j;
+	int tag = src[soff++];
+	for(j = 0; j < 8 && soff < slen; j++) {
+	    if(tag & (1<<j)){
+		int len;
+		int back;
+		int bits;
+
+		if(!doff || soff + 2 > slen)
+		    return -1;
+		len = lznt1_get16(src, soff); soff += 2;
+		// 12 length bits up to 16 bytes into the chunk, one fewer for each doubling
+		bits = __builtin_clz(((doff-1)>>3) | 1)-19;
+		back = (len >> bits) + 1;
+		len = (len & ((1<<bits)-1)) + 3;
+		if(doff < back || doff + len > 0x1000)
+		    return -1;
+		while(len-- > 0) {
+		    dst[doff] = dst[doff-back];
+		    doff++;
+		}
+	    } else {
+		if(doff >= 0x1000)
+		    return -1;
+		dst[doff++] = src[soff++];
+	    }
+	}
+    }
+    return doff;
+}
+
+/**
+ * Decode npage chunks from src into dst, skipping the first skip chunks.
+ * Returns 0, or -1 if the data is invalid.
+ */
+
+static int lznt1_decode(fsw_u8 *src, int slen, fsw_u8 *dst, int npage, int skip) {
+    fsw_u8 *se = src + slen;
+    fsw_u8 *de = dst + (npage<<12);
+    int i;
+    for(i=0; i<skip+npage; i++) {
+	fsw_u16 slen;
+	int comp;
+
+	if(src + 2 > se)
+	    return -1;
+	slen = lznt1_get16(src, 0);
+	comp = slen & 0x8000;
+	slen = (slen&0xfff)+1;
+	src += 2;
+
+	if(src + slen > se || dst + 0x1000 > de)
+	    return -1;
+
+	if(i < skip) {
+	    // every chunk expands to 4 KiB, so whole chunks are skipped unread
+	} else if(!comp) {
+	    fsw_memcpy(dst, src, slen);
+	    if(slen < 0x1000)
+		fsw_memzero(dst+slen, 0x1000-slen);
+	} else if(slen == 1) {
+	    fsw_memzero(dst, 0x1000);
+	} else {
+	    int dlen = lznt1_decode_chunk(src, slen, dst);
+	    if(dlen < 0)
+		return -1;
+	    if(dlen < 0x1000)
+		fsw_memzero(dst+dlen, 0x1000-dlen);
+	}
+	src += slen;
+	if(i >= skip)
+	    dst += 0x1000;
+    }
+    return 0;
+}
+
+static fsw_s32 lznt1_codec_decompress(void *workspace, fsw_u8 *in, fsw_u32 insize, fsw_u32 off,
+				      fsw_u8 *out, fsw_u32 outsize)
+{
+    if((off & 0xfff) || (outsize & 0xfff))
+	return -1;
+    if(lznt1_decode(in, insize, out, outsize >> 12, off >> 12) < 0)
+	return -1;
+    return outsize;
+}
+
+static const struct fsw_codec fsw_codec_lznt1 = {
+    FSW_CODEC_LZNT1, "lznt1", 0, 0,
+    lznt1_codec_decompress, NULL, NULL
+};
+
+// EOF
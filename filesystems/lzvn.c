@@ -0,0 +1,159 @@
+/**
+ * \file lzvn.c
+ * LZVN decoder for compressed HFS+ files (decmpfs types 7 and 8).
+ *
+ * LZVN is the LZ77 variant macOS uses for file system compression. A stream
+ * is a sequence of opcodes, each of which copies up to a few literal bytes
+ * from the input and then a match from earlier output:
+ *
+ *   sml_d  LLMMMDDD DDDDDDDD           L literals, match M+3 at distance D
+ *   med_d  101LLMMM DDDDDDMM DDDDDDDD  L literals, match M+3 at distance D
+ *   lrg_d  LLMMM111 DDDDDDDD DDDDDDDD  L literals, match M+3 at distance D
+ *   pre_d  LLMMM110                    L literals, match M+3 at previous D
+ *   sml_m  1111MMMM                    match M at previous D
+ *   lrg_m  11110000 MMMMMMMM           match M+16 at previous D
+ *   sml_l  1110LLLL                    L literals
+ *   lrg_l  11100000 LLLLLLLL           L+16 literals
+ *   nop    00001110 or 00010110
+ *   eos    00000110 followed by 7 zero bytes
+ *
+ * Multi byte distances are little endian. Every other opcode is invalid.
+ */
+
+/*
+ * This file is distributed under the terms of the GNU General Public
+ * License, version 3 or (at your option) any later version, like gzio.c.
+ */
+
+/**
+ * Decode the LZVN stream src of src_size bytes into dst, which holds
+ * dst_size bytes. Decoding stops at the end of stream opcode, at the end
+ * of the input or when dst is full. Returns the number of bytes written,
+ * or -1 if the stream is invalid.
+ */
+static int
+lzvn_decode (const fsw_u8 *src, fsw_u32 src_size, fsw_u8 *dst, fsw_u32 dst_size)
+{
+  const fsw_u8 *end = src + src_size;
+  fsw_u32 out = 0;
+  fsw_u32 dist = 0;
+
+  while (src < end && out < dst_size)
+    {
+      fsw_u8 op = src[0];
+      fsw_u32 lit = 0, match = 0, len = 1;
+
+      if (op == 0x06)
+        break;                  /* eos */
+      if (op == 0x0e || op == 0x16)
+        {
+          src++;                /* nop */
+          continue;
+        }
+
+      if ((op & 0xf0) == 0xe0)
+        {
+          /* sml_l, lrg_l */
+          if (op == 0xe0)
+            {
+              if (end - src < 2)
+                return -1;
+              lit = src[1] + 16;
+              len = 2;
+            }
+          else
+            lit = op & 0x0f;
+        }
+      else if ((op & 0xf0) == 0xf0)
+        {
+          /* sml_m, lrg_m */
+          if (op == 0xf0)
+            {
+              if (end - src < 2)
+                return -1;
+              match = src[1] + 16;
+              len = 2;
+            }
+          else
+            match = op & 0x0f;
+        }
+      else if ((op & 0xe0) == 0xa0)
+        {
+          /* med_d */
+          if (end - src < 3)
+            return -1;
+          lit = (op >> 3) & 3;
+          match = (((op & 7) << 2) | (src[1] & 3)) + 3;
+          dist = (src[1] >> 2) | ((fsw_u32) src[2] << 6);
+          len = 3;
+        }
+      else if ((op & 0xf0) == 0x70 || (op & 0xf0) == 0xd0 || (op < 0x40 && (op & 7) == 6))
+        return -1;              /* undefined */
+      else
+        {
+          lit = op >> 6;
+          match = ((op >> 3) & 7) + 3;
+          switch (op & 7)
+            {
+            case 6:             /* pre_d */
+              break;
+            case 7:             /* lrg_d */
+              if (end - src < 3)
+                return -1;
+              dist = src[1] | ((fsw_u32) src[2] << 8);
+              len = 3;
+              break;
+            default:            /* sml_d */
+              if (end - src < 2)
+                return -1;
+              dist = ((fsw_u32) (op & 7) << 8) | src[1];
+              len = 2;
+              break;
+            }
+        }
+
+      src += len;
+
+      if (lit)
+        {
+          if ((fsw_u32) (end - src) < lit)
+            return -1;
+          if (lit > dst_size - out)
+            lit = dst_size - out;
+          fsw_memcpy (dst + out, src, lit);
+          src += lit;
+          out += lit;
+        }
+
+      if (match)
+        {
+          const fsw_u8 *from;
+
+          if (dist == 0 || dist > out)
+            return -1;
+          if (match > dst_size - out)
+            match = dst_size - out;
+          /* The match may overlap its own output */
+          from = dst + out - dist;
+          while (match--)
+            dst[out++] = *from++;
+        }
+    }
+
+  return (int) out;
+}
+
+/* LZVN streams can only be decoded from their start */
+static fsw_s32
+lzvn_codec_decompress (void *workspace, fsw_u8 *in, fsw_u32 insize, fsw_u32 off,
+                       fsw_u8 *out, fsw_u32 outsize)
+{
+  if (off != 0)
+    return -1;
+  return lzvn_decode (in, insize, out, outsize);
+}
+
+static const struct fsw_codec fsw_codec_lzvn = {
+  FSW_CODEC_LZVN, "lzvn", 0, 0,
+  lzvn_codec_decompress, NULL, NULL
+};
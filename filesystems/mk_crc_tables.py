@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+
+#
+# mk_crc_tables.py
+#
+# Writes the slicing-by-8 tables for a reflected CRC-32 to stdout:
+#
+#   python3 mk_crc_tables.py crc32c > crc32c_table.h
+#   python3 mk_crc_tables.py crc32 > ../BootMaster/crc32_table.h
+#
+# Table 0 is the usual byte-at-a-time table. Entry i of table k is the CRC
+# register after byte i followed by k zero bytes, so eight bytes are folded
+# in with one lookup in each table. The headers are kept in the tree because
+# the EDK2 and gnu-efi builds have no step that runs host tools;
+# filesystems/test/Makefile regenerates them and fails if they differ.
+#
+
+import sys
+
+# name: (reflected polynomial, table name, element type, what uses it)
+crcs = {
+    'crc32c': (0x82f63b78, 'crc32c_table', 'uint32_t',
+               'CRC-32C (Castagnoli) for crc32c.c'),
+    'crc32': (0xedb88320, 'crc32_table', 'UINT32',
+              'CRC-32 (IEEE 802.3) for crc32.c'),
+}
+
+if len(sys.argv) != 2 or sys.argv[1] not in crcs:
+    sys.stderr.write('Usage: mk_crc_tables.py crc32c|crc32\n')
+    sys.exit(1)
+
+name = sys.argv[1]
+poly, table, ctype, what = crcs[name]
+
+tables = [[0] * 256 for k in range(8)]
+for i in range(256):
+    c = i
+    for j in range(8):
+        c = (c >> 1) ^ (poly if c & 1 else 0)
+    tables[0][i] = c
+for k in range(1, 8):
+    for i in range(256):
+        c = tables[k - 1][i]
+        tables[k][i] = (c >> 8) ^ tables[0][c & 0xff]
+
+out = sys.stdout
+out.write('/* %s_table.h generated by mk_crc_tables.py %s, do not edit */\n\n' % (name, name))
+out.write('/*\n * Slicing-by-8 tables for %s,\n * reflected polynomial 0x%08x.\n */\n\n' % (what, poly))
+out.write('static const %s %s[8][256] = {\n' % (ctype, table))
+for k in range(8):
+    out.write('  {\n')
+    for i in range(0, 256, 6):
+        row = ', '.join('0x%08x' % v for v in tables[k][i:i + 6])
+        out.write('    %s%s\n' % (row, ',' if i + 6 < 256 else ''))
+    out.write('  }%s\n' % (',' if k < 7 else ''))
+out.write('};\n')
+
+# EOF
@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+#
+# benchcmp.py - compare two runs of the host benchmark harness
+#
+# Reads the JSON records written by runbench.sh (one per line) for a base and
+# a new run and prints, for every image and workload found in both, the time
+# taken, the block cache hit rate and the number of device reads side by
+# side. A ratio above 1 means the new run was faster.
+#
+# Usage: benchcmp.py <base.jsonl> <new.jsonl>
+#
+
+import json
+import sys
+
+
+def load(path):
+    runs = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith('{'):
+                continue
+            r = json.loads(line)
+            runs[(r['image'], r['workload'])] = r
+    return runs
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: benchcmp.py <base.jsonl> <new.jsonl>')
+    base = load(sys.argv[1])
+    new = load(sys.argv[2])
+
+    print('%-18s %-9s %11s %11s %7s  %13s  %17s' % (
+        'image', 'workload', 'base ms', 'new ms', 'speedup', 'hit rate', 'device reads'))
+    for key in sorted(base):
+        if key not in new:
+            continue
+        b, n = base[key], new[key]
+        speedup = b['seconds'] / n['seconds'] if n['seconds'] > 0 else 0.0
+        reads_b = b['read_block_calls'] + b['read_blocks_calls'] + b.get('map_block_calls', 0)
+        reads_n = n['read_block_calls'] + n['read_blocks_calls'] + n.get('map_block_calls', 0)
+        flag = '  ERRORS' if n['errors'] and not b['errors'] else ''
+        print('%-18s %-9s %11.3f %11.3f %6.2fx  %5.1f%% %5.1f%%  %8d %8d%s' % (
+            key[0], key[1], b['seconds'] * 1000, n['seconds'] * 1000, speedup,
+            b['bcache_hit_rate'] * 100, n['bcache_hit_rate'] * 100, reads_b, reads_n, flag))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,63 @@
+/**
+ * \file chunkmap.c
+ * Prints the chunk map of a btrfs volume in the POSIX user space environment.
+ *
+ * fsw_btrfs reads all chunk items at mount and maps logical addresses with
+ * them. The output uses the field names of
+ * "btrfs inspect-internal dump-tree -t chunk", so the two can be compared
+ * line by line after filtering the dump-tree output for those fields.
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fsw_posix.h"
+
+
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(btrfs);
+extern void fsw_btrfs_dump_chunk_map(struct fsw_volume *vol);
+
+int main(int argc, char **argv)
+{
+    struct fsw_posix_volume *vol;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: chunkmap <file/device>\n");
+        return 1;
+    }
+
+    vol = fsw_posix_mount(argv[1], &FSW_FSTYPE_TABLE_NAME(btrfs));
+    if (vol == NULL) {
+        fprintf(stderr, "Mounting failed.\n");
+        return 1;
+    }
+    fsw_btrfs_dump_chunk_map(vol->vol);
+    fsw_posix_unmount(vol);
+
+    return 0;
+}
+
+// EOF
@@ -0,0 +1,607 @@
+/**
+ * \file codecbench.c
+ * Decompressor benchmark for the POSIX user space environment.
+ *
+ * Registers every decompressor the drivers and libeg carry (zlib, btrfs
+ * LZO, zstd, LZNT1, LZVN, ICNS RLE), cuts each file given on the command
+ * line into the units they decode (128 KiB btrfs extents, 64 KiB NTFS
+ * compression units and HFS+ chunks, 16 KiB icon planes), compresses them
+ * and decodes them through fsw_codec_ctx_decompress. Each codec is timed
+ * with the workspace pooled in the context, as the drivers use it, and with
+ * the workspace set up for every call, and the throughput and allocations
+ * per call of both are printed. Codecs with a stream entry point are also
+ * timed reading every unit through a stream in 4 KiB pieces, as a file is
+ * read block by block.
+ * zlib and zstd data is made with libz.so.1 and libzstd.so.1, loaded at run
+ * time; LZO with minilzo; LZNT1, LZVN and ICNS RLE with simple greedy
+ * encoders below.
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fsw_codec.h"
+
+#include <dlfcn.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static long allocations;
+
+static void *count_alloc(size_t size)
+{
+    allocations++;
+    return malloc(size);
+}
+
+// the codecs are set up as in fsw_btrfs.c, fsw_hfs.c and fsw_ntfs.c
+#undef AllocatePool
+#define AllocatePool(size) count_alloc(size)
+#define uint8_t fsw_u8
+#define uint16_t fsw_u16
+#define uint32_t fsw_u32
+#define uint64_t fsw_u64
+#define int64_t fsw_s64
+#define int32_t fsw_s32
+#define DPRINT(x...)    /* */
+#define fsw_size_t int
+#define fsw_ssize_t int
+#define grub_off_t int32_t
+#define grub_size_t int32_t
+#define grub_ssize_t int32_t
+#include "gzio.c"
+#define MINILZO_CFG_SKIP_LZO_PTR 1
+#define MINILZO_CFG_SKIP_LZO_UTIL 1
+#define MINILZO_CFG_SKIP_LZO_INIT 1
+#define MINILZO_CFG_SKIP_LZO1X_DECOMPRESS 1
+#include "minilzo.c"
+#include "fsw_btrfs_lzo.h"
+#include "fsw_btrfs_zstd.h"
+#include "lzvn.c"
+#include "lznt1.c"
+#include "../../libeg/icns_rle.c"
+
+
+/** Minimum time spent on each codec, mode and file, in seconds. */
+#define MIN_SECONDS (0.5)
+/** Compression levels: zlib's default, btrfs's zstd default. */
+#define ZLIB_LEVEL 6
+#define ZSTD_LEVEL 3
+/** Size of the pieces streamed units are read in. */
+#define STREAM_PIECE 4096
+
+static int (*z_compress2)(unsigned char *dest, unsigned long *destLen, const unsigned char *source,
+                          unsigned long sourceLen, int level);
+static size_t (*zstd_compress)(void *dst, size_t dstCapacity, const void *src, size_t srcSize, int level);
+static unsigned (*zstd_is_error)(size_t code);
+
+typedef long (*compressor_t)(const fsw_u8 *src, long size, fsw_u8 *dst, long cap);
+
+struct codec_case {
+    const struct fsw_codec *codec;
+    long        unit;               //!< Uncompressed size of a unit
+    compressor_t compress;          //!< Returns the compressed size, or -1
+};
+
+struct unit {
+    fsw_u8  *z;
+    long    zsize;
+    long    size;                   //!< Bytes of the file in this unit
+    long    outsize;                //!< Bytes the unit decodes to
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long compress_zlib(const fsw_u8 *src, long size, fsw_u8 *dst, long cap)
+{
+    unsigned long n = cap;
+
+    if (z_compress2 == NULL || z_compress2(dst, &n, src, size, ZLIB_LEVEL) != 0)
+        return -1;
+    return n;
+}
+
+static long compress_zstd(const fsw_u8 *src, long size, fsw_u8 *dst, long cap)
+{
+    size_t n;
+
+    if (zstd_compress == NULL)
+        return -1;
+    n = zstd_compress(dst, cap, src, size, ZSTD_LEVEL);
+    return zstd_is_error(n) ? -1 : (long)n;
+}
+
+/**
+ * btrfs LZO: total size, then per 4 KiB the size of its LZO1X segment and the
+ * segment. A size field that would cross a 4 KiB boundary moves to the next.
+ */
+
+static long compress_lzo(const fsw_u8 *src, long size, fsw_u8 *dst, long cap)
+{
+    static lzo_align_t wrkmem[(LZO1X_1_MEM_COMPRESS + sizeof(lzo_align_t) - 1) / sizeof(lzo_align_t)];
+    long pos, out = 4, n;
+    lzo_uint seg;
+
+    for (pos = 0; pos < size; pos += n) {
+        n = size - pos < GRUB_BTRFS_LZO_BLOCK_SIZE ? size - pos : GRUB_BTRFS_LZO_BLOCK_SIZE;
+        if (4096 - (out % 4096) < 4) {
+            memset(dst + out, 0, 4096 - (out % 4096));
+            out += 4096 - (out % 4096);
+        }
+        if (out + 4 + GRUB_BTRFS_LZO_BLOCK_MAX_CSIZE > cap ||
+            lzo1x_1_compress(src + pos, n, dst + out + 4, &seg, wrkmem) != LZO_E_OK)
+            return -1;
+        dst[out] = seg; dst[out + 1] = seg >> 8; dst[out + 2] = seg >> 16; dst[out + 3] = seg >> 24;
+        out += 4 + seg;
+    }
+    dst[0] = out; dst[1] = out >> 8; dst[2] = out >> 16; dst[3] = out >> 24;
+    return out;
+}
+
+/**
+ * LZNT1: one chunk per 4 KiB, greedy matches against the last position with
+ * the same three bytes, stored uncompressed when that is not smaller.
+ */
+
+static long compress_lznt1(const fsw_u8 *src, long size, fsw_u8 *dst, long cap)
+{
+    static int last[4096];
+    long pos, out = 0, n;
+    int i, doff, flag_pos, items, bits, best, back, h;
+    fsw_u8 *chunk;
+
+    for (pos = 0; pos < size; pos += n) {
+        n = size - pos < 4096 ? size - pos : 4096;
+        if (out + 2 + 4096 + 4096 / 8 + 1 > cap)
+            return -1;
+        chunk = dst + out + 2;
+        memset(last, 0xff, sizeof(last));
+        i = 0;
+        flag_pos = 0;
+        items = 8;
+        for (doff = 0; doff < n; ) {
+            if (items == 8) {
+                flag_pos = i;
+                chunk[i++] = 0;
+                items = 0;
+            }
+            best = 0;
+            back = 0;
+            if (doff + 3 <= n) {
+                h = ((src[pos + doff] << 4) ^ (src[pos + doff + 1] << 2) ^ src[pos + doff + 2]) & 4095;
+                if (last[h] >= 0 && doff > 0) {
+                    bits = __builtin_clz(((doff - 1) >> 3) | 1) - 19;
+                    back = doff - last[h];
+                    if (back <= (1 << (16 - bits))) {
+                        while (doff + best < n && best < (1 << bits) + 2 &&
+                               src[pos + doff + best] == src[pos + doff + best - back])
+                            best++;
+                    }
+                }
+                last[h] = doff;
+            }
+            if (best >= 3) {
+                int token = ((back - 1) << bits) | (best - 3);
+
+                chunk[flag_pos] |= 1 << items;
+                chunk[i++] = token;
+                chunk[i++] = token >> 8;
+                doff += best;
+            } else {
+                chunk[i++] = src[pos + doff++];
+            }
+            items++;
+        }
+        if (i >= n) {
+            // no gain: 0x3000 is the chunk signature, bit 15 clear means stored
+            memcpy(chunk, src + pos, n);
+            i = n;
+            dst[out] = (i - 1) & 0xff;
+            dst[out + 1] = 0x30 | ((i - 1) >> 8);
+        } else {
+            dst[out] = (i - 1) & 0xff;
+            dst[out + 1] = 0xb0 | ((i - 1) >> 8);
+        }
+        out += 2 + i;
+    }
+    return out;
+}
+
+static long lzvn_literals(fsw_u8 *dst, long out, const fsw_u8 *lit, long len)
+{
+    long k;
+
+    while (len > 0) {
+        k = len < 271 ? len : 271;
+        if (k >= 16) {
+            dst[out++] = 0xe0;
+            dst[out++] = k - 16;
+        } else {
+            dst[out++] = 0xe0 | k;
+        }
+        memcpy(dst + out, lit, k);
+        out += k;
+        lit += k;
+        len -= k;
+    }
+    return out;
+}
+
+/**
+ * LZVN: greedy matches against the last position with the same three bytes
+ * or the previous distance, as mkhfsplus.py does.
+ */
+
+static long compress_lzvn(const fsw_u8 *src, long size, fsw_u8 *dst, long cap)
+{
+    static long last[65536];
+    long pos = 0, lit_start = 0, out = 0, d, prev_d = 0, m, first, left, k, nl, max_m;
+    unsigned h;
+
+    if (cap < size + size / 8 + 64)
+        return -1;
+    memset(last, 0xff, sizeof(last));
+    while (pos + 3 <= size) {
+        h = (src[pos] << 8 | src[pos + 1]) ^ (src[pos + 2] << 4);
+        h &= 0xffff;
+        d = 0;
+        if (last[h] >= 0 && memcmp(src + last[h], src + pos, 3) == 0)
+            d = pos - last[h];
+        last[h] = pos;
+        if (prev_d && pos >= prev_d && memcmp(src + pos - prev_d, src + pos, 3) == 0)
+            d = prev_d;
+        if (d == 0 || d > 0xffff) {
+            pos++;
+            continue;
+        }
+        m = 3;
+        while (pos + m < size && src[pos + m] == src[pos + m - d])
+            m++;
+
+        nl = pos - lit_start;
+        if (nl > 3) {
+            out = lzvn_literals(dst, out, src + lit_start, nl - (nl & 3));
+            lit_start += nl - (nl & 3);
+            nl &= 3;
+        }
+        max_m = nl == 0 ? 10 : nl == 1 ? 8 : nl == 2 ? 6 : 4;
+        if (d == prev_d && nl == 0) {
+            first = 0;
+        } else if (d == prev_d) {
+            first = m < max_m ? m : max_m;
+            dst[out++] = nl << 6 | (first - 3) << 3 | 6;
+        } else if (d < 0x600) {
+            first = m < max_m ? m : max_m;
+            dst[out++] = nl << 6 | (first - 3) << 3 | d >> 8;
+            dst[out++] = d & 0xff;
+        } else if (d < 0x4000) {
+            first = m < 34 ? m : 34;
+            dst[out++] = 0xa0 | nl << 3 | (first - 3) >> 2;
+            dst[out++] = ((first - 3) & 3) | (d & 0x3f) << 2;
+            dst[out++] = d >> 6;
+        } else {
+            first = m < max_m ? m : max_m;
+            dst[out++] = nl << 6 | (first - 3) << 3 | 7;
+            dst[out++] = d & 0xff;
+            dst[out++] = d >> 8;
+        }
+        memcpy(dst + out, src + lit_start, nl);
+        out += nl;
+        for (left = m - first; left > 0; left -= k) {
+            k = left < 271 ? left : 271;
+            if (k >= 16) {
+                dst[out++] = 0xf0;
+                dst[out++] = k - 16;
+            } else {
+                dst[out++] = 0xf0 | k;
+            }
+        }
+        prev_d = d;
+        pos += m;
+        lit_start = pos;
+    }
+    out = lzvn_literals(dst, out, src + lit_start, size - lit_start);
+    memset(dst + out, 0, 8);
+    dst[out] = 0x06;
+    return out + 8;
+}
+
+/**
+ * ICNS RLE: runs of three or more equal bytes as repeat packets, everything
+ * else as literal packets of up to 128 bytes.
+ */
+
+static long compress_icns_rle(const fsw_u8 *src, long size, fsw_u8 *dst, long cap)
+{
+    long pos = 0, lit = 0, out = 0, n;
+
+    if (cap < size + size / 128 + 2)
+        return -1;
+    while (pos < size) {
+        for (n = 1; pos + n < size && n < 130 && src[pos + n] == src[pos]; n++)
+            ;
+        if (n < 3 && pos + n < size) {
+            pos += n;
+            continue;
+        }
+        if (n < 3)
+            pos += n;
+        while (lit < pos) {
+            long k = pos - lit < 128 ? pos - lit : 128;
+
+            dst[out++] = k - 1;
+            memcpy(dst + out, src + lit, k);
+            out += k;
+            lit += k;
+        }
+        if (n >= 3) {
+            dst[out++] = n + 125;
+            dst[out++] = src[pos];
+            pos += n;
+            lit = pos;
+        }
+    }
+    return out;
+}
+
+static struct codec_case cases[] = {
+    { &fsw_codec_zlib,  128 * 1024, compress_zlib },
+    { &fsw_codec_lzo,   128 * 1024, compress_lzo },
+    { &fsw_codec_zstd,  128 * 1024, compress_zstd },
+    { &fsw_codec_lznt1,  64 * 1024, compress_lznt1 },
+    { &fsw_codec_lzvn,   64 * 1024, compress_lzvn },
+    { &fsw_codec_icns_rle, 16 * 1024, compress_icns_rle },
+};
+
+#define NCASES (sizeof(cases) / sizeof(cases[0]))
+
+static void load_libs(void)
+{
+    void *lib;
+
+    lib = dlopen("libz.so.1", RTLD_NOW);
+    if (lib != NULL)
+        z_compress2 = (int (*)(unsigned char *, unsigned long *, const unsigned char *, unsigned long, int))
+            dlsym(lib, "compress2");
+    lib = dlopen("libzstd.so.1", RTLD_NOW);
+    if (lib != NULL) {
+        zstd_compress = (size_t (*)(void *, size_t, const void *, size_t, int))dlsym(lib, "ZSTD_compress");
+        zstd_is_error = (unsigned (*)(size_t))dlsym(lib, "ZSTD_isError");
+        if (zstd_is_error == NULL)
+            zstd_compress = NULL;
+    }
+}
+
+/**
+ * Decode all units through the registry until MIN_SECONDS have passed,
+ * checking the output against data on the first pass. With pooled set the
+ * context keeps its workspaces; otherwise they are freed after every call.
+ * Returns the seconds per pass and stores the allocations per call.
+ */
+
+static double run(struct fsw_codec_ctx *ctx, const struct fsw_codec *codec, struct unit *units, long count,
+                  const fsw_u8 *data, long unit_size, int pooled, fsw_u8 *out, double *allocs_out)
+{
+    double start, seconds;
+    long runs = 0, calls = 0, allocs_start, i;
+    fsw_u64 workspaces = 0;
+    fsw_u32 produced;
+
+    allocs_start = allocations;
+    workspaces -= ctx->slots[codec->format].workspace_allocs;
+    start = now();
+    do {
+        for (i = 0; i < count; i++) {
+            if (fsw_codec_ctx_decompress(ctx, codec->format, units[i].z, units[i].zsize, 0,
+                                         out, units[i].outsize, &produced) != FSW_SUCCESS ||
+                produced < units[i].size ||
+                (runs == 0 && memcmp(out, data + i * unit_size, units[i].size) != 0))
+                return -1;
+            calls++;
+            if (!pooled) {
+                workspaces += ctx->slots[codec->format].workspace_allocs;
+                fsw_codec_ctx_free(ctx);
+            }
+        }
+        runs++;
+        seconds = now() - start;
+    } while (seconds < MIN_SECONDS);
+    if (pooled)
+        workspaces += ctx->slots[codec->format].workspace_allocs;
+    *allocs_out = (double)(allocations - allocs_start + workspaces) / calls;
+    return seconds / runs;
+}
+
+/**
+ * Read all units through streams in STREAM_PIECE pieces until MIN_SECONDS
+ * have passed, checking the output against data on the first pass. Returns
+ * the seconds per pass.
+ */
+
+static double run_stream(struct fsw_codec_ctx *ctx, const struct fsw_codec *codec, struct unit *units,
+                         long count, const fsw_u8 *data, long unit_size, fsw_u8 *out)
+{
+    struct fsw_codec_stream stream;
+    double start, seconds;
+    long runs = 0, i, pos, piece;
+    fsw_u32 produced;
+
+    start = now();
+    do {
+        for (i = 0; i < count; i++) {
+            fsw_codec_stream_init(ctx, &stream, codec->format);
+            fsw_codec_stream_feed(&stream, units[i].z, units[i].zsize, 1);
+            for (pos = 0; pos < units[i].size; pos += piece) {
+                piece = units[i].size - pos < STREAM_PIECE ? units[i].size - pos : STREAM_PIECE;
+                if (fsw_codec_stream_read(&stream, out + pos, piece, &produced) != FSW_SUCCESS ||
+                    produced != piece)
+                    return -1;
+            }
+            if (runs == 0 && memcmp(out, data + i * unit_size, units[i].size) != 0)
+                return -1;
+        }
+        runs++;
+        seconds = now() - start;
+    } while (seconds < MIN_SECONDS);
+    return seconds / runs;
+}
+
+static fsw_u8 * load_file(const char *path, long *size_out)
+{
+    FILE *f;
+    fsw_u8 *data;
+    long size;
+
+    f = fopen(path, "rb");
+    if (f == NULL)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = malloc(size > 0 ? size : 1);
+    if (data == NULL || size <= 0 || fread(data, 1, size, f) != (size_t)size) {
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+    fclose(f);
+    *size_out = size;
+    return data;
+}
+
+int main(int argc, char **argv)
+{
+    struct fsw_codec_ctx pool_ctx, call_ctx;
+    struct unit *units;
+    fsw_u8 *data, *out, *buf;
+    long size, zsize, count, unit, cap, i;
+    unsigned c;
+    int f, status = 0;
+    double t_pool, t_call, t_stream, a_pool, a_call;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: codecbench <file>...\n");
+        return 1;
+    }
+    load_libs();
+    for (c = 0; c < NCASES; c++)
+        fsw_codec_register(cases[c].codec);
+    fsw_codec_ctx_init(&pool_ctx);
+    fsw_codec_ctx_init(&call_ctx);
+
+    printf("%-24s %-8s %8s %10s %10s %10s %10s %8s %10s\n", "file", "codec", "ratio",
+           "pool MiB/s", "allocs", "call MiB/s", "allocs", "speedup", "4k MiB/s");
+    for (f = 1; f < argc; f++) {
+        data = load_file(argv[f], &size);
+        if (data == NULL || size > 0x7fffffffL) {
+            fprintf(stderr, "%s: cannot read\n", argv[f]);
+            free(data);
+            status = 1;
+            continue;
+        }
+
+        for (c = 0; c < NCASES; c++) {
+            unit = cases[c].unit;
+            count = (size + unit - 1) / unit;
+            cap = unit + unit / 4 + 4096;
+            units = calloc(count, sizeof(*units));
+            buf = malloc(cap);
+            out = malloc(unit);
+            if (units == NULL || buf == NULL || out == NULL)
+                return 1;
+
+            zsize = 0;
+            for (i = 0; i < count; i++) {
+                units[i].size = size - i * unit < unit ? size - i * unit : unit;
+                // LZNT1 units decode to whole 4 KiB chunks
+                units[i].outsize = cases[c].codec->format == FSW_CODEC_LZNT1 ?
+                    (units[i].size + 4095) & ~4095L : units[i].size;
+                units[i].zsize = cases[c].compress(data + i * unit, units[i].size, buf, cap);
+                if (units[i].zsize < 0)
+                    break;
+                units[i].z = malloc(units[i].zsize);
+                if (units[i].z == NULL)
+                    return 1;
+                memcpy(units[i].z, buf, units[i].zsize);
+                zsize += units[i].zsize;
+            }
+
+            if (i < count) {
+                fprintf(stderr, "%s: %s: cannot compress the input, skipped\n", argv[f], cases[c].codec->name);
+            } else {
+                t_pool = run(&pool_ctx, cases[c].codec, units, count, data, unit, 1, out, &a_pool);
+                t_call = run(&call_ctx, cases[c].codec, units, count, data, unit, 0, out, &a_call);
+                t_stream = 0;
+                if (cases[c].codec->stream_read != NULL)
+                    t_stream = run_stream(&pool_ctx, cases[c].codec, units, count, data, unit, out);
+                if (t_pool < 0 || t_call < 0 || t_stream < 0) {
+                    fprintf(stderr, "%s: %s: wrong output\n", argv[f], cases[c].codec->name);
+                    status = 1;
+                } else {
+                    // throughput in MiB/s of uncompressed data
+                    printf("%-24.24s %-8s %8.2f %10.1f %10.3f %10.1f %10.3f %7.2fx", argv[f],
+                           cases[c].codec->name, (double)size / zsize,
+                           size / t_pool / 1048576.0, a_pool, size / t_call / 1048576.0, a_call,
+                           t_call / t_pool);
+                    if (t_stream > 0)
+                        printf(" %10.1f\n", size / t_stream / 1048576.0);
+                    else
+                        printf(" %10s\n", "-");
+                }
+            }
+            for (i = 0; i < count; i++)
+                free(units[i].z);
+            free(units);
+            free(buf);
+            free(out);
+        }
+        free(data);
+    }
+
+    for (c = 0; c < FSW_CODEC_MAX; c++) {
+        struct fsw_codec_slot *slot = &pool_ctx.slots[c];
+
+        if (slot->codec != NULL)
+            printf("%s: %lu calls, %lu stream reads, %lu errors, %lu workspaces, %lu KiB in, %lu KiB out\n",
+                   slot->codec->name, (unsigned long)slot->calls, (unsigned long)slot->stream_reads,
+                   (unsigned long)slot->errors, (unsigned long)slot->workspace_allocs,
+                   (unsigned long)(slot->bytes_in >> 10), (unsigned long)(slot->bytes_out >> 10));
+    }
+    fsw_codec_ctx_free(&pool_ctx);
+    fsw_codec_ctx_free(&call_ctx);
+    return status;
+}
+
+// EOF
@@ -0,0 +1,124 @@
+/**
+ * \file dirlookup.c
+ * Test program for name lookups in large directories in the POSIX user space environment.
+ *
+ * Looks up <count> entries named <directory>/<prefix><n> one by one with the
+ * path lookup cache disabled, followed by one name that does not exist. All
+ * lookups go to the file system driver, so on hash-indexed directories the
+ * time taken should stay far below that of a linear scan per name. The
+ * directory itself is kept referenced throughout, as the path lookup cache
+ * would keep it, so that drivers can keep per-directory state between names.
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fsw_posix.h"
+
+#include <time.h>
+
+
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(FSTYPE);
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static fsw_status_t lookup(struct fsw_volume *vol, char *path)
+{
+    struct fsw_string lookup_path;
+    struct fsw_dnode *dno;
+    fsw_status_t status;
+
+    lookup_path.type = FSW_STRING_TYPE_ISO88591;
+    lookup_path.len = lookup_path.size = strlen(path);
+    lookup_path.data = path;
+    status = fsw_dnode_lookup_path(vol->root, &lookup_path, '/', &dno);
+    if (status == FSW_SUCCESS)
+        fsw_dnode_release(dno);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    struct fsw_posix_volume *pvol;
+    struct fsw_string lookup_path;
+    struct fsw_dnode *dir = NULL;
+    char path[1024];
+    int count, failed = 0, i;
+    double start;
+
+    if (argc < 5) {
+        fprintf(stderr, "Usage: dirlookup <file/device> <directory> <prefix> <count>\n");
+        return 1;
+    }
+    count = atoi(argv[4]);
+
+    pvol = fsw_posix_mount(argv[1], &FSW_FSTYPE_TABLE_NAME(FSTYPE));
+    if (pvol == NULL) {
+        fprintf(stderr, "Mounting failed.\n");
+        return 1;
+    }
+    // every lookup must reach the driver
+    pvol->vol->dcache_limit = 0;
+
+    lookup_path.type = FSW_STRING_TYPE_ISO88591;
+    lookup_path.len = lookup_path.size = strlen(argv[2]);
+    lookup_path.data = argv[2];
+    if (fsw_dnode_lookup_path(pvol->vol->root, &lookup_path, '/', &dir) != FSW_SUCCESS) {
+        fprintf(stderr, "Lookup of %s failed\n", argv[2]);
+        fsw_posix_unmount(pvol);
+        return 1;
+    }
+
+    start = now();
+    for (i = 1; i <= count; i++) {
+        snprintf(path, sizeof(path), "%s/%s%d", argv[2], argv[3], i);
+        if (lookup(pvol->vol, path) != FSW_SUCCESS) {
+            fprintf(stderr, "Lookup of %s failed\n", path);
+            failed++;
+        }
+    }
+    snprintf(path, sizeof(path), "%s/%s-missing", argv[2], argv[3]);
+    if (lookup(pvol->vol, path) != FSW_NOT_FOUND) {
+        fprintf(stderr, "Lookup of %s did not report FSW_NOT_FOUND\n", path);
+        failed++;
+    }
+    printf("lookups %d  failed %d  time %.3f ms  block cache hits %llu misses %llu\n",
+           count + 1, failed, (now() - start) * 1000.0,
+           (unsigned long long)pvol->vol->bcache_hits,
+           (unsigned long long)pvol->vol->bcache_misses);
+
+    fsw_dnode_release(dir);
+    fsw_posix_unmount(pvol);
+    return failed ? 1 : 0;
+}
+
+// EOF
@@ -0,0 +1,127 @@
+/**
+ * \file dirscale.c
+ * Test program for dnode lookup scaling in the POSIX user space environment.
+ *
+ * Enumerates a directory while keeping every child dnode alive, so the core's
+ * dnode index grows with the directory. The time taken for each batch of entries
+ * is printed; it should stay flat instead of growing with the number of entries.
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fsw_posix.h"
+
+#include <time.h>
+
+
+#define BATCH_SIZE (1000)
+
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(FSTYPE);
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    struct fsw_posix_volume *pvol;
+    struct fsw_shandle shand;
+    struct fsw_dnode *dno, **children = NULL;
+    struct fsw_string lookup_path;
+    fsw_status_t status;
+    int count = 0, alloc = 0, min_expected = 0, i;
+    double start, batch_start;
+
+    if (argc < 3) {
+        fprintf(stderr, "Usage: dirscale <file/device> <directory> [min_entries]\n");
+        return 1;
+    }
+    if (argc > 3)
+        min_expected = atoi(argv[3]);
+
+    pvol = fsw_posix_mount(argv[1], &FSW_FSTYPE_TABLE_NAME(FSTYPE));
+    if (pvol == NULL) {
+        fprintf(stderr, "Mounting failed.\n");
+        return 1;
+    }
+
+    lookup_path.type = FSW_STRING_TYPE_ISO88591;
+    lookup_path.len = lookup_path.size = strlen(argv[2]);
+    lookup_path.data = argv[2];
+    status = fsw_dnode_lookup_path(pvol->vol->root, &lookup_path, '/', &dno);
+    if (status == FSW_SUCCESS)
+        status = fsw_shandle_open(dno, &shand);
+    if (status) {
+        fprintf(stderr, "Cannot open directory %s: %d\n", argv[2], status);
+        return 1;
+    }
+    fsw_dnode_release(dno);
+
+    start = batch_start = now();
+    for (;;) {
+        if (count == alloc) {
+            alloc = alloc ? alloc * 2 : BATCH_SIZE;
+            children = realloc(children, alloc * sizeof(struct fsw_dnode *));
+            if (children == NULL) {
+                fprintf(stderr, "Out of memory.\n");
+                return 1;
+            }
+        }
+        status = fsw_dnode_dir_read(&shand, &children[count]);
+        if (status)
+            break;
+        count++;
+        if (count % BATCH_SIZE == 0) {
+            printf("entries %6d  batch %8.3f ms  live dnodes %u\n",
+                   count, (now() - batch_start) * 1000.0, pvol->vol->dnode_count);
+            batch_start = now();
+        }
+    }
+    printf("total entries %d in %.3f ms\n", count, (now() - start) * 1000.0);
+
+    for (i = 0; i < count; i++)
+        fsw_dnode_release(children[i]);
+    free(children);
+    fsw_shandle_close(&shand);
+    fsw_posix_unmount(pvol);
+
+    if (status != FSW_NOT_FOUND) {
+        fprintf(stderr, "fsw_dnode_dir_read returned %d\n", status);
+        return 1;
+    }
+    if (count < min_expected) {
+        fprintf(stderr, "Expected at least %d entries, got %d\n", min_expected, count);
+        return 1;
+    }
+    return 0;
+}
+
+// EOF
@@ -35,8 +35,12 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE     // O_DIRECT
+
 #include "fsw_posix.h"
 
+#include <sys/mman.h>
+
 
 #ifndef FSTYPE
 /** The file system type name to use. */
@@ -52,7 +56,9 @@ fsw_status_t fsw_posix_open_dno(struct fsw_posix_volume *pvol, const char *path,
 void fsw_posix_change_blocksize(struct fsw_volume *vol,
                               fsw_u32 old_phys_blocksize, fsw_u32 old_log_blocksize,
                               fsw_u32 new_phys_blocksize, fsw_u32 new_log_blocksize);
-fsw_status_t fsw_posix_read_block(struct fsw_volume *vol, fsw_u32 phys_bno, void *buffer);
+fsw_status_t fsw_posix_read_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer);
+fsw_status_t fsw_posix_read_blocks(struct fsw_volume *vol, fsw_u64 phys_bno, fsw_u32 count, void *buffer);
+fsw_status_t fsw_posix_map_block(struct fsw_volume *vol, fsw_u64 phys_bno, void **buffer_out);
 
 /**
  * Dispatch table for our FSW host driver.
@@ -62,12 +68,57 @@ struct fsw_host_table   fsw_posix_host_table = {
     FSW_STRING_TYPE_ISO88591,
 
     fsw_posix_change_blocksize,
-    fsw_posix_read_block
+    fsw_posix_read_block,
+    fsw_posix_read_blocks,
+    NULL
 };
 
+/**
+ * Dispatch table for a volume whose image is mapped into memory.
+ */
+
+struct fsw_host_table   fsw_posix_mmap_host_table = {
+    FSW_STRING_TYPE_ISO88591,
+
+    fsw_posix_change_blocksize,
+    fsw_posix_read_block,
+    fsw_posix_read_blocks,
+    fsw_posix_map_block
+};
+
+static const char *fsw_posix_io_mode_names[] = { "read", "pread", "mmap", "direct" };
+
+//! I/O mode for the next mount, -1 to take it from the environment.
+static int fsw_posix_io_mode = -1;
+
 extern struct fsw_fstype_table   FSW_FSTYPE_TABLE_NAME(FSTYPE);
 
 
+/**
+ * Select the I/O mode for the following mounts by name. Returns the mode, or
+ * -1 if the name is not known.
+ */
+
+int fsw_posix_set_io_mode(const char *name)
+{
+    int i;
+
+    for (i = 0; i < (int)(sizeof (fsw_posix_io_mode_names) / sizeof (fsw_posix_io_mode_names[0])); i++) {
+        if (strcmp(name, fsw_posix_io_mode_names[i]) == 0)
+            return fsw_posix_io_mode = i;
+    }
+    return -1;
+}
+
+/**
+ * Get the name of an I/O mode.
+ */
+
+const char * fsw_posix_io_mode_name(int io_mode)
+{
+    return fsw_posix_io_mode_names[io_mode];
+}
+
 /**
  * Mount function.
  */
@@ -76,28 +127,66 @@ struct fsw_posix_volume * fsw_posix_mount(const char *path, struct fsw_fstype_ta
 {
     fsw_status_t        status;
     struct fsw_posix_volume *pvol;
+    struct fsw_host_table *host_table = &fsw_posix_host_table;
+    const char          *mode_name;
+    off_t               size;
+    void                *map;
+
+    if (fsw_posix_io_mode < 0) {
+        mode_name = getenv("FSW_POSIX_IO");
+        if (mode_name == NULL || *mode_name == 0)
+            mode_name = "read";
+        if (fsw_posix_set_io_mode(mode_name) < 0) {
+            fprintf(stderr, "fsw_posix_mount: unknown I/O mode %s\n", mode_name);
+            return NULL;
+        }
+    }
 
     // allocate volume structure
     status = fsw_alloc_zero(sizeof (struct fsw_posix_volume), (void **) &pvol);
     if (status)
         return NULL;
     pvol->fd = -1;
+    pvol->io_mode = fsw_posix_io_mode;
 
     // open underlying file/device
-    pvol->fd = open(path, O_RDONLY, 0);
+    pvol->fd = open(path, O_RDONLY | (pvol->io_mode == FSW_POSIX_IO_DIRECT ? O_DIRECT : 0), 0);
     if (pvol->fd < 0) {
         fprintf(stderr, "fsw_posix_mount: %s: %s\n", path, strerror(errno));
         fsw_free(pvol);
         return NULL;
     }
+    size = lseek(pvol->fd, 0, SEEK_END);
+    if (size < 0) {
+        fprintf(stderr, "fsw_posix_mount: %s: %s\n", path, strerror(errno));
+        close(pvol->fd);
+        fsw_free(pvol);
+        return NULL;
+    }
+    pvol->size = size;
+
+    // map the whole image; private and writable, so that a driver that
+    //  patches a block in place behaves as it does on a cached block
+    if (pvol->io_mode == FSW_POSIX_IO_MMAP && pvol->size > 0) {
+        map = mmap(NULL, pvol->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, pvol->fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "fsw_posix_mount: %s: mmap: %s\n", path, strerror(errno));
+            close(pvol->fd);
+            fsw_free(pvol);
+            return NULL;
+        }
+        pvol->map = map;
+        host_table = &fsw_posix_mmap_host_table;
+    }
 
     // mount the filesystem
     if (fstype_table == NULL)
         fstype_table = &FSW_FSTYPE_TABLE_NAME(FSTYPE);
-    status = fsw_mount(pvol, &fsw_posix_host_table, fstype_table, &pvol->vol);
+    status = fsw_mount(pvol, host_table, fstype_table, &pvol->vol);
     if (status) {
         fprintf(stderr, "fsw_posix_mount: fsw_mount returned %d\n", status);
-        fsw_free(pvol);
+        pvol->vol = NULL;
+        fsw_posix_unmount(pvol);
         return NULL;
     }
 
@@ -112,6 +201,12 @@ int fsw_posix_unmount(struct fsw_posix_volume *pvol)
 {
     if (pvol->vol != NULL)
         fsw_unmount(pvol->vol);
+    if (pvol->map != NULL)
+        munmap(pvol->map, pvol->size);
+    if (pvol->bounce != NULL)
+        free(pvol->bounce);
+    if (pvol->fd >= 0)
+        close(pvol->fd);
     fsw_free(pvol);
     return 0;
 }
@@ -205,7 +300,7 @@ struct fsw_posix_dir * fsw_posix_opendir(struct fsw_posix_volume *pvol, const ch
     struct fsw_posix_dir *dir;
 
     // allocate file structure
-    status = fsw_alloc(sizeof (struct fsw_posix_dir), &dir);
+    status = fsw_alloc_zero(sizeof (struct fsw_posix_dir), (void **) &dir);
     if (status)
         return NULL;
     dir->pvol = pvol;
@@ -232,10 +327,10 @@ struct dirent * fsw_posix_readdir(struct fsw_posix_dir *dir)
     static struct dirent dent;
 
     // Get next entry from file system
-    status = fsw_dnode_dir_read(&dir->shand, &dno);
+    status = fsw_dnode_dir_read_ahead(&dir->shand, &dir->ra, &dno);
     if (status) {
         if (status != 4)
-            fprintf(stderr, "fsw_posix_readdir: fsw_dnode_dir_read returned %d\n", status);
+            fprintf(stderr, "fsw_posix_readdir: fsw_dnode_dir_read_ahead returned %d\n", status);
         return NULL;
     }
     status = fsw_dnode_fill(dno);
@@ -265,8 +360,10 @@ struct dirent * fsw_posix_readdir(struct fsw_posix_dir *dir)
 #if 0
     dent.d_namlen = dno->name.size;
 #endif
-    memcpy(dent.d_name, dno->name.data, dno->name.size);
+    if (dno->name.size)
+        memcpy(dent.d_name, dno->name.data, dno->name.size);
     dent.d_name[dno->name.size] = 0;
+    fsw_dnode_release(dno);
 
     return &dent;
 }
@@ -277,6 +374,7 @@ struct dirent * fsw_posix_readdir(struct fsw_posix_dir *dir)
 
 void fsw_posix_rewinddir(struct fsw_posix_dir *dir)
 {
+    fsw_dir_readahead_reset(&dir->ra);
     dir->shand.pos = 0;
 }
 
@@ -286,6 +384,7 @@ void fsw_posix_rewinddir(struct fsw_posix_dir *dir)
 
 int fsw_posix_closedir(struct fsw_posix_dir *dir)
 {
+    fsw_dir_readahead_reset(&dir->ra);
     fsw_shandle_close(&dir->shand);
     fsw_free(dir);
     return 0;
@@ -378,31 +477,128 @@ void fsw_posix_change_blocksize(struct fsw_volume *vol,
     // nothing to do
 }
 
+/**
+ * Read a byte range of the file/device in the volume's I/O mode. Returns the
+ * number of bytes read like pread.
+ */
+
+static ssize_t fsw_posix_read_at(struct fsw_posix_volume *pvol, void *buffer, size_t length, off_t offset)
+{
+    off_t           start, seek_result;
+    size_t          span;
+    ssize_t         read_result;
+
+    switch (pvol->io_mode) {
+        case FSW_POSIX_IO_READ:
+            seek_result = lseek(pvol->fd, offset, SEEK_SET);
+            if (seek_result != offset)
+                return -1;
+            return read(pvol->fd, buffer, length);
+
+        case FSW_POSIX_IO_MMAP:
+            if ((fsw_u64)offset >= pvol->size)
+                return 0;
+            if (length > pvol->size - offset)
+                length = pvol->size - offset;
+            memcpy(buffer, pvol->map + offset, length);
+            return length;
+
+        case FSW_POSIX_IO_DIRECT:
+            // read the aligned span around the range into the bounce buffer
+            start = offset & ~(off_t)(FSW_POSIX_DIRECT_ALIGN - 1);
+            span = (offset - start + length + FSW_POSIX_DIRECT_ALIGN - 1) & ~(size_t)(FSW_POSIX_DIRECT_ALIGN - 1);
+            if (span > pvol->bounce_size) {
+                free(pvol->bounce);
+                pvol->bounce = NULL;
+                pvol->bounce_size = 0;
+                if (posix_memalign(&pvol->bounce, FSW_POSIX_DIRECT_ALIGN, span) != 0) {
+                    pvol->bounce = NULL;
+                    return -1;
+                }
+                pvol->bounce_size = span;
+            }
+            read_result = pread(pvol->fd, pvol->bounce, span, start);
+            if (read_result < 0)
+                return read_result;
+            if (read_result <= offset - start)
+                return 0;
+            if ((size_t)read_result - (offset - start) < length)
+                length = read_result - (offset - start);
+            memcpy(buffer, (fsw_u8 *)pvol->bounce + (offset - start), length);
+            return length;
+
+        default:
+            return pread(pvol->fd, buffer, length, offset);
+    }
+}
+
 /**
  * FSW interface function to read data blocks. This function is called by the FSW core
  * to read a block of data from the device. The buffer is allocated by the core code.
  */
 
-fsw_status_t fsw_posix_read_block(struct fsw_volume *vol, fsw_u32 phys_bno, void *buffer)
+fsw_status_t fsw_posix_read_block(struct fsw_volume *vol, fsw_u64 phys_bno, void *buffer)
 {
     struct fsw_posix_volume *pvol = (struct fsw_posix_volume *)vol->host_data;
-    off_t           block_offset, seek_result;
     ssize_t         read_result;
 
     FSW_MSG_DEBUGV((FSW_MSGSTR("fsw_posix_read_block: %d  (%d)\n"), phys_bno, vol->phys_blocksize));
 
     // read from disk
-    block_offset = (off_t)phys_bno * vol->phys_blocksize;
-    seek_result = lseek(pvol->fd, block_offset, SEEK_SET);
-    if (seek_result != block_offset)
+    if (phys_bno > (fsw_u64)INT64_MAX / vol->phys_blocksize)
         return FSW_IO_ERROR;
-    read_result = read(pvol->fd, buffer, vol->phys_blocksize);
+    read_result = fsw_posix_read_at(pvol, buffer, vol->phys_blocksize, (off_t)phys_bno * vol->phys_blocksize);
+    pvol->read_block_calls++;
     if (read_result != vol->phys_blocksize)
         return FSW_IO_ERROR;
+    pvol->bytes_read += read_result;
 
     return FSW_SUCCESS;
 }
 
+/**
+ * FSW interface function to read a run of contiguous data blocks straight into
+ * the caller's buffer.
+ */
+
+fsw_status_t fsw_posix_read_blocks(struct fsw_volume *vol, fsw_u64 phys_bno, fsw_u32 count, void *buffer)
+{
+    struct fsw_posix_volume *pvol = (struct fsw_posix_volume *)vol->host_data;
+    size_t          length = (size_t)count * vol->phys_blocksize;
+    ssize_t         read_result;
+
+    FSW_MSG_DEBUGV((FSW_MSGSTR("fsw_posix_read_blocks: %d +%d  (%d)\n"), (int)phys_bno, count, vol->phys_blocksize));
+
+    if (phys_bno > (fsw_u64)INT64_MAX / vol->phys_blocksize)
+        return FSW_IO_ERROR;
+    if (pvol->io_mode == FSW_POSIX_IO_READ)
+        read_result = pread(pvol->fd, buffer, length, (off_t)phys_bno * vol->phys_blocksize);
+    else
+        read_result = fsw_posix_read_at(pvol, buffer, length, (off_t)phys_bno * vol->phys_blocksize);
+    pvol->read_blocks_calls++;
+    if (read_result < 0 || (size_t)read_result != length)
+        return FSW_IO_ERROR;
+    pvol->bytes_read += read_result;
+
+    return FSW_SUCCESS;
+}
+
+/**
+ * FSW interface function to get a block of a mapped image without copying it.
+ * Blocks that do not lie completely within the image are left to read_block.
+ */
+
+fsw_status_t fsw_posix_map_block(struct fsw_volume *vol, fsw_u64 phys_bno, void **buffer_out)
+{
+    struct fsw_posix_volume *pvol = (struct fsw_posix_volume *)vol->host_data;
+
+    if (phys_bno >= pvol->size / vol->phys_blocksize)
+        return FSW_IO_ERROR;
+    pvol->map_block_calls++;
+    *buffer_out = pvol->map + phys_bno * vol->phys_blocksize;
+    return FSW_SUCCESS;
+}
+
 
 /**
  * Time mapping callback for the fsw_dnode_stat call. This function converts
@@ -498,4 +694,37 @@ EFI_STATUS fsw_posix_dnode_fill_FileInfo(IN FSW_VOLUME_DATA *Volume,
 }
 */
 
+/**
+ * Callbacks used by the file system drivers from their dnode_stat functions.
+ * The POSIX host passes a struct stat as host_data, or NULL when the caller
+ * only needs the fields of struct fsw_dnode_stat itself.
+ */
+
+void fsw_store_time_posix(struct fsw_dnode_stat *sb, int which, fsw_u32 posix_time)
+{
+    struct stat *st = (struct stat *)sb->host_data;
+
+    if (st == NULL)
+        return;
+    if (which == FSW_DNODE_STAT_CTIME)
+        st->st_ctime = posix_time;
+    else if (which == FSW_DNODE_STAT_MTIME)
+        st->st_mtime = posix_time;
+    else if (which == FSW_DNODE_STAT_ATIME)
+        st->st_atime = posix_time;
+}
+
+void fsw_store_attr_posix(struct fsw_dnode_stat *sb, fsw_u16 posix_mode)
+{
+    struct stat *st = (struct stat *)sb->host_data;
+
+    if (st != NULL)
+        st->st_mode = (st->st_mode & S_IFMT) | (posix_mode & ~S_IFMT);
+}
+
+void fsw_store_attr_efi(struct fsw_dnode_stat *sb, fsw_u16 attr)
+{
+    // EFI attributes have no POSIX equivalent beyond what the mode carries
+}
+
 // EOF
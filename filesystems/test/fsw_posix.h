@@ -42,9 +42,24 @@
 
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/dir.h>
 
 
+/**
+ * POSIX Host: How the image is read. The mode is taken from the FSW_POSIX_IO
+ * environment variable ("read", "pread", "mmap" or "direct") at mount time
+ * unless fsw_posix_set_io_mode was called before.
+ */
+
+#define FSW_POSIX_IO_READ       0   //!< lseek and read per block (default)
+#define FSW_POSIX_IO_PREAD      1   //!< pread per block
+#define FSW_POSIX_IO_MMAP       2   //!< Map the image, blocks are handed to the core without a copy
+#define FSW_POSIX_IO_DIRECT     3   //!< pread with O_DIRECT, bypassing the page cache
+
+//! Alignment of offsets, lengths and buffers for O_DIRECT reads.
+#define FSW_POSIX_DIRECT_ALIGN  4096
+
 /**
  * POSIX Host: Private per-volume structure.
  */
@@ -53,7 +68,16 @@ struct fsw_posix_volume {
     struct fsw_volume           *vol;           //!< FSW volume structure
 
     int                         fd;             //!< System file descriptor for data access
-
+    int                         io_mode;        //!< One of the FSW_POSIX_IO_* modes
+    fsw_u8                      *map;           //!< Mapped image in FSW_POSIX_IO_MMAP mode
+    fsw_u64                     size;           //!< Size of the file/device in bytes
+    void                        *bounce;        //!< Aligned buffer in FSW_POSIX_IO_DIRECT mode
+    size_t                      bounce_size;    //!< Size of the aligned buffer
+
+    fsw_u64                     read_block_calls;   //!< Number of read_block calls from the core
+    fsw_u64                     read_blocks_calls;  //!< Number of read_blocks calls from the core
+    fsw_u64                     map_block_calls;    //!< Number of map_block calls from the core
+    fsw_u64                     bytes_read;         //!< Bytes read from the file/device
 };
 
 /**
@@ -75,12 +99,15 @@ struct fsw_posix_dir {
     struct fsw_posix_volume     *pvol;          //!< POSIX host volume structure
 
     struct fsw_shandle          shand;          //!< FSW handle for this file
+    struct fsw_dir_readahead    ra;             //!< Entries read ahead of readdir
 
 };
 
 
 /* functions */
 
+int fsw_posix_set_io_mode(const char *name);
+const char * fsw_posix_io_mode_name(int io_mode);
 struct fsw_posix_volume * fsw_posix_mount(const char *path, struct fsw_fstype_table *fstype_table);
 int fsw_posix_unmount(struct fsw_posix_volume *pvol);
 
@@ -87,4 +87,28 @@ typedef uint64_t            fsw_u64;
 #define RShiftU64(val, shift) ((val) >> (shift))
 #define LShiftU64(val, shift) ((val) << (shift))
 
+// calling convention of the host and driver function tables
+
+#ifndef EFIAPI
+#define EFIAPI
+#endif
+
+// EFI library names used by drivers that are shared with the EFI build
+
+typedef unsigned char       BOOLEAN;
+typedef uintptr_t           UINTN;
+typedef uint32_t            UINT32;
+#define TRUE                (1)
+#define FALSE               (0)
+
+#define AllocatePool(size) malloc(size)
+#define FreePool(ptr) free(ptr)
+
+static inline uint64_t DivU64x32Remainder(uint64_t val, uint32_t divisor, uint32_t *rem)
+{
+    if (rem != NULL)
+        *rem = (uint32_t)(val % divisor);
+    return val / divisor;
+}
+
 #endif
@@ -0,0 +1,348 @@
+/**
+ * \file fswbench.c
+ * Timed workloads for a file system driver in the POSIX user space environment.
+ *
+ * Runs five workloads against one image and prints one JSON object per
+ * workload on stdout, so that results from different commits can be
+ * collected and compared with benchcmp.py:
+ *
+ *  - mount:    mount and unmount the volume repeatedly
+ *  - lookup:   resolve a deep path from the root repeatedly
+ *  - walk:     list every directory of the tree below a start directory
+ *  - seqread:  read a file from start to end
+ *  - randread: read the same file in 4 KiB pieces at pseudo-random offsets
+ *
+ * Every record carries the elapsed time, the amount of data, the block
+ * cache hits and misses and the number of read_block / read_blocks /
+ * map_block calls the core made to this host, all counted for that workload
+ * alone, and the host's I/O mode (-i, see fsw_posix.h). The walk
+ * and read workloads also report a checksum of the names / data they saw,
+ * so that a change in what the driver returns shows up as well.
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fsw_posix.h"
+
+#include <time.h>
+
+
+#define RANDOM_READ_SIZE (4096)
+
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(FSTYPE);
+
+/**
+ * Counters sampled before and after a workload.
+ */
+
+struct counters {
+    double          time;
+    fsw_u64         bcache_hits;
+    fsw_u64         bcache_misses;
+    fsw_u64         read_block_calls;
+    fsw_u64         read_blocks_calls;
+    fsw_u64         map_block_calls;
+    fsw_u64         device_bytes;
+};
+
+static const char *tag = "";
+static const char *image;
+static const char *image_name;
+static const char *io_mode = "read";
+
+#define FNV_OFFSET (0xcbf29ce484222325ULL)
+#define FNV_PRIME  (0x100000001b3ULL)
+
+static unsigned long long fnv1a(unsigned long long hash, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+
+    while (size--)
+        hash = (hash ^ *p++) * FNV_PRIME;
+    return hash;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sample(struct fsw_posix_volume *pvol, struct counters *c)
+{
+    c->time = now();
+    c->bcache_hits = pvol->vol->bcache_hits;
+    c->bcache_misses = pvol->vol->bcache_misses;
+    c->read_block_calls = pvol->read_block_calls;
+    c->read_blocks_calls = pvol->read_blocks_calls;
+    c->map_block_calls = pvol->map_block_calls;
+    c->device_bytes = pvol->bytes_read;
+}
+
+/**
+ * Add the difference between two samples to a running total.
+ */
+
+static void accumulate(struct counters *total, const struct counters *start, const struct counters *end)
+{
+    total->time += end->time - start->time;
+    total->bcache_hits += end->bcache_hits - start->bcache_hits;
+    total->bcache_misses += end->bcache_misses - start->bcache_misses;
+    total->read_block_calls += end->read_block_calls - start->read_block_calls;
+    total->read_blocks_calls += end->read_blocks_calls - start->read_blocks_calls;
+    total->map_block_calls += end->map_block_calls - start->map_block_calls;
+    total->device_bytes += end->device_bytes - start->device_bytes;
+}
+
+static void report(const char *workload, const struct counters *c, unsigned long long ops,
+                   unsigned long long bytes, unsigned long long errors, unsigned long long checksum)
+{
+    fsw_u64 lookups = c->bcache_hits + c->bcache_misses;
+
+    printf("{\"tag\": \"%s\", \"fs\": \"%s\", \"image\": \"%s\", \"io\": \"%s\", \"workload\": \"%s\", "
+           "\"seconds\": %.6f, \"ops\": %llu, \"ops_per_s\": %.1f, \"bytes\": %llu, \"mib_per_s\": %.2f, "
+           "\"bcache_hits\": %llu, \"bcache_misses\": %llu, \"bcache_hit_rate\": %.4f, "
+           "\"read_block_calls\": %llu, \"read_blocks_calls\": %llu, \"map_block_calls\": %llu, "
+           "\"device_bytes\": %llu, "
+           "\"errors\": %llu, \"checksum\": \"%016llx\"}\n",
+           tag, (const char *)FSW_FSTYPE_TABLE_NAME(FSTYPE).name.data, image_name, io_mode, workload,
+           c->time, ops, c->time > 0 ? ops / c->time : 0.0,
+           bytes, c->time > 0 ? bytes / c->time / 1048576.0 : 0.0,
+           (unsigned long long)c->bcache_hits, (unsigned long long)c->bcache_misses,
+           lookups ? (double)c->bcache_hits / lookups : 0.0,
+           (unsigned long long)c->read_block_calls, (unsigned long long)c->read_blocks_calls,
+           (unsigned long long)c->map_block_calls,
+           (unsigned long long)c->device_bytes, errors, checksum);
+    fflush(stdout);
+}
+
+static int bench_mount(int count)
+{
+    struct fsw_posix_volume *pvol;
+    struct counters total, start, end;
+    int i;
+
+    memset(&total, 0, sizeof (total));
+    for (i = 0; i < count; i++) {
+        double t0 = now();
+
+        pvol = fsw_posix_mount(image, &FSW_FSTYPE_TABLE_NAME(FSTYPE));
+        if (pvol == NULL)
+            return 1;
+        io_mode = fsw_posix_io_mode_name(pvol->io_mode);
+        memset(&start, 0, sizeof (start));
+        start.time = t0;
+        sample(pvol, &end);
+        fsw_posix_unmount(pvol);
+        end.time = now();
+        accumulate(&total, &start, &end);
+    }
+    report("mount", &total, count, 0, 0, 0);
+    return 0;
+}
+
+static void bench_lookup(struct fsw_posix_volume *pvol, const char *path, int count)
+{
+    struct counters total, start, end;
+    struct fsw_string lookup_path;
+    struct fsw_dnode *dno;
+    unsigned long long errors = 0;
+    int i;
+
+    lookup_path.type = FSW_STRING_TYPE_ISO88591;
+    lookup_path.len = lookup_path.size = (int)strlen(path);
+    lookup_path.data = (void *)path;
+
+    memset(&total, 0, sizeof (total));
+    sample(pvol, &start);
+    for (i = 0; i < count; i++) {
+        if (fsw_dnode_lookup_path(pvol->vol->root, &lookup_path, '/', &dno) == FSW_SUCCESS)
+            fsw_dnode_release(dno);
+        else
+            errors++;
+    }
+    sample(pvol, &end);
+    accumulate(&total, &start, &end);
+    report("lookup", &total, count, 0, errors, 0);
+}
+
+static void walk(struct fsw_posix_volume *pvol, const char *path,
+                 unsigned long long *entries, unsigned long long *errors, unsigned long long *checksum)
+{
+    struct fsw_posix_dir *dir;
+    struct dirent *dent;
+    char subpath[FSW_PATH_MAX];
+
+    dir = fsw_posix_opendir(pvol, path);
+    if (dir == NULL) {
+        (*errors)++;
+        return;
+    }
+    while ((dent = fsw_posix_readdir(dir)) != NULL) {
+        (*entries)++;
+        snprintf(subpath, sizeof (subpath), "%s%s", path, dent->d_name);
+        // the order of entries differs between file systems, so just add up
+        *checksum += fnv1a(FNV_OFFSET, subpath, strlen(subpath));
+        if (dent->d_type == DT_DIR) {
+            strncat(subpath, "/", sizeof (subpath) - strlen(subpath) - 1);
+            walk(pvol, subpath, entries, errors, checksum);
+        }
+    }
+    fsw_posix_closedir(dir);
+}
+
+static void bench_walk(struct fsw_posix_volume *pvol, const char *root)
+{
+    struct counters total, start, end;
+    unsigned long long entries = 0, errors = 0, checksum = 0;
+
+    memset(&total, 0, sizeof (total));
+    sample(pvol, &start);
+    walk(pvol, root, &entries, &errors, &checksum);
+    sample(pvol, &end);
+    accumulate(&total, &start, &end);
+    report("walk", &total, entries, 0, errors, checksum);
+}
+
+static int bench_read(struct fsw_posix_volume *pvol, const char *path, size_t chunk)
+{
+    struct fsw_posix_file *file;
+    struct counters total, start, end;
+    unsigned long long seed = 1, bytes = 0, ops = 0, errors = 0, checksum = FNV_OFFSET;
+    char *buffer;
+    ssize_t got;
+    long count, i;
+    off_t pos;
+
+    buffer = malloc(chunk);
+    if (buffer == NULL)
+        return 1;
+    file = fsw_posix_open(pvol, path, 0, 0);
+    if (file == NULL) {
+        free(buffer);
+        return 1;
+    }
+
+    // sequential pass
+    memset(&total, 0, sizeof (total));
+    sample(pvol, &start);
+    while ((got = fsw_posix_read(file, buffer, chunk)) > 0) {
+        checksum = fnv1a(checksum, buffer, got);
+        bytes += got;
+        ops++;
+    }
+    if (got < 0)
+        errors++;
+    sample(pvol, &end);
+    accumulate(&total, &start, &end);
+    report("seqread", &total, ops, bytes, errors, checksum);
+
+    // random pass over the same amount of data
+    count = (long)(bytes / RANDOM_READ_SIZE);
+    bytes = errors = 0;
+    checksum = FNV_OFFSET;
+    memset(&total, 0, sizeof (total));
+    sample(pvol, &start);
+    for (i = 0; i < count; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        pos = (off_t)((seed >> 33) % (unsigned long long)count) * RANDOM_READ_SIZE;
+        fsw_posix_lseek(file, pos, SEEK_SET);
+        got = fsw_posix_read(file, buffer, RANDOM_READ_SIZE);
+        if (got < 0) {
+            errors++;
+        } else {
+            checksum = fnv1a(checksum, buffer, got);
+            bytes += got;
+        }
+    }
+    sample(pvol, &end);
+    accumulate(&total, &start, &end);
+    report("randread", &total, count, bytes, errors, checksum);
+
+    fsw_posix_close(file);
+    free(buffer);
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: fswbench [-t tag] [-m mounts] [-l lookups] [-c chunk_size] [-w walk_root]\n"
+                    "                [-i read|pread|mmap|direct] <file/device> <deep path> <file>\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct fsw_posix_volume *pvol;
+    const char *walk_root = "/";
+    int mounts = 20, lookups = 1000;
+    size_t chunk = 65536;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:m:l:c:w:i:")) != -1) {
+        switch (opt) {
+            case 't': tag = optarg; break;
+            case 'm': mounts = atoi(optarg); break;
+            case 'l': lookups = atoi(optarg); break;
+            case 'c': chunk = strtoul(optarg, NULL, 0); break;
+            case 'w': walk_root = optarg; break;
+            case 'i':
+                if (fsw_posix_set_io_mode(optarg) < 0)
+                    usage();
+                break;
+            default: usage();
+        }
+    }
+    if (argc - optind != 3)
+        usage();
+    image = argv[optind];
+    image_name = strrchr(image, '/') ? strrchr(image, '/') + 1 : image;
+    if (chunk < RANDOM_READ_SIZE)
+        chunk = RANDOM_READ_SIZE;
+
+    if (bench_mount(mounts)) {
+        fprintf(stderr, "Mounting failed.\n");
+        return 1;
+    }
+
+    pvol = fsw_posix_mount(image, &FSW_FSTYPE_TABLE_NAME(FSTYPE));
+    if (pvol == NULL) {
+        fprintf(stderr, "Mounting failed.\n");
+        return 1;
+    }
+    bench_lookup(pvol, argv[optind + 1], lookups);
+    bench_walk(pvol, walk_root);
+    if (bench_read(pvol, argv[optind + 2], chunk))
+        fprintf(stderr, "Cannot read %s\n", argv[optind + 2]);
+    fsw_posix_unmount(pvol);
+
+    return 0;
+}
+
+// EOF
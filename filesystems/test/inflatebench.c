@@ -0,0 +1,197 @@
+/**
+ * \file inflatebench.c
+ * Inflate benchmark for the POSIX user space environment.
+ *
+ * Decompresses the deflate stream of each gzip file given on the command
+ * line with both decoders in gzio.c, the window decoder used for reads at
+ * an offset and the fast decoder used for reads from the start of a stream,
+ * checks that they produce the same data, and prints the throughput of each.
+ * Kernels, initrds and the like can be compressed with gzip for the input.
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fsw_codec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define uint8_t fsw_u8
+#define grub_off_t fsw_s32
+#define grub_size_t fsw_s32
+#define grub_ssize_t fsw_s32
+#include "gzio.c"
+
+
+/** Minimum time spent on each decoder and file, in seconds. */
+#define MIN_SECONDS (0.5)
+
+static struct gzio_workspace workspace;
+
+typedef grub_ssize_t (*decoder_t)(char *inbuf, grub_size_t insize, char *outbuf, grub_size_t outsize);
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static grub_ssize_t decode_window(char *inbuf, grub_size_t insize, char *outbuf, grub_size_t outsize)
+{
+    return grub_zlib_decompress_window(&workspace, inbuf, insize, 0, outbuf, outsize);
+}
+
+static grub_ssize_t decode_fast(char *inbuf, grub_size_t insize, char *outbuf, grub_size_t outsize)
+{
+    return grub_zlib_decompress_fast(&workspace.fast, inbuf, insize, outbuf, outsize);
+}
+
+/**
+ * Read a gzip file and turn its deflate stream into a zlib stream, which
+ * differs only in the header. The size of the data is taken from the trailer.
+ */
+
+static char * load_gzip(const char *path, long *zsize_out, long *size_out)
+{
+    FILE *f;
+    unsigned char *gz;
+    char *z;
+    long gzsize, pos;
+    int flags;
+
+    f = fopen(path, "rb");
+    if (f == NULL)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    gzsize = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    gz = malloc(gzsize > 0 ? gzsize : 1);
+    if (gz == NULL || fread(gz, 1, gzsize, f) != (size_t)gzsize || gzsize < 18 ||
+        gz[0] != 0x1f || gz[1] != 0x8b || gz[2] != DEFLATED) {
+        fclose(f);
+        free(gz);
+        return NULL;
+    }
+    fclose(f);
+
+    flags = gz[3];
+    pos = 10;
+    if (flags & EXTRA_FIELD)
+        pos += 2 + (gz[pos] | (gz[pos + 1] << 8));
+    if (flags & ORIG_NAME)
+        while (pos < gzsize && gz[pos++] != 0)
+            ;
+    if (flags & COMMENT)
+        while (pos < gzsize && gz[pos++] != 0)
+            ;
+    if (flags & 0x02)           // header CRC
+        pos += 2;
+    if (pos > gzsize - 8) {
+        free(gz);
+        return NULL;
+    }
+
+    *size_out = gz[gzsize - 4] | (gz[gzsize - 3] << 8) | (gz[gzsize - 2] << 16) |
+        ((long)gz[gzsize - 1] << 24);
+    *zsize_out = 2 + gzsize - 8 - pos;
+    z = malloc(*zsize_out);
+    if (z != NULL) {
+        z[0] = 0x78;
+        z[1] = 0x9c;
+        memcpy(z + 2, gz + pos, gzsize - 8 - pos);
+    }
+    free(gz);
+    return z;
+}
+
+static double run(decoder_t decode, char *z, long zsize, char *out, long size, long *runs_out)
+{
+    double start, seconds;
+    long runs = 0;
+
+    start = now();
+    do {
+        if (decode(z, zsize, out, size) != size)
+            return -1;
+        runs++;
+        seconds = now() - start;
+    } while (seconds < MIN_SECONDS);
+    *runs_out = runs;
+    return seconds / runs;
+}
+
+int main(int argc, char **argv)
+{
+    char *z, *out_window, *out_fast;
+    long zsize, size, runs_window, runs_fast;
+    double t_window, t_fast;
+    int i, status = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: inflatebench <file.gz>...\n");
+        return 1;
+    }
+
+    printf("%-32s %10s %10s %10s %10s %8s\n", "file", "bytes", "ratio", "window", "fast", "speedup");
+    for (i = 1; i < argc; i++) {
+        z = load_gzip(argv[i], &zsize, &size);
+        if (z == NULL || size <= 0 || size > 0x7fffffffL) {
+            fprintf(stderr, "%s: not a usable gzip file\n", argv[i]);
+            free(z);
+            status = 1;
+            continue;
+        }
+        out_window = malloc(size);
+        out_fast = malloc(size);
+        if (out_window == NULL || out_fast == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            return 1;
+        }
+
+        t_window = run(decode_window, z, zsize, out_window, size, &runs_window);
+        t_fast = run(decode_fast, z, zsize, out_fast, size, &runs_fast);
+        if (t_window < 0 || t_fast < 0 || memcmp(out_window, out_fast, size) != 0) {
+            fprintf(stderr, "%s: decoders disagree (window %s, fast %s)\n", argv[i],
+                    t_window < 0 ? "failed" : "ok", t_fast < 0 ? "failed" : "ok");
+            status = 1;
+        } else {
+            // throughput in MiB/s of uncompressed data
+            printf("%-32.32s %10ld %10.2f %10.1f %10.1f %7.2fx\n", argv[i], size, (double)size / zsize,
+                   size / t_window / 1048576.0, size / t_fast / 1048576.0, t_window / t_fast);
+        }
+        free(out_window);
+        free(out_fast);
+        free(z);
+    }
+    return status;
+}
+
+// EOF
@@ -118,7 +118,7 @@ int main(int argc, char **argv)
     for (i = 0; fstypes[i]; i++) {
         vol = fsw_posix_mount(argv[1], fstypes[i]);
         if (vol != NULL) {
-            fprintf(stderr, "Mounted as '%s'.\n", fstypes[i]->name.data);
+            fprintf(stderr, "Mounted as '%s'.\n", (char *)fstypes[i]->name.data);
             break;
         }
     }
@@ -130,6 +130,13 @@ int main(int argc, char **argv)
     listdir(vol, "/boot/", 0);
     catfile(vol, "/boot/testfile.txt");
 
+    fprintf(stderr, "Block cache: %llu hits, %llu misses, %llu evictions, %u entries\n",
+            (unsigned long long)vol->vol->bcache_hits, (unsigned long long)vol->vol->bcache_misses,
+            (unsigned long long)vol->vol->bcache_evictions, vol->vol->bcache_count);
+    fprintf(stderr, "Path lookup cache: %llu hits, %llu misses, %u bytes\n",
+            (unsigned long long)vol->vol->dcache_hits, (unsigned long long)vol->vol->dcache_misses,
+            vol->vol->dcache_mem);
+
     fsw_posix_unmount(vol);
 
     return 0;
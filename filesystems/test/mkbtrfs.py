@@ -0,0 +1,508 @@
+#!/usr/bin/env python3
+#
+# mkbtrfs.py - build small btrfs images for the fsw_btrfs host tests
+#
+# Writes a single-device btrfs image holding the contents of a source
+# directory, without needing btrfs-progs or root privileges. Only what the
+# read-only driver looks at is written: superblock with the system chunk
+# array, chunk tree, root tree and one FS tree with inode, inode ref, dir
+# item, dir index and file extent items. There is no extent tree, so the
+# images are not meant to be mounted read-write by Linux.
+#
+# File data can be stored uncompressed or compressed with zlib, zstd or
+# lzo, and the data chunk can use a RAID5 or RAID6 profile whose stripes all
+# live on the one image. Stripes listed with --missing point at a device that
+# is never attached, so every read from them goes through parity recovery.
+#
+# Usage: mkbtrfs.py [options] <source directory> <image>
+#
+
+import argparse
+import ctypes
+import ctypes.util
+import os
+import stat
+import struct
+import zlib
+
+SUPERBLOCK_OFFSET = 0x10000
+META_START = 0x100000
+STRIPE_LEN = 0x10000
+MAX_COMPRESSED_EXTENT = 128 * 1024
+MAX_EXTENT = 1024 * 1024
+MAX_INLINE = 2048
+
+FS_TREE_OBJECTID = 5
+ROOT_TREE_OBJECTID = 1
+CHUNK_TREE_OBJECTID = 3
+ROOT_TREE_DIR_OBJECTID = 6
+FIRST_CHUNK_TREE_OBJECTID = 256
+FIRST_FREE_OBJECTID = 256
+
+INODE_ITEM = 1
+INODE_REF = 12
+DIR_ITEM = 84
+DIR_INDEX = 96
+EXTENT_DATA = 108
+ROOT_ITEM = 132
+CHUNK_ITEM = 228
+
+BLOCK_GROUP_DATA = 0x1
+BLOCK_GROUP_SYSTEM = 0x2
+BLOCK_GROUP_METADATA = 0x4
+BLOCK_GROUP_RAID5 = 0x80
+BLOCK_GROUP_RAID6 = 0x100
+
+COMPRESSION = {'none': 0, 'zlib': 1, 'lzo': 2, 'zstd': 3}
+
+FT_REG_FILE = 1
+FT_DIR = 2
+FT_SYMLINK = 7
+
+HEADER_SIZE = 101
+ITEM_SIZE = 25
+KEY_PTR_SIZE = 33
+
+FSID = bytes(range(0x10, 0x20))
+CHUNK_TREE_UUID = bytes(range(0x20, 0x30))
+DEV_UUID = bytes(range(0x30, 0x40))
+GENERATION = 7
+
+
+def crc32c_table():
+    table = []
+    for i in range(256):
+        crc = i
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x82F63B78 if crc & 1 else crc >> 1
+        table.append(crc)
+    return table
+
+
+CRC32C_TABLE = crc32c_table()
+
+
+def crc32c_raw(crc, data):
+    for b in data:
+        crc = (crc >> 8) ^ CRC32C_TABLE[(crc ^ b) & 0xff]
+    return crc
+
+
+def crc32c(data):
+    return crc32c_raw(0xffffffff, data) ^ 0xffffffff
+
+
+def name_hash(name):
+    return crc32c_raw(0xfffffffe, name)
+
+
+def pack_key(objectid, type_, offset):
+    return struct.pack('<QBQ', objectid, type_, offset)
+
+
+def pack_timespec(sec):
+    return struct.pack('<qI', sec, 0)
+
+
+def inode_item(size, nbytes, nlink, mode, mtime):
+    return (struct.pack('<QQQQQIIIIQQQ', GENERATION, GENERATION, size, nbytes, 0,
+                        nlink, 0, 0, mode, 0, 0, 0)
+            + bytes(32)
+            + pack_timespec(mtime) * 4)
+
+
+def dir_item(child, ftype, name):
+    return (pack_key(child, INODE_ITEM, 0)
+            + struct.pack('<QHHB', GENERATION, 0, len(name), ftype) + name)
+
+
+def root_item(bytenr):
+    item = bytearray(439)
+    item[0:160] = inode_item(3, 16384, 1, stat.S_IFDIR | 0o755, 0)
+    struct.pack_into('<QQQ', item, 160, GENERATION, FIRST_FREE_OBJECTID, bytenr)
+    struct.pack_into('<I', item, 160 + 8 * 7, 1)         # refs
+    return bytes(item)
+
+
+def chunk_item(length, type_, stripes, num_stripes_total, sectorsize):
+    data = struct.pack('<QQQQIIIHH', length, 2, STRIPE_LEN, type_,
+                       STRIPE_LEN, STRIPE_LEN, sectorsize, num_stripes_total, 0)
+    for devid, offset in stripes:
+        data += struct.pack('<QQ', devid, offset) + DEV_UUID
+    return data
+
+
+# --- compression ---------------------------------------------------------
+
+def compress_zstd(data):
+    lib = ctypes.CDLL(ctypes.util.find_library('zstd') or 'libzstd.so.1')
+    lib.ZSTD_compressBound.restype = ctypes.c_size_t
+    lib.ZSTD_compress.restype = ctypes.c_size_t
+    lib.ZSTD_isError.restype = ctypes.c_uint
+    cap = lib.ZSTD_compressBound(ctypes.c_size_t(len(data)))
+    out = ctypes.create_string_buffer(cap)
+    n = lib.ZSTD_compress(out, ctypes.c_size_t(cap), data, ctypes.c_size_t(len(data)), 3)
+    if lib.ZSTD_isError(ctypes.c_size_t(n)):
+        raise RuntimeError('zstd compression failed')
+    return out.raw[:n]
+
+
+def lzo1x_literals(data):
+    # A valid LZO1X stream made of a single literal run and the end marker.
+    # It does not make the data smaller, but exercises the decoder.
+    n = len(data)
+    if n <= 238:
+        out = bytes([n + 17])
+    else:
+        t = n - 3
+        if t <= 15:
+            out = bytes([t])
+        else:
+            x = t - 15
+            zeros = (x - 1) // 255
+            out = bytes([0]) + bytes(zeros) + bytes([x - 255 * zeros])
+    return out + data + b'\x11\x00\x00'
+
+
+def compress_lzo(data, sectorsize):
+    out = bytearray(4)
+    for pos in range(0, len(data), sectorsize):
+        seg = lzo1x_literals(data[pos:pos + sectorsize])
+        if 4096 - (len(out) % 4096) < 4:
+            out += bytes(4096 - (len(out) % 4096))
+        out += struct.pack('<I', len(seg)) + seg
+    struct.pack_into('<I', out, 0, len(out))
+    return bytes(out)
+
+
+def compressed(method, comp, size):
+    # the lzo encoder above never shrinks data, keep it anyway for testing
+    return comp is not None and (len(comp) < size or method == 'lzo')
+
+
+def compress(method, data, sectorsize):
+    if method == 'zlib':
+        return zlib.compress(data)
+    if method == 'zstd':
+        return compress_zstd(data)
+    if method == 'lzo':
+        return compress_lzo(data, sectorsize)
+    return None
+
+
+# --- trees ---------------------------------------------------------------
+
+class Image:
+    def __init__(self, args):
+        self.args = args
+        self.sectorsize = args.sectorsize
+        self.nodesize = args.nodesize
+        self.meta_next = META_START
+        self.nodes = {}                 # bytenr -> node bytes
+        self.data = bytearray()         # data chunk contents, logical order
+        self.data_logical = None        # set once metadata size is known
+
+    def align(self, n, a):
+        return (n + a - 1) // a * a
+
+    def alloc_node(self):
+        bytenr = self.meta_next
+        self.meta_next += self.nodesize
+        return bytenr
+
+    def header(self, bytenr, owner, nritems, level):
+        return (bytes(32) + FSID + struct.pack('<QQ', bytenr, 1) + CHUNK_TREE_UUID
+                + struct.pack('<QQIB', GENERATION, owner, nritems, level))
+
+    def finish_node(self, node):
+        struct.pack_into('<I', node, 0, crc32c(bytes(node[32:])))
+        return bytes(node)
+
+    def build_tree(self, owner, items):
+        """items: sorted list of (key tuple, data). Returns root bytenr, level."""
+        leaves = []
+        cur = []
+        used = 0
+        for key, data in items:
+            need = ITEM_SIZE + len(data)
+            if cur and used + need > self.nodesize - HEADER_SIZE:
+                leaves.append(cur)
+                cur, used = [], 0
+            cur.append((key, data))
+            used += need
+        leaves.append(cur)
+
+        level_ptrs = []
+        for leaf in leaves:
+            bytenr = self.alloc_node()
+            node = bytearray(self.nodesize)
+            node[0:HEADER_SIZE] = self.header(bytenr, owner, len(leaf), 0)
+            data_end = self.nodesize - HEADER_SIZE
+            for i, (key, data) in enumerate(leaf):
+                data_end -= len(data)
+                node[HEADER_SIZE + data_end:HEADER_SIZE + data_end + len(data)] = data
+                node[HEADER_SIZE + i * ITEM_SIZE:HEADER_SIZE + (i + 1) * ITEM_SIZE] = \
+                    pack_key(*key) + struct.pack('<II', data_end, len(data))
+            self.nodes[bytenr] = self.finish_node(node)
+            level_ptrs.append((leaf[0][0] if leaf else (0, 0, 0), bytenr))
+
+        level = 0
+        per_node = (self.nodesize - HEADER_SIZE) // KEY_PTR_SIZE
+        while len(level_ptrs) > 1:
+            level += 1
+            next_ptrs = []
+            for i in range(0, len(level_ptrs), per_node):
+                group = level_ptrs[i:i + per_node]
+                bytenr = self.alloc_node()
+                node = bytearray(self.nodesize)
+                node[0:HEADER_SIZE] = self.header(bytenr, owner, len(group), level)
+                for j, (key, ptr) in enumerate(group):
+                    off = HEADER_SIZE + j * KEY_PTR_SIZE
+                    node[off:off + KEY_PTR_SIZE] = pack_key(*key) + struct.pack('<QQ', ptr, GENERATION)
+                self.nodes[bytenr] = self.finish_node(node)
+                next_ptrs.append((group[0][0], bytenr))
+            level_ptrs = next_ptrs
+        return level_ptrs[0][1], level
+
+    # --- file data ---------------------------------------------------------
+
+    def add_data(self, data):
+        """Appends sector aligned data to the data chunk, returns its offset."""
+        off = len(self.data)
+        self.data += data
+        self.data += bytes(self.align(len(self.data), self.sectorsize) - len(self.data))
+        return off
+
+    def file_extents(self, ino, content, items):
+        method = self.args.compress
+        size = len(content)
+        if size == 0:
+            return 0
+        if size <= MAX_INLINE and size < self.sectorsize:
+            comp = compress(method, content, self.sectorsize) if method != 'none' else None
+            if compressed(method, comp, size):
+                body = comp
+                ctype = COMPRESSION[method]
+            else:
+                body = content
+                ctype = 0
+            items.append(((ino, EXTENT_DATA, 0),
+                          struct.pack('<QQBBHB', GENERATION, size, ctype, 0, 0, 0) + body))
+            return size
+
+        nbytes = 0
+        chunk = MAX_COMPRESSED_EXTENT if method != 'none' else MAX_EXTENT
+        for pos in range(0, size, chunk):
+            piece = content[pos:pos + chunk]
+            piece += bytes(self.align(len(piece), self.sectorsize) - len(piece))
+            comp = compress(method, piece, self.sectorsize) if method != 'none' else None
+            if compressed(method, comp, len(piece)):
+                ctype = COMPRESSION[method]
+                stored = comp
+            else:
+                ctype = 0
+                stored = piece
+            # extents are relative to the data chunk until its address is known
+            off = self.add_data(stored)
+            disk_len = self.align(len(stored), self.sectorsize)
+            items.append(((ino, EXTENT_DATA, pos),
+                          ['regular', GENERATION, len(piece), ctype, off, disk_len, len(piece)]))
+            nbytes += len(piece)
+        return nbytes
+
+    # --- directory walk ----------------------------------------------------
+
+    def walk(self, source):
+        items = []
+        next_ino = [FIRST_FREE_OBJECTID + 1]
+
+        def add_dir(path, ino, parent, name):
+            entries = sorted(os.listdir(path))
+            dir_items = {}
+            size = 0
+            for index, entry in enumerate(entries, start=2):
+                full = os.path.join(path, entry)
+                bname = entry.encode('utf-8')
+                child = next_ino[0]
+                next_ino[0] += 1
+                st = os.lstat(full)
+                if stat.S_ISDIR(st.st_mode):
+                    ftype = FT_DIR
+                    add_dir(full, child, ino, bname)
+                elif stat.S_ISLNK(st.st_mode):
+                    ftype = FT_SYMLINK
+                    target = os.readlink(full).encode('utf-8')
+                    items.append(((child, INODE_ITEM, 0),
+                                  inode_item(len(target), len(target), 1, st.st_mode, int(st.st_mtime))))
+                    items.append(((child, INODE_REF, ino), struct.pack('<QH', index, len(bname)) + bname))
+                    items.append(((child, EXTENT_DATA, 0),
+                                  struct.pack('<QQBBHB', GENERATION, len(target), 0, 0, 0, 0) + target))
+                else:
+                    ftype = FT_REG_FILE
+                    with open(full, 'rb') as f:
+                        content = f.read()
+                    nbytes = self.file_extents(child, content, items)
+                    items.append(((child, INODE_ITEM, 0),
+                                  inode_item(len(content), nbytes, 1, st.st_mode, int(st.st_mtime))))
+                    items.append(((child, INODE_REF, ino), struct.pack('<QH', index, len(bname)) + bname))
+                h = name_hash(bname)
+                dir_items[h] = dir_items.get(h, b'') + dir_item(child, ftype, bname)
+                items.append(((ino, DIR_INDEX, index), dir_item(child, ftype, bname)))
+                size += 2 * len(bname)
+            for h, data in dir_items.items():
+                items.append(((ino, DIR_ITEM, h), data))
+            items.append(((ino, INODE_ITEM, 0),
+                          inode_item(size, 0, 1, stat.S_IFDIR | 0o755, int(os.stat(path).st_mtime))))
+            items.append(((ino, INODE_REF, parent), struct.pack('<QH', 0, len(name)) + name))
+
+        add_dir(source, FIRST_FREE_OBJECTID, FIRST_FREE_OBJECTID, b'..')
+        return items
+
+    # --- data chunk layout -------------------------------------------------
+
+    def data_stripes(self):
+        """Returns (chunk type, number of stripes, number of parity stripes)."""
+        if self.args.raid == 'raid5':
+            return BLOCK_GROUP_RAID5, self.args.stripes, 1
+        if self.args.raid == 'raid6':
+            return BLOCK_GROUP_RAID6, self.args.stripes, 2
+        return 0, 1, 0
+
+    def place_data(self, image, phys_base):
+        """Writes the data chunk at phys_base and returns (length, stripes)."""
+        raid, nstripes, nparity = self.data_stripes()
+        dstripes = nstripes - nparity
+        row_len = STRIPE_LEN * dstripes
+        length = self.align(max(len(self.data), 1), row_len)
+        data = bytes(self.data) + bytes(length - len(self.data))
+        if not raid:
+            image[phys_base:] = data
+            return length, [(1, phys_base)]
+
+        rows = length // row_len
+        per_stripe = rows * STRIPE_LEN
+        image[phys_base:] = bytes(nstripes * per_stripe)
+        missing = set(self.args.missing)
+        stripes = []
+        for s in range(nstripes):
+            stripes.append((2 + s if s in missing else 1, phys_base + s * per_stripe))
+        for row in range(rows):
+            blocks = [data[(row * dstripes + i) * STRIPE_LEN:(row * dstripes + i + 1) * STRIPE_LEN]
+                      for i in range(dstripes)]
+            p = bytearray(STRIPE_LEN)
+            for blk in blocks:
+                p = bytearray(a ^ b for a, b in zip(p, blk))
+            blocks.append(bytes(p))
+            if nparity == 2:
+                blocks.append(raid6_q(blocks[:dstripes]))
+            for i, blk in enumerate(blocks):
+                s = (row + i) % nstripes
+                dst = phys_base + s * per_stripe + row * STRIPE_LEN
+                if s in missing:
+                    blk = b'\xee' * STRIPE_LEN
+                image[dst:dst + STRIPE_LEN] = blk
+        return length, stripes
+
+    # --- whole image ---------------------------------------------------------
+
+    def build(self, source, path):
+        fs_items = self.walk(source)
+
+        # metadata is laid out first, so estimate its size generously
+        leaf_bytes = sum(ITEM_SIZE + (len(d) if isinstance(d, bytes) else 53) for _, d in fs_items)
+        meta_len = self.align(META_START + 8 * self.nodesize
+                              + 3 * leaf_bytes * self.nodesize // (self.nodesize - HEADER_SIZE),
+                              STRIPE_LEN)
+        self.data_logical = meta_len
+
+        items = []
+        for key, data in fs_items:
+            if not isinstance(data, bytes):
+                _, gen, ram, ctype, off, disk_len, num = data
+                data = struct.pack('<QQBBHBQQQQ', gen, ram, ctype, 0, 0, 1,
+                                   self.data_logical + off, disk_len, 0, num)
+            items.append((key, data))
+        items.sort(key=lambda kd: kd[0])
+
+        fs_root, _ = self.build_tree(FS_TREE_OBJECTID, items)
+        root_items = [((FS_TREE_OBJECTID, ROOT_ITEM, 0), root_item(fs_root))]
+        root_root, root_level = self.build_tree(ROOT_TREE_OBJECTID, root_items)
+
+        raid, nstripes, nparity = self.data_stripes()
+        data_phys = meta_len
+        image = bytearray(meta_len)
+        data_len, stripes = self.place_data(image, data_phys)
+        total = len(image)
+
+        sys_chunk = chunk_item(meta_len, BLOCK_GROUP_SYSTEM | BLOCK_GROUP_METADATA,
+                               [(1, 0)], 1, self.sectorsize)
+        data_chunk = chunk_item(data_len, BLOCK_GROUP_DATA | raid,
+                                stripes, nstripes, self.sectorsize)
+        chunk_items = [((FIRST_CHUNK_TREE_OBJECTID, CHUNK_ITEM, 0), sys_chunk),
+                       ((FIRST_CHUNK_TREE_OBJECTID, CHUNK_ITEM, self.data_logical), data_chunk)]
+        chunk_root, chunk_level = self.build_tree(CHUNK_TREE_OBJECTID, chunk_items)
+        if self.meta_next > meta_len:
+            raise RuntimeError('metadata estimate too small')
+
+        for bytenr, node in self.nodes.items():
+            image[bytenr:bytenr + len(node)] = node
+
+        # like mkfs.btrfs, only the system chunk goes into the superblock, the
+        # data chunk has to be found in the chunk tree
+        sys_array = pack_key(*chunk_items[0][0]) + chunk_items[0][1]
+        if len(sys_array) > 2048:
+            raise RuntimeError('too many stripes for the system chunk array')
+
+        sb = bytearray(4096)
+        sb[32:48] = FSID
+        struct.pack_into('<QQ8sQQQQQQQQQIIIIIQQQQHBBB', sb, 48,
+                         SUPERBLOCK_OFFSET, 1, b'_BHRfS_M', GENERATION,
+                         root_root, chunk_root, 0, 0,
+                         total, self.data_logical + data_len, ROOT_TREE_DIR_OBJECTID, 1,
+                         self.sectorsize, self.nodesize, self.nodesize, self.sectorsize,
+                         len(sys_array), GENERATION, 0, 0, 0, 0,
+                         root_level, chunk_level, 0)
+        struct.pack_into('<QQQIIIQQQIBB', sb, 0xc9, 1, total, total, self.sectorsize,
+                         self.sectorsize, self.sectorsize, 0, GENERATION, 0, 0, 0, 0)
+        sb[0xc9 + 66:0xc9 + 82] = DEV_UUID
+        sb[0xc9 + 82:0xc9 + 98] = FSID
+        label = self.args.label.encode('utf-8')[:255]
+        sb[0x12b:0x12b + len(label)] = label
+        sb[0x32b:0x32b + len(sys_array)] = sys_array
+        struct.pack_into('<I', sb, 0, crc32c(bytes(sb[32:])))
+        image[SUPERBLOCK_OFFSET:SUPERBLOCK_OFFSET + 4096] = sb
+
+        with open(path, 'wb') as f:
+            f.write(image)
+
+
+def gf_mul2(block):
+    return bytes(((b << 1) ^ 0x1d) & 0xff if b & 0x80 else b << 1 for b in block)
+
+
+def raid6_q(blocks):
+    # Q = sum(g**i * D_i) over GF(2**8), evaluated with Horner's rule
+    q = bytes(len(blocks[0]))
+    for blk in reversed(blocks):
+        q = bytes(a ^ b for a, b in zip(gf_mul2(q), blk))
+    return q
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Build a btrfs image for the fsw host tests.')
+    parser.add_argument('source')
+    parser.add_argument('image')
+    parser.add_argument('--compress', choices=sorted(COMPRESSION), default='none')
+    parser.add_argument('--sectorsize', type=int, default=4096)
+    parser.add_argument('--nodesize', type=int, default=16384)
+    parser.add_argument('--raid', choices=['single', 'raid5', 'raid6'], default='single')
+    parser.add_argument('--stripes', type=int, default=4)
+    parser.add_argument('--missing', type=lambda s: [int(x) for x in s.split(',') if x],
+                        default=[], help='comma separated stripes to leave unreadable')
+    parser.add_argument('--label', default='fswtest')
+    args = parser.parse_args()
+    Image(args).build(args.source, args.image)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,98 @@
+#!/bin/sh
+#
+# Generates the fixture images for the host benchmark harness (runbench.sh).
+#
+# Usage: mkfixtures.sh <output directory>
+#
+# All images hold the same tree, generated from a fixed seed so that results
+# stay comparable across commits:
+#   /deep/l1/.../l12/leaf.txt   deep path lookups
+#   /many/file0001..file2000    one large directory
+#   /docs/*.txt                 text files of various sizes
+#   /data/big.bin               16 MiB, alternating random and text chunks
+#
+# Images are named <driver>-<variant>.img, which is how runbench.sh picks the
+# tools for them. ext2/ext4 images are made with mke2fs, btrfs images with
+# mkbtrfs.py, HFS+ images with mkhfsplus.py, ISO9660 images with
+# mkiso9660.py, NTFS images with mkntfs.py and ReiserFS images with
+# mkreiserfs.py.
+#
+# Needs python3 and mke2fs.
+
+set -e
+
+OUT=${1:?usage: mkfixtures.sh <output directory>}
+HERE=$(cd "$(dirname "$0")" && pwd)
+
+mkdir -p "$OUT"
+SRC=$(mktemp -d)
+trap 'rm -rf "$SRC"' EXIT
+
+python3 - "$SRC" <<'PYEOF'
+import os, random, sys
+
+src = sys.argv[1]
+rnd = random.Random(2026)
+words = [''.join(rnd.choice('abcdefghijklmnopqrstuvwxyz') for _ in range(rnd.randint(2, 9)))
+         for _ in range(500)]
+
+def text(size):
+    out = []
+    n = 0
+    while n < size:
+        w = rnd.choice(words)
+        out.append(w)
+        n += len(w) + 1
+    return (' '.join(out)[:size]).ljust(size).encode()
+
+def write(path, data):
+    full = os.path.join(src, path)
+    os.makedirs(os.path.dirname(full), exist_ok=True)
+    with open(full, 'wb') as f:
+        f.write(data)
+
+write('deep/' + '/'.join('l%d' % i for i in range(1, 13)) + '/leaf.txt', b'leaf\n')
+for i in range(1, 2001):
+    write('many/file%04d' % i, b'%d\n' % i)
+for i in range(1, 51):
+    write('docs/doc%02d.txt' % i, text(rnd.randint(100, 200000)))
+chunks = []
+for i in range(256):
+    chunks.append(rnd.randbytes(65536) if i % 2 else text(65536))
+write('data/big.bin', b''.join(chunks))
+os.symlink('data/big.bin', os.path.join(src, 'link'))
+PYEOF
+
+mkext () {
+    # mkext <name> <mke2fs type> <block size>
+    IMG="$OUT/$1.img"
+    rm -f "$IMG"
+    mke2fs -q -F -t $2 -b $3 -d "$SRC" "$IMG" 64M > /dev/null
+    echo "$IMG"
+}
+
+mkext ext2-1k ext2 1024
+mkext ext4-4k ext4 4096
+
+for C in none zlib zstd; do
+    python3 "$HERE/mkbtrfs.py" --compress $C "$SRC" "$OUT/btrfs-$C.img" > /dev/null
+    echo "$OUT/btrfs-$C.img"
+done
+
+python3 "$HERE/mkhfsplus.py" "$SRC" "$OUT/hfs-plus.img"
+echo "$OUT/hfs-plus.img"
+for C in zlib lzvn; do
+    python3 "$HERE/mkhfsplus.py" --compress $C "$SRC" "$OUT/hfs-$C.img"
+    echo "$OUT/hfs-$C.img"
+done
+
+python3 "$HERE/mkiso9660.py" "$SRC" "$OUT/iso9660-rr.img"
+echo "$OUT/iso9660-rr.img"
+
+for C in 4k:4096 512:512; do
+    python3 "$HERE/mkntfs.py" --cluster ${C#*:} "$SRC" "$OUT/ntfs-${C%:*}.img"
+    echo "$OUT/ntfs-${C%:*}.img"
+done
+
+python3 "$HERE/mkreiserfs.py" "$SRC" "$OUT/reiserfs-r5.img"
+echo "$OUT/reiserfs-r5.img"
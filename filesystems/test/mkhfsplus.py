@@ -0,0 +1,538 @@
+#!/usr/bin/env python3
+#
+# mkhfsplus.py - build small HFS+ images for the fsw_hfs host tests
+#
+# Writes an HFS+ image holding the contents of a source directory, without
+# needing newfs_hfs or a mount. Only what the read-only driver looks at is
+# filled in properly: volume header, catalog B-tree with folder, file and
+# thread records, and the extents overflow B-tree. The allocation file marks
+# every used block, but there is no journal.
+#
+# The catalog uses small nodes by default so that the fixtures have a B-tree
+# of some depth. Files larger than --fragment bytes are split into 16 block
+# runs with a gap between them, so that they need the extents overflow tree.
+# Names are compared the way the driver does (ASCII case folding); names
+# outside Latin-1 may sort differently from what macOS would write.
+#
+# With --compress zlib or lzvn every non-empty file is stored the way
+# "ditto --hfsCompression" / afsctool would: the UF_COMPRESSED flag, a
+# com.apple.decmpfs attribute in the attributes B-tree, and the data either
+# inline in that attribute (small files) or as 64 KiB chunks in the resource
+# fork. Chunks that do not shrink are stored raw behind a marker byte.
+#
+# Usage: mkhfsplus.py [options] <source directory> <image>
+#
+
+import argparse
+import itertools
+import os
+import stat
+import struct
+import zlib
+
+BLOCK = 4096
+HFS_EPOCH_OFFSET = 2082844800
+DATE = 1767225600 + HFS_EPOCH_OFFSET   # 2026-01-01 00:00:00 UTC
+
+ROOT_PARENT_ID = 1
+ROOT_FOLDER_ID = 2
+EXTENTS_FILE_ID = 3
+CATALOG_FILE_ID = 4
+ALLOCATION_FILE_ID = 6
+ATTRIBUTES_FILE_ID = 8
+FIRST_USER_ID = 16
+
+HAS_ATTRIBUTES = 0x0004     # catalog record flag
+UF_COMPRESSED = 0x20        # BSD owner flag
+
+ATTR_INLINE_DATA = 0x10
+DECMPFS_MAGIC = b'fpmc'
+DECMPFS_ZLIB_ATTR, DECMPFS_ZLIB_RSRC = 3, 4
+DECMPFS_LZVN_ATTR, DECMPFS_LZVN_RSRC = 7, 8
+DECMPFS_CHUNK = 65536
+DECMPFS_INLINE_MAX = 3802   # largest attribute macOS keeps inline
+ATTRIBUTES_NODE = 8192
+
+FOLDER_RECORD = 1
+FILE_RECORD = 2
+FOLDER_THREAD = 3
+FILE_THREAD = 4
+
+LEAF_NODE = 0xff    # -1
+INDEX_NODE = 0
+HEADER_NODE = 1
+
+BIG_KEYS = 0x2
+VARIABLE_INDEX_KEYS = 0x4
+CASE_FOLDING = 0xcf
+
+
+def fold(name):
+    return [ord(c.lower()) if ord(c) < 0x100 else ord(c) for c in name]
+
+
+def utf16(name):
+    return name.encode('utf-16-be')
+
+
+class Node:
+    def __init__(self, path, name, parent, cnid):
+        self.path = path
+        self.name = name
+        self.parent = parent
+        self.cnid = cnid
+        self.is_dir = os.path.isdir(path)
+        self.children = []
+        self.size = 0
+        self.extents = []
+        self.compressed = False
+        self.rsrc = b''
+        self.rsrc_extents = []
+
+    def data_length(self):
+        return 0 if self.compressed else self.size
+
+
+def build_tree(path, name, parent, ids):
+    node = Node(path, name, parent, next(ids) if parent else ROOT_FOLDER_ID)
+    if node.is_dir:
+        for entry in sorted(os.listdir(path)):
+            full = os.path.join(path, entry)
+            st = os.lstat(full)
+            if stat.S_ISDIR(st.st_mode) or stat.S_ISREG(st.st_mode):
+                node.children.append(build_tree(full, entry, node, ids))
+    else:
+        node.size = os.path.getsize(path)
+    return node
+
+
+def walk(node):
+    yield node
+    for c in node.children:
+        yield from walk(c)
+
+
+def fork_data(size, extents):
+    blocks = sum(n for _, n in extents)
+    first = extents[:8] + [(0, 0)] * (8 - min(8, len(extents)))
+    return (struct.pack('>QII', size, 0, blocks)
+            + b''.join(struct.pack('>II', s, n) for s, n in first))
+
+
+def bsd_info(is_dir, owner_flags=0):
+    mode = 0o40755 if is_dir else 0o100644
+    return struct.pack('>IIBBHI', 0, 0, 0, owner_flags, mode, 0)
+
+
+def catalog_key(parent, name):
+    u = utf16(name)
+    return struct.pack('>HIH', 6 + len(u), parent, len(u) // 2) + u
+
+
+def catalog_sort_key(parent, name):
+    return (parent, fold(name))
+
+
+def folder_record(node):
+    return (struct.pack('>hHII', FOLDER_RECORD, 0, len(node.children), node.cnid)
+            + struct.pack('>IIIII', DATE, DATE, DATE, DATE, 0)
+            + bsd_info(True) + bytes(32) + struct.pack('>II', 0, 0))
+
+
+def file_record(node):
+    flags = HAS_ATTRIBUTES if node.compressed else 0
+    return (struct.pack('>hHII', FILE_RECORD, flags, 0, node.cnid)
+            + struct.pack('>IIIII', DATE, DATE, DATE, DATE, 0)
+            + bsd_info(False, UF_COMPRESSED if node.compressed else 0)
+            + bytes(32) + struct.pack('>II', 0, 0)
+            + fork_data(node.data_length(), node.extents)
+            + fork_data(len(node.rsrc), node.rsrc_extents))
+
+
+def thread_record(node, label):
+    kind = FOLDER_THREAD if node.is_dir else FILE_THREAD
+    name = label if node.parent is None else node.name
+    parent = node.parent.cnid if node.parent else ROOT_PARENT_ID
+    u = utf16(name)
+    return struct.pack('>hhIH', kind, 0, parent, len(u) // 2) + u
+
+
+def lzvn_literals(out, lit):
+    while lit:
+        n = min(len(lit), 271)
+        out += bytes([0xe0, n - 16]) if n >= 16 else bytes([0xe0 | n])
+        out += lit[:n]
+        lit = lit[n:]
+
+
+def lzvn_compress(data):
+    """Greedy LZVN encoder; uses every opcode type the format has."""
+    out = bytearray()
+    table = {}
+    pos = lit_start = 0
+    prev_d = 0
+    n = len(data)
+    while pos + 3 <= n:
+        key = data[pos:pos + 3]
+        cand = table.get(key)
+        table[key] = pos
+        d = pos - cand if cand is not None else 0
+        if prev_d and pos >= prev_d and data[pos - prev_d:pos - prev_d + 3] == key:
+            d = prev_d
+        if not d or d > 0xffff:
+            pos += 1
+            continue
+        m = 3
+        while pos + m < n and data[pos + m] == data[pos + m - d]:
+            m += 1
+
+        lit = data[lit_start:pos]
+        if len(lit) > 3:
+            keep = len(lit) & 3
+            lzvn_literals(out, lit[:len(lit) - keep])
+            lit = lit[len(lit) - keep:]
+        nl = len(lit)
+        max_m = (10, 8, 6, 4)[nl]
+        if d == prev_d and nl == 0:
+            first = 0
+        elif d == prev_d:
+            first = min(m, max_m)
+            out.append(nl << 6 | (first - 3) << 3 | 6)
+        elif d < 0x600:
+            first = min(m, max_m)
+            out += bytes([nl << 6 | (first - 3) << 3 | d >> 8, d & 0xff])
+        elif d < 0x4000:
+            first = min(m, 34)
+            out += bytes([0xa0 | nl << 3 | (first - 3) >> 2, (first - 3) & 3 | (d & 0x3f) << 2, d >> 6])
+        else:
+            first = min(m, max_m)
+            out += bytes([nl << 6 | (first - 3) << 3 | 7, d & 0xff, d >> 8])
+        out += lit
+        left = m - first
+        while left:
+            k = min(left, 271)
+            out += bytes([0xf0, k - 16]) if k >= 16 else bytes([0xf0 | k])
+            left -= k
+        prev_d = d
+        pos += m
+        lit_start = pos
+    lzvn_literals(out, data[lit_start:])
+    out += b'\x06' + bytes(7)
+    return bytes(out)
+
+
+def compress_chunk(method, data):
+    # incompressible data is stored raw behind a marker byte, as macOS does;
+    # a quick zlib pass keeps the slow LZVN encoder off random data
+    if len(zlib.compress(data, 1)) >= len(data):
+        packed = None
+    elif method == 'zlib':
+        packed = zlib.compress(data, 9)
+    else:
+        packed = lzvn_compress(data)
+    if packed is None or len(packed) >= len(data):
+        return (b'\xff' if method == 'zlib' else b'\x06') + data
+    return packed
+
+
+def resource_fork_zlib(chunks):
+    table = struct.pack('<I', len(chunks))
+    pos = 4 + 8 * len(chunks)
+    for c in chunks:
+        table += struct.pack('<II', pos, len(c))
+        pos += len(c)
+    data = table + b''.join(chunks)
+    header = struct.pack('>IIII', 0x100, 0x104 + len(data), 4 + len(data), 50)
+    # resource map with a single 'cmpf' resource, id 1
+    res_map = (header + struct.pack('>IHHHH', 0, 0, 0, 28, 50)
+               + struct.pack('>H4sHH', 0, b'cmpf', 0, 10)
+               + struct.pack('>HHBBHI', 1, 0xffff, 0, 0, 0, 0))
+    return header.ljust(0x100, b'\0') + struct.pack('>I', len(data)) + data + res_map
+
+
+def resource_fork_lzvn(chunks):
+    pos = 4 * (len(chunks) + 1)
+    offsets = [pos]
+    for c in chunks:
+        pos += len(c)
+        offsets.append(pos)
+    return struct.pack('<%dI' % len(offsets), *offsets) + b''.join(chunks)
+
+
+def compress_file(method, data):
+    """Returns the decmpfs attribute value and the resource fork."""
+    if len(data) <= DECMPFS_CHUNK:
+        packed = compress_chunk(method, data)
+        if 16 + len(packed) <= DECMPFS_INLINE_MAX:
+            kind = DECMPFS_ZLIB_ATTR if method == 'zlib' else DECMPFS_LZVN_ATTR
+            return DECMPFS_MAGIC + struct.pack('<IQ', kind, len(data)) + packed, b''
+    chunks = [compress_chunk(method, data[i:i + DECMPFS_CHUNK])
+              for i in range(0, len(data), DECMPFS_CHUNK)]
+    if method == 'zlib':
+        kind, rsrc = DECMPFS_ZLIB_RSRC, resource_fork_zlib(chunks)
+    else:
+        kind, rsrc = DECMPFS_LZVN_RSRC, resource_fork_lzvn(chunks)
+    return DECMPFS_MAGIC + struct.pack('<IQ', kind, len(data)), rsrc
+
+
+def attribute_record(cnid, name, value):
+    u = utf16(name)
+    key = struct.pack('>HHIIH', 12 + len(u), 0, cnid, 0, len(u) // 2) + u
+    data = struct.pack('>IIII', ATTR_INLINE_DATA, 0, 0, len(value)) + value
+    if len(data) & 1:
+        data += b'\0'
+    return (cnid, [ord(c) for c in name]), key, data
+
+
+def node_bytes(nodesize, kind, height, records, flink=0, blink=0):
+    out = bytearray(nodesize)
+    struct.pack_into('>IIBBHH', out, 0, flink, blink, kind, height, len(records), 0)
+    pos = 14
+    for i, r in enumerate(records):
+        struct.pack_into('>H', out, nodesize - 2 * (i + 1), pos)
+        out[pos:pos + len(r)] = r
+        pos += len(r)
+    struct.pack_into('>H', out, nodesize - 2 * (len(records) + 1), pos)
+    return out
+
+
+def fits(nodesize, records):
+    return 14 + sum(len(r) for r in records) + 2 * (len(records) + 1) <= nodesize
+
+
+class BTree:
+    """Bottom-up B-tree writer for sorted (key bytes, data bytes) records."""
+
+    def __init__(self, nodesize, compare_type, attributes, max_key):
+        self.nodesize = nodesize
+        self.compare_type = compare_type
+        self.attributes = attributes
+        self.max_key = max_key
+
+    def build(self, records):
+        self.nodes = [None]     # node 0 is the header node
+        self.depth = 0
+        self.root = 0
+        self.first_leaf = self.last_leaf = 0
+        self.leaf_records = len(records)
+        level = [(k, k + d) for k, d in records]
+        kind, height = LEAF_NODE, 1
+        while level:
+            groups = [[]]
+            for key, rec in level:
+                if groups[-1] and not fits(self.nodesize, [r for _, r in groups[-1]] + [rec]):
+                    groups.append([])
+                groups[-1].append((key, rec))
+            first = len(self.nodes)
+            numbers = list(range(first, first + len(groups)))
+            for i, g in enumerate(groups):
+                flink = numbers[i + 1] if i + 1 < len(groups) else 0
+                blink = numbers[i - 1] if i > 0 else 0
+                self.nodes.append(node_bytes(self.nodesize, kind, height,
+                                             [r for _, r in g], flink, blink))
+            if kind == LEAF_NODE:
+                self.first_leaf, self.last_leaf = numbers[0], numbers[-1]
+            self.depth = height
+            if len(groups) == 1:
+                self.root = numbers[0]
+                break
+            level = [(g[0][0], g[0][0] + struct.pack('>I', n)) for g, n in zip(groups, numbers)]
+            kind, height = INDEX_NODE, height + 1
+        return self
+
+    def image(self, total_nodes):
+        header = struct.pack('>HIIIIHHIIHIBBI', self.depth, self.root, self.leaf_records,
+                             self.first_leaf, self.last_leaf, self.nodesize, self.max_key,
+                             total_nodes, total_nodes - len(self.nodes), 0,
+                             self.nodesize, 0, self.compare_type, self.attributes) + bytes(64)
+        map_len = self.nodesize - 14 - len(header) - 128 - 2 * 4
+        bitmap = bytearray(map_len)
+        for i in range(len(self.nodes)):
+            bitmap[i // 8] |= 0x80 >> (i % 8)
+        self.nodes[0] = node_bytes(self.nodesize, HEADER_NODE, 0, [header, bytes(128), bytes(bitmap)])
+        out = b''.join(bytes(n) for n in self.nodes)
+        return out.ljust(total_nodes * self.nodesize, b'\0')
+
+
+class Allocator:
+    def __init__(self, start):
+        self.next = start
+
+    def take(self, count, gap=0):
+        start = self.next
+        self.next += count + gap
+        return start
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Build an HFS+ image for the fsw host tests.')
+    ap.add_argument('--label', default='fswtest')
+    ap.add_argument('--nodesize', type=int, default=4096)
+    ap.add_argument('--fragment', type=int, default=4 * 1024 * 1024,
+                    help='split forks larger than this into many extents')
+    ap.add_argument('--compress', choices=('none', 'zlib', 'lzvn'), default='none',
+                    help='store files compressed with decmpfs')
+    ap.add_argument('source')
+    ap.add_argument('image')
+    args = ap.parse_args()
+
+    ids = itertools.count(FIRST_USER_ID)
+    root = build_tree(args.source, args.label, None, ids)
+    nodes = list(walk(root))
+    next_cnid = max(n.cnid for n in nodes) + 1
+
+    # catalog records: one folder or file record and one thread record per node
+    records = []
+    for n in nodes:
+        parent = n.parent.cnid if n.parent else ROOT_PARENT_ID
+        name = n.name if n.parent else args.label
+        records.append((catalog_sort_key(parent, name), catalog_key(parent, name), n, False))
+        records.append((catalog_sort_key(n.cnid, ''), catalog_key(n.cnid, ''), n, True))
+    records.sort(key=lambda r: r[0])
+
+    def catalog_records():
+        out = []
+        for _, key, n, thread in records:
+            if thread:
+                out.append((key, thread_record(n, args.label)))
+            else:
+                out.append((key, folder_record(n) if n.is_dir else file_record(n)))
+        return out
+
+    def new_catalog():
+        return BTree(args.nodesize, CASE_FOLDING, BIG_KEYS | VARIABLE_INDEX_KEYS, 516)
+
+    # compressed files keep their data in the decmpfs attribute or the
+    # resource fork; the data fork is empty
+    files = [n for n in nodes if not n.is_dir]
+    attributes = []
+    for f in files:
+        f.rsrc = b''
+        if args.compress != 'none' and f.size:
+            with open(f.path, 'rb') as src:
+                value, f.rsrc = compress_file(args.compress, src.read())
+            f.compressed = True
+            attributes.append(attribute_record(f.cnid, 'com.apple.decmpfs', value))
+    attributes.sort(key=lambda r: r[0])
+
+    # size the metadata files from a first pass with dummy extents
+    for f in files:
+        f.extents = [(0, 0)]
+        f.rsrc_extents = [(0, 0)] if f.rsrc else []
+    catalog_nodes = len(new_catalog().build(catalog_records()).nodes)
+    catalog_blocks = (catalog_nodes * args.nodesize + BLOCK - 1) // BLOCK * 2 + 4
+    extents_blocks = 64
+    attributes_tree = BTree(ATTRIBUTES_NODE, 0, BIG_KEYS | VARIABLE_INDEX_KEYS, 266).build(
+        [(k, d) for _, k, d in attributes])
+    attributes_blocks = (len(attributes_tree.nodes) * ATTRIBUTES_NODE + BLOCK - 1) // BLOCK if attributes else 0
+
+    forks = [(f, 0, f.data_length()) for f in files] + [(f, 0xff, len(f.rsrc)) for f in files]
+    data_blocks = sum((n + BLOCK - 1) // BLOCK for _, _, n in forks)
+    gaps = sum((n + BLOCK - 1) // BLOCK // 16 + 1 for _, _, n in forks if n > args.fragment)
+    total_blocks = (1 + 64 + extents_blocks + catalog_blocks + attributes_blocks
+                    + data_blocks + gaps + 16)
+    alloc_blocks = (total_blocks + 8 * BLOCK - 1) // (8 * BLOCK)
+    total_blocks += alloc_blocks
+
+    space = Allocator(1)
+    alloc_start = space.take(alloc_blocks)
+    extents_start = space.take(extents_blocks)
+    catalog_start = space.take(catalog_blocks)
+    attributes_start = space.take(attributes_blocks)
+
+    overflow = []
+    for f, fork, length in forks:
+        count = (length + BLOCK - 1) // BLOCK
+        if count == 0:
+            extents = []
+        elif length > args.fragment:
+            extents = []
+            left = count
+            while left:
+                run = min(16, left)
+                extents.append((space.take(run, gap=1), run))
+                left -= run
+            pos = sum(n for _, n in extents[:8])
+            for i in range(8, len(extents), 8):
+                group = extents[i:i + 8]
+                key = struct.pack('>HBBII', 10, fork, 0, f.cnid, pos)
+                data = b''.join(struct.pack('>II', s, n) for s, n in group)
+                overflow.append(((f.cnid, fork, pos), key, data.ljust(64, b'\0')))
+                pos += sum(n for _, n in group)
+        else:
+            extents = [(space.take(count), count)]
+        if fork:
+            f.rsrc_extents = extents
+        else:
+            f.extents = extents
+    used_blocks = space.next
+
+    catalog = new_catalog().build(catalog_records())
+    catalog_total = catalog_blocks * BLOCK // args.nodesize
+    if len(catalog.nodes) > catalog_total:
+        raise RuntimeError('catalog estimate too small')
+
+    overflow.sort(key=lambda r: r[0])
+    extents = BTree(BLOCK, 0, BIG_KEYS, 10).build([(k, d) for _, k, d in overflow])
+    extents_total = extents_blocks
+    if len(extents.nodes) > extents_total:
+        raise RuntimeError('too many overflow extents')
+
+    bitmap = bytearray(alloc_blocks * BLOCK)
+    used = [(0, 1), (alloc_start, alloc_blocks), (extents_start, extents_blocks),
+            (catalog_start, catalog_blocks), (attributes_start, attributes_blocks),
+            (total_blocks - 1, 1)]
+    used += [e for f in files for e in f.extents + f.rsrc_extents]
+    n_used = 0
+    for s, n in used:
+        for b in range(s, s + n):
+            bitmap[b // 8] |= 0x80 >> (b % 8)
+            n_used += 1
+
+    folders = sum(1 for n in nodes if n.is_dir) - 1
+    vh = struct.pack('>2sHIII', b'H+', 4, 1 << 8, 0x31302e30, 0)
+    vh += struct.pack('>IIII', DATE, DATE, 0, DATE)
+    vh += struct.pack('>II', len(files), folders)
+    vh += struct.pack('>IIIIIIII', BLOCK, total_blocks, total_blocks - n_used, used_blocks,
+                      BLOCK, BLOCK, next_cnid, 1)
+    vh += struct.pack('>Q', 1) + bytes(32)
+    vh += fork_data(alloc_blocks * BLOCK, [(alloc_start, alloc_blocks)])
+    vh += fork_data(extents_blocks * BLOCK, [(extents_start, extents_blocks)])
+    vh += fork_data(catalog_blocks * BLOCK, [(catalog_start, catalog_blocks)])
+    if attributes:
+        vh += fork_data(attributes_blocks * BLOCK, [(attributes_start, attributes_blocks)])
+    else:
+        vh += fork_data(0, [])
+    vh += fork_data(0, [])
+    assert len(vh) == 512
+
+    with open(args.image, 'wb') as img:
+        img.truncate(total_blocks * BLOCK)
+        img.seek(1024)
+        img.write(vh)
+        img.seek(total_blocks * BLOCK - 1024)
+        img.write(vh)
+        img.seek(alloc_start * BLOCK)
+        img.write(bitmap)
+        img.seek(extents_start * BLOCK)
+        img.write(extents.image(extents_total))
+        img.seek(catalog_start * BLOCK)
+        img.write(catalog.image(catalog_total))
+        if attributes:
+            img.seek(attributes_start * BLOCK)
+            img.write(attributes_tree.image(attributes_blocks * BLOCK // ATTRIBUTES_NODE))
+        for f in files:
+            if f.extents:
+                with open(f.path, 'rb') as src:
+                    for s, n in f.extents:
+                        img.seek(s * BLOCK)
+                        img.write(src.read(n * BLOCK))
+            pos = 0
+            for s, n in f.rsrc_extents:
+                img.seek(s * BLOCK)
+                img.write(f.rsrc[pos:pos + n * BLOCK])
+                pos += n * BLOCK
+
+
+if __name__ == '__main__':
+    main()
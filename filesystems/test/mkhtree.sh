@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# Generates ext3/ext4 images with a large hash-indexed directory for the
+# HTree lookup code in fsw_ext2.c / fsw_ext4.c.
+#
+# Usage: mkhtree.sh <output directory> [entries]
+#
+# Each image holds /many/e1 .. /many/e<entries> (default 10000). The
+# directories are re-indexed with e2fsck -D so they always carry an index,
+# and one image per hash algorithm is written. Run the results with e.g.
+#   build/ext4/dirlookup htree-ext4-1k.img /many e 10000
+#
+# Needs mke2fs, tune2fs and e2fsck from e2fsprogs.
+
+set -e
+
+OUT=${1:?usage: mkhtree.sh <output directory> [entries]}
+COUNT=${2:-10000}
+
+mkdir -p "$OUT"
+SRC=$(mktemp -d)
+trap 'rm -rf "$SRC"' EXIT
+
+mkdir "$SRC/many"
+i=1
+while [ $i -le $COUNT ]; do
+    : > "$SRC/many/e$i"
+    i=$((i + 1))
+done
+
+mkimage () {
+    # mkimage <name> <mke2fs type> <block size> <hash algorithm>
+    IMG="$OUT/htree-$1.img"
+    rm -f "$IMG"
+    mke2fs -q -F -t $2 -b $3 -N $((COUNT + 64)) -d "$SRC" "$IMG" 32M > /dev/null
+    tune2fs -E hash_alg=$4 "$IMG" > /dev/null
+    e2fsck -fyD "$IMG" > /dev/null 2>&1 || [ $? -le 1 ]
+    echo "$IMG"
+}
+
+mkimage ext3-1k       ext3 1024 half_md4
+mkimage ext4-1k       ext4 1024 half_md4
+mkimage ext4-4k       ext4 4096 half_md4
+mkimage ext4-1k-tea   ext4 1024 tea
+mkimage ext4-1k-legacy ext4 1024 legacy
@@ -0,0 +1,209 @@
+#!/usr/bin/env python3
+#
+# mkiso9660.py - build small ISO9660 images for the fsw_iso9660 host tests
+#
+# Writes an ISO9660 image holding the contents of a source directory, without
+# needing genisoimage or xorriso. Names are stored as Rock Ridge NM entries,
+# so they keep their case and length; the ISO9660 identifiers are derived
+# from them and only need to be unique. Symbolic links and special files are
+# skipped, the driver reads neither from Rock Ridge.
+#
+# Usage: mkiso9660.py [--label LABEL] <source directory> <image>
+#
+
+import argparse
+import os
+import stat
+import struct
+
+BLOCK = 2048
+SYSTEM_AREA_BLOCKS = 16
+
+
+def both16(v):
+    return struct.pack('<H', v) + struct.pack('>H', v)
+
+
+def both32(v):
+    return struct.pack('<I', v) + struct.pack('>I', v)
+
+
+DATE = bytes([126, 1, 1, 0, 0, 0, 0])   # 2026-01-01 00:00:00 UTC
+
+
+class Node:
+    def __init__(self, path, name, parent):
+        self.path = path
+        self.name = name
+        self.parent = parent
+        self.is_dir = os.path.isdir(path)
+        self.children = []
+        self.ident = b''
+        self.extent = 0
+        self.size = 0
+
+
+def build_tree(path, name='', parent=None):
+    node = Node(path, name, parent)
+    if node.is_dir:
+        used = set()
+        for entry in sorted(os.listdir(path)):
+            full = os.path.join(path, entry)
+            st = os.lstat(full)
+            if not (stat.S_ISDIR(st.st_mode) or stat.S_ISREG(st.st_mode)):
+                continue
+            child = build_tree(full, entry, node)
+            child.ident = iso_ident(entry, child.is_dir, used)
+            node.children.append(child)
+        node.children.sort(key=lambda c: c.ident)
+    else:
+        node.size = os.path.getsize(path)
+    return node
+
+
+def iso_ident(name, is_dir, used):
+    allowed = 'ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_'
+    base = ''.join(c if c in allowed else '_' for c in name.upper())[:24] or '_'
+    ident = base
+    n = 0
+    while ident in used:
+        n += 1
+        ident = '%s_%d' % (base[:24 - len(str(n)) - 1], n)
+    used.add(ident)
+    return ident.encode() if is_dir else (ident + '.;1').encode()
+
+
+def susp(node, special):
+    # PX first so that NM never starts the system use area, as mkisofs does
+    mode = (0o40555 if node.is_dir else 0o100444)
+    data = b'PX' + bytes([44, 1]) + both32(mode) + both32(1) + both32(0) + both32(0) + both32(0)
+    if special == 0:
+        name = node.name.encode()
+        data += b'NM' + bytes([5 + len(name), 1, 0]) + name
+    return data
+
+
+def dirrec(node, ident, special=None, sp=False):
+    sua = b''
+    if sp:
+        sua += b'SP' + bytes([7, 1, 0xbe, 0xef, 0])
+    sua += susp(node, 0 if special is None else special)
+    length = 33 + len(ident)
+    pad = b'\0' if length % 2 else b''
+    length += len(pad) + len(sua)
+    if length % 2:
+        sua += b'\0'
+        length += 1
+    flags = 2 if node.is_dir else 0
+    return (bytes([length, 0]) + both32(node.extent) + both32(node.size) + DATE
+            + bytes([flags, 0, 0]) + both16(1) + bytes([len(ident)]) + ident + pad + sua)
+
+
+def dir_records(node):
+    parent = node.parent or node
+    recs = [dirrec(node, b'\0', special=1, sp=node.parent is None),
+            dirrec(parent, b'\1', special=2)]
+    recs += [dirrec(c, c.ident) for c in node.children]
+    return recs
+
+
+def dir_size(node):
+    # records may not cross a block boundary
+    used = 0
+    for r in dir_records(node):
+        if used % BLOCK + len(r) > BLOCK:
+            used += BLOCK - used % BLOCK
+        used += len(r)
+    return (used + BLOCK - 1) // BLOCK * BLOCK
+
+
+def walk(node):
+    yield node
+    for c in node.children:
+        if c.is_dir:
+            yield from walk(c)
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Build an ISO9660 image for the fsw host tests.')
+    ap.add_argument('--label', default='FSWTEST')
+    ap.add_argument('source')
+    ap.add_argument('image')
+    args = ap.parse_args()
+
+    root = build_tree(args.source)
+    dirs = list(walk(root))
+
+    # layout: system area, PVD, terminator, L and M path tables, directories, files
+    path_table = b''
+    numbers = {}
+    for i, d in enumerate(dirs):
+        numbers[id(d)] = i + 1
+    next_block = SYSTEM_AREA_BLOCKS + 2 + 2
+    for d in dirs:
+        d.size = dir_size(d)
+        d.extent = next_block
+        next_block += d.size // BLOCK
+    files = [c for d in dirs for c in d.children if not c.is_dir]
+    for f in files:
+        f.extent = next_block if f.size else 0
+        next_block += (f.size + BLOCK - 1) // BLOCK
+    total_blocks = next_block
+
+    def table(fmt32, fmt16):
+        out = b''
+        for d in dirs:
+            ident = d.ident if d.parent else b'\0'
+            parent = numbers[id(d.parent)] if d.parent else 1
+            out += bytes([len(ident), 0]) + struct.pack(fmt32, d.extent) + struct.pack(fmt16, parent) + ident
+            if len(ident) % 2:
+                out += b'\0'
+        return out
+    l_table = table('<I', '<H')
+    m_table = table('>I', '>H')
+
+    with open(args.image, 'wb') as img:
+        img.truncate(total_blocks * BLOCK)
+
+        pvd = bytearray(BLOCK)
+        pvd[0:8] = b'\x01CD001\x01\x00'
+        pvd[8:40] = b' ' * 32
+        pvd[40:72] = args.label.encode()[:32].ljust(32)
+        pvd[80:88] = both32(total_blocks)
+        pvd[120:124] = both16(1)
+        pvd[124:128] = both16(1)
+        pvd[128:132] = both16(BLOCK)
+        pvd[132:140] = both32(len(l_table))
+        pvd[140:144] = struct.pack('<I', SYSTEM_AREA_BLOCKS + 2)
+        pvd[148:152] = struct.pack('>I', SYSTEM_AREA_BLOCKS + 3)
+        rootrec = dirrec(root, b'\0', special=1)[:34]
+        rootrec = bytes([34]) + rootrec[1:]
+        pvd[156:190] = rootrec
+        pvd[190:813] = b' ' * 623
+        for off in (813, 830, 847, 864):
+            pvd[off:off + 17] = b'2026010100000000\0'
+        pvd[881] = 1
+        img.seek(SYSTEM_AREA_BLOCKS * BLOCK)
+        img.write(pvd)
+        img.write(b'\xffCD001\x01'.ljust(BLOCK, b'\0'))
+        img.write(l_table.ljust(BLOCK, b'\0'))
+        img.write(m_table.ljust(BLOCK, b'\0'))
+
+        for d in dirs:
+            data = bytearray()
+            for r in dir_records(d):
+                if len(data) % BLOCK + len(r) > BLOCK:
+                    data += b'\0' * (BLOCK - len(data) % BLOCK)
+                data += r
+            img.seek(d.extent * BLOCK)
+            img.write(bytes(data).ljust(d.size, b'\0'))
+
+        for f in files:
+            if f.size:
+                img.seek(f.extent * BLOCK)
+                with open(f.path, 'rb') as src:
+                    img.write(src.read())
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,537 @@
+#!/usr/bin/env python3
+#
+# mkntfs.py - build small NTFS images for the fsw_ntfs host tests
+#
+# Writes an NTFS 3.1 image holding the contents of a source directory,
+# without needing mkntfs or a mount. Only what the read-only driver looks at
+# is filled in properly: boot sector, $MFT and $MFTMirr, $Volume, $UpCase,
+# and per file the standard information, file name and data attributes.
+# Directories get $I30 indexes built as a B-tree of 4 KiB INDX blocks, so
+# large directories have an index of some depth. There is no $LogFile
+# content, no security descriptors and no DOS (8.3) names.
+#
+# Clusters are 4 KiB by default; with --cluster 512 every 1 KiB MFT record
+# spans two clusters. Files that fit are stored resident in their MFT record.
+# Files larger than --fragment bytes are split into 16 cluster runs with a
+# gap between them; their run lists do not fit one record, so they are
+# spread over extension records found through an $ATTRIBUTE_LIST, as
+# Windows does for badly fragmented files. Names are collated with the same
+# $UpCase table that is written to the image. Symbolic links and special
+# files are skipped.
+#
+# Usage: mkntfs.py [options] <source directory> <image>
+#
+
+import argparse
+import os
+import stat
+import struct
+
+SECTOR = 512
+CLUSTER = 4096
+RECORD = 1024
+INDEX_BLOCK = 4096
+NTFS_EPOCH_OFFSET = 11644473600
+DATE = (1767225600 + NTFS_EPOCH_OFFSET) * 10000000   # 2026-01-01 00:00:00 UTC
+
+MFT, MFTMIRR, LOGFILE, VOLUME, ATTRDEF, ROOT = 0, 1, 2, 3, 4, 5
+BITMAP, BOOT, BADCLUS, SECURE, UPCASE, EXTEND = 6, 7, 8, 9, 10, 11
+FIRST_USER_RECORD = 24
+
+AT_STANDARD_INFORMATION = 0x10
+AT_ATTRIBUTE_LIST = 0x20
+AT_FILE_NAME = 0x30
+AT_VOLUME_NAME = 0x60
+AT_VOLUME_INFORMATION = 0x70
+AT_DATA = 0x80
+AT_INDEX_ROOT = 0x90
+AT_INDEX_ALLOCATION = 0xa0
+AT_BITMAP = 0xb0
+AT_END = 0xffffffff
+
+SYSTEM_FILES = [(MFT, '$MFT'), (MFTMIRR, '$MFTMirr'), (LOGFILE, '$LogFile'),
+                (VOLUME, '$Volume'), (ATTRDEF, '$AttrDef'), (ROOT, '.'), (BITMAP, '$Bitmap'),
+                (BOOT, '$Boot'), (BADCLUS, '$BadClus'), (SECURE, '$Secure'),
+                (UPCASE, '$UpCase'), (EXTEND, '$Extend')]
+
+RECORD_IN_USE = 0x1
+RECORD_IS_DIRECTORY = 0x2
+
+FILE_ATTRIBUTE_HIDDEN = 0x2
+FILE_ATTRIBUTE_SYSTEM = 0x4
+FILE_ATTRIBUTE_ARCHIVE = 0x20
+FILE_NAME_INDEX_PRESENT = 0x10000000    # directory flag in $FILE_NAME
+
+WIN32_NAMESPACE = 1
+INDEX_ENTRY_NODE = 0x1
+INDEX_ENTRY_END = 0x2
+LARGE_INDEX = 0x1
+COLLATION_FILE_NAME = 1
+
+RUN = 16                    # clusters per run of a fragmented file
+RUNS_PER_RECORD = 64        # runs per $DATA piece of a fragmented file
+
+
+def align8(n):
+    return (n + 7) & ~7
+
+
+def utf16(name):
+    return name.encode('utf-16-le')
+
+
+def ref(record):
+    return record | 1 << 48     # every record keeps sequence number 1
+
+
+def upcase_table():
+    table = []
+    for c in range(0x10000):
+        u = chr(c).upper() if not 0xd800 <= c < 0xe000 else chr(c)
+        table.append(ord(u) if len(u) == 1 and ord(u) < 0x10000 else c)
+    return table
+
+
+UPCASE_TABLE = upcase_table()
+
+
+def collate(name):
+    u = utf16(name)
+    return [UPCASE_TABLE[c] for c in struct.unpack('<%dH' % (len(u) // 2), u)]
+
+
+class Node:
+    def __init__(self, path, name, parent, record):
+        self.path = path
+        self.name = name
+        self.parent = parent
+        self.record = record
+        self.is_dir = os.path.isdir(path) if path else True
+        self.children = []
+        self.size = 0
+        self.runs = []
+        self.extension = []     # (record, first vcn, runs) per $DATA piece
+        self.list_runs = []     # non-resident $ATTRIBUTE_LIST
+        self.index = None
+
+
+def build_tree(path, name, parent, records):
+    node = Node(path, name, parent, next(records) if parent else ROOT)
+    if node.is_dir:
+        for entry in sorted(os.listdir(path)):
+            full = os.path.join(path, entry)
+            st = os.lstat(full)
+            if stat.S_ISDIR(st.st_mode) or stat.S_ISREG(st.st_mode):
+                node.children.append(build_tree(full, entry, node, records))
+        node.children.sort(key=lambda c: collate(c.name))
+    else:
+        node.size = os.path.getsize(path)
+    return node
+
+
+def walk(node):
+    yield node
+    for c in node.children:
+        yield from walk(c)
+
+
+def signed(v):
+    n = 1
+    while not -(1 << (8 * n - 1)) <= v < 1 << (8 * n - 1):
+        n += 1
+    return v.to_bytes(n, 'little', signed=True)
+
+
+def mapping_pairs(runs):
+    out = bytearray()
+    prev = 0
+    for lcn, count in runs:
+        length = signed(count)
+        delta = signed(lcn - prev)
+        out.append(len(delta) << 4 | len(length))
+        out += length + delta
+        prev = lcn
+    out.append(0)
+    return bytes(out)
+
+
+def resident(kind, value, name='', attr_id=0, indexed=0):
+    n = utf16(name)
+    value_off = align8(0x18 + len(n))
+    out = struct.pack('<IIBBHHHIHBB', kind, align8(value_off + len(value)), 0, len(n) // 2,
+                      0x18, 0, attr_id, len(value), value_off, indexed, 0)
+    return (out + n).ljust(value_off, b'\0') + value.ljust(align8(len(value)), b'\0')
+
+
+def nonresident(kind, runs, first_vcn, size, name='', attr_id=0):
+    """$DATA style attribute record for one piece of a run list. Only the
+    first piece carries the sizes, as on Windows."""
+    n = utf16(name)
+    pairs = mapping_pairs(runs)
+    pairs_off = align8(0x40 + len(n))
+    last_vcn = first_vcn + sum(c for _, c in runs) - 1
+    alloc = (size + CLUSTER - 1) // CLUSTER * CLUSTER if first_vcn == 0 else 0
+    size = size if first_vcn == 0 else 0
+    out = struct.pack('<IIBBHHHQQHHIQQQ', kind, align8(pairs_off + len(pairs)), 1, len(n) // 2,
+                      0x40, 0, attr_id, first_vcn, last_vcn, pairs_off, 0, 0,
+                      alloc, size, size)
+    return (out + n).ljust(pairs_off, b'\0') + pairs.ljust(align8(len(pairs)), b'\0')
+
+
+def standard_information(attributes=0):
+    return struct.pack('<QQQQIIII', DATE, DATE, DATE, DATE, attributes, 0, 0, 0)
+
+
+def file_name(node, parent_record, name=None):
+    name = node.name if name is None else name
+    n = utf16(name)
+    flags = FILE_NAME_INDEX_PRESENT if node.is_dir else FILE_ATTRIBUTE_ARCHIVE
+    alloc = 0 if node.is_dir else (node.size + CLUSTER - 1) // CLUSTER * CLUSTER
+    size = 0 if node.is_dir else node.size
+    return struct.pack('<QQQQQQQIIBB', ref(parent_record), DATE, DATE, DATE, DATE,
+                       alloc, size, flags, 0, len(n) // 2, WIN32_NAMESPACE) + n
+
+
+def record_bytes(number, attributes, flags, base=0):
+    """One MFT record with its update sequence array applied."""
+    out = bytearray(RECORD)
+    sectors = RECORD // SECTOR
+    first = align8(0x30 + 2 * (sectors + 1))
+    body = b''.join(attributes) + struct.pack('<I', AT_END)
+    used = align8(first + len(body))
+    if used > RECORD:
+        raise RuntimeError('MFT record %d overflows' % number)
+    struct.pack_into('<4sHHQHHHHIIQHHI', out, 0, b'FILE', 0x30, sectors + 1, 0, 1, 1,
+                     first, RECORD_IN_USE | flags, used, RECORD, ref(base) if base else 0,
+                     len(attributes) + 1, 0, number)
+    out[first:first + len(body)] = body
+    return fixup(out, 0x30, 1)
+
+
+def fixup(out, usa_off, usn):
+    struct.pack_into('<H', out, usa_off, usn)
+    for i in range(1, len(out) // SECTOR + 1):
+        end = i * SECTOR
+        out[usa_off + 2 * i:usa_off + 2 * i + 2] = out[end - 2:end]
+        struct.pack_into('<H', out, end - 2, usn)
+    return bytes(out)
+
+
+def record_size(attributes):
+    return align8(0x30 + 2 * (RECORD // SECTOR + 1)) + sum(len(a) for a in attributes) + 8
+
+
+def index_entry(key, child=None):
+    """key is (record, $FILE_NAME value) or None for the end entry."""
+    flags = 0 if key else INDEX_ENTRY_END
+    if child is not None:
+        flags |= INDEX_ENTRY_NODE
+    value = key[1] if key else b''
+    length = align8(0x10 + len(value)) + (8 if child is not None else 0)
+    out = struct.pack('<QHHI', ref(key[0]) if key else 0, length, len(value), flags) + value
+    out = out.ljust(length - (8 if child is not None else 0), b'\0')
+    if child is not None:
+        out += struct.pack('<Q', child * (INDEX_BLOCK // CLUSTER))
+    return out
+
+
+def index_entries(keys, children):
+    out = b''.join(index_entry(k, c) for k, c in zip(keys, children))
+    return out + index_entry(None, children[-1])
+
+
+def index_header(entries, allocated, children):
+    flags = LARGE_INDEX if children[-1] is not None else 0
+    return struct.pack('<IIIB3x', 0x10, 0x10 + len(entries), allocated, flags)
+
+
+INDX_ENTRIES = align8(0x28 + 2 * (INDEX_BLOCK // SECTOR + 1))
+
+
+def indx_block(vcn, keys, children):
+    entries = index_entries(keys, children)
+    out = bytearray(INDEX_BLOCK)
+    struct.pack_into('<4sHHQQ', out, 0, b'INDX', 0x28, INDEX_BLOCK // SECTOR + 1, 0,
+                     vcn * (INDEX_BLOCK // CLUSTER))
+    flags = LARGE_INDEX if children[-1] is not None else 0
+    struct.pack_into('<IIIB', out, 0x18, INDX_ENTRIES - 0x18,
+                     INDX_ENTRIES - 0x18 + len(entries), INDEX_BLOCK - 0x18, flags)
+    out[INDX_ENTRIES:INDX_ENTRIES + len(entries)] = entries
+    return fixup(out, 0x28, 1)
+
+
+def build_index(keys, root_fits):
+    """B-tree of $I30 entries, built bottom up. Blocks are filled in key
+    order; the entry that does not fit a block any more moves up a level.
+    Returns the keys and children of the root and the INDX blocks."""
+    blocks = []
+    children = [None] * (len(keys) + 1)
+    while not root_fits(keys, children):
+        up_keys, up_children = [], []
+        cur_keys, cur_children = [], [children[0]]
+        for k, c in zip(keys, children[1:]):
+            if cur_keys and len(index_entries(cur_keys + [k], cur_children + [c])) > INDEX_BLOCK - INDX_ENTRIES:
+                up_children.append(len(blocks))
+                up_keys.append(k)
+                blocks.append((cur_keys, cur_children))
+                cur_keys, cur_children = [], [c]
+            else:
+                cur_keys.append(k)
+                cur_children.append(c)
+        up_children.append(len(blocks))
+        blocks.append((cur_keys, cur_children))
+        keys, children = up_keys, up_children
+    return keys, children, [indx_block(vcn, k, c) for vcn, (k, c) in enumerate(blocks)]
+
+
+def index_root(keys, children):
+    entries = index_entries(keys, children)
+    return (struct.pack('<IIIB3x', AT_FILE_NAME, COLLATION_FILE_NAME, INDEX_BLOCK,
+                        INDEX_BLOCK // CLUSTER)
+            + index_header(entries, 0x10 + len(entries), children) + entries)
+
+
+def directory_attributes(keys, children, index_runs, blocks):
+    out = [resident(AT_INDEX_ROOT, index_root(keys, children), '$I30', 3)]
+    if blocks:
+        out.append(nonresident(AT_INDEX_ALLOCATION, index_runs, 0, blocks * INDEX_BLOCK, '$I30', 4))
+        bitmap = bytearray(align8((blocks + 7) // 8))
+        for b in range(blocks):
+            bitmap[b // 8] |= 1 << (b % 8)
+        out.append(resident(AT_BITMAP, bytes(bitmap), '$I30', 5))
+    return out
+
+
+def attribute_list_entry(kind, first_vcn, record, attr_id, name=''):
+    n = utf16(name)
+    length = align8(0x1a + len(n))
+    return struct.pack('<IHBBQQH', kind, length, len(n) // 2, 0x1a, first_vcn,
+                       ref(record), attr_id).ljust(0x1a, b'\0') + n.ljust(length - 0x1a, b'\0')
+
+
+def attribute_list(f):
+    entries = [attribute_list_entry(AT_STANDARD_INFORMATION, 0, f.record, 0),
+               attribute_list_entry(AT_FILE_NAME, 0, f.record, 1)]
+    entries += [attribute_list_entry(AT_DATA, vcn, r, 3 if r == f.record else 0)
+                for r, vcn, _ in f.extension]
+    return b''.join(entries)
+
+
+class Allocator:
+    def __init__(self, start):
+        self.next = start
+
+    def take(self, count, gap=0):
+        start = self.next
+        self.next += count + gap
+        return start
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Build an NTFS image for the fsw host tests.')
+    ap.add_argument('--label', default='fswtest')
+    ap.add_argument('--cluster', type=int, choices=(512, 1024, 2048, 4096), default=4096,
+                    help='cluster size; below 1024 MFT records span clusters')
+    ap.add_argument('--fragment', type=int, default=4 * 1024 * 1024,
+                    help='split files larger than this into many runs')
+    ap.add_argument('source')
+    ap.add_argument('image')
+    args = ap.parse_args()
+    global CLUSTER
+    CLUSTER = args.cluster
+
+    records = iter(range(FIRST_USER_RECORD, 1 << 32))
+    root = build_tree(args.source, '.', None, records)
+    nodes = list(walk(root))
+    files = [n for n in nodes if not n.is_dir]
+    dirs = [n for n in nodes if n.is_dir]
+    next_record = max(n.record for n in nodes) + 1
+
+    def base_attributes(node):
+        return [resident(AT_STANDARD_INFORMATION, standard_information(), attr_id=0),
+                resident(AT_FILE_NAME, file_name(node, node.parent.record if node.parent else ROOT),
+                         attr_id=1, indexed=1)]
+
+    # file data: resident if it fits the record, else one run, or short runs
+    # spread over extension records for files above --fragment
+    # $Boot takes the first 8 KiB, $MFTMirr the next 4 KiB
+    boot_clusters = 0x2000 // CLUSTER
+    mirror_clusters = 4 * RECORD // CLUSTER
+    space = Allocator(boot_clusters + mirror_clusters)
+    data = {}
+    for f in files:
+        with open(f.path, 'rb') as src:
+            content = src.read()
+        if record_size(base_attributes(f) + [resident(AT_DATA, content, attr_id=2)]) <= RECORD:
+            data[f.record] = content
+            continue
+        count = (f.size + CLUSTER - 1) // CLUSTER
+        if f.size > args.fragment:
+            left = count
+            while left:
+                run = min(RUN, left)
+                f.runs.append((space.take(run, gap=1), run))
+                left -= run
+            vcn = 0
+            for i in range(0, len(f.runs), RUNS_PER_RECORD):
+                piece = f.runs[i:i + RUNS_PER_RECORD]
+                f.extension.append((next_record if i else f.record, vcn, piece))
+                next_record += 1 if i else 0
+                vcn += sum(c for _, c in piece)
+            # long attribute lists move out of the record, as on Windows
+            listing = attribute_list(f)
+            if record_size(base_attributes(f) + [resident(AT_ATTRIBUTE_LIST, listing),
+                                                 nonresident(AT_DATA, f.runs[:RUNS_PER_RECORD], 0, f.size)]) > RECORD:
+                count = (len(listing) + CLUSTER - 1) // CLUSTER
+                f.list_runs = [(space.take(count), count)]
+        else:
+            f.runs = [(space.take(count), count)]
+
+    # directory indexes; the root also lists the system files, which the
+    # driver has to skip. Whether the index root fits its record is decided
+    # assuming a worst case single run for the allocation
+    system_nodes = []
+    for number, name in SYSTEM_FILES:
+        node = Node(None, name, None, number)
+        node.is_dir = number == EXTEND
+        system_nodes.append(node)
+    index_runs = {}
+    for d in dirs:
+        keys = [(c.record, file_name(c, d.record)) for c in d.children]
+        if d is root:
+            keys = sorted(keys + [(s.record, file_name(s, ROOT)) for s in system_nodes],
+                          key=lambda k: collate(k[1][0x42:].decode('utf-16-le')))
+        base = base_attributes(d)
+
+        def root_fits(keys, children):
+            attrs = base + directory_attributes(keys, children, [(1 << 40, 1 << 24)], 1)
+            return record_size(attrs) <= RECORD
+
+        d.index = build_index(keys, root_fits)
+        blocks = len(d.index[2])
+        if blocks:
+            index_runs[d.record] = [(space.take(blocks * INDEX_BLOCK // CLUSTER),
+                                     blocks * INDEX_BLOCK // CLUSTER)]
+
+    upcase_clusters = 0x20000 // CLUSTER
+    upcase_start = space.take(upcase_clusters)
+    mft_records = (next_record + 7) // 8 * 8
+    mft_clusters = mft_records * RECORD // CLUSTER
+    mft_start = space.take(mft_clusters)
+    mft_bitmap_clusters = (mft_records + 8 * CLUSTER - 1) // (8 * CLUSTER)
+    mft_bitmap_start = space.take(mft_bitmap_clusters)
+    bitmap_clusters = 1
+    while (space.next + bitmap_clusters + 1 + 8 * CLUSTER - 1) // (8 * CLUSTER) > bitmap_clusters:
+        bitmap_clusters += 1
+    bitmap_start = space.take(bitmap_clusters)
+    total_clusters = space.next + 1     # the last cluster holds the backup boot sector
+
+    mft = bytearray(mft_records * RECORD)
+
+    def put(number, attributes, flags=0, base=0):
+        mft[number * RECORD:(number + 1) * RECORD] = record_bytes(number, attributes, flags, base)
+
+    def system(number, extra):
+        node = system_nodes[number]
+        put(number, [resident(AT_STANDARD_INFORMATION,
+                              standard_information(FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM)),
+                     resident(AT_FILE_NAME, file_name(node, ROOT), attr_id=1, indexed=1)] + extra,
+            RECORD_IS_DIRECTORY if node.is_dir else 0)
+
+    mft_bitmap = bytearray(mft_bitmap_clusters * CLUSTER)
+    for r in list(range(len(SYSTEM_FILES))) + list(range(FIRST_USER_RECORD, next_record)):
+        mft_bitmap[r // 8] |= 1 << (r % 8)
+    label = utf16(args.label)
+    system(MFT, [nonresident(AT_DATA, [(mft_start, mft_clusters)], 0, len(mft), attr_id=2),
+                 nonresident(AT_BITMAP, [(mft_bitmap_start, mft_bitmap_clusters)], 0,
+                             (mft_records + 7) // 8, attr_id=3)])
+    system(MFTMIRR, [nonresident(AT_DATA, [(boot_clusters, mirror_clusters)], 0, 4 * RECORD,
+                                             attr_id=2)])
+    system(LOGFILE, [resident(AT_DATA, b'', attr_id=2)])
+    system(VOLUME, [resident(AT_VOLUME_NAME, label, attr_id=2),
+                    resident(AT_VOLUME_INFORMATION, struct.pack('<QBBH', 0, 3, 1, 0), attr_id=3),
+                    resident(AT_DATA, b'', attr_id=4)])
+    system(ATTRDEF, [resident(AT_DATA, b'', attr_id=2)])
+    system(BITMAP, [nonresident(AT_DATA, [(bitmap_start, bitmap_clusters)], 0,
+                                (total_clusters + 7) // 8, attr_id=2)])
+    system(BOOT, [nonresident(AT_DATA, [(0, boot_clusters)], 0, 0x2000, attr_id=2)])
+    system(BADCLUS, [resident(AT_DATA, b'', attr_id=2)])
+    system(SECURE, [])
+    system(UPCASE, [nonresident(AT_DATA, [(upcase_start, upcase_clusters)], 0, 0x20000, attr_id=2)])
+    system(EXTEND, directory_attributes([], [None], [], 0))
+
+    for d in dirs:
+        keys, children, blocks = d.index
+        put(d.record, base_attributes(d) + directory_attributes(keys, children, index_runs.get(d.record, []),
+                                                                len(blocks)), RECORD_IS_DIRECTORY)
+
+    for f in files:
+        attrs = base_attributes(f)
+        if f.record in data:
+            put(f.record, attrs + [resident(AT_DATA, data[f.record], attr_id=2)])
+        elif len(f.extension) > 1:
+            listing = attribute_list(f)
+            if f.list_runs:
+                listing = nonresident(AT_ATTRIBUTE_LIST, f.list_runs, 0, len(listing), attr_id=2)
+            else:
+                listing = resident(AT_ATTRIBUTE_LIST, listing, attr_id=2)
+            first = f.extension[0]
+            put(f.record, attrs[:1] + [listing] + attrs[1:]
+                + [nonresident(AT_DATA, first[2], 0, f.size, attr_id=3)])
+            for r, vcn, piece in f.extension[1:]:
+                put(r, [nonresident(AT_DATA, piece, vcn, f.size)], base=f.record)
+        else:
+            put(f.record, attrs + [nonresident(AT_DATA, f.runs, 0, f.size, attr_id=2)])
+
+    used = [(0, boot_clusters + mirror_clusters), (upcase_start, upcase_clusters), (mft_start, mft_clusters),
+            (mft_bitmap_start, mft_bitmap_clusters),
+            (bitmap_start, bitmap_clusters), (total_clusters - 1, 1)]
+    used += [r for f in files for r in f.runs + f.list_runs] + [r for runs in index_runs.values() for r in runs]
+    bitmap = bytearray(bitmap_clusters * CLUSTER)
+    for s, n in used:
+        for c in range(s, s + n):
+            bitmap[c // 8] |= 1 << (c % 8)
+
+    boot = bytearray(SECTOR)
+    struct.pack_into('<3s8sHBHBHHBHHHII', boot, 0, b'\xeb\x52\x90', b'NTFS    ', SECTOR,
+                     CLUSTER // SECTOR, 0, 0, 0, 0, 0xf8, 0, 63, 255, 0, 0)
+    struct.pack_into('<IQQQbxxxbxxxQ', boot, 0x24, 0x800080, total_clusters * CLUSTER // SECTOR - 1,
+                     mft_start, boot_clusters,
+                     RECORD // CLUSTER if RECORD >= CLUSTER else -RECORD.bit_length() + 1,
+                     INDEX_BLOCK // CLUSTER, 0x2026010100000000)
+    boot[0x1fe:0x200] = b'\x55\xaa'
+
+    upcase = struct.pack('<65536H', *UPCASE_TABLE)
+
+    with open(args.image, 'wb') as img:
+        img.truncate(total_clusters * CLUSTER)
+        img.write(boot)
+        img.seek(total_clusters * CLUSTER - SECTOR)
+        img.write(boot)
+        img.seek(boot_clusters * CLUSTER)
+        img.write(mft[:4 * RECORD])
+        img.seek(mft_start * CLUSTER)
+        img.write(mft)
+        img.seek(mft_bitmap_start * CLUSTER)
+        img.write(mft_bitmap)
+        img.seek(upcase_start * CLUSTER)
+        img.write(upcase)
+        img.seek(bitmap_start * CLUSTER)
+        img.write(bitmap)
+        for d in dirs:
+            if d.record in index_runs:
+                img.seek(index_runs[d.record][0][0] * CLUSTER)
+                img.write(b''.join(d.index[2]))
+        for f in files:
+            if f.list_runs:
+                img.seek(f.list_runs[0][0] * CLUSTER)
+                img.write(attribute_list(f))
+            if f.runs:
+                with open(f.path, 'rb') as src:
+                    for s, n in f.runs:
+                        img.seek(s * CLUSTER)
+                        img.write(src.read(n * CLUSTER))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,332 @@
+#!/usr/bin/env python3
+#
+# mkreiserfs.py - build small ReiserFS images for the fsw_reiserfs host tests
+#
+# Writes a ReiserFS 3.6 image holding the contents of a source directory,
+# without needing reiserfsprogs or a mount. Only what the read-only driver
+# looks at is filled in properly: the superblock and the S+tree with stat
+# data, directory, direct and indirect items. The journal area is reserved
+# but empty and only the first bitmap block is written, so the images are
+# not meant to be mounted read-write by Linux.
+#
+# As with mkreiserfs, directory items use 3.5 keys with R5 hashed entry
+# offsets and everything else uses 3.6 keys. Files up to --tail bytes are
+# stored in a direct item; larger ones in unformatted blocks listed by
+# indirect items. Files larger than --fragment bytes get their blocks in
+# 16 block runs with a gap between them, so that consecutive pointers of an
+# indirect item are not always contiguous.
+#
+# Usage: mkreiserfs.py [options] <source directory> <image>
+#
+
+import argparse
+import os
+import stat
+import struct
+
+BLOCK = 4096
+SUPERBLOCK_BLOCK = 16           # 64 KiB into the device
+BITMAP_BLOCK = 17
+JOURNAL_BLOCK = 18
+JOURNAL_SIZE = 8192
+RUN = 16                        # blocks per run of a fragmented file
+
+BLKH_SIZE = 24
+IH_SIZE = 24
+KEY_SIZE = 16
+DC_SIZE = 8
+DEH_SIZE = 16
+SD_SIZE = 44
+
+TYPE_STAT_DATA = 0
+TYPE_INDIRECT = 1
+TYPE_DIRECT = 2
+TYPE_DIRENTRY = 3
+V1_DIRENTRY_UNIQUENESS = 500
+KEY_FORMAT_3_5 = 0
+KEY_FORMAT_3_6 = 1
+
+DOT_OFFSET = 1
+DOT_DOT_OFFSET = 2
+DEH_VISIBLE = 1 << 2
+R5_HASH = 3
+
+ROOT_PARENT_OBJECTID = 1
+ROOT_OBJECTID = 2
+FIRST_OBJECTID = 100
+
+MAX_ITEM = BLOCK - BLKH_SIZE - IH_SIZE
+MAX_POINTERS = MAX_ITEM // 4
+
+
+def r5_hash(name):
+    a = 0
+    for b in name:
+        c = b - 256 if b >= 128 else b
+        a = (a + (c << 4)) & 0xffffffff
+        a = (a + (c >> 4)) & 0xffffffff
+        a = (a * 11) & 0xffffffff
+    return a
+
+
+def key_v1(dir_id, objectid, offset, uniqueness):
+    return struct.pack('<IIII', dir_id, objectid, offset, uniqueness)
+
+
+def key_v2(dir_id, objectid, offset, type_):
+    return struct.pack('<IIQ', dir_id, objectid, type_ << 60 | offset)
+
+
+class Node:
+    def __init__(self, path, name, parent, objectid):
+        self.path = path
+        self.name = name
+        self.parent = parent
+        self.objectid = objectid
+        self.st = os.lstat(path)
+        self.is_dir = stat.S_ISDIR(self.st.st_mode)
+        self.children = []
+        self.blocks = []
+
+    @property
+    def dir_id(self):
+        return self.parent.objectid if self.parent else ROOT_PARENT_OBJECTID
+
+
+def build_tree(path, name, parent, oids):
+    node = Node(path, name, parent, next(oids) if parent else ROOT_OBJECTID)
+    if node.is_dir:
+        for entry in sorted(os.listdir(path)):
+            full = os.path.join(path, entry)
+            mode = os.lstat(full).st_mode
+            if stat.S_ISDIR(mode) or stat.S_ISREG(mode) or stat.S_ISLNK(mode):
+                node.children.append(build_tree(full, entry, node, oids))
+    return node
+
+
+def walk(node):
+    yield node
+    for c in node.children:
+        yield from walk(c)
+
+
+def contents(node):
+    if stat.S_ISLNK(node.st.st_mode):
+        return os.readlink(node.path).encode()
+    with open(node.path, 'rb') as f:
+        return f.read()
+
+
+def stat_data(mode, nlink, size, blocks, mtime):
+    return struct.pack('<HHIQIIIIIII', mode, 0, nlink, size, 0, 0,
+                       mtime, mtime, mtime, blocks, 0)
+
+
+def directory_items(node):
+    """Directory entries sorted by hash, cut into items that fit a leaf."""
+    entries = [(DOT_OFFSET, node.dir_id, node.objectid, b'.'),
+               (DOT_DOT_OFFSET, node.parent.dir_id if node.parent else 0,
+                node.dir_id, b'..')]
+    used = set()
+    for c in node.children:
+        name = os.fsencode(c.name)
+        offset = r5_hash(name) & 0x7fffff80 or 128
+        while offset in used:           # generation number in the low bits
+            offset += 1
+        used.add(offset)
+        entries.append((offset, node.objectid, c.objectid, name))
+    entries.sort()
+
+    items = []
+    cur = []
+    size = 0
+    for e in entries:
+        need = DEH_SIZE + (len(e[3]) + 7) // 8 * 8
+        if cur and size + need > MAX_ITEM:
+            items.append(cur)
+            cur, size = [], 0
+        cur.append(e)
+        size += need
+    items.append(cur)
+
+    out = []
+    for entries in items:
+        names = [name.ljust((len(name) + 7) // 8 * 8, b'\0') for _, _, _, name in entries]
+        heads = bytearray()
+        location = DEH_SIZE * len(entries) + sum(len(n) for n in names)
+        for (offset, dir_id, objectid, _), name in zip(entries, names):
+            location -= len(name)
+            heads += struct.pack('<IIIHH', offset, dir_id, objectid, location, DEH_VISIBLE)
+        body = bytes(heads) + b''.join(reversed(names))
+        out.append((key_v1(node.dir_id, node.objectid, entries[0][0],
+                           V1_DIRENTRY_UNIQUENESS),
+                    len(entries), KEY_FORMAT_3_5, body))
+    return out
+
+
+class Allocator:
+    def __init__(self, start):
+        self.next = start
+
+    def take(self, count):
+        first = self.next
+        self.next += count
+        return first
+
+
+def sort_key(item):
+    k = item[0]
+    dir_id, objectid = struct.unpack_from('<II', k)
+    if item[2] == KEY_FORMAT_3_5:
+        offset, uniqueness = struct.unpack_from('<II', k, 8)
+        type_ = TYPE_DIRENTRY if uniqueness == V1_DIRENTRY_UNIQUENESS else TYPE_STAT_DATA
+    else:
+        v, = struct.unpack_from('<Q', k, 8)
+        offset, type_ = v & ((1 << 60) - 1), v >> 60
+    return (dir_id, objectid, offset, type_)
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Build a ReiserFS image for the fsw host tests.')
+    ap.add_argument('source')
+    ap.add_argument('image')
+    ap.add_argument('--tail', type=int, default=2048,
+                    help='largest file stored in a direct item')
+    ap.add_argument('--fragment', type=int, default=4 * 1024 * 1024,
+                    help='files above this size are split into short runs')
+    ap.add_argument('--label', default='fswtest')
+    args = ap.parse_args()
+
+    oids = iter(range(FIRST_OBJECTID, 1 << 32))
+    root = build_tree(args.source, '', None, oids)
+    nodes = list(walk(root))
+    next_oid = next(oids)
+
+    space = Allocator(JOURNAL_BLOCK + JOURNAL_SIZE + 1)
+    data = {}                           # block -> bytes
+    items = []                          # (key, count/free space, key format, body)
+    for n in nodes:
+        mtime = int(n.st.st_mtime)
+        if n.is_dir:
+            dir_items = directory_items(n)
+            size = sum(len(body) for _, _, _, body in dir_items)
+            nlink = 2 + sum(1 for c in n.children if c.is_dir)
+            items.append((key_v2(n.dir_id, n.objectid, 0, TYPE_STAT_DATA), 0, KEY_FORMAT_3_6,
+                          stat_data(n.st.st_mode, nlink, size, (size + 511) // 512, mtime)))
+            items += dir_items
+            continue
+
+        body = contents(n)
+        blocks = (len(body) + BLOCK - 1) // BLOCK
+        if len(body) <= args.tail:
+            sectors = 0
+        else:
+            sectors = blocks * BLOCK // 512
+        items.append((key_v2(n.dir_id, n.objectid, 0, TYPE_STAT_DATA), 0, KEY_FORMAT_3_6,
+                      stat_data(n.st.st_mode, 1, len(body), sectors, mtime)))
+        if not body:
+            continue
+        if len(body) <= args.tail:
+            items.append((key_v2(n.dir_id, n.objectid, 1, TYPE_DIRECT), 0xffff, KEY_FORMAT_3_6,
+                          body.ljust((len(body) + 7) // 8 * 8, b'\0')))
+            continue
+
+        for i in range(blocks):
+            if len(body) > args.fragment and i % RUN == 0 and i:
+                space.take(1)
+            b = space.take(1)
+            n.blocks.append(b)
+            data[b] = body[i * BLOCK:(i + 1) * BLOCK]
+        for i in range(0, blocks, MAX_POINTERS):
+            pointers = n.blocks[i:i + MAX_POINTERS]
+            items.append((key_v2(n.dir_id, n.objectid, 1 + i * BLOCK, TYPE_INDIRECT), 0,
+                          KEY_FORMAT_3_6, struct.pack('<%dI' % len(pointers), *pointers)))
+
+    items.sort(key=sort_key)
+
+    # leaves, filled in key order
+    leaves = []
+    cur = []
+    used = 0
+    for it in items:
+        need = IH_SIZE + len(it[3])
+        if cur and used + need > BLOCK - BLKH_SIZE:
+            leaves.append(cur)
+            cur, used = [], 0
+        cur.append(it)
+        used += need
+    leaves.append(cur)
+
+    tree = {}                           # block -> bytes
+    level = []                          # (block, first key, used bytes)
+    for leaf in leaves:
+        blk = bytearray(BLOCK)
+        end = BLOCK
+        for i, (key, count, fmt, body) in enumerate(leaf):
+            end -= len(body)
+            blk[end:end + len(body)] = body
+            struct.pack_into('<16sHHHH', blk, BLKH_SIZE + i * IH_SIZE,
+                             key, count, len(body), end, fmt)
+        free = end - BLKH_SIZE - IH_SIZE * len(leaf)
+        struct.pack_into('<HHHH', blk, 0, 1, len(leaf), free, 0)
+        b = space.take(1)
+        tree[b] = bytes(blk)
+        level.append((b, leaf[0][0], BLOCK - free))
+
+    # internal levels up to a single root
+    height = 1
+    fanout = (BLOCK - BLKH_SIZE - DC_SIZE) // (KEY_SIZE + DC_SIZE) + 1
+    while len(level) > 1:
+        height += 1
+        upper = []
+        for i in range(0, len(level), fanout):
+            children = level[i:i + fanout]
+            blk = bytearray(BLOCK)
+            nr = len(children) - 1
+            for j, (_, key, _) in enumerate(children[1:]):
+                blk[BLKH_SIZE + j * KEY_SIZE:BLKH_SIZE + (j + 1) * KEY_SIZE] = key
+            for j, (child, _, size) in enumerate(children):
+                struct.pack_into('<IHH', blk, BLKH_SIZE + nr * KEY_SIZE + j * DC_SIZE,
+                                 child, size, 0)
+            used = BLKH_SIZE + nr * KEY_SIZE + len(children) * DC_SIZE
+            struct.pack_into('<HHHH', blk, 0, height, nr, BLOCK - used, 0)
+            b = space.take(1)
+            tree[b] = bytes(blk)
+            upper.append((b, children[0][1], used))
+        level = upper
+    root_block = level[0][0]
+
+    total = space.next + 64
+    free_blocks = total - space.next
+    bitmaps = (total + BLOCK * 8 - 1) // (BLOCK * 8)
+
+    label = args.label.encode()[:16]
+    oid_max = (BLOCK - 204) // 4 // 2 * 2
+    sb = struct.pack('<III', total, free_blocks, root_block)
+    sb += struct.pack('<8I', JOURNAL_BLOCK, 0, JOURNAL_SIZE, 1024, 0x12345678, 900, 30, 30)
+    sb += struct.pack('<HHHH', BLOCK, oid_max, 2, 1)
+    sb += b'ReIsEr2Fs\0'
+    sb += struct.pack('<HIHHHH', 0, R5_HASH, height + 1, bitmaps, 2, 0)
+    sb += struct.pack('<II', 0, 0) + bytes(range(16)) + label.ljust(16, b'\0') + bytes(88)
+    sb += struct.pack('<II', 1, next_oid)
+
+    bitmap = bytearray(BLOCK)
+    for b in range(min(space.next, BLOCK * 8)):
+        bitmap[b // 8] |= 1 << (b % 8)
+
+    with open(args.image, 'wb') as img:
+        img.truncate(total * BLOCK)
+        img.seek(SUPERBLOCK_BLOCK * BLOCK)
+        img.write(sb)
+        img.seek(BITMAP_BLOCK * BLOCK)
+        img.write(bitmap)
+        for b, blk in sorted(tree.items()):
+            img.seek(b * BLOCK)
+            img.write(blk)
+        for b, blk in sorted(data.items()):
+            img.seek(b * BLOCK)
+            img.write(blk)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+# Measures reads that go through RAID5/RAID6 parity recovery in fsw_btrfs.c.
+#
+# Usage: raidbench.sh <readbench> [<readbench> ...]
+#
+# Builds a 16 MiB file of random data into one healthy and several degraded
+# btrfs images with mkbtrfs.py, then runs every given readbench binary (e.g.
+# build/btrfs/readbench) on each of them. readbench checks every read against
+# the source file, and the script fails if one returns other data. To compare
+# two versions of the driver, build readbench once per version, for example with
+#   make DRIVERNAME=btrfs BUILDROOT=build-nosimd EXTRA_CFLAGS=-DFSW_BTRFS_NO_SIMD tools
+# for the plain word-wide parity kernels, and pass all binaries at once.
+#
+# Needs python3.
+
+set -e
+
+[ $# -ge 1 ] || { echo "usage: raidbench.sh <readbench> [<readbench> ...]" >&2; exit 1; }
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir "$WORK/src"
+head -c 16777216 /dev/urandom > "$WORK/src/data"
+
+mkimage () {
+    # mkimage <name> <profile> <stripes> [<missing stripes>]
+    python3 "$HERE/mkbtrfs.py" --raid $2 --stripes $3 ${4:+--missing $4} \
+        "$WORK/src" "$WORK/$1.img" > /dev/null
+}
+
+mkimage raid6-healthy  raid6 6
+mkimage raid5-missing1 raid5 4 1
+mkimage raid6-missing1 raid6 6 1
+mkimage raid6-missing2 raid6 6 0,2
+
+for IMG in raid6-healthy raid5-missing1 raid6-missing1 raid6-missing2; do
+    for BIN in "$@"; do
+        echo "== $IMG $BIN"
+        "$BIN" -r "$WORK/src/data" "$WORK/$IMG.img" /data
+    done
+done
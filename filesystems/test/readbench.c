@@ -0,0 +1,210 @@
+/**
+ * \file readbench.c
+ * File read benchmark for the POSIX user space environment.
+ *
+ * Reads a file once sequentially in chunks of the given size, then reads the
+ * same number of bytes in 4 KiB pieces at pseudo-random offsets, and prints
+ * the throughput of both passes. Building the driver with different cache
+ * settings (e.g. -DDECOMPRESS_CACHE_MAX_EXTENT=0 for fsw_btrfs) and running
+ * both binaries on the same image compares the code paths.
+ *
+ * With -r, every read of both passes is compared with the same range of a
+ * host file holding the expected contents, and readbench exits non-zero on
+ * the first difference.
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fsw_posix.h"
+
+#include <time.h>
+#include <unistd.h>
+
+
+#define RANDOM_READ_SIZE (4096)
+
+extern struct fsw_fstype_table FSW_FSTYPE_TABLE_NAME(FSTYPE);
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char * load_reference(const char *path, off_t *size_out)
+{
+    FILE *f;
+    char *data;
+    long size;
+
+    f = fopen(path, "rb");
+    if (f == NULL)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = malloc(size > 0 ? size : 1);
+    if (data == NULL || size < 0 || fread(data, 1, size, f) != (size_t)size) {
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+    fclose(f);
+    *size_out = size;
+    return data;
+}
+
+/**
+ * Compare got bytes read at pos with the reference, if there is one.
+ * Returns 0 if they match.
+ */
+
+static int check(const char *ref, off_t ref_size, off_t pos, const char *data, ssize_t got)
+{
+    if (ref == NULL)
+        return 0;
+    if (pos + got > ref_size || memcmp(ref + pos, data, got) != 0) {
+        fprintf(stderr, "Data differs from the reference in %lld bytes at %lld.\n",
+                (long long)got, (long long)pos);
+        return 1;
+    }
+    return 0;
+}
+
+static void report(const char *pass, double bytes, double seconds)
+{
+    printf("%-10s %10.0f bytes  %9.3f ms  %8.2f MiB/s\n", pass, bytes, seconds * 1000.0,
+           seconds > 0 ? bytes / seconds / 1048576.0 : 0.0);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: readbench [-r reference] <file/device> <file> [chunk_size]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct fsw_posix_volume *pvol;
+    struct fsw_posix_file *file;
+    char *buffer, *ref = NULL;
+    size_t chunk = 65536;
+    ssize_t got;
+    off_t size, pos, ref_size = 0;
+    double total, start;
+    unsigned long long seed = 1;
+    long count, i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:")) != -1) {
+        switch (opt) {
+            case 'r':
+                ref = load_reference(optarg, &ref_size);
+                if (ref == NULL) {
+                    fprintf(stderr, "Cannot read %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default: usage();
+        }
+    }
+    if (argc - optind < 2 || argc - optind > 3)
+        usage();
+    if (argc - optind > 2)
+        chunk = strtoul(argv[optind + 2], NULL, 0);
+    if (chunk < RANDOM_READ_SIZE)
+        chunk = RANDOM_READ_SIZE;
+
+    buffer = malloc(chunk);
+    if (buffer == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    pvol = fsw_posix_mount(argv[optind], &FSW_FSTYPE_TABLE_NAME(FSTYPE));
+    if (pvol == NULL) {
+        fprintf(stderr, "Mounting failed.\n");
+        return 1;
+    }
+    file = fsw_posix_open(pvol, argv[optind + 1], 0, 0);
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open %s\n", argv[optind + 1]);
+        return 1;
+    }
+
+    // sequential pass
+    total = 0;
+    start = now();
+    while ((got = fsw_posix_read(file, buffer, chunk)) > 0) {
+        if (check(ref, ref_size, (off_t)total, buffer, got))
+            return 1;
+        total += got;
+    }
+    report("sequential", total, now() - start);
+    if (got < 0) {
+        fprintf(stderr, "Read error.\n");
+        return 1;
+    }
+    size = (off_t)total;
+    if (ref != NULL && size != ref_size) {
+        fprintf(stderr, "Read %lld bytes, the reference has %lld.\n", (long long)size, (long long)ref_size);
+        return 1;
+    }
+
+    // random pass over the same amount of data
+    count = (long)(size / RANDOM_READ_SIZE);
+    total = 0;
+    start = now();
+    for (i = 0; i < count; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        pos = (off_t)((seed >> 33) % (unsigned long long)count) * RANDOM_READ_SIZE;
+        fsw_posix_lseek(file, pos, SEEK_SET);
+        got = fsw_posix_read(file, buffer, RANDOM_READ_SIZE);
+        if (got < 0) {
+            fprintf(stderr, "Read error at %lld.\n", (long long)pos);
+            return 1;
+        }
+        if (check(ref, ref_size, pos, buffer, got))
+            return 1;
+        total += got;
+    }
+    report("random", total, now() - start);
+
+    printf("block cache: %llu hits, %llu misses\n",
+           (unsigned long long)pvol->vol->bcache_hits,
+           (unsigned long long)pvol->vol->bcache_misses);
+
+    fsw_posix_close(file);
+    fsw_posix_unmount(pvol);
+    free(buffer);
+    free(ref);
+    return 0;
+}
+
+// EOF
@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+# Runs fswbench on every fixture image and prints one JSON record per
+# workload and image on stdout.
+#
+# Usage: runbench.sh <fixtures directory> [<build root> [<tag>]]
+#
+# The driver is taken from the image name (<driver>-<variant>.img) and its
+# tools from <build root>/<driver>/ (default: build). The tag defaults to the
+# current git revision; save the output per commit and compare two runs with
+# benchcmp.py.
+
+FIXTURES=${1:?usage: runbench.sh <fixtures directory> [<build root> [<tag>]]}
+BUILDROOT=${2:-build}
+TAG=${3:-$(git rev-parse --short HEAD 2>/dev/null || echo unknown)}
+
+DEEP=/deep/l1/l2/l3/l4/l5/l6/l7/l8/l9/l10/l11/l12/leaf.txt
+FILE=/data/big.bin
+
+STATUS=0
+for IMG in "$FIXTURES"/*.img; do
+    [ -e "$IMG" ] || continue
+    NAME=$(basename "$IMG" .img)
+    DRIVER=${NAME%%-*}
+    BIN="$BUILDROOT/$DRIVER/fswbench"
+    if [ ! -x "$BIN" ]; then
+        echo "$NAME: $BIN not built, skipped" >&2
+        continue
+    fi
+    "$BIN" -t "$TAG" "$IMG" $DEEP $FILE || STATUS=1
+done
+exit $STATUS
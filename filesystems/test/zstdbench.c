@@ -0,0 +1,299 @@
+/**
+ * \file zstdbench.c
+ * zstd benchmark for the POSIX user space environment.
+ *
+ * Cuts each file given on the command line into 128 KiB extents, compresses
+ * every extent into a zstd frame the way btrfs does, and decodes them with
+ * fsw_btrfs_zstd.h, once with a decoder set up for each call and once with
+ * the decoder kept across calls as the btrfs driver does per volume. Whole
+ * extents and 4 KiB reads at every offset of an extent are timed, the latter
+ * also with each extent split into several frames. Throughput and workspace
+ * allocations per call are printed for both. libzstd.so.1 is loaded at run
+ * time for the compression side only.
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fsw_codec.h"
+
+#include <dlfcn.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static long allocations;
+
+static void *count_alloc(size_t size)
+{
+    allocations++;
+    return malloc(size);
+}
+
+#undef AllocatePool
+#define AllocatePool(size) count_alloc(size)
+#define DPRINT(x...)    /* */
+#define fsw_size_t int
+#define fsw_ssize_t int
+#define grub_off_t fsw_s32
+#include "fsw_btrfs_zstd.h"
+
+
+/** Largest extent btrfs compresses, and the size of a read from an extent. */
+#define EXTENT_SIZE (128 * 1024)
+#define READ_SIZE 4096
+/** Frames per extent for the multi-frame window reads. */
+#define FRAMES 8
+/** Compression level btrfs uses by default. */
+#define LEVEL 3
+/** Minimum time spent on each mode and file, in seconds. */
+#define MIN_SECONDS (0.5)
+
+struct extent {
+    char *z;
+    int zsize;
+    int size;
+};
+
+static size_t (*zstd_compress)(void *dst, size_t dstCapacity, const void *src, size_t srcSize, int level);
+static size_t (*zstd_compress_bound)(size_t srcSize);
+static unsigned (*zstd_is_error)(size_t code);
+
+static struct zstd_btrfs_ctx volume_ctx;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int load_libzstd(void)
+{
+    void *lib = dlopen("libzstd.so.1", RTLD_NOW);
+
+    if (lib == NULL)
+        return -1;
+    zstd_compress = (size_t (*)(void *, size_t, const void *, size_t, int))dlsym(lib, "ZSTD_compress");
+    zstd_compress_bound = (size_t (*)(size_t))dlsym(lib, "ZSTD_compressBound");
+    zstd_is_error = (unsigned (*)(size_t))dlsym(lib, "ZSTD_isError");
+    return zstd_compress && zstd_compress_bound && zstd_is_error ? 0 : -1;
+}
+
+/**
+ * Compress data into one frame per frame_size bytes, concatenated.
+ */
+
+static int compress_extent(struct extent *e, const char *data, int size, int frame_size)
+{
+    size_t bound = 0, r;
+    int pos, n;
+
+    for (pos = 0; pos < size; pos += frame_size)
+        bound += zstd_compress_bound(size - pos < frame_size ? size - pos : frame_size);
+    e->z = malloc(bound);
+    if (e->z == NULL)
+        return -1;
+    e->zsize = 0;
+    e->size = size;
+    for (pos = 0; pos < size; pos += n) {
+        n = size - pos < frame_size ? size - pos : frame_size;
+        r = zstd_compress(e->z + e->zsize, bound - e->zsize, data + pos, n, LEVEL);
+        if (zstd_is_error(r))
+            return -1;
+        e->zsize += r;
+    }
+    return 0;
+}
+
+static fsw_ssize_t decode_per_call(char *z, fsw_size_t zsize, grub_off_t off, char *out, fsw_size_t size)
+{
+    struct zstd_btrfs_ctx ctx;
+    fsw_ssize_t ret;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ret = zstd_decompress_ctx(&ctx, z, zsize, off, out, size);
+    zstd_ctx_free(&ctx);
+    return ret;
+}
+
+static fsw_ssize_t decode_per_volume(char *z, fsw_size_t zsize, grub_off_t off, char *out, fsw_size_t size)
+{
+    return zstd_decompress_ctx(&volume_ctx, z, zsize, off, out, size);
+}
+
+typedef fsw_ssize_t (*decoder_t)(char *z, fsw_size_t zsize, grub_off_t off, char *out, fsw_size_t size);
+
+/**
+ * Decode all extents, whole or READ_SIZE bytes at every offset, until
+ * MIN_SECONDS have passed and check the output against data. Returns the
+ * seconds per pass and stores the allocations per decoder call.
+ */
+
+static double run(decoder_t decode, struct extent *ext, int count, const char *data,
+                  int windowed, char *out, double *allocs_out)
+{
+    double start, seconds;
+    long runs = 0, calls = 0, allocs_start = allocations;
+    int i, off, n;
+    const char *src;
+
+    start = now();
+    do {
+        src = data;
+        for (i = 0; i < count; i++) {
+            if (!windowed) {
+                if (decode(ext[i].z, ext[i].zsize, 0, out, ext[i].size) != ext[i].size ||
+                    (runs == 0 && memcmp(out, src, ext[i].size) != 0))
+                    return -1;
+                calls++;
+            } else {
+                for (off = 0; off < ext[i].size; off += READ_SIZE) {
+                    n = ext[i].size - off < READ_SIZE ? ext[i].size - off : READ_SIZE;
+                    if (decode(ext[i].z, ext[i].zsize, off, out, n) != n ||
+                        (runs == 0 && memcmp(out, src + off, n) != 0))
+                        return -1;
+                    calls++;
+                }
+            }
+            src += ext[i].size;
+        }
+        runs++;
+        seconds = now() - start;
+    } while (seconds < MIN_SECONDS);
+    *allocs_out = (double)(allocations - allocs_start) / calls;
+    return seconds / runs;
+}
+
+static void free_extents(struct extent *ext, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        free(ext[i].z);
+    free(ext);
+}
+
+static char * load_file(const char *path, long *size_out)
+{
+    FILE *f;
+    char *data;
+    long size;
+
+    f = fopen(path, "rb");
+    if (f == NULL)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = malloc(size > 0 ? size : 1);
+    if (data == NULL || size <= 0 || fread(data, 1, size, f) != (size_t)size) {
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+    fclose(f);
+    *size_out = size;
+    return data;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *modes[] = { "extent", "4k-window", "4k-window/8fr" };
+    struct extent *ext;
+    char *data, *out;
+    long size, zsize;
+    int count, i, m, j, status = 0;
+    double t_call, t_vol, a_call, a_vol;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: zstdbench <file>...\n");
+        return 1;
+    }
+    if (load_libzstd() != 0) {
+        fprintf(stderr, "libzstd.so.1 not found, it is needed to compress the input.\n");
+        return 1;
+    }
+    out = malloc(EXTENT_SIZE);
+    if (out == NULL)
+        return 1;
+
+    printf("%-24s %-14s %8s %10s %10s %10s %10s %8s\n", "file", "mode", "ratio",
+           "call MiB/s", "allocs", "vol MiB/s", "allocs", "speedup");
+    for (i = 1; i < argc; i++) {
+        data = load_file(argv[i], &size);
+        if (data == NULL || size > 0x7fffffffL) {
+            fprintf(stderr, "%s: cannot read\n", argv[i]);
+            free(data);
+            status = 1;
+            continue;
+        }
+        count = (size + EXTENT_SIZE - 1) / EXTENT_SIZE;
+
+        for (m = 0; m < 3; m++) {
+            ext = calloc(count, sizeof(*ext));
+            if (ext == NULL)
+                return 1;
+            zsize = 0;
+            for (j = 0; j < count; j++) {
+                int n = size - (long)j * EXTENT_SIZE < EXTENT_SIZE ? size - (long)j * EXTENT_SIZE : EXTENT_SIZE;
+
+                if (compress_extent(&ext[j], data + (long)j * EXTENT_SIZE, n,
+                                    m == 2 ? EXTENT_SIZE / FRAMES : EXTENT_SIZE) != 0) {
+                    fprintf(stderr, "%s: compression failed\n", argv[i]);
+                    return 1;
+                }
+                zsize += ext[j].zsize;
+            }
+
+            t_call = run(decode_per_call, ext, count, data, m != 0, out, &a_call);
+            t_vol = run(decode_per_volume, ext, count, data, m != 0, out, &a_vol);
+            if (t_call < 0 || t_vol < 0) {
+                fprintf(stderr, "%s: %s: wrong output (per call %s, per volume %s)\n", argv[i], modes[m],
+                        t_call < 0 ? "failed" : "ok", t_vol < 0 ? "failed" : "ok");
+                status = 1;
+            } else {
+                // throughput in MiB/s of data returned to the caller
+                printf("%-24.24s %-14s %8.2f %10.1f %10.3f %10.1f %10.3f %7.2fx\n", argv[i], modes[m],
+                       (double)size / zsize, size / t_call / 1048576.0, a_call,
+                       size / t_vol / 1048576.0, a_vol, t_call / t_vol);
+            }
+            free_extents(ext, count);
+        }
+        free(data);
+    }
+    printf("per-volume decoder: %lu calls, %lu workspace allocations, %lu frames skipped, %lu KiB discarded\n",
+           (unsigned long)volume_ctx.calls, (unsigned long)volume_ctx.allocs,
+           (unsigned long)volume_ctx.frames_skipped, (unsigned long)(volume_ctx.bytes_discarded >> 10));
+    zstd_ctx_free(&volume_ctx);
+    free(out);
+    return status;
+}
+
+// EOF
@@ -0,0 +1,219 @@
+/*
+ * libeg/decompress.c
+ * Decompression of image data through the file system drivers' registry
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libegint.h"
+#include "lodepng.h"
+#include "../filesystems/fsw_codec.h"
+
+// The decoders are set up as in fsw_hfs.c; lodepng.h provides uint8_t
+#define DPRINT(x)
+#define grub_off_t   fsw_s32
+#define grub_size_t  fsw_s32
+#define grub_ssize_t fsw_s32
+#include "../filesystems/gzio.c"
+#include "icns_rle.c"
+
+// Bytes of a plane decoded at a time before they are spread out
+#define ICNS_RLE_CHUNK 256
+
+// Largest number of bytes read from a stream in one call
+#define STREAM_READ_MAX 0x40000000
+
+// One context for all images, so the workspaces are set up once
+static struct fsw_codec_ctx egCodecs;
+static BOOLEAN              egCodecsReady = FALSE;
+
+static
+VOID egCodecSetup (VOID) {
+    if (egCodecsReady) {
+        return;
+    }
+
+    fsw_codec_ctx_init (&egCodecs);
+    fsw_codec_register (&fsw_codec_zlib);
+    fsw_codec_register (&fsw_codec_icns_rle);
+    egCodecsReady = TRUE;
+} // static VOID egCodecSetup()
+
+//
+// Decompress .icns RLE data
+//
+
+VOID egDecompressIcnsRLE (
+    IN OUT UINT8 **CompData,
+    IN OUT UINTN  *CompLen,
+    IN UINT8      *PixelData,
+    IN UINTN       PixelCount
+) {
+    struct fsw_codec_stream Stream;
+    fsw_status_t            Status;
+    fsw_u32                 Produced;
+    fsw_u32                 Want;
+    fsw_u32                 i;
+    UINT8                   Buffer[ICNS_RLE_CHUNK];
+    UINT8                  *pp;
+
+    egCodecSetup();
+
+    fsw_codec_stream_init (&egCodecs, &Stream, FSW_CODEC_ICNS_RLE);
+    fsw_codec_stream_feed (
+        &Stream, *CompData,
+        (*CompLen > 0xffffffff) ? 0xffffffff : (fsw_u32) *CompLen, 1
+    );
+
+    // Decode a chunk at a time and spread it over every fourth byte
+    pp = PixelData;
+    while (PixelCount > 0) {
+        Want   = (PixelCount < ICNS_RLE_CHUNK) ? (fsw_u32) PixelCount : ICNS_RLE_CHUNK;
+        Status = fsw_codec_stream_read (&Stream, Buffer, Want, &Produced);
+        if (Status != FSW_SUCCESS || Produced == 0) {
+            break;
+        }
+
+        for (i = 0; i < Produced; i++) {
+            *pp = Buffer[i];
+            pp += 4;
+        }
+        PixelCount -= Produced;
+    }
+
+    // Record what is left of the compressed data stream
+    *CompData += Stream.in_used;
+    *CompLen  -= Stream.in_used;
+} // VOID egDecompressIcnsRLE()
+
+static
+UINT32 egAdler32 (
+    IN UINT8 *Data,
+    IN UINTN  Size
+) {
+    UINT32 a = 1;
+    UINT32 b = 0;
+    UINTN  n;
+
+    while (Size > 0) {
+        // 5552 bytes is the most that can be summed before b overflows
+        n = (Size < 5552) ? Size : 5552;
+        Size -= n;
+        while (n--) {
+            a += *Data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return (b << 16) | a;
+} // static UINT32 egAdler32()
+
+//
+// Zlib decoder for lodepng, set as custom_zlib in its decompress settings.
+// custom_context may point to the expected output size, which is then
+// allocated up front; otherwise the buffer grows as the stream is read.
+// Returns 0 on success, non-zero on error as lodepng expects.
+//
+
+unsigned egInflatePNG (
+    IN OUT unsigned char                   **Out,
+    IN OUT size_t                           *OutSize,
+    IN     const unsigned char              *In,
+    IN     size_t                            InSize,
+    IN     const LodePNGDecompressSettings  *Settings
+) {
+    struct fsw_codec_stream  Stream;
+    fsw_status_t             Status;
+    fsw_u32                  Produced;
+    fsw_u32                  Want;
+    unsigned char           *Buffer;
+    unsigned char           *NewBuffer;
+    size_t                   Start;
+    size_t                   Used;
+    size_t                   Room;
+    size_t                   Grow;
+    unsigned                 Error;
+
+    // Header, a final empty block and the Adler-32 trailer at least
+    if (InSize < 7 || InSize > 0xffffffff) {
+        return 53;
+    }
+
+    egCodecSetup();
+
+    fsw_codec_stream_init (&egCodecs, &Stream, FSW_CODEC_ZLIB);
+    fsw_codec_stream_feed (&Stream, (VOID *) In, (fsw_u32) InSize, 1);
+
+    // One byte more than expected, so a stream of the expected size is
+    // known to end without a further read
+    Grow = (Settings->custom_context != NULL)
+        ? *(const size_t *) Settings->custom_context : 0;
+    Grow = (Grow > 0) ? Grow + 1 : InSize * 4;
+
+    Buffer = *Out;
+    Start  = Used = Room = *OutSize;
+    Error  = 0;
+    for (;;) {
+        if (Used == Room) {
+            // Start over with a larger buffer and keep what has been read
+            if (Used - Start > Grow) {
+                Grow = Used - Start;
+            }
+            NewBuffer = lodepng_refit_malloc (Room + Grow);
+            if (NewBuffer == NULL) {
+                Error = 83;
+                break;
+            }
+            if (Used > 0) {
+                CopyMem (NewBuffer, Buffer, Used);
+            }
+            lodepng_refit_free (Buffer);
+            Buffer = NewBuffer;
+            Room  += Grow;
+        }
+
+        Want   = (Room - Used < STREAM_READ_MAX) ? (fsw_u32) (Room - Used) : STREAM_READ_MAX;
+        Status = fsw_codec_stream_read (&Stream, Buffer + Used, Want, &Produced);
+        if (Status != FSW_SUCCESS) {
+            Error = 110;
+            break;
+        }
+
+        Used += Produced;
+        if (Settings->max_output_size && Used - Start > Settings->max_output_size) {
+            Error = 109;
+            break;
+        }
+        if (Produced < Want) {
+            // End of the stream
+            break;
+        }
+    }
+
+    if (!Error && !Settings->ignore_adler32) {
+        if (egAdler32 (Buffer + Start, Used - Start) !=
+            ((UINT32) In[InSize - 4] << 24 | (UINT32) In[InSize - 3] << 16 |
+             (UINT32) In[InSize - 2] << 8  | (UINT32) In[InSize - 1])
+        ) {
+            Error = 58;
+        }
+    }
+
+    *Out     = Buffer;
+    *OutSize = Used;
+
+    return Error;
+} // unsigned egInflatePNG()
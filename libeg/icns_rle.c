@@ -0,0 +1,143 @@
+/**
+ * \file icns_rle.c
+ * Decoder for the run-length coded planes of Apple .icns icons.
+ *
+ * The red, green and blue planes of the 32-bit icon types, and the alpha
+ * planes read by image.c, are coded as a sequence of packets:
+ *
+ *   0LLLLLLL                   L+1 literal bytes follow
+ *   1LLLLLLL VVVVVVVV          V repeated L-125 times (3 to 130)
+ *
+ * The decoder keeps its place between calls, so a plane can be read in
+ * pieces and the next read of the stream picks up where the last one
+ * stopped.
+ */
+
+/*
+ * This file is distributed under the terms of the GNU General Public
+ * License, version 3 or (at your option) any later version.
+ */
+
+/**
+ * Decoder state, kept in the workspace of the codec.
+ */
+struct icns_rle_state
+{
+  fsw_u32 stream_id;            /* stream the state belongs to, 0 for none */
+  fsw_u32 in_pos;               /* input used up */
+  fsw_u64 out_pos;              /* output produced */
+  fsw_u32 run;                  /* bytes left of the current run */
+  fsw_u32 literal;              /* bytes left of the current literal packet */
+  fsw_u8 value;                 /* byte of the current run */
+};
+
+/**
+ * Decode the stream in of insize bytes from the place state was left at
+ * until outsize bytes at offset pos are stored in out. Output before pos is
+ * decoded and dropped. Decoding stops early at the end of the input; a
+ * packet cut short by the end of complete input ends the data. Returns the
+ * number of bytes stored.
+ */
+static fsw_s32
+icns_rle_decode (struct icns_rle_state *state, const fsw_u8 *in, fsw_u32 insize,
+                 int in_complete, fsw_u64 pos, fsw_u8 *out, fsw_u32 outsize)
+{
+  fsw_u32 produced = 0;
+  fsw_u32 n, c;
+
+  while (produced < outsize)
+    {
+      /* skip up to pos, then fill out */
+      if (state->out_pos < pos)
+        n = pos - state->out_pos < 0x80000000 ? (fsw_u32) (pos - state->out_pos) : 0x80000000;
+      else
+        n = outsize - produced;
+
+      if (state->run > 0)
+        {
+          if (n > state->run)
+            n = state->run;
+          if (state->out_pos >= pos)
+            {
+              fsw_u8 *p = out + produced, *end = p + n;
+
+              while (p < end)
+                *p++ = state->value;
+              produced += n;
+            }
+          state->run -= n;
+        }
+      else if (state->literal > 0)
+        {
+          if (n > state->literal)
+            n = state->literal;
+          if (n > insize - state->in_pos)
+            n = insize - state->in_pos;
+          if (n == 0)
+            break;
+          if (state->out_pos >= pos)
+            {
+              fsw_memcpy (out + produced, in + state->in_pos, n);
+              produced += n;
+            }
+          state->in_pos += n;
+          state->literal -= n;
+        }
+      else
+        {
+          /* a packet takes at least two bytes */
+          if (insize - state->in_pos < 2)
+            break;
+          c = in[state->in_pos];
+          if (c & 0x80)
+            {
+              state->value = in[state->in_pos + 1];
+              state->run = c - 125;
+              state->in_pos += 2;
+            }
+          else
+            {
+              if (in_complete && c + 2 > insize - state->in_pos)
+                break;
+              state->literal = c + 1;
+              state->in_pos += 1;
+            }
+          continue;
+        }
+      state->out_pos += n;
+    }
+
+  return produced;
+}
+
+static fsw_s32
+icns_rle_codec_decompress (void *workspace, fsw_u8 *in, fsw_u32 insize, fsw_u32 off,
+                           fsw_u8 *out, fsw_u32 outsize)
+{
+  struct icns_rle_state state;
+
+  fsw_memzero (&state, sizeof (state));
+  return icns_rle_decode (&state, in, insize, 1, off, out, outsize);
+}
+
+static fsw_s32
+icns_rle_codec_stream_read (void *workspace, fsw_u32 id, fsw_u8 *in, fsw_u32 insize, int in_complete,
+                            fsw_u64 pos, fsw_u8 *out, fsw_u32 outsize, fsw_u32 *in_used)
+{
+  struct icns_rle_state *state = workspace;
+  fsw_s32 ret;
+
+  if (id == 0 || id != state->stream_id || pos < state->out_pos)
+    {
+      fsw_memzero (state, sizeof (*state));
+      state->stream_id = id;
+    }
+  ret = icns_rle_decode (state, in, insize, in_complete, pos, out, outsize);
+  *in_used = state->in_pos;
+  return ret;
+}
+
+static const struct fsw_codec fsw_codec_icns_rle = {
+  FSW_CODEC_ICNS_RLE, "icns-rle", 0, sizeof (struct icns_rle_state),
+  icns_rle_codec_decompress, icns_rle_codec_stream_read, NULL
+};
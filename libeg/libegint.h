@@ -99,6 +99,16 @@ VOID egDecompressIcnsRLE(
     IN     UINTN PixelCount
 );
 
+struct LodePNGDecompressSettings;
+
+unsigned egInflatePNG(
+    IN OUT unsigned char                           **Out,
+    IN OUT UINTN                                    *OutSize,
+    IN     const unsigned char                      *In,
+    IN     UINTN                                     InSize,
+    IN     const struct LodePNGDecompressSettings   *Settings
+);
+
 VOID egInsertPlane(
     IN UINT8 *SrcDataPtr,
     IN UINT8 *DestPlanePtr,
@@ -38,63 +38,6 @@
 
 #define MAX_ICNS_SIZES 4
 
-//
-// Decompress .icns RLE data
-//
-
-VOID egDecompressIcnsRLE (
-    IN OUT UINT8 **CompData,
-    IN OUT UINTN  *CompLen,
-    IN UINT8      *PixelData,
-    IN UINTN       PixelCount
-) {
-    UINT8 *cp;
-    UINT8 *cp_end;
-    UINT8 *pp;
-    UINTN  pp_left;
-    UINTN  len, i;
-    UINT8  value;
-
-    // setup variables
-    cp      = *CompData;
-    cp_end  =  cp + *CompLen;
-    pp      =  PixelData;
-    pp_left =  PixelCount;
-
-    // Decode
-    while (cp + 1 < cp_end && pp_left > 0) {
-        len = *cp++;
-
-        if (len & 0x80) {
-            // Compressed data: repeat next byte
-            len -= 125;
-            if (len > pp_left) {
-                break;
-            }
-            value = *cp++;
-            for (i = 0; i < len; i++) {
-                *pp = value;
-                pp += 4;
-            }
-        }
-        else {
-            // Uncompressed data: copy bytes
-            len++;
-            if (len > pp_left || cp + len > cp_end)
-                break;
-            for (i = 0; i < len; i++) {
-                *pp = *cp++;
-                pp += 4;
-            }
-        }
-        pp_left -= len;
-    }
-
-    // Record what is left of the compressed data stream
-    *CompData = cp;
-    *CompLen = (UINTN)(cp_end - cp);
-}
-
 //
 // Load Apple .icns icons
 //
@@ -29,6 +29,7 @@
  * Modifications distributed under the preceding terms.
  */
 
+#include "libegint.h"
 #include "lodepng.h"
 #include "../BootMaster/rp_funcs.h"
 #include "../BootMaster/screenmgt.h"
@@ -142,22 +143,47 @@ EG_IMAGE * egDecodePNG (
     IN UINTN    IconSize,
     IN BOOLEAN  WantAlpha
 ) {
-    unsigned    Error;
-    unsigned    Width;
-    unsigned    Height;
-    lode_color *LodeData;
-    EG_IMAGE   *NewImage;
-    EG_PIXEL   *PixelData;
-    UINTN       i;
-
-    Error = lodepng_decode_memory (
-        (unsigned char **) &PixelData,
-        &Width,
-        &Height,
-        (unsigned char *) FileData,
-        (size_t) FileDataLength,
-        LCT_RGBA, 8
+    unsigned      Error;
+    unsigned      Width;
+    unsigned      Height;
+    unsigned      Bpp;
+    size_t        ExpectedSize;
+    lode_color   *LodeData;
+    EG_IMAGE     *NewImage;
+    EG_PIXEL     *PixelData;
+    LodePNGState  State;
+    UINTN         i;
+
+    // Image data is inflated by the shared decompressor rather than
+    // lodepng's own, with the size of a non-interlaced image as a hint
+    lodepng_state_init (&State);
+    State.info_raw.colortype                   = LCT_RGBA;
+    State.info_raw.bitdepth                    = 8;
+    State.decoder.zlibsettings.custom_zlib     = egInflatePNG;
+    State.decoder.zlibsettings.custom_context  = &ExpectedSize;
+
+    ExpectedSize = 0;
+    Error = lodepng_inspect (
+        &Width, &Height, &State,
+        (unsigned char *) FileData, (size_t) FileDataLength
     );
+    if (!Error && State.info_png.interlace_method == 0) {
+        Bpp          = lodepng_get_bpp (&State.info_png.color);
+        ExpectedSize = (size_t) Height * (1 + ((size_t) Width * Bpp + 7) / 8);
+    }
+
+    PixelData = NULL;
+    if (!Error) {
+        Error = lodepng_decode (
+            (unsigned char **) &PixelData,
+            &Width,
+            &Height,
+            &State,
+            (unsigned char *) FileData,
+            (size_t) FileDataLength
+        );
+    }
+    lodepng_state_cleanup (&State);
     if (Error) {
         return NULL;
     }